@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "selfstats.h"
+
+/*
+ * Allocations are counted by standing in for the allocator, which glibc
+ * allows, as long as every function which allocates or frees is replaced;
+ * the calls are passed on to its own functions. Other threads may allocate
+ * too, hence the atomic counter. Only built with COUNT_ALLOCATIONS (see
+ * CMakeLists.txt), so that a plain build keeps the allocator as it is.
+ */
+#ifdef __GLIBC__
+static uint64_t allocations;
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void *__libc_memalign (size_t alignment, size_t size);
+extern void *__libc_valloc (size_t size);
+extern void *__libc_pvalloc (size_t size);
+extern void __libc_free (void *ptr);
+
+static void
+count (void)
+{
+    __atomic_fetch_add (&allocations, 1, __ATOMIC_RELAXED);
+}
+
+void *
+malloc (size_t size)
+{
+    count ();
+    return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n, size_t size)
+{
+    count ();
+    return __libc_calloc (n, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+    count ();
+    return __libc_realloc (ptr, size);
+}
+
+void
+free (void *ptr)
+{
+    __libc_free (ptr);
+}
+
+void *
+memalign (size_t alignment, size_t size)
+{
+    count ();
+    return __libc_memalign (alignment, size);
+}
+
+void *
+aligned_alloc (size_t alignment, size_t size)
+{
+    count ();
+    return __libc_memalign (alignment, size);
+}
+
+int
+posix_memalign (void **ptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    /* A power of two, and a multiple of the size of a pointer */
+    if (0 == alignment || 0 != (alignment & (alignment - 1))
+     || 0 != alignment % sizeof (void *))
+        return EINVAL;
+
+    count ();
+
+    if (NULL == (p = __libc_memalign (alignment, size)) && size > 0)
+        return ENOMEM;
+
+    *ptr = p;
+    return 0;
+}
+
+void *
+valloc (size_t size)
+{
+    count ();
+    return __libc_valloc (size);
+}
+
+void *
+pvalloc (size_t size)
+{
+    count ();
+    return __libc_pvalloc (size);
+}
+
+int64_t
+selfstats_allocations (void)
+{
+    return __atomic_load_n (&allocations, __ATOMIC_RELAXED);
+}
+#else
+int64_t
+selfstats_allocations (void)
+{
+    return -1;
+}
+#endif
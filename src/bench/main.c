@@ -0,0 +1,635 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../argtable3/argtable3.h"
+#include "../mbs.h"
+#include "../procnet.h"
+#include "../rate.h"
+#include "../selfstats.h"
+#include "../source.h"
+#include "../statsfile.h"
+#include "../window.h"
+
+/* Iterations run under ptrace to count system calls */
+#define SYSCALL_ITERATIONS 64
+
+/* Iterations run before anything is measured */
+#define WARMUP_ITERATIONS 16
+
+struct bench
+{
+    const char *name;
+
+    /* Number of interfaces, or 0 if it does not apply */
+    size_t ifaces;
+
+    void (*run) (void *arg);
+    void *arg;
+};
+
+struct result
+{
+    unsigned long iterations;
+    double ns;
+    double allocs;
+    double syscalls;  /* Negative if they could not be counted */
+};
+
+static struct
+{
+    bool json;
+    const char *filter;
+    uint64_t min_time;
+} options;
+
+/*
+ * Run the benchmark in a child process which stops itself, and count the
+ * system calls it enters from then on. The difference between a run of n
+ * iterations and an empty one is what the iterations cost; the rest is
+ * getting stopped and exiting. Returns -1 if the process cannot be traced.
+ */
+static long
+count_syscalls (const struct bench *b, unsigned long n)
+{
+    unsigned long i;
+    long count = 0;
+    bool entry = true;
+    int status;
+    pid_t pid;
+
+    fflush (stdout);
+
+    if (-1 == (pid = fork ()))
+        return -1;
+
+    if (0 == pid)
+    {
+        if (-1 == ptrace (PTRACE_TRACEME, 0, NULL, NULL))
+            _exit (EXIT_FAILURE);
+
+        raise (SIGSTOP);
+
+        for (i = 0; i < n; ++i)
+            b->run (b->arg);
+
+        _exit (EXIT_SUCCESS);
+    }
+
+    if (-1 == waitpid (pid, &status, 0) || !WIFSTOPPED (status)
+     || -1 == ptrace (PTRACE_SETOPTIONS, pid, NULL,
+                      (void *) (PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL)))
+    {
+        kill (pid, SIGKILL);
+        waitpid (pid, &status, 0);
+        return -1;
+    }
+
+    while (0 == ptrace (PTRACE_SYSCALL, pid, NULL, NULL)
+        && -1 != waitpid (pid, &status, 0) && WIFSTOPPED (status))
+    {
+        /* Stops at system calls alternate between entry and exit */
+        if ((SIGTRAP | 0x80) == WSTOPSIG (status))
+        {
+            if (entry)
+                ++count;
+
+            entry = !entry;
+        }
+    }
+
+    return WIFEXITED (status) && EXIT_SUCCESS == WEXITSTATUS (status)
+        ? count : -1;
+}
+
+/*
+ * Double the number of iterations until a run takes at least the minimum
+ * time, and report the last run.
+ */
+static void
+measure (const struct bench *b, struct result *r)
+{
+    unsigned long i, n = 1;
+    int64_t a;
+    uint64_t t;
+    long base, count;
+
+    for (i = 0; i < WARMUP_ITERATIONS; ++i)
+        b->run (b->arg);
+
+    for (;;)
+    {
+        a = selfstats_allocations ();
+        t = mbs_now ();
+
+        for (i = 0; i < n; ++i)
+            b->run (b->arg);
+
+        t = mbs_now () - t;
+        a = selfstats_allocations () - a;
+
+        if (t >= options.min_time || n >= 1UL << 30)
+            break;
+
+        n *= 2;
+    }
+
+    r->iterations = n;
+    r->ns = (double) t / n;
+    r->allocs = selfstats_allocations () < 0 ? -1 : (double) a / n;
+
+    base = count_syscalls (b, 0);
+    count = count_syscalls (b, SYSCALL_ITERATIONS);
+
+    r->syscalls = -1 == base || -1 == count
+        ? -1 : (double) (count - base) / SYSCALL_ITERATIONS;
+}
+
+static void
+report (const struct bench *b, const struct result *r)
+{
+    if (options.json)
+    {
+        printf ("{\"name\":\"%s\",\"ifaces\":%zu,\"iterations\":%lu,"
+                "\"ns_per_op\":%.1f,", b->name, b->ifaces, r->iterations,
+                r->ns);
+
+        if (r->allocs < 0)
+            printf ("\"allocs_per_op\":null,");
+        else
+            printf ("\"allocs_per_op\":%.2f,", r->allocs);
+
+        if (r->syscalls < 0)
+            printf ("\"syscalls_per_op\":null}\n");
+        else
+            printf ("\"syscalls_per_op\":%.2f}\n", r->syscalls);
+    }
+    else
+    {
+        char allocs_str[16] = "-", syscalls_str[16] = "-";
+
+        if (r->allocs >= 0)
+            snprintf (allocs_str, sizeof (allocs_str), "%.2f", r->allocs);
+
+        if (r->syscalls >= 0)
+            snprintf (syscalls_str, sizeof (syscalls_str), "%.2f",
+                      r->syscalls);
+
+        printf ("%-28s %7zu %11lu %12.1f %9s %9s\n", b->name, b->ifaces,
+                r->iterations, r->ns, allocs_str, syscalls_str);
+    }
+
+    fflush (stdout);
+}
+
+static bool
+selected (const char *name)
+{
+    return NULL == options.filter || NULL != strstr (name, options.filter);
+}
+
+static void
+run (const struct bench *b)
+{
+    struct result r;
+
+    if (!selected (b->name))
+        return;
+
+    measure (b, &r);
+    report (b, &r);
+}
+
+/*
+ * Polling
+ */
+
+static int
+synthetic_init (struct mbs *s)
+{
+    (void) s;
+    return 0;
+}
+
+/* Every interface moves a packet's worth of data in each direction */
+static int
+synthetic_read (struct mbs *s)
+{
+    const uint64_t now = mbs_now ();
+    size_t i;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        s->ifaces[i].sample.rx_bytes += 1500;
+        s->ifaces[i].sample.tx_bytes += 1500;
+        s->ifaces[i].sample.timestamp = now;
+        s->ifaces[i].error = 0;
+    }
+
+    return 0;
+}
+
+static void
+synthetic_close (struct mbs *s)
+{
+    (void) s;
+}
+
+static const struct counter_source synthetic_source = {
+    "synthetic", 64, synthetic_init, synthetic_read, synthetic_close
+};
+
+static void
+run_poll (void *arg)
+{
+    struct mbs *s = arg;
+    struct stats delta;
+
+    mbs_poll_interfaces (s, &delta);
+}
+
+static void
+bench_poll (const char *name, const struct counter_source *source,
+            size_t n_ifaces)
+{
+    struct if_nameindex *names = NULL, *n;
+    struct mbs s;
+    struct bench b = { name, 0, run_poll, &s };
+    char iface[32];
+    size_t i;
+
+    if (!selected (name))
+        return;
+
+    memset (&s, 0, sizeof (s));
+    s.nl_fd = -1;
+
+    if (0 == n_ifaces)
+    {
+        /* Every interface on the host */
+        if (NULL == (names = if_nameindex ()))
+            return;
+
+        for (n = names; 0 != n->if_index; ++n)
+            mbs_add_iface (&s, n->if_name);
+
+        if_freenameindex (names);
+    }
+    else
+    {
+        for (i = 0; i < n_ifaces; ++i)
+        {
+            snprintf (iface, sizeof (iface), "syn%zu", i);
+            mbs_add_iface (&s, iface);
+        }
+    }
+
+    s.source = source;
+    b.ifaces = s.n_ifaces;
+
+    if (0 == s.n_ifaces || -1 == source->init (&s))
+    {
+        fprintf (stderr, "%s: unavailable\n", name);
+        s.source = NULL;
+    }
+    else
+    {
+        mbs_poll_interfaces (&s, NULL);
+        run (&b);
+    }
+
+    mbs_cleanup (&s);
+}
+
+/*
+ * Parsing and formatting
+ */
+
+static const char *const amounts[] = {
+    "0", "1024", "1k", "1K", "1MiB", "500m", "2g", "4G", "230GB",
+    "246960619520"
+};
+
+static void
+run_parse_bytes (void *arg)
+{
+    static size_t i;
+    uint64_t result;
+
+    (void) arg;
+
+    parse_bytes (amounts[i], &result);
+    i = (i + 1) % (sizeof (amounts) / sizeof (amounts[0]));
+}
+
+static const double values[] = {
+    0, 512, 1442, 1048575, 3.5e6, 4294967296.0, 7.3e11, 2.2e13
+};
+
+static void
+run_to_human_readable (void *arg)
+{
+    static size_t i;
+    char buf[MBS_HUMAN_READABLE_MAX];
+
+    (void) arg;
+
+    to_human_readable (values[i], buf);
+    i = (i + 1) % (sizeof (values) / sizeof (values[0]));
+}
+
+/*
+ * Drawing
+ */
+
+#ifdef HAVE_CURSES
+static void
+run_draw_idle (void *arg)
+{
+    draw_window (arg, false, false);
+}
+
+/* A tick with traffic: the totals, rates, bar and graph all change */
+static void
+run_draw_traffic (void *arg)
+{
+    struct mbs *s = arg;
+
+    s->used.tx_bytes += 150000;
+    s->balance -= 150000;
+
+    if (s->balance < 150000)
+        s->balance = 100000000000ULL;
+
+    rate_update (&s->rates, 150000, 0, 200000000ULL);
+    draw_window (s, true, false);
+}
+
+static void
+bench_draw (void)
+{
+    FILE *out = tmpfile (), *in = fopen ("/dev/null", "r");
+    struct iface iface;
+    SCREEN *screen = NULL;
+    struct mbs s;
+    struct bench idle = { "draw_window/idle", 1, run_draw_idle, &s },
+                 traffic = { "draw_window/traffic", 1, run_draw_traffic, &s };
+
+    /* A terminal which is written to a file, and never read */
+    if (NULL == out || NULL == in
+     || NULL == (screen = newterm ("xterm", out, in)))
+    {
+        fprintf (stderr, "draw_window: no terminal description\n");
+        goto done;
+    }
+
+    set_term (screen);
+
+    memset (&s, 0, sizeof (s));
+    memset (&iface, 0, sizeof (iface));
+
+    iface.name = "eth0";
+    s.ifaces = &iface;
+    s.n_ifaces = 1;
+    s.flags = FLAG_COUNTDOWN;
+    s.balance = 100000000000ULL;
+    rate_init (&s.rates, RATE_DEFAULT_TAU, RATE_DEFAULT_AVG_TAU);
+
+    if (-1 == window_open (&s))
+    {
+        fprintf (stderr, "draw_window: failed to open the window\n");
+        goto done;
+    }
+
+    draw_window (&s, false, false);
+
+    run (&idle);
+    run (&traffic);
+
+    window_close (&s);
+
+done:
+    if (NULL != screen)
+        delscreen (screen);
+
+    if (NULL != out)
+        fclose (out);
+
+    if (NULL != in)
+        fclose (in);
+}
+#endif
+
+/*
+ * The stats file
+ */
+
+static void
+run_statsfile_save (void *arg)
+{
+    struct mbs *s = arg;
+
+    s->used.tx_bytes += 1500;
+    statsfile_save (s);
+}
+
+/* With an interval of 0, every sync goes to disk */
+static void
+run_statsfile_sync (void *arg)
+{
+    run_statsfile_save (arg);
+    statsfile_sync ();
+}
+
+static void
+bench_statsfile (void)
+{
+    char path[] = "/tmp/mbs_bench.XXXXXX";
+    struct statsfile_record last;
+    struct mbs s;
+    struct bench save = { "statsfile/save", 0, run_statsfile_save, &s },
+                 sync = { "statsfile/save+sync", 0, run_statsfile_sync, &s };
+    int fd;
+
+    memset (&s, 0, sizeof (s));
+
+    if (-1 == (fd = mkstemp (path)))
+    {
+        perror ("mkstemp");
+        return;
+    }
+
+    close (fd);
+
+    if (-1 == statsfile_open (path, 0, &last))
+    {
+        perror ("statsfile_open");
+    }
+    else
+    {
+        run (&save);
+        run (&sync);
+        statsfile_close ();
+    }
+
+    unlink (path);
+}
+
+/*
+ * Attribution to processes
+ */
+
+/* A full scan of every descriptor of every process, as on startup */
+static void
+run_procnet_open (void *arg)
+{
+    (void) arg;
+
+    procnet_open ();
+    procnet_close ();
+}
+
+static void
+run_procnet_refresh (void *arg)
+{
+    (void) arg;
+
+    procnet_refresh ();
+}
+
+/* A new socket every time, whose owner has to be found */
+static void
+run_procnet_new_socket (void *arg)
+{
+    int *fd = arg;
+    struct sockaddr_in addr = { 0 };
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+    close (*fd);
+    *fd = socket (AF_INET, SOCK_DGRAM, 0);
+    bind (*fd, (struct sockaddr *) &addr, sizeof (addr));
+
+    procnet_refresh ();
+}
+
+static void
+bench_procnet (void)
+{
+    int fd = -1;
+
+    run (&(struct bench) { "procnet/open", 0, run_procnet_open, NULL });
+
+    if (-1 == procnet_open ())
+    {
+        perror ("procnet_open");
+        return;
+    }
+
+    run (&(struct bench) { "procnet/refresh", 0, run_procnet_refresh, NULL });
+    run (&(struct bench) { "procnet/refresh+socket", 0,
+                           run_procnet_new_socket, &fd });
+
+    close (fd);
+    procnet_close ();
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct arg_lit *help,
+                   *json;
+    struct arg_str *filter;
+    struct arg_int *min_time;
+    struct arg_end *end;
+
+    int nerrors;
+    const char command[] = "mbs_bench";
+
+    void *argtable[] =
+    {
+        help = arg_litn (
+            NULL, "help",
+            0, 1, "display this help and exit"
+        ),
+        json = arg_litn (
+            NULL, "json",
+            0, 1, "print one JSON object per benchmark"
+        ),
+        filter = arg_strn (
+            NULL, "filter", "<text>",
+            0, 1, "only run benchmarks whose name contains the text"
+        ),
+        min_time = arg_intn (
+            NULL, "min-time", "<ms>",
+            0, 1, "shortest measured run of each benchmark (default: 200)"
+        ),
+        end = arg_end (20),
+    };
+
+    nerrors = arg_parse (argc, argv, argtable);
+
+    if (help->count > 0)
+    {
+        printf ("Usage: %s", command);
+        arg_print_syntax (stdout, argtable, "\n");
+        printf ("Time the hot paths of mbs, and count the allocations and "
+            "system calls they make.\n\n");
+        arg_print_glossary (stdout, argtable, "  %-25s %s\n");
+        arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+        return EXIT_SUCCESS;
+    }
+
+    if (nerrors > 0 || (min_time->count > 0 && *min_time->ival < 1))
+    {
+        arg_print_errors (stdout, end, command);
+        printf ("Try '%s --help' for more information.\n", command);
+        arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+        return EXIT_FAILURE;
+    }
+
+    options.json = json->count > 0;
+    options.filter = filter->count > 0 ? *filter->sval : NULL;
+    options.min_time = (min_time->count > 0 ? *min_time->ival : 200)
+                     * 1000000ULL;
+
+    if (!options.json)
+    {
+        printf ("%-28s %7s %11s %12s %9s %9s\n", "benchmark", "ifaces",
+                "iterations", "ns/op", "allocs/op", "syscalls");
+    }
+
+    bench_poll ("poll/netlink", &netlink_source, 0);
+    bench_poll ("poll/sysfs", &sysfs_source, 0);
+    bench_poll ("poll/getifaddrs", &getifaddrs_source, 0);
+    bench_poll ("poll/synthetic/1", &synthetic_source, 1);
+    bench_poll ("poll/synthetic/16", &synthetic_source, 16);
+    bench_poll ("poll/synthetic/256", &synthetic_source, 256);
+    bench_poll ("poll/synthetic/4096", &synthetic_source, 4096);
+
+    run (&(struct bench) { "parse_bytes", 0, run_parse_bytes, NULL });
+    run (&(struct bench) { "to_human_readable", 0, run_to_human_readable,
+                           NULL });
+
+#ifdef HAVE_CURSES
+    bench_draw ();
+#endif
+
+    bench_statsfile ();
+    bench_procnet ();
+
+    arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+
+    return EXIT_SUCCESS;
+}
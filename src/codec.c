@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdbool.h>
+#include <string.h>
+#include "codec.h"
+
+static uint32_t table[256];
+static bool table_ready = false;
+
+static void
+init_table (void)
+{
+    uint32_t i, crc;
+    int k;
+
+    for (i = 0; i < 256; ++i)
+    {
+        crc = i;
+
+        for (k = 0; k < 8; ++k)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+
+        table[i] = crc;
+    }
+
+    table_ready = true;
+}
+
+uint32_t
+codec_crc32 (uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    if (!table_ready)
+        init_table ();
+
+    crc = ~crc;
+
+    while (len--)
+        crc = (crc >> 8) ^ table[(crc ^ *p++) & 0xff];
+
+    return ~crc;
+}
+
+/* Hashing a message in pieces, as HMAC needs */
+struct sha256
+{
+    uint32_t h[8];
+    uint8_t block[64];
+    size_t used;
+    uint64_t len;
+};
+
+static const uint32_t k256[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t
+ror (uint32_t x, int n)
+{
+    return x >> n | x << (32 - n);
+}
+
+static void
+sha256_block (struct sha256 *c, const uint8_t *p)
+{
+    uint32_t w[64], a, b, d, e, f, g, h, cc, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; ++i)
+    {
+        w[i] = (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16
+             | (uint32_t) p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+
+    for (i = 16; i < 64; ++i)
+    {
+        w[i] = w[i - 16] + w[i - 7]
+             + (ror (w[i - 15], 7) ^ ror (w[i - 15], 18) ^ w[i - 15] >> 3)
+             + (ror (w[i - 2], 17) ^ ror (w[i - 2], 19) ^ w[i - 2] >> 10);
+    }
+
+    a = c->h[0];
+    b = c->h[1];
+    cc = c->h[2];
+    d = c->h[3];
+    e = c->h[4];
+    f = c->h[5];
+    g = c->h[6];
+    h = c->h[7];
+
+    for (i = 0; i < 64; ++i)
+    {
+        t1 = h + (ror (e, 6) ^ ror (e, 11) ^ ror (e, 25))
+           + ((e & f) ^ (~e & g)) + k256[i] + w[i];
+        t2 = (ror (a, 2) ^ ror (a, 13) ^ ror (a, 22))
+           + ((a & b) ^ (a & cc) ^ (b & cc));
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = cc;
+        cc = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    c->h[0] += a;
+    c->h[1] += b;
+    c->h[2] += cc;
+    c->h[3] += d;
+    c->h[4] += e;
+    c->h[5] += f;
+    c->h[6] += g;
+    c->h[7] += h;
+}
+
+static void
+sha256_init (struct sha256 *c)
+{
+    static const uint32_t iv[8] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f,
+        0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy (c->h, iv, sizeof (iv));
+    c->used = 0;
+    c->len = 0;
+}
+
+static void
+sha256_update (struct sha256 *c, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t n;
+
+    c->len += len;
+
+    while (len > 0)
+    {
+        n = sizeof (c->block) - c->used;
+
+        if (n > len)
+            n = len;
+
+        memcpy (c->block + c->used, p, n);
+        c->used += n;
+        p += n;
+        len -= n;
+
+        if (sizeof (c->block) == c->used)
+        {
+            sha256_block (c, c->block);
+            c->used = 0;
+        }
+    }
+}
+
+static void
+sha256_final (struct sha256 *c, uint8_t *out)
+{
+    const uint64_t bits = c->len * 8;
+    const uint8_t one = 0x80, zero = 0;
+    uint8_t len[8];
+    int i;
+
+    sha256_update (c, &one, 1);
+
+    while (56 != c->used)
+        sha256_update (c, &zero, 1);
+
+    for (i = 0; i < 8; ++i)
+        len[i] = bits >> (56 - 8 * i);
+
+    sha256_update (c, len, sizeof (len));
+
+    for (i = 0; i < 32; ++i)
+        out[i] = c->h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+void
+codec_sha256 (const void *data, size_t len, uint8_t *out)
+{
+    struct sha256 c;
+
+    sha256_init (&c);
+    sha256_update (&c, data, len);
+    sha256_final (&c, out);
+}
+
+void
+codec_hmac_sha256 (const void *key, size_t key_len, const void *data,
+                   size_t len, uint8_t *out)
+{
+    uint8_t pad[64], inner[CODEC_SHA256_LEN];
+    struct sha256 c;
+    size_t i;
+
+    memset (pad, 0, sizeof (pad));
+
+    /* Keys longer than a block are hashed first */
+    if (key_len > sizeof (pad))
+        codec_sha256 (key, key_len, pad);
+    else
+        memcpy (pad, key, key_len);
+
+    for (i = 0; i < sizeof (pad); ++i)
+        pad[i] ^= 0x36;
+
+    sha256_init (&c);
+    sha256_update (&c, pad, sizeof (pad));
+    sha256_update (&c, data, len);
+    sha256_final (&c, inner);
+
+    /* From the inner padding to the outer one */
+    for (i = 0; i < sizeof (pad); ++i)
+        pad[i] ^= 0x36 ^ 0x5c;
+
+    sha256_init (&c);
+    sha256_update (&c, pad, sizeof (pad));
+    sha256_update (&c, inner, sizeof (inner));
+    sha256_final (&c, out);
+}
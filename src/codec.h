@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file codec.h
+ * @brief Small encoding helpers shared by the on-disk and wire formats:
+ *        LEB128 varints, zigzag encoding of signed values, CRC-32, and
+ *        HMAC-SHA-256.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Longest encoding of a 64-bit varint, in bytes.
+ */
+#define CODEC_VARINT_MAX 10
+
+/**
+ * @brief Encode an unsigned integer as a varint: seven bits per byte, least
+ *        significant group first, with the high bit set on all but the last
+ *        byte.
+ *
+ * @param  buf Output buffer, with room for at least \ref CODEC_VARINT_MAX
+ *             bytes.
+ * @param  n   The value to encode.
+ * @return     Number of bytes written.
+ */
+static inline size_t
+codec_put_varint (uint8_t *buf, uint64_t n)
+{
+    size_t len = 0;
+
+    while (n >= 0x80)
+    {
+        buf[len++] = (uint8_t) n | 0x80;
+        n >>= 7;
+    }
+
+    buf[len++] = (uint8_t) n;
+
+    return len;
+}
+
+/**
+ * @brief Decode a varint.
+ *
+ * @param  p   Start of the encoded value.
+ * @param  end End of the input.
+ * @param  n   Receives the value.
+ * @return     Number of bytes read, or 0 if the input ends in the middle of
+ *             the value, or the value does not fit in 64 bits.
+ */
+static inline size_t
+codec_get_varint (const uint8_t *p, const uint8_t *end, uint64_t *n)
+{
+    uint64_t value = 0;
+    size_t i;
+
+    for (i = 0; i < CODEC_VARINT_MAX && p + i < end; ++i)
+    {
+        value |= (uint64_t) (p[i] & 0x7f) << (7 * i);
+
+        if (!(p[i] & 0x80))
+        {
+            *n = value;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Map a signed integer to an unsigned one, so that values close to
+ *        zero (of either sign) get short varint encodings: 0, -1, 1, -2, ...
+ *        become 0, 1, 2, 3, ...
+ *
+ * @param  n A signed value.
+ * @return   The zigzag encoding of \a n.
+ */
+static inline uint64_t
+codec_zigzag (int64_t n)
+{
+    return ((uint64_t) n << 1) ^ (uint64_t) (n >> 63);
+}
+
+/**
+ * @brief Inverse of \ref codec_zigzag.
+ *
+ * @param  n A zigzag-encoded value.
+ * @return   The signed value.
+ */
+static inline int64_t
+codec_unzigzag (uint64_t n)
+{
+    return (int64_t) (n >> 1) ^ -(int64_t) (n & 1);
+}
+
+/**
+ * @brief Compute, or continue computing, a CRC-32 (IEEE 802.3).
+ *
+ * @param  crc  0 to start a new checksum, or the result of a previous call
+ *              to continue it.
+ * @param  data Data to checksum.
+ * @param  len  Length of \a data.
+ * @return      The updated checksum.
+ */
+uint32_t codec_crc32 (uint32_t crc, const void *data, size_t len);
+
+/**
+ * @brief Length of a SHA-256 digest, in bytes.
+ */
+#define CODEC_SHA256_LEN 32
+
+/**
+ * @brief Compute a SHA-256 digest (FIPS 180-4).
+ *
+ * @param  data Data to hash.
+ * @param  len  Length of \a data.
+ * @param  out  Receives the \ref CODEC_SHA256_LEN bytes of the digest.
+ * @return Nothing
+ */
+void codec_sha256 (const void *data, size_t len, uint8_t *out);
+
+/**
+ * @brief Compute an HMAC-SHA-256 (RFC 2104) of a message, under a key of
+ *        any length.
+ *
+ * @param  key     The key.
+ * @param  key_len Length of \a key.
+ * @param  data    The message.
+ * @param  len     Length of \a data.
+ * @param  out     Receives the \ref CODEC_SHA256_LEN bytes of the result.
+ * @return Nothing
+ */
+void codec_hmac_sha256 (const void *key, size_t key_len, const void *data,
+                        size_t len, uint8_t *out);
+
+#endif
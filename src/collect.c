@@ -0,0 +1,1265 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include "argtable3/argtable3.h"
+#include "codec.h"
+#include "collect.h"
+#include "status.h"
+#include "window.h"
+
+static const uint8_t magic[] = { 'M', 'B', 'C', COLLECT_VERSION };
+static const uint8_t keyed_magic[] = { 'M', 'B', 'K', COLLECT_VERSION };
+
+/* The shared key, if frames are authenticated */
+static uint8_t key[COLLECT_KEY_MAX];
+static size_t key_len = 0;
+
+/* Where batches are sent, and the batch being filled */
+static bool reporting = false;
+static int send_fd = -1;
+static int send_type;
+static struct sockaddr_storage send_addr;
+static socklen_t send_addrlen;
+static struct collect_batch batch;
+static struct stats sent;
+
+/* Usage when reporting started; batches carry the totals since then */
+static struct stats origin;
+static uint64_t first, last;
+
+/*
+ * What has been merged of each host, in the same order as the interfaces of
+ * the fleet.
+ */
+struct peer
+{
+    uint64_t session;
+
+    /* Sequence number of the next sample which the rates have not seen */
+    uint64_t next_seq;
+
+    /* Totals of the session, as far as they have been merged */
+    uint64_t tx, rx;
+
+    struct rates rates;
+};
+
+static struct peer *peers = NULL;
+
+/* The listening sockets, and connections, of a collector */
+struct conn
+{
+    int fd;
+    size_t len;
+    uint8_t buf[2 * COLLECT_FRAME_MAX];
+};
+
+static int recv_epfd = -1;
+static int udp_fd = -1;
+static int tcp_fd = -1;
+
+static struct conn conns[COLLECT_MAX_CONNS];
+static size_t n_conns = 0;
+
+static uint8_t *
+put_varint (uint8_t *p, uint64_t n)
+{
+    return p + codec_put_varint (p, n);
+}
+
+int
+collect_set_key (const char *path)
+{
+    FILE *file;
+    size_t len;
+
+    if (NULL == (file = fopen (path, "r")))
+        return -1;
+
+    len = fread (key, 1, sizeof (key), file);
+
+    /* Longer than a key can be */
+    if (sizeof (key) == len && EOF != fgetc (file))
+        len = 0;
+
+    fclose (file);
+
+    /* Written with echo, most likely */
+    while (len > 0 && ('\n' == key[len - 1] || '\r' == key[len - 1]))
+        --len;
+
+    if (0 == len)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    key_len = len;
+    return 0;
+}
+
+/*
+ * What follows the fields of a frame: the first bytes of an HMAC-SHA-256 of
+ * them with a key, or else a CRC-32, four bytes, little-endian.
+ */
+static size_t
+trailer_len (void)
+{
+    return key_len > 0 ? COLLECT_TAG_LEN : 4;
+}
+
+static void
+trailer (const uint8_t *body, size_t len, uint8_t *out)
+{
+    uint8_t mac[CODEC_SHA256_LEN];
+    uint32_t crc;
+
+    if (key_len > 0)
+    {
+        codec_hmac_sha256 (key, key_len, body, len, mac);
+        memcpy (out, mac, COLLECT_TAG_LEN);
+        return;
+    }
+
+    crc = codec_crc32 (0, body, len);
+
+    out[0] = crc;
+    out[1] = crc >> 8;
+    out[2] = crc >> 16;
+    out[3] = crc >> 24;
+}
+
+size_t
+collect_encode (const struct collect_batch *b, uint8_t *buf)
+{
+    const size_t name_len = strlen (b->name);
+    uint8_t *body = buf + 2, *p = body, len[CODEC_VARINT_MAX];
+    size_t n;
+    unsigned int i;
+
+    memcpy (p, key_len > 0 ? keyed_magic : magic, sizeof (magic));
+    p += sizeof (magic);
+
+    p = put_varint (p, b->session);
+    p = put_varint (p, name_len);
+    memcpy (p, b->name, name_len);
+    p += name_len;
+
+    p = put_varint (p, b->seq);
+    p = put_varint (p, b->base_tx);
+    p = put_varint (p, b->base_rx);
+    p = put_varint (p, b->n);
+
+    for (i = 0; i < b->n; ++i)
+    {
+        p = put_varint (p, b->samples[i].ms);
+        p = put_varint (p, b->samples[i].tx);
+        p = put_varint (p, b->samples[i].rx);
+    }
+
+    trailer (body, p - body, p);
+    p += trailer_len ();
+
+    /* The length goes in front; it takes one byte or two */
+    n = codec_put_varint (len, p - body);
+    memmove (buf + n, body, p - body);
+    memcpy (buf, len, n);
+
+    return n + (p - body);
+}
+
+static int
+get_varint (const uint8_t **p, const uint8_t *end, uint64_t *n)
+{
+    const size_t len = codec_get_varint (*p, end, n);
+
+    *p += len;
+    return len ? 0 : -1;
+}
+
+int
+collect_decode (const uint8_t *buf, size_t len, struct collect_batch *b)
+{
+    const uint8_t *p, *end;
+    uint8_t expected[COLLECT_TAG_LEN], diff = 0;
+    uint64_t body, name_len, n, ms, tx, rx;
+    size_t k;
+    unsigned int i;
+
+    /* Frames are shorter than 2^14 bytes, so the length takes two at most */
+    if (0 == (k = codec_get_varint (buf, buf + len, &body)))
+    {
+        if (len < 2)
+            return 0;
+
+        goto invalid;
+    }
+
+    if (body < sizeof (magic) + trailer_len () || body > COLLECT_FRAME_MAX)
+        goto invalid;
+
+    if (k + body > len)
+        return 0;
+
+    p = buf + k;
+    end = p + body - trailer_len ();
+
+    trailer (p, end - p, expected);
+
+    /* Without giving away, in the time taken, how much of it matched */
+    for (i = 0; i < trailer_len (); ++i)
+        diff |= expected[i] ^ end[i];
+
+    if (0 != diff
+     || 0 != memcmp (p, key_len > 0 ? keyed_magic : magic, sizeof (magic)))
+        goto invalid;
+
+    p += sizeof (magic);
+
+    if (-1 == get_varint (&p, end, &b->session)
+     || -1 == get_varint (&p, end, &name_len)
+     || 0 == name_len || name_len >= COLLECT_NAME_MAX
+     || name_len > (uint64_t) (end - p))
+        goto invalid;
+
+    for (i = 0; i < name_len; ++i)
+    {
+        if (p[i] <= ' ' || p[i] > '~')
+            goto invalid;
+
+        b->name[i] = p[i];
+    }
+
+    b->name[name_len] = '\0';
+    p += name_len;
+
+    if (-1 == get_varint (&p, end, &b->seq)
+     || -1 == get_varint (&p, end, &b->base_tx)
+     || -1 == get_varint (&p, end, &b->base_rx)
+     || -1 == get_varint (&p, end, &n)
+     || n > COLLECT_BATCH)
+        goto invalid;
+
+    tx = b->base_tx;
+    rx = b->base_rx;
+
+    for (i = 0; i < n; ++i)
+    {
+        struct collect_sample *s = &b->samples[i];
+
+        if (-1 == get_varint (&p, end, &ms)
+         || -1 == get_varint (&p, end, &s->tx)
+         || -1 == get_varint (&p, end, &s->rx)
+         || ms > UINT32_MAX
+         || s->tx > UINT64_MAX - tx
+         || s->rx > UINT64_MAX - rx)
+            goto invalid;
+
+        s->ms = ms;
+        tx += s->tx;
+        rx += s->rx;
+    }
+
+    if (p != end)
+        goto invalid;
+
+    b->n = n;
+
+    return k + body;
+
+invalid:
+    errno = EPROTO;
+    return -1;
+}
+
+/*
+ * Split `<host>[:<port>]`, where the host may be an IPv6 address in
+ * brackets, `*`, or be left out, leaving only a port. Without a host, it comes
+ * out empty; without a port, it is the default one.
+ */
+static int
+split_address (const char *address, char *host, size_t size, char *port)
+{
+    const char *end, *digits = NULL;
+    size_t len;
+
+    if ('[' == *address)
+    {
+        if (NULL == (end = strchr (address, ']'))
+         || ('\0' != end[1] && ':' != end[1]))
+            return -1;
+
+        digits = ':' == end[1] ? end + 2 : NULL;
+        ++address;
+    }
+    else if ('\0' != *address
+          && strspn (address, "0123456789") == strlen (address))
+    {
+        end = digits = address;
+    }
+    else
+    {
+        end = strchr (address, ':');
+
+        /* More than one colon is an IPv6 address, without a port */
+        if (NULL != end && NULL != strchr (end + 1, ':'))
+            end = NULL;
+
+        if (NULL != end)
+            digits = end + 1;
+        else
+            end = address + strlen (address);
+    }
+
+    if ((len = end - address) >= size)
+        return -1;
+
+    memcpy (host, address, len);
+    host[len] = '\0';
+
+    if (NULL == digits)
+    {
+        snprintf (port, 6, "%d", COLLECT_DEFAULT_PORT);
+        return 0;
+    }
+
+    len = strlen (digits);
+
+    if (0 == len || len > 5 || strspn (digits, "0123456789") != len
+     || 0 == atoi (digits) || atoi (digits) > 65535)
+        return -1;
+
+    strcpy (port, digits);
+    return 0;
+}
+
+static int
+resolve (const char *address, int type, bool passive,
+         struct sockaddr_storage *addr, socklen_t *addrlen)
+{
+    struct addrinfo hints, *res;
+    char host[256], port[6];
+    const char *node = host;
+
+    if (-1 == split_address (address, host, sizeof (host), port))
+        return -1;
+
+    /* Unless told otherwise, only listen for reports from this machine */
+    if ('\0' == *host)
+        node = passive ? "127.0.0.1" : NULL;
+
+    memset (&hints, 0, sizeof (hints));
+
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = type;
+    hints.ai_flags    = passive ? AI_PASSIVE : 0;
+
+    /* Listening on any address means IPv6 and IPv4, where there is IPv6 */
+    if (passive && 0 == strcmp (host, "*"))
+    {
+        node = NULL;
+        hints.ai_family = AF_INET6;
+
+        if (0 == getaddrinfo (NULL, port, &hints, &res))
+            goto found;
+
+        hints.ai_family = AF_UNSPEC;
+    }
+
+    if (0 != getaddrinfo (node, port, &hints, &res))
+        return -1;
+
+found:
+
+    memcpy (addr, res->ai_addr, res->ai_addrlen);
+    *addrlen = res->ai_addrlen;
+
+    freeaddrinfo (res);
+    return 0;
+}
+
+/*
+ * Without waiting for a TCP connection to be established; until it is,
+ * batches are dropped.
+ */
+static void
+connect_sender (void)
+{
+    send_fd = socket (send_addr.ss_family,
+                      send_type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (-1 == send_fd)
+        return;
+
+    if (-1 == connect (send_fd, (struct sockaddr *) &send_addr, send_addrlen)
+     && EINPROGRESS != errno)
+    {
+        close (send_fd);
+        send_fd = -1;
+    }
+}
+
+static bool
+valid_name (const char *name)
+{
+    const size_t len = strlen (name);
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+    {
+        if (name[i] <= ' ' || name[i] > '~')
+            return false;
+    }
+
+    return len > 0 && len < COLLECT_NAME_MAX;
+}
+
+int
+collect_open (const char *address, const char *name, const struct mbs *s)
+{
+    char hostname[256];
+    struct timespec ts;
+
+    send_type = SOCK_DGRAM;
+
+    if (0 == strncmp ("tcp://", address, 6))
+    {
+        send_type = SOCK_STREAM;
+        address += 6;
+    }
+    else if (0 == strncmp ("udp://", address, 6))
+    {
+        address += 6;
+    }
+
+    if (NULL == name)
+    {
+        if (-1 == gethostname (hostname, sizeof (hostname)))
+            return -1;
+
+        hostname[sizeof (hostname) - 1] = '\0';
+        name = hostname;
+    }
+
+    if (!valid_name (name)
+     || -1 == resolve (address, send_type, false, &send_addr, &send_addrlen))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset (&batch, 0, sizeof (batch));
+    strcpy (batch.name, name);
+
+    /*
+     * Later runs have larger sessions: the wall-clock time in milliseconds,
+     * above bits which differ between runs started at the same time.
+     */
+    clock_gettime (CLOCK_REALTIME, &ts);
+
+    batch.session = ((uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000) << 20
+                  | ((mbs_now () ^ (uint64_t) getpid () << 10) & 0xfffff);
+
+    /* A persistent instance has usage from earlier runs, which is not sent */
+    origin = s->used;
+    sent = s->used;
+    last = mbs_now ();
+    reporting = true;
+
+    connect_sender ();
+
+    return 0;
+}
+
+static void
+flush (void)
+{
+    uint8_t buf[COLLECT_FRAME_MAX];
+    const size_t len = collect_encode (&batch, buf);
+    ssize_t n;
+
+    if (-1 == send_fd)
+        connect_sender ();
+
+    if (-1 != send_fd)
+    {
+        n = send (send_fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        /*
+         * Over TCP, a batch is kept while the connection is not ready, and
+         * tried again on the next tick, unless it is full. A frame which was
+         * cut short, or any other error, means starting over with a new
+         * connection. Over UDP, a batch which does not arrive is lost.
+         */
+        if (SOCK_STREAM == send_type && (ssize_t) len != n)
+        {
+            if (-1 == n && (EAGAIN == errno || ENOTCONN == errno))
+            {
+                if (batch.n < COLLECT_BATCH)
+                    return;
+            }
+            else
+            {
+                close (send_fd);
+                send_fd = -1;
+            }
+        }
+    }
+
+    batch.seq += batch.n;
+    batch.base_tx = sent.tx_bytes - origin.tx_bytes;
+    batch.base_rx = sent.rx_bytes - origin.rx_bytes;
+    batch.n = 0;
+}
+
+void
+collect_sample (const struct mbs *s)
+{
+    struct collect_sample *sample;
+    const uint64_t now = mbs_now ();
+    uint64_t ms;
+
+    if (!reporting)
+        return;
+
+    if (0 == batch.n)
+        first = now;
+
+    ms = (now - last) / 1000000;
+
+    if (ms > UINT32_MAX)
+        ms = UINT32_MAX;
+
+    /* What is left over of a millisecond counts towards the next sample */
+    last += ms * 1000000;
+
+    sample = &batch.samples[batch.n++];
+    sample->ms = ms;
+    sample->tx = s->used.tx_bytes - sent.tx_bytes;
+    sample->rx = s->used.rx_bytes - sent.rx_bytes;
+
+    sent = s->used;
+
+    if (COLLECT_BATCH == batch.n || now - first >= COLLECT_FLUSH_MS * 1000000ULL)
+        flush ();
+}
+
+/*
+ * Bring the merged totals of a host up to the given session totals. Anything
+ * which was merged already, from a batch that arrived late, is skipped.
+ */
+static void
+advance (struct iface *host, struct peer *p, uint64_t tx, uint64_t rx)
+{
+    if (tx > p->tx)
+    {
+        host->used.tx_bytes += tx - p->tx;
+        p->tx = tx;
+    }
+
+    if (rx > p->rx)
+    {
+        host->used.rx_bytes += rx - p->rx;
+        p->rx = rx;
+    }
+}
+
+int
+collect_merge (struct mbs *fleet, const struct collect_batch *b, uint64_t now)
+{
+    struct peer *p;
+    struct iface *host;
+    uint64_t tx = b->base_tx, rx = b->base_rx;
+    size_t i;
+    unsigned int k;
+
+    for (i = 0; i < fleet->n_ifaces; ++i)
+    {
+        if (0 == strcmp (fleet->ifaces[i].name, b->name))
+            break;
+    }
+
+    if (i == fleet->n_ifaces)
+    {
+        if (COLLECT_MAX_HOSTS == fleet->n_ifaces)
+        {
+            errno = ENOSPC;
+            return -1;
+        }
+
+        if (NULL == (p = realloc (peers, (i + 1) * sizeof (*peers))))
+            return -1;
+
+        peers = p;
+
+        if (-1 == mbs_add_iface (fleet, b->name))
+            return -1;
+
+        memset (&peers[i], 0, sizeof (peers[i]));
+        peers[i].session = b->session;
+        rate_init (&peers[i].rates, RATE_DEFAULT_TAU, RATE_DEFAULT_AVG_TAU);
+    }
+
+    p = &peers[i];
+    host = &fleet->ifaces[i];
+
+    /*
+     * A batch of a session before a restart, which arrived late or was
+     * replayed. Taking it as another restart would count it twice.
+     */
+    if (b->session < p->session)
+        return 0;
+
+    /* Restarted; the new session replaces the old one, from zero */
+    if (p->session != b->session)
+    {
+        p->session = b->session;
+        p->next_seq = 0;
+        p->tx = 0;
+        p->rx = 0;
+    }
+
+    advance (host, p, tx, rx);
+
+    for (k = 0; k < b->n; ++k)
+    {
+        const struct collect_sample *s = &b->samples[k];
+
+        tx += s->tx;
+        rx += s->rx;
+
+        if (b->seq + k >= p->next_seq)
+            rate_update (&p->rates, s->tx, s->rx, s->ms * 1000000ULL);
+
+        advance (host, p, tx, rx);
+    }
+
+    if (b->seq + b->n > p->next_seq)
+        p->next_seq = b->seq + b->n;
+
+    host->sample.timestamp = now;
+    host->error = 0;
+
+    return 0;
+}
+
+void
+collect_update (struct mbs *fleet, uint64_t budget, uint64_t now,
+                uint64_t timeout, struct stats *delta)
+{
+    struct stats used = { 0, 0, 0 };
+    double tx = 0, rx = 0, tx_avg = 0, rx_avg = 0;
+    size_t i;
+
+    for (i = 0; i < fleet->n_ifaces; ++i)
+    {
+        struct iface *host = &fleet->ifaces[i];
+
+        used.tx_bytes += host->used.tx_bytes;
+        used.rx_bytes += host->used.rx_bytes;
+
+        if (now - host->sample.timestamp > timeout)
+        {
+            host->error = ETIMEDOUT;
+            continue;
+        }
+
+        tx += peers[i].rates.tx.value;
+        rx += peers[i].rates.rx.value;
+        tx_avg += peers[i].rates.tx_avg.value;
+        rx_avg += peers[i].rates.rx_avg.value;
+    }
+
+    delta->tx_bytes = used.tx_bytes - fleet->used.tx_bytes;
+    delta->rx_bytes = used.rx_bytes - fleet->used.rx_bytes;
+    delta->timestamp = now;
+
+    used.timestamp = now;
+    fleet->used = used;
+
+    fleet->rates.tx.value = tx;
+    fleet->rates.rx.value = rx;
+    fleet->rates.tx_avg.value = tx_avg;
+    fleet->rates.rx_avg.value = rx_avg;
+
+    rate_record (&fleet->rates, tx, rx);
+
+    if (fleet->flags & FLAG_COUNTDOWN)
+    {
+        const uint64_t total = used.tx_bytes + used.rx_bytes;
+
+        fleet->balance = budget > total ? budget - total : 0;
+    }
+}
+
+static void
+close_receiver (void)
+{
+    while (n_conns > 0)
+        close (conns[--n_conns].fd);
+
+    if (-1 != udp_fd)
+        close (udp_fd);
+
+    if (-1 != tcp_fd)
+        close (tcp_fd);
+
+    if (-1 != recv_epfd)
+        close (recv_epfd);
+
+    udp_fd = tcp_fd = recv_epfd = -1;
+}
+
+void
+collect_close (void)
+{
+    if (reporting && batch.n > 0)
+        flush ();
+
+    if (-1 != send_fd)
+        close (send_fd);
+
+    send_fd = -1;
+    reporting = false;
+
+    free (peers);
+
+    peers = NULL;
+    key_len = 0;
+
+    close_receiver ();
+}
+
+static int
+bind_socket (const char *address, int type)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    struct epoll_event ev;
+    const int on = 1, off = 0;
+    int fd;
+
+    if (-1 == resolve (address, type, true, &addr, &addrlen))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (-1 == (fd = socket (addr.ss_family, type | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                            0)))
+        return -1;
+
+    memset (&ev, 0, sizeof (ev));
+
+    ev.events  = EPOLLIN;
+    ev.data.fd = fd;
+
+    if (AF_INET6 == addr.ss_family)
+        setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof (off));
+
+    if (-1 == setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on))
+     || -1 == bind (fd, (struct sockaddr *) &addr, addrlen)
+     || (SOCK_STREAM == type && -1 == listen (fd, 64))
+     || -1 == epoll_ctl (recv_epfd, EPOLL_CTL_ADD, fd, &ev))
+    {
+        const int err = errno;
+
+        close (fd);
+        errno = err;
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Listen for batches on both UDP and TCP, on the same port. Returns a file
+ * descriptor which becomes readable when there is something to receive.
+ */
+static int
+listen_batches (const char *address)
+{
+    if (-1 == (recv_epfd = epoll_create1 (EPOLL_CLOEXEC))
+     || -1 == (udp_fd = bind_socket (address, SOCK_DGRAM))
+     || -1 == (tcp_fd = bind_socket (address, SOCK_STREAM)))
+    {
+        const int err = errno;
+
+        close_receiver ();
+        errno = err;
+        return -1;
+    }
+
+    return recv_epfd;
+}
+
+static struct conn *
+find_conn (int fd)
+{
+    size_t i;
+
+    for (i = 0; i < n_conns; ++i)
+    {
+        if (conns[i].fd == fd)
+            return &conns[i];
+    }
+
+    return NULL;
+}
+
+static void
+drop_conn (struct conn *c)
+{
+    epoll_ctl (recv_epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close (c->fd);
+
+    /* The buffer is large; only what it holds is moved */
+    c->fd = conns[n_conns - 1].fd;
+    c->len = conns[n_conns - 1].len;
+    memmove (c->buf, conns[n_conns - 1].buf, c->len);
+
+    --n_conns;
+}
+
+static void
+accept_conns (void)
+{
+    struct epoll_event ev;
+    int fd;
+
+    while (-1 != (fd = accept4 (tcp_fd, NULL, NULL,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC)))
+    {
+        memset (&ev, 0, sizeof (ev));
+
+        ev.events  = EPOLLIN;
+        ev.data.fd = fd;
+
+        if (COLLECT_MAX_CONNS == n_conns ||
+            -1 == epoll_ctl (recv_epfd, EPOLL_CTL_ADD, fd, &ev))
+        {
+            close (fd);
+            continue;
+        }
+
+        conns[n_conns].fd = fd;
+        conns[n_conns++].len = 0;
+    }
+}
+
+static void
+receive_datagrams (struct mbs *fleet, uint64_t now)
+{
+    uint8_t buf[COLLECT_FRAME_MAX + 1];
+    struct collect_batch b;
+    ssize_t n;
+
+    while ((n = recv (udp_fd, buf, sizeof (buf), MSG_DONTWAIT)) >= 0)
+    {
+        if (n == collect_decode (buf, n, &b))
+            collect_merge (fleet, &b, now);
+    }
+}
+
+/*
+ * Read what the host has sent, and merge every complete frame. Returns -1 if
+ * the connection should be dropped.
+ */
+static int
+receive_stream (struct mbs *fleet, struct conn *c, uint64_t now)
+{
+    struct collect_batch b;
+    size_t start = 0;
+    ssize_t n;
+    int len;
+
+    n = read (c->fd, c->buf + c->len, sizeof (c->buf) - c->len);
+
+    if (n <= 0)
+        return 0 == n || (EAGAIN != errno && EINTR != errno) ? -1 : 0;
+
+    c->len += n;
+
+    while ((len = collect_decode (c->buf + start, c->len - start, &b)) > 0)
+    {
+        collect_merge (fleet, &b, now);
+        start += len;
+    }
+
+    if (-1 == len)
+        return -1;
+
+    c->len -= start;
+    memmove (c->buf, c->buf + start, c->len);
+
+    return 0;
+}
+
+static void
+receive (struct mbs *fleet, uint64_t now)
+{
+    struct epoll_event events[16];
+    struct conn *c;
+    int i, n;
+
+    if (-1 == (n = epoll_wait (recv_epfd, events, 16, 0)))
+        return;
+
+    for (i = 0; i < n; ++i)
+    {
+        if (events[i].data.fd == udp_fd)
+            receive_datagrams (fleet, now);
+        else if (events[i].data.fd == tcp_fd)
+            accept_conns ();
+        else if (NULL != (c = find_conn (events[i].data.fd))
+              && -1 == receive_stream (fleet, c, now))
+            drop_conn (c);
+    }
+}
+
+/*
+ * Tags for the file descriptors in the epoll set of the command.
+ */
+enum event
+{
+    EVENT_TIMER,
+    EVENT_STDIN,
+    EVENT_SIGNAL,
+    EVENT_RECEIVE
+};
+
+static int
+watch (int epfd, int fd, enum event tag)
+{
+    struct epoll_event ev;
+
+    memset (&ev, 0, sizeof (ev));
+
+    ev.events   = EPOLLIN;
+    ev.data.u32 = tag;
+
+    return epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * Tick once a second, and receive in between, until a signal arrives or 'q'
+ * is pressed.
+ */
+static int
+run (struct mbs *fleet, const char *address, uint64_t budget,
+     uint64_t timeout)
+{
+    const struct itimerspec its = { { 1, 0 }, { 0, 1 } };
+    sigset_t signals;
+    int epfd = -1, sigfd = -1, timer = -1, recvfd, status = EXIT_FAILURE;
+    size_t hosts = 0;
+    bool loop = true, redraw = true;
+
+    if (-1 == (recvfd = listen_batches (address)))
+    {
+        fprintf (stderr, "Error listening on '%s': %s\n", address,
+                 strerror (errno));
+        return EXIT_FAILURE;
+    }
+
+    sigemptyset (&signals);
+    sigaddset (&signals, SIGINT);
+    sigaddset (&signals, SIGTERM);
+    sigaddset (&signals, SIGHUP);
+    sigaddset (&signals, SIGWINCH);
+
+    sigprocmask (SIG_BLOCK, &signals, NULL);
+
+    if (-1 == (epfd = epoll_create1 (EPOLL_CLOEXEC))
+     || -1 == (sigfd = signalfd (-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC))
+     || -1 == (timer = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC))
+     || -1 == timerfd_settime (timer, 0, &its, NULL)
+     || -1 == watch (epfd, timer, EVENT_TIMER)
+     || -1 == watch (epfd, sigfd, EVENT_SIGNAL)
+     || -1 == watch (epfd, recvfd, EVENT_RECEIVE))
+    {
+        perror ("epoll");
+        goto done;
+    }
+
+    if (!(fleet->flags & FLAG_DAEMON))
+    {
+        if (-1 == window_open (fleet))
+        {
+            fprintf (stderr, "Error initialising ncurses.\n");
+            goto done;
+        }
+
+        watch (epfd, fileno (stdin), EVENT_STDIN);
+    }
+
+    while (loop)
+    {
+        struct epoll_event events[4];
+        struct signalfd_siginfo si;
+        struct stats delta;
+        uint64_t expirations;
+        bool tick = false;
+        int n;
+
+        if (-1 == (n = epoll_wait (epfd, events, 4, -1)))
+            continue;
+
+        while (n-- > 0)
+        {
+            switch (events[n].data.u32)
+            {
+            case EVENT_TIMER:
+                tick = sizeof (expirations) == read (
+                    timer, &expirations, sizeof (expirations));
+                break;
+
+            case EVENT_STDIN:
+                if (window_read_keys () & WINDOW_QUIT)
+                    loop = false;
+
+                if (events[n].events & (EPOLLHUP | EPOLLERR))
+                    epoll_ctl (epfd, EPOLL_CTL_DEL, fileno (stdin), NULL);
+                break;
+
+            case EVENT_SIGNAL:
+                while (sizeof (si) == read (sigfd, &si, sizeof (si)))
+                {
+                    if (SIGWINCH != si.ssi_signo)
+                        loop = false;
+                    else if (!(fleet->flags & FLAG_DAEMON))
+                        window_resize ();
+                }
+                break;
+
+            case EVENT_RECEIVE:
+                receive (fleet, mbs_now ());
+                break;
+            }
+        }
+
+        if (!loop || !tick)
+            continue;
+
+        collect_update (fleet, budget, mbs_now (), timeout, &delta);
+
+        if (fleet->flags & FLAG_DAEMON)
+        {
+            for (; hosts < fleet->n_ifaces; ++hosts)
+                fprintf (stderr, "New host: %s\n", fleet->ifaces[hosts].name);
+
+            if (redraw || delta.tx_bytes || delta.rx_bytes)
+                status_line (fleet);
+
+            redraw = delta.tx_bytes || delta.rx_bytes;
+            continue;
+        }
+
+        /* A row for each host, so the window grows as they turn up */
+        if (hosts != fleet->n_ifaces)
+        {
+            window_close (fleet);
+
+            if (-1 == window_open (fleet))
+            {
+                fprintf (stderr, "Error initialising ncurses.\n");
+                goto done;
+            }
+
+            hosts = fleet->n_ifaces;
+        }
+
+        draw_window (fleet, !!delta.tx_bytes, !!delta.rx_bytes);
+    }
+
+    status = EXIT_SUCCESS;
+
+done:
+    if (!(fleet->flags & FLAG_DAEMON))
+        window_close (fleet);
+
+    status_line_end ();
+
+    if (-1 != timer)
+        close (timer);
+
+    if (-1 != sigfd)
+        close (sigfd);
+
+    if (-1 != epfd)
+        close (epfd);
+
+    return status;
+}
+
+int
+collect_main (int argc, char *argv[])
+{
+    struct arg_lit *help,
+                   *ascii,
+                   *daemon,
+                   *si;
+    struct arg_str *listen,
+                   *key_file,
+                   *available;
+    struct arg_int *timeout;
+    struct arg_end *end;
+
+    struct mbs fleet;
+    uint64_t budget = 0;
+    int nerrors, status = EXIT_FAILURE;
+    const char command[] = "mbs collect";
+
+    void *argtable[] =
+    {
+        help = arg_litn (
+            NULL, "help",
+            0, 1, "display this help and exit"
+        ),
+        listen = arg_strn (
+            NULL, "listen", "<[address:]port>",
+            0, 1, "where to receive batches, on UDP and TCP (default: "
+                  "127.0.0.1:7665, or * for any address)"
+        ),
+        key_file = arg_strn (
+            NULL, "key", "<path>",
+            0, 1, "only accept batches signed with the key in this file"
+        ),
+        available = arg_strn (
+            "a", "available", "<amount>",
+            0, 1, "data available to the whole fleet"
+        ),
+        timeout = arg_intn (
+            NULL, "timeout", "<sec>",
+            0, 1, "show hosts not heard from in this long as gone (default: 10)"
+        ),
+        ascii = arg_litn (
+            NULL, "ascii",
+            0, 1, "disable non-ascii unicode characters"
+        ),
+        daemon = arg_litn (
+            "d", "daemon",
+            0, 1, "print a line of status on every update, instead"
+        ),
+        si = arg_litn (
+            NULL, "si",
+            0, 1, "show amounts in powers of 1000 rather than 1024"
+        ),
+        end = arg_end (20),
+    };
+
+    nerrors = arg_parse (argc, argv, argtable);
+
+    if (help->count > 0)
+    {
+        printf ("Usage: %s", command);
+        arg_print_syntax (stdout, argtable, "\n");
+        printf ("Combine the usage reported by mbs --collector on many hosts, "
+            "against a fleet budget.\n\n");
+        arg_print_glossary (stdout, argtable, "  %-25s %s\n");
+        arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+        return EXIT_SUCCESS;
+    }
+
+    if (nerrors > 0)
+    {
+        arg_print_errors (stdout, end, command);
+        printf ("Try '%s --help' for more information.\n", command);
+        goto done;
+    }
+
+    if (timeout->count > 0 && *timeout->ival < 1)
+    {
+        fprintf (stderr, "The timeout must be at least a second.\n");
+        goto done;
+    }
+
+    if (available->count > 0 && -1 == parse_bytes (*available->sval, &budget))
+        goto done;
+
+    if (key_file->count > 0 && -1 == collect_set_key (*key_file->sval))
+    {
+        fprintf (stderr, "Error reading key from '%s': %s\n",
+                 *key_file->sval, strerror (errno));
+        goto done;
+    }
+
+    memset (&fleet, 0, sizeof (fleet));
+
+    fleet.nl_fd = -1;
+    fleet.flags = FLAG_FLEET;
+
+    if (available->count > 0)
+        fleet.flags |= FLAG_COUNTDOWN;
+
+    if (ascii->count > 0)
+        fleet.flags |= FLAG_ASCII;
+
+#ifdef HAVE_CURSES
+    if (daemon->count > 0)
+        fleet.flags |= FLAG_DAEMON;
+#else
+    fleet.flags |= FLAG_DAEMON;
+#endif
+
+    mbs_set_units (si->count ? MBS_UNITS_SI : MBS_UNITS_IEC);
+    rate_init (&fleet.rates, RATE_DEFAULT_TAU, RATE_DEFAULT_AVG_TAU);
+
+    fleet.balance = budget;
+
+    status = run (&fleet, listen->count ? *listen->sval : "", budget,
+                  (timeout->count ? *timeout->ival : COLLECT_DEFAULT_TIMEOUT)
+                  * 1000000000ULL);
+
+    mbs_cleanup (&fleet);
+
+done:
+    arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+
+    return status;
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file collect.h
+ * @brief Reporting usage to a collector (`--collector=<address>`), and the
+ *        `mbs collect` command, which combines what many hosts report into
+ *        per-host and fleet-wide totals, against a shared budget.
+ *
+ * Each tick of a reporting instance becomes a sample: the milliseconds since
+ * the previous one, and the data sent and received in between. Samples are
+ * sent in batches, at least once a second, over UDP (the default) or TCP. A
+ * batch is one frame, with all integers as varints (see \ref codec.h):
+ *
+ * | Field      | Contents                                                    |
+ * |------------|-------------------------------------------------------------|
+ * | length     | Length of the rest of the frame.                            |
+ * | magic      | `MBC` and the version, \ref COLLECT_VERSION.                 |
+ * | session    | Start time in ms, shifted up 20 bits, above random bits.    |
+ * | name       | Length and bytes of the host name.                          |
+ * | seq        | Number of samples sent before this batch in the session.    |
+ * | base       | TX and RX used in the session, before the first sample.     |
+ * | samples    | Count, then `<ms> <tx> <rx>` for each sample.               |
+ * | trailer    | Of everything after the length: see below.                  |
+ *
+ * Without a key, the trailer is a CRC-32, four bytes, little-endian. With a
+ * shared key (`--collector-key=<path>` on the hosts, `--key=<path>` on the
+ * collector), the magic is `MBK` instead, and the trailer is the first
+ * \ref COLLECT_TAG_LEN bytes of an HMAC-SHA-256 under the key; the collector
+ * ignores frames which were not signed with it. A frame which is replayed
+ * adds nothing, since totals only ever move forward, and a session never
+ * goes back to an earlier one.
+ *
+ * The collector listens on the loopback address only, unless it is given
+ * another one (or `*`, for any). Since the frames are not encrypted, a key is
+ * the only thing that keeps other machines on the network from reporting
+ * usage.
+ *
+ * On TCP, frames follow each other on the stream; over UDP, each datagram
+ * holds one. Since every batch starts from the session totals, a batch which
+ * is lost (or a connection which drops) only loses detail: the next one still
+ * brings the totals up to date. A new session means that the instance was
+ * restarted, and its totals start from zero again; what the host had used
+ * before is kept. Hosts are told apart by name alone. Since later runs have
+ * larger sessions, the new session replaces the old one, and batches of any
+ * earlier session are ignored if they arrive late. A host whose clock is set
+ * back across a restart is ignored until it catches up.
+ *
+ * The collector shows the hosts as the rows of the usual terminal interface,
+ * under the fleet totals. The rates are the sums of those of the hosts, which
+ * are computed from the samples, on the clocks of the hosts. A host which has
+ * not been heard from in a while is shown as gone, but its usage still
+ * counts.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef COLLECT_H
+#define COLLECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mbs.h"
+
+/**
+ * @brief Version in the magic of each frame.
+ */
+#define COLLECT_VERSION 1
+
+/**
+ * @brief Size of a buffer which can hold a host name, including the
+ *        terminating null character.
+ */
+#define COLLECT_NAME_MAX 64
+
+/**
+ * @brief Longest shared key, in bytes.
+ */
+#define COLLECT_KEY_MAX 256
+
+/**
+ * @brief Length of the authentication tag of a frame signed with a key, in
+ *        bytes.
+ */
+#define COLLECT_TAG_LEN 16
+
+/**
+ * @brief Largest number of samples in a batch.
+ */
+#define COLLECT_BATCH 32
+
+/**
+ * @brief Longest that a sample waits before it is sent, in milliseconds.
+ */
+#define COLLECT_FLUSH_MS 1000
+
+/**
+ * @brief Size of a buffer which can hold any frame, which also fits in a
+ *        single UDP datagram without fragmentation.
+ */
+#define COLLECT_FRAME_MAX 1100
+
+/**
+ * @brief Largest number of hosts a collector keeps track of.
+ */
+#define COLLECT_MAX_HOSTS 1024
+
+/**
+ * @brief Largest number of TCP connections a collector accepts at the same
+ *        time.
+ */
+#define COLLECT_MAX_CONNS 256
+
+/**
+ * @brief Default port, for both UDP and TCP.
+ */
+#define COLLECT_DEFAULT_PORT 7665
+
+/**
+ * @brief Default number of seconds after which a host which has not been
+ *        heard from is shown as gone.
+ */
+#define COLLECT_DEFAULT_TIMEOUT 10
+
+/**
+ * @brief One tick of a reporting instance.
+ */
+struct collect_sample
+{
+    /**
+     * @brief Milliseconds since the previous sample.
+     */
+    uint32_t ms;
+
+    /**
+     * @brief Data sent and received since the previous sample.
+     */
+    uint64_t tx, rx;
+};
+
+/**
+ * @brief The contents of a frame.
+ */
+struct collect_batch
+{
+    uint64_t session;
+    char name[COLLECT_NAME_MAX];
+    uint64_t seq;
+    uint64_t base_tx, base_rx;
+    unsigned int n;
+    struct collect_sample samples[COLLECT_BATCH];
+};
+
+/**
+ * @brief Sign the frames that are encoded, and only accept those which are
+ *        signed, with a shared key, until \ref collect_close.
+ *
+ * @param  path A file holding the key, of at most \ref COLLECT_KEY_MAX
+ *              bytes. A line break at the end is not part of it.
+ * @return      0 on success, or -1 if the file could not be read, or the key
+ *              is empty or too long (`EINVAL`), in which case `errno` is set.
+ */
+int collect_set_key (const char *path);
+
+/**
+ * @brief Encode a batch as a frame.
+ *
+ * @param  b   The batch, whose name must not be empty.
+ * @param  buf A buffer of at least \ref COLLECT_FRAME_MAX bytes.
+ * @return     The length of the frame.
+ */
+size_t collect_encode (const struct collect_batch *b, uint8_t *buf);
+
+/**
+ * @brief Decode the frame at the start of \a buf.
+ *
+ * @param  buf The input.
+ * @param  len Length of the input.
+ * @param  b   Receives the batch.
+ * @return     The length of the frame, 0 if the input ends before it does, or
+ *             -1 if it is not a valid frame (the checksum or signature does
+ *             not match, the name is not printable, or the totals overflow),
+ *             in which case `errno` is set to `EPROTO`.
+ */
+int collect_decode (const uint8_t *buf, size_t len, struct collect_batch *b);
+
+/**
+ * @brief Start reporting to a collector.
+ *
+ * @param  address `[udp://|tcp://]<host>[:<port>]`, where the host may be a
+ *                 name, or an address (in brackets, for IPv6).
+ * @param  name    The name to report as.
+ * @param  s       An \ref mbs struct holding application state and
+ *                 configuration settings. Usage from before this call (with
+ *                 `--persistent`, from earlier runs) is not reported: the
+ *                 batches carry the totals of the session.
+ * @return         0 on success, or -1 if the address is invalid or cannot be
+ *                 resolved, in which case `errno` is set. Failing to reach the
+ *                 collector is not an error; the batches are dropped until it
+ *                 can be reached.
+ */
+int collect_open (const char *address, const char *name, const struct mbs *s);
+
+/**
+ * @brief Add a sample of the current usage to the batch, and send the batch
+ *        if it is full, or its first sample is \ref COLLECT_FLUSH_MS old.
+ *        Does nothing unless \ref collect_open was called. Never blocks.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @return Nothing
+ */
+void collect_sample (const struct mbs *s);
+
+/**
+ * @brief Merge a batch into the fleet, whose interfaces are the hosts. A host
+ *        which has not been seen before is added.
+ *
+ * @param  fleet The fleet.
+ * @param  b     The batch.
+ * @param  now   The time of arrival, in nanoseconds on the monotonic clock.
+ * @return       0 on success, or -1 if the host could not be added, in which
+ *               case `errno` is set (`ENOSPC` if there are already
+ *               \ref COLLECT_MAX_HOSTS hosts).
+ */
+int collect_merge (struct mbs *fleet, const struct collect_batch *b,
+                   uint64_t now);
+
+/**
+ * @brief Bring the fleet totals, balance and rates up to date, and mark the
+ *        hosts which have not been heard from in \a timeout as gone.
+ *
+ * @param  fleet   The fleet.
+ * @param  budget  The fleet budget, used with \ref FLAG_COUNTDOWN.
+ * @param  now     The current time, in nanoseconds on the monotonic clock.
+ * @param  timeout How long a host may stay silent, in nanoseconds.
+ * @param  delta   Receives the data used since the previous update.
+ * @return Nothing
+ */
+void collect_update (struct mbs *fleet, uint64_t budget, uint64_t now,
+                     uint64_t timeout, struct stats *delta);
+
+/**
+ * @brief Send what is left of the batch, stop reporting, and forget the
+ *        hosts merged so far, and the key.
+ *
+ * @return Nothing
+ */
+void collect_close (void);
+
+/**
+ * @brief Run the `mbs collect` command.
+ *
+ * @param  argc Number of arguments, starting with `collect`.
+ * @param  argv The arguments.
+ * @return      The exit status.
+ */
+int collect_main (int argc, char *argv[]);
+
+#endif
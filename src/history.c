@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "codec.h"
+#include "history.h"
+#include "mbs.h"
+
+#define HEADER_SIZE offsetof (struct history_block, data)
+
+/* Longest encoding of a sample */
+#define SAMPLE_MAX (3 * CODEC_VARINT_MAX)
+
+/*
+ * Decoding state of a block: the last sample read, and the time between it
+ * and the one before. The writer keeps the same state for the samples it has
+ * encoded.
+ */
+struct cursor
+{
+    const uint8_t *p, *end;
+    unsigned int n;
+    unsigned int count;
+    struct history_sample x;
+    int64_t delta;
+};
+
+static int fd = -1;
+static off_t offset;
+static struct history_block block;
+static struct cursor last;
+
+static struct history_sample pending;
+static bool has_pending = false;
+
+static bool dirty = false;
+static uint64_t written = 0;
+static uint64_t sync_ns = 0;
+
+static uint32_t
+checksum (const struct history_block *b)
+{
+    const size_t skip = offsetof (struct history_block, version);
+    const uint32_t crc = codec_crc32 (
+        0, (const uint8_t *) b + skip, HEADER_SIZE - skip);
+
+    return codec_crc32 (crc, b->data, b->length);
+}
+
+static bool
+block_valid (const struct history_block *b)
+{
+    return HISTORY_MAGIC == b->magic
+        && HISTORY_VERSION == b->version
+        && b->count > 0
+        && b->length <= sizeof (b->data)
+        && checksum (b) == b->checksum;
+}
+
+static void
+cursor_init (struct cursor *c, const struct history_block *b)
+{
+    memset (c, 0, sizeof (*c));
+
+    c->p = b->data;
+    c->end = b->data + b->length;
+    c->count = b->count;
+    c->x.time = b->first;
+}
+
+/*
+ * Decode the next sample of a block into c->x. Returns 1 if there was one,
+ * 0 at the end of the block, and -1 if the block is malformed.
+ */
+static int
+cursor_next (struct cursor *c)
+{
+    uint64_t dod = 0, tx, rx;
+    size_t len;
+
+    if (c->n == c->count)
+        return 0;
+
+    /* The first sample's time is in the header */
+    if (c->n > 0)
+    {
+        if (0 == (len = codec_get_varint (c->p, c->end, &dod)))
+            return -1;
+
+        c->p += len;
+        c->delta += codec_unzigzag (dod);
+        c->x.time += c->delta;
+    }
+
+    if (0 == (len = codec_get_varint (c->p, c->end, &tx)))
+        return -1;
+
+    c->p += len;
+
+    if (0 == (len = codec_get_varint (c->p, c->end, &rx)))
+        return -1;
+
+    c->p += len;
+    c->x.tx_bytes += codec_unzigzag (tx);
+    c->x.rx_bytes += codec_unzigzag (rx);
+    c->n++;
+
+    return 1;
+}
+
+static void
+start_block (void)
+{
+    memset (&block, 0, sizeof (block));
+
+    block.magic = HISTORY_MAGIC;
+    block.version = HISTORY_VERSION;
+
+    cursor_init (&last, &block);
+}
+
+/*
+ * Write the block to its slot, after a spare copy to the slot following it.
+ * A crash which tears one of the two writes leaves the other intact.
+ */
+static int
+write_block (void)
+{
+    block.checksum = checksum (&block);
+    block.magic = HISTORY_SPARE_MAGIC;
+
+    if ((ssize_t) sizeof (block) != pwrite (fd, &block, sizeof (block),
+                                            offset + (off_t) sizeof (block)))
+    {
+        block.magic = HISTORY_MAGIC;
+        return -1;
+    }
+
+    block.magic = HISTORY_MAGIC;
+
+    if ((ssize_t) sizeof (block) != pwrite (fd, &block, sizeof (block), offset))
+        return -1;
+
+    dirty = false;
+    written = mbs_now ();
+
+    return 0;
+}
+
+static int
+encode (const struct history_sample *x)
+{
+    uint8_t buf[SAMPLE_MAX], *p = buf;
+    int64_t delta = 0;
+
+    if (block.count > 0)
+    {
+        delta = x->time - last.x.time;
+        p += codec_put_varint (p, codec_zigzag (delta - last.delta));
+    }
+
+    p += codec_put_varint (p, codec_zigzag (x->tx_bytes - last.x.tx_bytes));
+    p += codec_put_varint (p, codec_zigzag (x->rx_bytes - last.x.rx_bytes));
+
+    if (block.length + (size_t) (p - buf) > sizeof (block.data)
+     || UINT16_MAX == block.count)
+    {
+        if (-1 == write_block ())
+            return -1;
+
+        offset += sizeof (block);
+        start_block ();
+
+        /* Encoded relative to nothing, as the first sample of the block */
+        return encode (x);
+    }
+
+    if (0 == block.count)
+        block.first = x->time;
+
+    memcpy (block.data + block.length, buf, p - buf);
+
+    block.length += p - buf;
+    block.last = x->time;
+    block.count++;
+
+    last.x = *x;
+    last.delta = delta;
+    dirty = true;
+
+    return 0;
+}
+
+int
+history_open (const char *path, unsigned int sync_interval)
+{
+    struct history_block spare;
+    struct stat st;
+    int err;
+
+    if (-1 == (fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)))
+        return -1;
+
+    if (-1 == fstat (fd, &st))
+        goto fail;
+
+    if (st.st_size > 0)
+    {
+        uint32_t magic[2] = { 0, 0 };
+
+        if (-1 == pread (fd, &magic[0], sizeof (magic[0]), 0)
+         || -1 == pread (fd, &magic[1], sizeof (magic[1]), sizeof (block)))
+            goto fail;
+
+        /* The first block may be missing if only its spare was written */
+        if (HISTORY_MAGIC != magic[0] && HISTORY_SPARE_MAGIC != magic[1])
+        {
+            errno = EPROTO;
+            goto fail;
+        }
+    }
+
+    /* A partial block at the end was never completely written */
+    offset = st.st_size - st.st_size % sizeof (block);
+
+    start_block ();
+    dirty = false;
+
+    if (offset > 0)
+    {
+        offset -= sizeof (block);
+
+        if ((ssize_t) sizeof (block) != pread (fd, &block, sizeof (block),
+                                               offset))
+            goto fail;
+
+        /*
+         * The last slot normally holds the spare of the block before it. If
+         * that block was torn, or its latest write never happened, the spare
+         * takes its place.
+         */
+        if (HISTORY_SPARE_MAGIC == block.magic && offset > 0)
+        {
+            spare = block;
+            spare.magic = HISTORY_MAGIC;
+            offset -= sizeof (block);
+
+            if ((ssize_t) sizeof (block) != pread (fd, &block, sizeof (block),
+                                                   offset))
+                goto fail;
+
+            if (block_valid (&spare)
+             && (!block_valid (&block)
+              || (block.first == spare.first && block.count < spare.count)))
+            {
+                block = spare;
+                dirty = true;
+            }
+        }
+
+        /*
+         * Carry on filling the last block, after catching up with its
+         * encoding state. If it is damaged, it is overwritten.
+         */
+        if (block_valid (&block))
+        {
+            cursor_init (&last, &block);
+
+            while (1 == cursor_next (&last))
+                ;
+
+            if (last.n != block.count)
+                start_block ();
+        }
+        else
+        {
+            start_block ();
+        }
+    }
+
+    has_pending = false;
+    written = mbs_now ();
+    sync_ns = sync_interval * 1000000000ULL;
+
+    return 0;
+
+fail:
+    err = errno;
+    close (fd);
+    fd = -1;
+    errno = err;
+
+    return -1;
+}
+
+void
+history_append (uint64_t time, uint64_t tx_bytes, uint64_t rx_bytes)
+{
+    if (-1 == fd || (0 == tx_bytes && 0 == rx_bytes))
+        return;
+
+    if (has_pending && pending.time == time)
+    {
+        pending.tx_bytes += tx_bytes;
+        pending.rx_bytes += rx_bytes;
+        return;
+    }
+
+    if (has_pending)
+        encode (&pending);
+
+    pending.time = time;
+    pending.tx_bytes = tx_bytes;
+    pending.rx_bytes = rx_bytes;
+    has_pending = true;
+}
+
+int
+history_sync (void)
+{
+    if (-1 == fd || (!dirty && !has_pending)
+     || mbs_now () - written < sync_ns)
+        return 0;
+
+    if (has_pending)
+    {
+        has_pending = false;
+
+        if (-1 == encode (&pending))
+            return -1;
+    }
+
+    return write_block ();
+}
+
+int
+history_close (void)
+{
+    int ret = 0;
+
+    if (-1 == fd)
+        return 0;
+
+    if (has_pending && -1 == encode (&pending))
+        ret = -1;
+    else if (dirty && -1 == write_block ())
+        ret = -1;
+
+    close (fd);
+
+    fd = -1;
+    has_pending = false;
+
+    return ret;
+}
+
+long
+history_scan (const char *path, uint64_t from, uint64_t to,
+              history_fn fn, void *arg)
+{
+    const size_t size = HISTORY_SCAN_BLOCKS * sizeof (struct history_block);
+    struct history_block *blocks;
+    struct cursor c;
+    long count = 0;
+    ssize_t len;
+    size_t i;
+    int in, err;
+
+    if (-1 == (in = open (path, O_RDONLY | O_CLOEXEC)))
+        return -1;
+
+    if (NULL == (blocks = malloc (size)))
+    {
+        close (in);
+        return -1;
+    }
+
+    posix_fadvise (in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    while ((len = read (in, blocks, size)) > 0)
+    {
+        /* Regular files are only read short at the end */
+        for (i = 0; i < len / sizeof (struct history_block); ++i)
+        {
+            const struct history_block *b = &blocks[i];
+
+            if (b->last < from || b->first >= to || !block_valid (b))
+                continue;
+
+            cursor_init (&c, b);
+
+            while (1 == cursor_next (&c))
+            {
+                if (c.x.time < from || c.x.time >= to)
+                    continue;
+
+                count++;
+
+                if (0 != fn (&c.x, arg))
+                    goto done;
+            }
+        }
+    }
+
+done:
+    err = errno;
+    free (blocks);
+    close (in);
+
+    if (len < 0)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return count;
+}
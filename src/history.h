@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file history.h
+ * @brief An append-only log of how much data was transferred, and when
+ *        (`--history=<path>`).
+ *
+ * Each sample holds the number of bytes sent and received during one second
+ * of wall-clock time. Seconds in which nothing was transferred are not
+ * recorded, so an idle link costs nothing.
+ *
+ * The log is a sequence of fixed-size blocks. Each block starts with a header
+ * holding the time of its first and last sample, and a CRC-32. The samples
+ * follow, as varints: the timestamp as a zigzag-encoded delta of deltas, and
+ * the TX and RX amounts as zigzag-encoded deltas from the previous sample.
+ * With the link busy every second, a sample usually takes a few bytes. Every
+ * block can be decoded on its own, and a scan skips blocks outside the
+ * requested range without decoding them.
+ *
+ * The block being filled is kept in memory, and written out when it is full,
+ * at most every `--sync-interval` seconds, and on exit. Each write of a block
+ * is preceded by a spare copy in the slot after it, which readers skip, and
+ * which the next block overwrites. A block which was torn by a crash fails its
+ * checksum; readers skip it, and \ref history_open recovers it from the
+ * spare, so that only the samples since the last write are lost.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+/**
+ * @brief Value of \ref history_block::magic ("MBSH").
+ */
+#define HISTORY_MAGIC 0x4853424d
+
+/**
+ * @brief Value of \ref history_block::magic in the spare copy of the last
+ *        block ("MBSh").
+ */
+#define HISTORY_SPARE_MAGIC 0x6853424d
+
+/**
+ * @brief Layout version; bumped whenever the block format changes.
+ */
+#define HISTORY_VERSION 1
+
+/**
+ * @brief Size of a block in the file, in bytes.
+ */
+#define HISTORY_BLOCK_SIZE 4096
+
+/**
+ * @brief Number of blocks read at a time by \ref history_scan.
+ */
+#define HISTORY_SCAN_BLOCKS 64
+
+/**
+ * @brief Data transferred during one second.
+ */
+struct history_sample
+{
+    /**
+     * @brief Wall-clock time, in seconds since the epoch.
+     */
+    uint64_t time;
+
+    /**
+     * @brief Number of bytes sent and received.
+     */
+    uint64_t tx_bytes, rx_bytes;
+};
+
+/**
+ * @brief A block of the log, as stored on disk (in host byte order).
+ */
+struct history_block
+{
+    /**
+     * @brief \ref HISTORY_MAGIC, or \ref HISTORY_SPARE_MAGIC in a spare.
+     */
+    uint32_t magic;
+
+    /**
+     * @brief CRC-32 of the rest of the header, and the first \ref length
+     *        bytes of \ref data.
+     */
+    uint32_t checksum;
+
+    /**
+     * @brief Always \ref HISTORY_VERSION.
+     */
+    uint16_t version;
+
+    /**
+     * @brief Number of samples in the block.
+     */
+    uint16_t count;
+
+    /**
+     * @brief Number of bytes used in \ref data.
+     */
+    uint32_t length;
+
+    /**
+     * @brief Times of the first and last sample.
+     */
+    uint64_t first, last;
+
+    /**
+     * @brief The encoded samples.
+     */
+    uint8_t data[HISTORY_BLOCK_SIZE - 32];
+};
+
+/**
+ * @brief Called by \ref history_scan for each sample.
+ *
+ * @param  sample The sample.
+ * @param  arg    The argument given to \ref history_scan.
+ * @return        0 to continue the scan, or anything else to stop it.
+ */
+typedef int (*history_fn) (const struct history_sample *sample, void *arg);
+
+/**
+ * @brief Open the log for writing, creating it if it does not exist. If the
+ *        last block has room left, new samples are added to it. If it was
+ *        torn, it is first recovered from its spare.
+ *
+ * @param  path          Location of the log.
+ * @param  sync_interval Minimum number of seconds between writes of a block
+ *                       which is not yet full.
+ * @return               0 on success, or -1 if the file could not be opened
+ *                       or is not a history log, in which case `errno` is
+ *                       set.
+ */
+int history_open (const char *path, unsigned int sync_interval);
+
+/**
+ * @brief Record data transferred at the given time. Amounts which fall in the
+ *        same second are added up into one sample.
+ *
+ * @param  time     Wall-clock time, in seconds since the epoch.
+ * @param  tx_bytes Number of bytes sent.
+ * @param  rx_bytes Number of bytes received.
+ * @return Nothing
+ */
+void history_append (uint64_t time, uint64_t tx_bytes, uint64_t rx_bytes);
+
+/**
+ * @brief Write out the block being filled, if it has changed and the sync
+ *        interval has passed since it was last written. This is cheap to
+ *        call on every tick.
+ *
+ * @return 0 on success, or -1 if the write failed.
+ */
+int history_sync (void);
+
+/**
+ * @brief Write out any pending samples and close the log. The log is closed
+ *        even if the write fails.
+ *
+ * @return 0 on success, or -1 if the write failed.
+ */
+int history_close (void);
+
+/**
+ * @brief Read the samples in a time range, in the order they were recorded.
+ *
+ * @param  path Location of the log.
+ * @param  from Start of the range (inclusive).
+ * @param  to   End of the range (exclusive).
+ * @param  fn   Called for each sample in the range.
+ * @param  arg  Passed on to \a fn.
+ * @return      The number of samples passed to \a fn, or -1 if the log
+ *              could not be read, in which case `errno` is set.
+ */
+long history_scan (const char *path, uint64_t from, uint64_t to,
+                   history_fn fn, void *arg);
+
+#endif
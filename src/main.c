@@ -60,15 +60,33 @@
  * make test
  * @endcode 
  *
+ * The terminal interface is optional. To build without ncurses, configure
+ * with `cmake -DWITH_CURSES=OFF ..`. Such a build always runs as if
+ * `--daemon` was given.
+ *
+ * The `mbs_bench` executable times the hot paths (polling, parsing and
+ * formatting amounts, drawing the window and saving the stats file), and
+ * reports the time, allocations and system calls per iteration. With
+ * `--json`, it prints one JSON object per benchmark.
+ *
  * @section Usage
  *
  * @code
- * mbs [-vkp] [--help] [--version] [--ascii] [-a <amount>] [--statsfile=<path>] [<interface>]
+ * mbs [-vkpd] [--help] [--version] [--ascii] [--si] [--status-line] [--self-stats] [--processes] [-a <amount>] [--statsfile=<path>] [--sync-interval=<sec>] [--history=<path>] [--rollups=<path>] [--record=<path>] [--socket=<path>] [--shm=<name>] [--metrics-port=<port>] [--collector=<address>] [--host-name=<name>] [--collector-key=<path>] [--source=<name>] [--speed=<factor>] [--netns] [--interval=<ms>] [--min-interval=<ms>] [--max-interval=<ms>] [--rate-window=<sec>] [--average-window=<sec>] [<interface>...]
  * @endcode
  *
  * If no `<interface>` is given, the program will try to automatically find an
  * active network interface (excluding `lo`).
  *
+ * Several interfaces, or shell-style glob patterns (e.g., `'wlan*'`), can be
+ * given. Their usage is then combined and charged against the same budget,
+ * with a per-interface breakdown shown below the totals. The command keeps
+ * running as long as at least one of them is present.
+ *
+ * Interfaces are followed through renames, and marked as down, gone, or back as
+ * soon as the kernel reports it. The command exits cleanly on `SIGINT`, `SIGTERM`
+ * or `SIGHUP`.
+ *
  * @subsection Examples
  *
  * Specify the amount of data available using the `--available` (`-a`) flag to
@@ -108,6 +126,81 @@
  * The stats file's location can be set using the `--statsfile=<path>` flag. If
  * this flag is not provided, then `$HOME/.mbs` is used as default path.
  *
+ * Besides the totals, the window shows the current and average TX and RX
+ * rates, which are exponentially weighted moving averages with time constants
+ * of 2 and 60 seconds (see `--rate-window` and `--average-window`). With
+ * `--available`, it also shows how long the balance lasts at the average rate.
+ * With `--verbose`, the rates are also printed on exit.
+ *
+ * Under the totals, a graph shows the TX and RX rates of the last 62 ticks
+ * (60 with `--ascii`), newest to the right. Each row is scaled to its peak
+ * rate, which is given next to it, so a burst of background traffic stands
+ * out even when the link is otherwise quiet.
+ *
+ * The stats file is a small binary file, which is mapped into memory and
+ * updated in place (see \ref statsfile.h). It is flushed to disk at most every
+ * `--sync-interval` seconds, and on exit. A stats file in the old text format
+ * is converted the first time it is opened.
+ *
+ * @subsection history Usage history
+ *
+ * With `--history=<path>`, the command also keeps a log of how much data was
+ * sent and received during each second, in compressed blocks which are
+ * written at most every `--sync-interval` seconds (see \ref history.h).
+ * Seconds in which nothing was transferred are left out.
+ *
+ * @subsection status Status bars
+ *
+ * With `--status-line`, the command runs without the terminal interface (and
+ * without initializing ncurses), and prints a single line of status on every
+ * update, for status bars which read a stream of lines (see \ref status.h).
+ *
+ * @subsection selfstats Self statistics
+ *
+ * With `--self-stats`, the command prints what it has itself cost on exit: a
+ * histogram of how long each phase of an update took, CPU time, and system
+ * calls and allocations per update (see \ref selfstats.h). Pressing `s` in the
+ * terminal interface shows the same figures live.
+ *
+ * @subsection processes Processes
+ *
+ * With `--processes`, the traffic is split between the processes which own
+ * sockets, in proportion to what they read and write (see \ref procnet.h).
+ * This is an estimate. The busiest processes are shown in the terminal
+ * interface, and all of them are printed on exit.
+ *
+ * @subsection reports Reports
+ *
+ * With `--rollups=<path>`, the command keeps running totals per minute, hour,
+ * day and month (see \ref rollup.h). The `report` command answers questions
+ * about past usage from them:
+ *
+ * @code
+ * mbs report --rollups=<path> [--since=<when>] [--until=<when>] [--billing-day=<day>] [--by=<level>] [--top=<n>] [--bytes] [--si]
+ * @endcode
+ *
+ * For instance, `mbs report --rollups=<path> --since=-7d --by=hour --top=10`
+ * lists the ten busiest hours of the last week. Without `--since`, the range
+ * starts at the beginning of the billing month.
+ *
+ * @subsection fleets Fleets
+ *
+ * With `--collector=[udp://|tcp://]<host>[:<port>]`, the command also reports
+ * its usage to a collector, in small batches (see \ref collect.h). The
+ * `collect` command is the collector: it combines what every host reports into
+ * per-host and fleet-wide totals, against a shared budget:
+ *
+ * @code
+ * mbs collect [-d] [--listen=<[address:]port>] [--key=<path>] [-a <amount>] [--timeout=<sec>] [--ascii] [--si]
+ * @endcode
+ *
+ * @subsection daemon Running as a service
+ *
+ * With `--daemon` (`-d`), the command does the same sampling, accounting and
+ * persisting, but without a terminal interface. It runs in the foreground and
+ * logs to stderr, which makes it a good fit for a systemd unit. The process
+ * exits on `SIGTERM`, after saving its state to the stats file.
+ *
  * @section Flags
  *
  * | Flag             | Short option   | Description                             |
@@ -116,10 +209,38 @@
  * | `--version`      |                | Display version info and exit.          |
  * | `--verbose`      | `-v`           | Render verbose output.                  |
  * | `--ascii`        |                | Disable non-ascii Unicode characters.   |
+ * | `--si`           |                | Show amounts in powers of 1000 rather than 1024. |
  * | `--keep-running` | `-k`           | Do not exit when data limit is exceeded or connection is lost. |
  * | `--persistent`   | `-p`           | Continue from where last session ended. |
+ * | `--daemon`       | `-d`           | Run without a terminal interface, e.g., as a service. |
+ * | `--status-line`  |                | Print a line of status on every update, for status bars (see \ref status.h). |
+ * | `--self-stats`   |                | Print what the command itself has cost on exit (see \ref selfstats.h). |
+ * | `--processes`    |                | Estimate which processes the traffic is for (see \ref procnet.h). |
  * | `--available`    | `-a`           | Amount of data available to use in your subscription plan or budget. |
  * | `--statsfile`    |                | Override default stats file path.       |
+ * | `--sync-interval` |               | Seconds between flushes of the stats file to disk (default: 30). |
+ * | `--history`      |                | Keep a log of when data was transferred (see \ref history.h). |
+ * | `--rollups`      |                | Keep per-minute, hour, day and month totals (see \ref rollup.h). |
+ * | `--record`       |                | Record the interface counters to a trace (see \ref trace.h). |
+ * | `--socket`       |                | Serve queries on a Unix domain socket (see \ref server.h). |
+ * | `--shm`          |                | Publish counters in a shared-memory segment (see \ref shm.h). |
+ * | `--metrics-port` |                | Serve OpenMetrics on `127.0.0.1:<port>` (see \ref metrics.h). |
+ * | `--collector`    |                | Report usage to `mbs collect` (see \ref collect.h). |
+ * | `--host-name`    |                | Name to report to the collector as (default: the host name). |
+ * | `--collector-key`|                | Sign reports with the shared key in a file (see \ref collect.h). |
+ * | `--source`       |                | Counter source: `netlink`, `sysfs`, `getifaddrs`, `synthetic[:<pattern>]`, `replay:<path>`, `step:<path>` or `auto` (default). |
+ * | `--speed`        |                | Run the synthetic and replay sources faster than real time, up to 1000 times (default: 1). |
+ * | `--netns`        |                | Monitor all network namespaces. |
+ * | `--interval`     |                | Sampling interval in milliseconds while data is transferred (default: 200, minimum: 10). |
+ * | `--min-interval` |                | Shortest sampling interval, used as the balance runs out (default: 10). |
+ * | `--max-interval` |                | Longest sampling interval, used while the link is idle (default: 2000). |
+ * | `--rate-window`  |                | Time constant of the current rates, in seconds (default: 2). |
+ * | `--average-window` |              | Time constant of the average rates, in seconds (default: 60). |
+ *
+ * While the link is idle, the sampling interval doubles on every tick, up to
+ * `--max-interval`, and the display is left alone. It drops back to `--interval`
+ * as soon as data is transferred again. With `--available`, the interval is also
+ * shortened as the balance runs out, so that the limit is not overshot.
  *
  * The `--available` argument accepts the following suffixes:
  *
@@ -132,10 +253,20 @@
  * | **MB**, **M**, or **MiB**  | Mebibyte<sup>†</sup>   | 2<sup>20</sup>   |
  * | **gB**, or **g**           | Gigabyte               | 1000<sup>3</sup> |
  * | **GB**, **G**, or **GiB**  | Gibibyte<sup>†</sup>   | 2<sup>30</sup>   |
+ * | **tB**, or **t**           | Terabyte               | 1000<sup>4</sup> |
+ * | **TB**, **T**, or **TiB**  | Tebibyte<sup>†</sup>   | 2<sup>40</sup>   |
+ * | **pB**, or **p**           | Petabyte               | 1000<sup>5</sup> |
+ * | **PB**, **P**, or **PiB**  | Pebibyte<sup>†</sup>   | 2<sup>50</sup>   |
+ * | **eB**, or **e**           | Exabyte                | 1000<sup>6</sup> |
+ * | **EB**, **E**, or **EiB**  | Exbibyte<sup>†</sup>   | 2<sup>60</sup>   |
  *
  * †) Defined by the International Electrotechnical Commission (IEC).
  *
- * A decimal point can also be used; e.g., `mbs -a 100.5M`.
+ * A decimal point can also be used; e.g., `mbs -a 100.5M`. Amounts are read
+ * exactly, up to 2<sup>64</sup> - 1 bytes, and rounded down to whole bytes.
+ *
+ * Amounts are shown in powers of 1024 (`K`, `M`, `G`, ...), or with `--si`, in
+ * powers of 1000, with the lowercase suffixes above (`k`, `m`, `g`, ...).
  *
  * @section source Source Code
  *
@@ -148,57 +279,169 @@
  *
  * @author Johannes Hildén <hildenjohannes@gmail.com>
  */
-#define _BSD_SOURCE
+#define _DEFAULT_SOURCE
 #define __STDC_FORMAT_MACROS
 
+#include <errno.h>
 #include <inttypes.h>
-#include <locale.h>
-#include <ncurses.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include <unistd.h>
+#include "collect.h"
+#include "history.h"
 #include "mbs.h"
+#include "metrics.h"
+#include "netlink.h"
+#include "procnet.h"
+#include "report.h"
+#include "rollup.h"
+#include "selfstats.h"
+#include "server.h"
+#include "shm.h"
+#include "source.h"
+#include "statsfile.h"
+#include "status.h"
+#include "trace.h"
 #include "window.h"
 
-static volatile bool loop = true;
+/*
+ * Tags for the file descriptors in the epoll set.
+ */
+enum event
+{
+    EVENT_TIMER,
+    EVENT_STDIN,
+    EVENT_SIGNAL,
+    EVENT_LINK,
+    EVENT_SERVER,
+    EVENT_METRICS
+};
+
+static int
+watch (int epfd, int fd, enum event tag)
+{
+    struct epoll_event ev;
+
+    memset (&ev, 0, sizeof (ev));
+
+    ev.events   = EPOLLIN;
+    ev.data.u32 = tag;
+
+    return epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev);
+}
 
 static void
-sig_handler (int signo)
+report_gone (const struct mbs *s)
+{
+    if (1 == s->n_ifaces)
+        fprintf (stderr, "Interface %s is gone.\n", s->ifaces[0].name);
+    else
+        fprintf (stderr, "All interfaces are gone.\n");
+}
+
+/*
+ * Link events are collected here, and acted upon once the socket has been
+ * drained.
+ */
+struct link_events
 {
-    if (signo != SIGINT)
-        return;
+    struct mbs *s;
+    bool changed;
+};
 
-    loop = false;
+static void
+on_link (const struct netlink_link *link, void *arg)
+{
+    struct link_events *events = arg;
+
+    if (0 != mbs_link_event (events->s, link))
+        events->changed = true;
+}
+
+/*
+ * Set the timer to expire once, at the absolute time `deadline` (in
+ * nanoseconds on the monotonic clock). Each deadline is derived from the
+ * previous one rather than from the current time, so neither the time spent
+ * sampling and drawing nor a key press pushes the next sample back.
+ */
+static int
+arm_timer (int fd, uint64_t deadline)
+{
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+    its.it_value.tv_sec  = deadline / 1000000000ULL;
+    its.it_value.tv_nsec = deadline % 1000000000ULL;
+
+    return timerfd_settime (fd, TFD_TIMER_ABSTIME, &its, NULL);
 }
 
 /**
  * @brief This is the application's main entry point. After initialization,
- * it runs the main loop until a `SIGINT` signal is received, or the user
- * presses the 'Q' key.
+ * it runs the main loop until a `SIGINT`, `SIGTERM` or `SIGHUP` signal is
+ * received, or the user presses the 'Q' key.
  */
 int
 main (int argc, char *argv[])
 {
-    struct timeval tv;
-    fd_set         s_rd;
+    sigset_t       signals;
+    int            epfd, sigfd, linkfd = -1, srvfd = -1, metfd = -1;
     uint64_t       balance;
     bool           balance_set;
+    int            timer;
+    uint64_t       deadline;
+    unsigned int   interval;
 
     struct mbs state = {
-        { 0, 0 },  /* snapshot */
-        { 0, 0 },  /* used */
-        0,         /* balance */
-        0,         /* flags */
-        NULL,      /* ifa_name */
-        NULL,      /* statsfile */
-        NULL,      /* WINDOW */
-        NULL       /* FILE */
+        { 0, 0, 0 },           /* snapshot */
+        { 0, 0, 0 },           /* used */
+        0,                     /* balance */
+        0,                     /* flags */
+        MBS_DEFAULT_INTERVAL,  /* interval */
+        MBS_MIN_INTERVAL,      /* min_interval */
+        MBS_DEFAULT_MAX_INTERVAL, /* max_interval */
+        NULL,                  /* ifaces */
+        0,                     /* n_ifaces */
+        NULL,                  /* statsfile */
+        STATSFILE_DEFAULT_SYNC_INTERVAL, /* sync_interval */
+        NULL,                  /* history */
+        NULL,                  /* rollups */
+        NULL,                  /* record */
+        NULL,                  /* socket */
+        NULL,                  /* shm */
+        0,                     /* metrics_port */
+        NULL,                  /* collector */
+        NULL,                  /* host_name */
+        NULL,                  /* collector_key */
+#ifdef HAVE_CURSES
+        NULL,                  /* WINDOW */
+#endif
+        NULL,                  /* source */
+        -1,                    /* nl_fd */
+        { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 },
+          { { 0 }, { 0 }, 0, 0 } }  /* rates */
     };
 
-    struct stats stats = { 0, 0 };
+    struct statsfile_record record;
+    struct stats saved;
+    struct stats delta = { 0, 0, 0 };
+    uint64_t last;
+    size_t i, gone = 0, rows;
+    bool redraw = true,
+         loop = true,
+         lost = false;
+
+    if (argc > 1 && 0 == strcmp ("report", argv[1]))
+        return report_main (argc - 1, argv + 1);
+
+    if (argc > 1 && 0 == strcmp ("collect", argv[1]))
+        return collect_main (argc - 1, argv + 1);
 
     /*
      * Initialize the mbs struct from command-line arguments.
@@ -207,83 +450,136 @@ main (int argc, char *argv[])
 
     balance_set = !!(state.flags & FLAG_COUNTDOWN);
 
-    if (state.flags & FLAG_VERBOSE)
-        printf ("Using stats file: %s\n", state.statsfile);
+    /*
+     * Set up the counter source, timing the available ones to find the
+     * cheapest, unless a specific source was given.
+     */
+    if (-1 == source_init (&state))
+    {
+        fprintf (
+            stderr, "Error initialising counter source: %s\n",
+            state.source->name
+        );
+        state.source = NULL;
+        mbs_cleanup (&state);
+
+        return EXIT_FAILURE;
+    }
 
-    if (-1 == access (state.statsfile, F_OK))
+    if (state.flags & FLAG_VERBOSE)
     {
-        FILE *file;
-        file = fopen (state.statsfile, "w+");
-        fprintf (file, "0:0:0:0:0");
-        fflush (file);
-        fclose (file);
-        state.flags &= ~FLAG_PERSISTENT;
+        printf (
+            "Polling interface counters using %s.\n", state.source->name
+        );
     }
 
-    state.file = fopen (state.statsfile, "r+");
+    if (state.flags & FLAG_VERBOSE)
+        printf ("Using stats file: %s\n", state.statsfile);
 
-    if (NULL == state.file)
+    switch (statsfile_open (state.statsfile, state.sync_interval, &record))
     {
-        fprintf (stderr, "Error opening stats file '%s'.\n", state.statsfile);
+        case -1:
+            fprintf (
+                stderr, "Error opening stats file '%s': %s\n",
+                state.statsfile,
+                EPROTO == errno ? "not a stats file" : strerror (errno)
+            );
+            /* fall through */
+        case 0:
+            state.flags &= ~FLAG_PERSISTENT;
     }
 
     if (state.flags & FLAG_PERSISTENT)
     {
-        if (5 == fscanf (
-            state.file, "%"PRIu64":%"PRIu64":%"PRIu64":%"PRIu64":%"PRIu64,
-            &state.snapshot.tx_bytes,
-            &state.snapshot.rx_bytes,
-            &state.used.tx_bytes,
-            &state.used.rx_bytes,
-            &balance))
-        {
-            if (state.flags & FLAG_VERBOSE)
-            {
-                printf (
-                    "Snapshot TX bytes: %"PRIu64"\n",
-                    state.snapshot.tx_bytes
-                );
-                printf (
-                    "Snapshot RX bytes: %"PRIu64"\n",
-                    state.snapshot.rx_bytes
-                );
-                printf ("Used TX bytes: %"PRIu64"\n", state.used.tx_bytes);
-                printf ("Used RX bytes: %"PRIu64"\n", state.used.rx_bytes);
-                printf ("Available: %"PRIu64"\n", balance);
-            }
+        state.snapshot.tx_bytes = record.snapshot_tx;
+        state.snapshot.rx_bytes = record.snapshot_rx;
+        state.used.tx_bytes = record.used_tx;
+        state.used.rx_bytes = record.used_rx;
+        balance = record.balance;
 
-            if (!(state.flags & FLAG_COUNTDOWN))
-            {
-                state.balance = balance;
-                state.flags |= FLAG_COUNTDOWN;
-            }
+        if (state.flags & FLAG_VERBOSE)
+        {
+            printf (
+                "Snapshot TX bytes: %"PRIu64"\n",
+                state.snapshot.tx_bytes
+            );
+            printf (
+                "Snapshot RX bytes: %"PRIu64"\n",
+                state.snapshot.rx_bytes
+            );
+            printf ("Used TX bytes: %"PRIu64"\n", state.used.tx_bytes);
+            printf ("Used RX bytes: %"PRIu64"\n", state.used.rx_bytes);
+            printf ("Available: %"PRIu64"\n", balance);
         }
-        else
+
+        if (!(state.flags & FLAG_COUNTDOWN))
         {
-            state.snapshot.tx_bytes = 0;
-            state.snapshot.rx_bytes = 0;
-            state.used.tx_bytes = 0;
-            state.used.rx_bytes = 0;
-            state.flags &= ~FLAG_PERSISTENT;
+            state.balance = balance;
+            state.flags |= FLAG_COUNTDOWN;
         }
     }
 
-    if (-1 == mbs_poll_interfaces (&state, &stats))
+    if (NULL != state.history
+     && -1 == history_open (state.history, state.sync_interval))
     {
-        fprintf (stderr, "No such interface: %s\n", state.ifa_name);
-        free (state.ifa_name);
-        free (state.statsfile);
+        fprintf (
+            stderr, "Error opening history log '%s': %s\n",
+            state.history,
+            EPROTO == errno ? "not a history log" : strerror (errno)
+        );
+        mbs_cleanup (&state);
 
-        if (NULL != state.file)
-            fclose (state.file);
+        return EXIT_FAILURE;
+    }
+
+    if (NULL != state.rollups
+     && -1 == rollup_open (state.rollups, state.sync_interval))
+    {
+        fprintf (
+            stderr, "Error opening rollups '%s': %s\n",
+            state.rollups,
+            EPROTO == errno ? "not a rollups file" : strerror (errno)
+        );
+        mbs_cleanup (&state);
+
+        return EXIT_FAILURE;
+    }
+
+    if (NULL != state.record
+     && -1 == trace_record_open (state.record, &state))
+    {
+        fprintf (
+            stderr, "Error opening trace '%s': %s\n", state.record,
+            strerror (errno)
+        );
+        mbs_cleanup (&state);
+
+        return EXIT_FAILURE;
+    }
+
+    saved = state.snapshot;
+
+    /* Take the initial snapshots, which all later deltas are relative to */
+    if (-1 == mbs_poll_interfaces (&state, NULL))
+    {
+        if (1 == state.n_ifaces)
+        {
+            fprintf (stderr, "No such interface: %s\n", state.ifaces[0].name);
+        }
+        else
+        {
+            fprintf (stderr, "None of the network interfaces were found.\n");
+        }
+
+        mbs_cleanup (&state);
 
         return EXIT_FAILURE;
     }
 
     if (state.flags & FLAG_PERSISTENT)
     {
-        if (state.snapshot.tx_bytes > stats.tx_bytes ||
-            state.snapshot.rx_bytes > stats.rx_bytes)
+        if (saved.tx_bytes > state.snapshot.tx_bytes ||
+            saved.rx_bytes > state.snapshot.rx_bytes)
         {
             fprintf (
                 stderr,
@@ -291,119 +587,332 @@ main (int argc, char *argv[])
                 "the kernel's TX/RX counters were reset since last session.\n"
             );
 
-            free (state.ifa_name);
-            free (state.statsfile);
-
-            if (NULL != state.file)
-                fclose (state.file);
+            mbs_cleanup (&state);
 
             return EXIT_FAILURE;
         }
 
-        if (true == balance_set)
-        {
-            const uint64_t tx_diff = stats.tx_bytes - state.snapshot.tx_bytes,
-                           rx_diff = stats.rx_bytes - state.snapshot.rx_bytes;
+        /*
+         * Account for data used while the command was not running. If a new
+         * amount was given with --available, it is what's left right now.
+         */
+        const uint64_t tx_diff = state.snapshot.tx_bytes - saved.tx_bytes,
+                       rx_diff = state.snapshot.rx_bytes - saved.rx_bytes;
 
-            state.used.tx_bytes += tx_diff;
-            state.used.rx_bytes += rx_diff;
+        state.used.tx_bytes += tx_diff;
+        state.used.rx_bytes += rx_diff;
 
-            state.snapshot = stats;
+        if (false == balance_set)
+        {
+            if (state.balance > tx_diff + rx_diff)
+                state.balance -= tx_diff + rx_diff;
+            else
+                state.balance = 0;
         }
     }
-    else
+
+    if (state.flags & FLAG_VERBOSE)
     {
-        state.snapshot = stats;
+        for (i = 0; i < state.n_ifaces; ++i)
+        {
+            printf (
+                "Monitoring network %s %s%s.\n",
+                state.flags & FLAG_NETNS ? "namespace" : "interface",
+                state.ifaces[i].name,
+                state.ifaces[i].error ? " (not found)" : ""
+            );
+        }
     }
 
-    if (state.flags & FLAG_VERBOSE)
-        printf ("Monitoring network interface %s.\n", state.ifa_name);
+    /* The first sample is taken right away */
+    interval = state.interval;
+    deadline = mbs_now ();
+    last = state.snapshot.timestamp;
+
+    if (-1 == (timer = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC))
+     || -1 == arm_timer (timer, deadline))
+    {
+        perror ("timerfd");
+        mbs_cleanup (&state);
 
-    setlocale (LC_ALL, "");
-    initscr ();
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * Signals are received through a file descriptor, like everything else
+     * that the loop waits for.
+     */
+    sigemptyset (&signals);
+    sigaddset (&signals, SIGINT);
+    sigaddset (&signals, SIGTERM);
+    sigaddset (&signals, SIGHUP);
+    sigaddset (&signals, SIGWINCH);
+
+    sigprocmask (SIG_BLOCK, &signals, NULL);
 
-    if (state.flags & FLAG_COUNTDOWN)
+    if (-1 == (epfd = epoll_create1 (EPOLL_CLOEXEC))
+     || -1 == (sigfd = signalfd (-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC))
+     || -1 == watch (epfd, timer, EVENT_TIMER)
+     || -1 == watch (epfd, sigfd, EVENT_SIGNAL))
     {
-        state.win = newwin (5, 82, 0, 0);
+        perror ("epoll");
+        mbs_cleanup (&state);
+
+        return EXIT_FAILURE;
     }
-    else
+
+    /*
+     * Keys are only read with a terminal interface. Fails if stdin is a
+     * regular file, in which case they are not read either.
+     */
+    if (!(state.flags & FLAG_DAEMON))
+        watch (epfd, fileno (stdin), EVENT_STDIN);
+
+    /*
+     * Have the kernel tell us as soon as an interface goes away, is renamed,
+     * or changes state. Not in namespace mode, where the entries are not
+     * interfaces.
+     */
+    if (!(state.flags & FLAG_NETNS)
+     && -1 != (linkfd = netlink_subscribe_links ())
+     && -1 == watch (epfd, linkfd, EVENT_LINK))
     {
-        state.win = newwin (3, 82, 0, 0);
+        netlink_close (linkfd);
+        linkfd = -1;
     }
 
-    if (NULL == state.win)
+    if (NULL != state.socket
+     && (-1 == (srvfd = server_open (state.socket))
+      || -1 == watch (epfd, srvfd, EVENT_SERVER)))
     {
-        fprintf (stderr, "Error initialising ncurses.\n");
+        perror (state.socket);
+        server_close ();
+        mbs_cleanup (&state);
 
-        endwin ();
-        free (state.ifa_name);
-        free (state.statsfile);
+        return EXIT_FAILURE;
+    }
 
-        if (NULL != state.file)
-            fclose (state.file);
+    if (0 != state.metrics_port
+     && (-1 == (metfd = metrics_open (state.metrics_port))
+      || -1 == watch (epfd, metfd, EVENT_METRICS)))
+    {
+        perror ("metrics");
+        metrics_close ();
+        server_close ();
+        mbs_cleanup (&state);
 
         return EXIT_FAILURE;
     }
 
-    curs_set (0);
-    timeout (0);  /* This is so that getch doesn't block. */
+    if (NULL != state.shm && -1 == shm_publish_open (&state, state.shm))
+    {
+        perror (state.shm);
+        metrics_close ();
+        server_close ();
+        mbs_cleanup (&state);
 
-    signal (SIGINT, sig_handler);
+        return EXIT_FAILURE;
+    }
 
-    /* Run main loop until SIGINT signal is received */
+    if (NULL != state.collector && NULL != state.collector_key
+     && -1 == collect_set_key (state.collector_key))
+    {
+        fprintf (stderr, "Error reading key from '%s': %s\n",
+                 state.collector_key, strerror (errno));
+        shm_publish_close ();
+        metrics_close ();
+        server_close ();
+        mbs_cleanup (&state);
+
+        return EXIT_FAILURE;
+    }
+
+    if (NULL != state.collector
+     && -1 == collect_open (state.collector, state.host_name, &state))
+    {
+        fprintf (stderr, "Invalid collector address or host name: %s\n",
+                 state.collector);
+        shm_publish_close ();
+        metrics_close ();
+        server_close ();
+        mbs_cleanup (&state);
+
+        return EXIT_FAILURE;
+    }
+
+    if ((state.flags & FLAG_PROCESSES) && -1 == procnet_open ())
+    {
+        perror ("Error reading sockets");
+        shm_publish_close ();
+        metrics_close ();
+        server_close ();
+        mbs_cleanup (&state);
+
+        return EXIT_FAILURE;
+    }
+
+    if (!(state.flags & FLAG_DAEMON) && -1 == window_open (&state))
+    {
+        fprintf (stderr, "Error initialising ncurses.\n");
+        shm_publish_close ();
+        metrics_close ();
+        server_close ();
+        mbs_cleanup (&state);
+
+        return EXIT_FAILURE;
+    }
+
+    /* Namespaces come and go, and the window has a row for each */
+    rows = state.n_ifaces;
+
+    selfstats_init ();
+
+    /* Run main loop until a signal is received, or 'q' is pressed */
     while (true == loop)
     {
-        if ('q' == getch ()) /* ...or 'q' is pressed */
-            break;
+        struct epoll_event events[4];
+        struct signalfd_siginfo si;
+        uint64_t expirations;
+        bool expired = false,
+             sample = false;
+        int n;
+
+        /* Sleep until something happens */
+        if (-1 == (n = epoll_wait (epfd, events, 4, -1)))
+            continue;
 
-        if (-1 == mbs_poll_interfaces (&state, &stats))
+        while (n-- > 0)
         {
-            if (state.flags & FLAG_NO_EXIT)
+            switch (events[n].data.u32)
+            {
+            case EVENT_TIMER:
+                expired = sizeof (expirations) == read (
+                    timer, &expirations, sizeof (expirations));
+                sample = sample || expired;
+                break;
+
+            case EVENT_STDIN:
+            {
+                const int keys = window_read_keys ();
+
+                if (keys & WINDOW_QUIT)
+                    loop = false;
+
+                if (keys & WINDOW_REDRAW)
+                    redraw = sample = true;
+
+                /* The terminal is gone */
+                if (events[n].events & (EPOLLHUP | EPOLLERR))
+                    epoll_ctl (epfd, EPOLL_CTL_DEL, fileno (stdin), NULL);
+                break;
+            }
+
+            case EVENT_SIGNAL:
+                while (sizeof (si) == read (sigfd, &si, sizeof (si)))
+                {
+                    if (SIGWINCH == si.ssi_signo)
+                    {
+                        if (!(state.flags & FLAG_DAEMON))
+                        {
+                            window_resize ();
+                            redraw = sample = true;
+                        }
+                    }
+                    else
+                    {
+                        loop = false;
+                    }
+                }
+                break;
+
+            case EVENT_SERVER:
+                server_dispatch (&state);
+                break;
+
+            case EVENT_METRICS:
+                metrics_dispatch (&state);
+                break;
+
+            case EVENT_LINK:
             {
-                state.snapshot.rx_bytes = 0;
-                state.snapshot.tx_bytes = 0;
+                struct link_events link = { &state, false };
+
+                /* Some events were lost; take a sample to catch up */
+                if (-1 == netlink_read_link_events (linkfd, on_link, &link)
+                 && ENOBUFS == errno)
+                    link.changed = true;
+
+                if (link.changed)
+                    redraw = sample = true;
+                break;
+            }
+            }
+        }
+
+        if (false == loop)
+            break;
 
-                werase (state.win);
+        if (!sample)
+            continue;
 
-                box (state.win, 0, 0);
-                wmove (state.win, 0, 2);
-                wattron (state.win, A_BOLD);
-                wprintw (state.win, " mbs ");
-                wattroff (state.win, A_BOLD);
+        selfstats_begin ();
 
-                wmove (state.win, 2, 2);
-                wprintw (state.win, "Interface %s is gone.", state.ifa_name);
-                wrefresh (state.win);
+        if (-1 == mbs_poll_interfaces (&state, &delta))
+        {
+            redraw = true;
+
+            if (state.flags & FLAG_NO_EXIT)
+            {
+                if (!(state.flags & FLAG_DAEMON))
+                    draw_gone (&state);
+                else if (!lost)
+                    report_gone (&state);
+
+                lost = true;
             }
             else
             {
-                curs_set (1);
-                delwin (state.win);
-                endwin ();
+                if (!(state.flags & FLAG_DAEMON))
+                    window_close (&state);
 
-                fprintf (stderr, "Interface %s is gone.\n", state.ifa_name);
+                report_gone (&state);
 
-                free (state.ifa_name);
-                free (state.statsfile);
+                if (state.flags & FLAG_SELF_STATS)
+                    selfstats_print (stdout);
 
-                if (NULL != state.file)
-                    fclose (state.file);
+                shm_publish_close ();
+                metrics_close ();
+                server_close ();
+                mbs_cleanup (&state);
 
                 return EXIT_FAILURE;
             }
         }
         else
         {
-            const uint64_t tx_diff = stats.tx_bytes - state.snapshot.tx_bytes,
-                           rx_diff = stats.rx_bytes - state.snapshot.rx_bytes;
+            const uint64_t tx_diff = delta.tx_bytes,
+                           rx_diff = delta.rx_bytes;
+            const uint64_t elapsed = delta.timestamp - last;
+            size_t n_gone = 0;
+
+            lost = false;
+
+            selfstats_mark (SELFSTATS_POLL);
 
             state.used.tx_bytes += tx_diff;
             state.used.rx_bytes += rx_diff;
 
-            state.snapshot = stats;
-
             const uint64_t diff = tx_diff + rx_diff;
 
+            last = delta.timestamp;
+
+            rate_update (&state.rates, tx_diff, rx_diff, elapsed);
+
+            const bool idle = state.rates.tx.value < 1
+                           && state.rates.rx.value < 1
+                           && state.rates.tx_avg.value < 1
+                           && state.rates.rx_avg.value < 1;
+
             if (state.flags & FLAG_COUNTDOWN)
             {
                 if (state.balance > diff)
@@ -412,46 +921,140 @@ main (int argc, char *argv[])
                     state.balance = 0;
             }
 
-            if (NULL != state.file)
+            server_publish (&state, &delta);
+            shm_publish (&state);
+            collect_sample (&state);
+            procnet_add (tx_diff, rx_diff, delta.timestamp);
+
+            const uint64_t wall = time (NULL);
+
+            history_append (wall, tx_diff, rx_diff);
+            rollup_add (wall, tx_diff, rx_diff);
+
+            for (i = 0; i < state.n_ifaces; i++)
+                n_gone += !!state.ifaces[i].error;
+
+            selfstats_mark (SELFSTATS_UPDATE);
+
+            /*
+             * Nothing has changed since the last tick, and the activity
+             * indicators and rates are already down to zero; there is
+             * nothing to redraw and nothing new to save.
+             */
+            if (!redraw && !diff && n_gone == gone && rows == state.n_ifaces
+             && saved.tx_bytes == state.snapshot.tx_bytes
+             && saved.rx_bytes == state.snapshot.rx_bytes)
+                goto schedule;
+
+            redraw = diff || !idle;
+            gone = n_gone;
+            saved = state.snapshot;
+
+            statsfile_save (&state);
+            selfstats_mark (SELFSTATS_SAVE);
+
+            if (!(state.flags & FLAG_DAEMON) && rows != state.n_ifaces)
             {
-                rewind (state.file);
-
-                if (-1 == ftruncate (fileno (state.file), fprintf (
-                    state.file,
-                    "%"PRIu64":%"PRIu64":%"PRIu64":%"PRIu64":%"PRIu64,
-                    stats.tx_bytes,
-                    stats.rx_bytes,
-                    state.used.tx_bytes,
-                    state.used.rx_bytes,
-                    state.balance
-                )))
+                window_close (&state);
+
+                if (-1 == window_open (&state))
                 {
-                    fprintf (stderr, "Error writing to stats file.");
+                    fprintf (stderr, "Error initialising ncurses.\n");
+                    state.flags |= FLAG_DAEMON;
+                    break;
                 }
-
-                fflush (state.file);
             }
 
-            draw_window (&state, !!tx_diff, !!rx_diff);
+            rows = state.n_ifaces;
+
+            if (!(state.flags & FLAG_DAEMON))
+                draw_window (&state, !!tx_diff, !!rx_diff);
+            else if (state.flags & FLAG_STATUS_LINE)
+                status_line (&state);
+
+            selfstats_mark (SELFSTATS_DRAW);
 
             if ((state.flags & FLAG_COUNTDOWN)
              && !state.balance
              && !(state.flags & FLAG_NO_EXIT))
                 break;
+
+schedule:
+            if (-1 == statsfile_sync ())
+                fprintf (stderr, "Error writing to stats file.\n");
+
+            if (-1 == history_sync ())
+                fprintf (stderr, "Error writing to history log.\n");
+
+            if (-1 == rollup_sync ())
+                fprintf (stderr, "Error writing to rollups.\n");
+
+            if (-1 == trace_record_sync ())
+                fprintf (stderr, "Error writing to trace.\n");
+
+            selfstats_mark (SELFSTATS_SAVE);
+
+            interval = mbs_next_interval (&state, interval, diff, elapsed);
+            selfstats_end ();
         }
 
-        FD_ZERO (&s_rd);
-        FD_SET (fileno (stdin), &s_rd);
+        /*
+         * Re-arm the timer, skipping any deadlines which were missed. After
+         * an event, the next sample is one interval away from this one.
+         */
+        const uint64_t now = mbs_now ();
+
+        deadline = (expired ? deadline : now) + interval * 1000000ULL;
 
-        tv.tv_sec = 0;
-        tv.tv_usec = 200000;
+        if (deadline < now)
+            deadline = now;
 
-        select (fileno (stdin) + 1, &s_rd, NULL, NULL, &tv);
+        arm_timer (timer, deadline);
     }
 
-    curs_set (1);
-    delwin (state.win);
-    endwin ();
+    shm_publish_close ();
+    metrics_close ();
+    server_close ();
+    netlink_close (linkfd);
+    close (sigfd);
+    close (epfd);
+    close (timer);
+
+    if (!(state.flags & FLAG_DAEMON))
+        window_close (&state);
+
+    status_line_end ();
+
+    if (state.flags & FLAG_SELF_STATS)
+        selfstats_print (stdout);
+
+    if (state.flags & FLAG_PROCESSES)
+        procnet_print (stdout);
+
+    if (state.flags & FLAG_VERBOSE)
+    {
+        char tx_str[MBS_HUMAN_READABLE_MAX], rx_str[MBS_HUMAN_READABLE_MAX],
+             eta_str[RATE_ETA_MAX];
+
+        printf (
+            "Current rate: TX %s/s, RX %s/s\n",
+            to_human_readable (state.rates.tx.value, tx_str),
+            to_human_readable (state.rates.rx.value, rx_str)
+        );
+        printf (
+            "Average rate: TX %s/s, RX %s/s\n",
+            to_human_readable (state.rates.tx_avg.value, tx_str),
+            to_human_readable (state.rates.rx_avg.value, rx_str)
+        );
+
+        if (state.flags & FLAG_COUNTDOWN)
+        {
+            printf (
+                "Time left: %s\n", rate_format_eta (
+                    rate_eta (&state.rates, state.balance), eta_str)
+            );
+        }
+    }
 
     if ((state.flags & FLAG_COUNTDOWN) && !state.balance)
     {
@@ -462,11 +1065,7 @@ main (int argc, char *argv[])
         printf ("Terminated!\n");
     }
 
-    free (state.ifa_name);
-    free (state.statsfile);
-
-    if (NULL != state.file)
-        fclose (state.file);
+    mbs_cleanup (&state);
 
     return 0;
 }
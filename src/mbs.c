@@ -30,19 +30,33 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-#define _BSD_SOURCE 
+#define _DEFAULT_SOURCE
 #define __STDC_FORMAT_MACROS
 
+#include <errno.h>
+#include <fnmatch.h>
 #include <ifaddrs.h>
 #include <inttypes.h>
 #include <limits.h>
-#include <linux/if_link.h>
 #include <net/if.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "argtable3/argtable3.h"
+#include "collect.h"
+#include "history.h"
 #include "mbs.h"
+#include "netlink.h"
+#include "netns.h"
+#include "procnet.h"
+#include "rollup.h"
+#include "source.h"
+#include "statsfile.h"
+#include "trace.h"
+
+/* Maximum number of <interface> arguments */
+#define MAX_IFACE_ARGS 64
 
 static int
 get_default_interface (char **ifa_name)
@@ -79,90 +93,295 @@ get_default_interface (char **ifa_name)
     return -1;
 }
 
+int
+mbs_add_iface (struct mbs *s, const char *name)
+{
+    struct iface *ifaces;
+    size_t i;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        if (0 == strcmp (s->ifaces[i].name, name))
+            return 0;
+    }
+
+    ifaces = realloc (s->ifaces, (s->n_ifaces + 1) * sizeof (*ifaces));
+
+    if (NULL == ifaces)
+        return -1;
+
+    s->ifaces = ifaces;
+
+    memset (&ifaces[s->n_ifaces], 0, sizeof (*ifaces));
+    ifaces[s->n_ifaces].name  = strdup (name);
+    ifaces[s->n_ifaces].ifindex = if_nametoindex (name);
+    ifaces[s->n_ifaces].rx_fd = -1;
+    ifaces[s->n_ifaces].tx_fd = -1;
+
+    ++s->n_ifaces;
+    return 0;
+}
+
+void
+mbs_remove_iface (struct mbs *s, size_t i)
+{
+    free (s->ifaces[i].name);
+
+    memmove (&s->ifaces[i], &s->ifaces[i + 1],
+             (s->n_ifaces - i - 1) * sizeof (struct iface));
+
+    --s->n_ifaces;
+}
+
+/*
+ * Add an interface, or if the argument contains wildcards, every interface
+ * whose name matches it.
+ */
+static int
+add_iface_pattern (struct mbs *s, const char *pattern)
+{
+    struct if_nameindex *names, *n;
+    const size_t count = s->n_ifaces;
+
+    if (NULL == strpbrk (pattern, "*?["))
+        return mbs_add_iface (s, pattern);
+
+    if (NULL == (names = if_nameindex ()))
+    {
+        perror ("if_nameindex");
+        return -1;
+    }
+
+    for (n = names; 0 != n->if_index; ++n)
+    {
+        if (0 == fnmatch (pattern, n->if_name, 0) &&
+            -1 == mbs_add_iface (s, n->if_name))
+            break;
+    }
+
+    if_freenameindex (names);
+
+    if (count == s->n_ifaces)
+    {
+        fprintf (stderr, "No network interface matches '%s'.\n", pattern);
+        return -1;
+    }
+
+    return 0;
+}
+
 static void
-set_flag (uint8_t *flags, bool set, uint8_t mask)
+set_flag (uint16_t *flags, bool set, uint16_t mask)
 {
     true == set ? (*flags |= mask) : (*flags &= ~mask);
 }
 
+uint64_t
+mbs_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * The unit prefixes, as parsed and printed. Lowercase letters are powers of
+ * 1000 and uppercase letters powers of 1024, which is also how the SI prefixes
+ * are printed, so that the output of format_bytes can be read back.
+ */
+static const struct
+{
+    char symbol;
+    uint64_t size;
+}
+prefixes[] =
+{
+    { 'k', 1000ULL },
+    { 'm', 1000000ULL },
+    { 'g', 1000000000ULL },
+    { 't', 1000000000000ULL },
+    { 'p', 1000000000000000ULL },
+    { 'e', 1000000000000000000ULL },
+    { 'K', 1ULL << 10 },
+    { 'M', 1ULL << 20 },
+    { 'G', 1ULL << 30 },
+    { 'T', 1ULL << 40 },
+    { 'P', 1ULL << 50 },
+    { 'E', 1ULL << 60 }
+};
+
+#define PREFIXES_PER_UNITS 6
+
+static enum mbs_units human_units = MBS_UNITS_IEC;
+
+void
+mbs_set_units (enum mbs_units units)
+{
+    human_units = units;
+}
+
 char *
-to_human_readable (double bytes, char *buf)
+format_bytes (uint64_t bytes, enum mbs_units units, char *buf)
 {
-    const char *units[] = {"B", "K", "M", "G", "T"};
-    int i = 0;
+    const uint64_t base = MBS_UNITS_SI == units ? 1000 : 1024;
+    uint64_t size = 1, whole, rest;
+    char digits[PREFIXES_PER_UNITS], *d;
+    int i = 0, k, n = 0;
 
-    while (bytes >= 1024)
+    while (i < PREFIXES_PER_UNITS && bytes / size >= base)
     {
-        bytes /= 1024;
+        size *= base;
         ++i;
     }
 
-    sprintf (buf, "%.*f%s", i, bytes, units[i]);
-    return buf;
-}
+    whole = bytes / size;
+    rest = bytes % size;
 
-int
-parse_bytes (const char *str, uint64_t *result)
-{
-    char *suffix;
-    double b;
+    /* One decimal per prefix step, by long division so that nothing is lost */
+    for (k = 0; k < i; ++k)
+    {
+        rest *= 10;
+        digits[n++] = '0' + rest / size;
+        rest %= size;
+    }
 
-    if (NULL == str || 0 == strlen (str))
+    /* Round half up, carrying into the whole part */
+    if (rest >= size - rest)
     {
-        *result = 0;
-        return 0;
+        for (k = n - 1; k >= 0 && '9' == digits[k]; --k)
+            digits[k] = '0';
+
+        if (k >= 0)
+            ++digits[k];
+        else
+            ++whole;
     }
 
-    b = strtod (str, &suffix);
+    d = buf;
+
+    do
+        *d++ = '0' + whole % 10;
+    while (whole /= 10);
 
-    if (0 == strlen (suffix) || 
-        0 == strcmp ("B", suffix) || 
-        0 == strcmp ("b", suffix))
+    for (k = 0; k < (d - buf) / 2; ++k)
     {
-        *result = b;
-        return 0;
+        char c = buf[k];
+
+        buf[k] = d[-1 - k];
+        d[-1 - k] = c;
     }
-    else if (0 == strcmp ("kB", suffix) || 
-             0 == strcmp ("k", suffix))
+
+    if (n > 0)
     {
-        *result = 1000 * b;
-        return 0;
+        *d++ = '.';
+        memcpy (d, digits, n);
+        d += n;
     }
-    else if (0 == strcmp ("KB", suffix) || 
-             0 == strcmp ("K", suffix)  || 
-             0 == strcmp ("KiB", suffix))
+
+    *d++ = 0 == i ? 'B' : prefixes[(MBS_UNITS_SI == units ? 0 :
+                                    PREFIXES_PER_UNITS) + i - 1].symbol;
+    *d = '\0';
+
+    return buf;
+}
+
+char *
+to_human_readable (double bytes, char *buf)
+{
+    uint64_t b;
+
+    if (!(bytes >= 0))
+        b = 0;
+    else if (bytes >= 18446744073709551615.0)
+        b = UINT64_MAX;
+    else
+        b = bytes + 0.5;
+
+    return format_bytes (b, human_units, buf);
+}
+
+int
+parse_bytes (const char *str, uint64_t *result)
+{
+    const char *p = str, *point = NULL, *end;
+    uint64_t whole = 0, size = 1, fraction = 0;
+    size_t i;
+
+    if (NULL == str || '\0' == *str)
     {
-        *result = 1024 * b;
+        *result = 0;
         return 0;
     }
-    else if (0 == strcmp ("mB", suffix) || 
-             0 == strcmp ("m", suffix))
+
+    while (' ' == *p || '\t' == *p)
+        ++p;
+
+    for (end = p; ; ++end)
     {
-        *result = 1000 * 1000 * b;
-        return 0;
+        if ('.' == *end && NULL == point)
+            point = end;
+        else if (*end < '0' || '9' < *end)
+            break;
+        else if (NULL == point)
+        {
+            if (whole > (UINT64_MAX - (*end - '0')) / 10)
+                goto too_large;
+
+            whole = whole * 10 + (*end - '0');
+        }
     }
-    else if (0 == strcmp ("MB", suffix) || 
-             0 == strcmp ("M", suffix)  ||
-             0 == strcmp ("MiB", suffix))
+
+    if (end == p || (point && end == p + 1))
     {
-        *result = 1024 * 1024 * b;
-        return 0;
+        fprintf (stderr, "Not an amount: %s\n", str);
+        return -1;
     }
-    else if (0 == strcmp ("gB", suffix) || 
-             0 == strcmp ("g", suffix))
+
+    /* Then [<prefix>[i]]B, or the legacy lowercase b for plain bytes */
+    if ('\0' != *end && 0 != strcmp ("B", end) && 0 != strcmp ("b", end))
     {
-        *result = 1000 * 1000 * 1000 * b;
-        return 0;
+        for (i = 0; i < sizeof (prefixes) / sizeof (prefixes[0]); ++i)
+        {
+            if (prefixes[i].symbol == *end)
+                break;
+        }
+
+        if (i == sizeof (prefixes) / sizeof (prefixes[0])
+         || !('\0' == end[1] || 0 == strcmp ("B", end + 1)
+              || (i >= PREFIXES_PER_UNITS && 0 == strcmp ("iB", end + 1))))
+        {
+            fprintf (stderr, "Unrecognized suffix: %s\n", end);
+            return -1;
+        }
+
+        size = prefixes[i].size;
     }
-    else if (0 == strcmp ("GB", suffix) || 
-             0 == strcmp ("G", suffix)  ||
-             0 == strcmp ("GiB", suffix))
+
+    if (whole > UINT64_MAX / size)
+        goto too_large;
+
+    /*
+     * The fractional part, in whole bytes (rounded down), from its last digit
+     * to its first: each step adds a digit times the size, and divides by ten.
+     * Neither step can overflow, since the carried value is less than the size.
+     */
+    if (point)
     {
-        *result = 1024 * 1024 * 1024 * b;
-        return 0;
+        const char *c;
+
+        for (c = end - 1; c > point; --c)
+            fraction = ((*c - '0') * size + fraction) / 10;
     }
 
-    fprintf (stderr, "Unrecognized suffix: %s\n", suffix);
+    if (whole * size > UINT64_MAX - fraction)
+        goto too_large;
+
+    *result = whole * size + fraction;
+    return 0;
+
+too_large:
+    fprintf (stderr, "Amount out of range: %s\n", str);
     return -1;
 }
 
@@ -174,14 +393,37 @@ mbs_getopt (int argc, char *argv[], struct mbs *s)
                    *version,
                    *ascii,
                    *keep_running,
-                   *persistent;
+                   *persistent,
+                   *netns,
+                   *daemon,
+                   *status_line,
+                   *processes,
+                   *self_stats,
+                   *si;
 
     struct arg_str *iface;
+    struct arg_int *metrics_port,
+                   *sync_interval,
+                   *interval,
+                   *min_interval,
+                   *max_interval,
+                   *speed;
+    struct arg_dbl *rate_window,
+                   *average_window;
     struct arg_end *end;
     struct arg_str *available,
-                   *statsfile;
+                   *statsfile,
+                   *history,
+                   *rollups,
+                   *record,
+                   *socket,
+                   *shm,
+                   *collector,
+                   *host_name,
+                   *collector_key,
+                   *source;
 
-    int nerrors;
+    int nerrors, i;
     const char command[] = "mbs";
 
     void *argtable[] = 
@@ -211,6 +453,26 @@ mbs_getopt (int argc, char *argv[], struct mbs *s)
             "p", "persistent", 
             0, 1, "continue from where last session ended"
         ),
+        daemon = arg_litn (
+            "d", "daemon",
+            0, 1, "run without a terminal interface, e.g., as a service"
+        ),
+        status_line = arg_litn (
+            NULL, "status-line",
+            0, 1, "print a line of status on every update, for status bars"
+        ),
+        processes = arg_litn (
+            NULL, "processes",
+            0, 1, "estimate which processes the traffic is for"
+        ),
+        self_stats = arg_litn (
+            NULL, "self-stats",
+            0, 1, "print what mbs itself has cost on exit"
+        ),
+        si = arg_litn (
+            NULL, "si",
+            0, 1, "show amounts in powers of 1000 rather than 1024"
+        ),
         available = arg_strn (
             "a", "available", "<amount>",
             0, 1, "data available to use in your subscription plan or budget"
@@ -219,9 +481,82 @@ mbs_getopt (int argc, char *argv[], struct mbs *s)
             NULL, "statsfile", "<path>",
             0, 1, "stats file location (for persistent sessions)"
         ),
+        sync_interval = arg_intn (
+            NULL, "sync-interval", "<sec>",
+            0, 1, "seconds between flushes of the stats file (default: 30)"
+        ),
+        history = arg_strn (
+            NULL, "history", "<path>",
+            0, 1, "keep a log of when data was transferred"
+        ),
+        rollups = arg_strn (
+            NULL, "rollups", "<path>",
+            0, 1, "keep per-minute, hour, day and month totals (see mbs report)"
+        ),
+        record = arg_strn (
+            NULL, "record", "<path>",
+            0, 1, "record the interface counters to a trace, for replay"
+        ),
+        socket = arg_strn (
+            NULL, "socket", "<path>",
+            0, 1, "serve queries on a Unix domain socket"
+        ),
+        shm = arg_strn (
+            NULL, "shm", "<name>",
+            0, 1, "publish counters in a shared-memory segment"
+        ),
+        collector = arg_strn (
+            NULL, "collector", "<address>",
+            0, 1, "report usage to mbs collect at [udp://|tcp://]<host>[:<port>]"
+        ),
+        host_name = arg_strn (
+            NULL, "host-name", "<name>",
+            0, 1, "name to report to the collector as (default: host name)"
+        ),
+        collector_key = arg_strn (
+            NULL, "collector-key", "<path>",
+            0, 1, "sign reports with the shared key in this file"
+        ),
+        metrics_port = arg_intn (
+            NULL, "metrics-port", "<port>",
+            0, 1, "serve OpenMetrics on 127.0.0.1:<port>"
+        ),
+        interval = arg_intn (
+            NULL, "interval", "<ms>",
+            0, 1, "sampling interval in milliseconds (default: 200, min: 10)"
+        ),
+        min_interval = arg_intn (
+            NULL, "min-interval", "<ms>",
+            0, 1, "shortest interval, used as the balance runs out (default: 10)"
+        ),
+        max_interval = arg_intn (
+            NULL, "max-interval", "<ms>",
+            0, 1, "longest interval, used when the link is idle (default: 2000)"
+        ),
+        rate_window = arg_dbln (
+            NULL, "rate-window", "<sec>",
+            0, 1, "time constant of the current rates (default: 2)"
+        ),
+        average_window = arg_dbln (
+            NULL, "average-window", "<sec>",
+            0, 1, "time constant of the average rates (default: 60)"
+        ),
+        netns = arg_litn (
+            NULL, "netns",
+            0, 1, "monitor all network namespaces (requires CAP_SYS_ADMIN)"
+        ),
+        source = arg_strn (
+            NULL, "source", "<name>",
+            0, 1, "counter source: netlink, sysfs, getifaddrs, synthetic[:<pattern>], "
+                  "replay:<path>, step:<path> or auto (default)"
+        ),
+        speed = arg_intn (
+            NULL, "speed", "<factor>",
+            0, 1, "speed up the synthetic and replay sources (max: 1000)"
+        ),
         iface = arg_strn (
             NULL, NULL, "<interface>", 
-            0, 1, "network interface"
+            0, MAX_IFACE_ARGS, "network interface(s), or glob pattern(s)"
         ),
         end = arg_end (20),
     };
@@ -254,23 +589,181 @@ mbs_getopt (int argc, char *argv[], struct mbs *s)
         exit (EXIT_FAILURE);
     }
 
-    if (strlen (*iface->sval) > 0)
+    s->interval = interval->count > 0 ?
+        *interval->ival : MBS_DEFAULT_INTERVAL;
+    s->min_interval = min_interval->count > 0 ?
+        *min_interval->ival : MBS_MIN_INTERVAL;
+    s->max_interval = max_interval->count > 0 ?
+        *max_interval->ival : MBS_DEFAULT_MAX_INTERVAL;
+
+    rate_init (
+        &s->rates,
+        rate_window->count > 0 ? *rate_window->dval : RATE_DEFAULT_TAU,
+        average_window->count > 0 ?
+            *average_window->dval : RATE_DEFAULT_AVG_TAU
+    );
+
+    if (s->rates.tx.tau < 0 || s->rates.tx_avg.tau < 0)
+    {
+        fprintf (stderr, "The rate windows must not be negative.\n");
+        arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+        exit (EXIT_FAILURE);
+    }
+
+    /* Only the interval itself was given; don't let the defaults clash */
+    if (0 == max_interval->count && s->max_interval < s->interval)
+        s->max_interval = s->interval;
+
+    if (s->min_interval < MBS_MIN_INTERVAL ||
+        s->min_interval > s->interval ||
+        s->interval > s->max_interval)
+    {
+        fprintf (
+            stderr, "The sampling intervals must satisfy %d <= "
+            "--min-interval <= --interval <= --max-interval.\n",
+            MBS_MIN_INTERVAL
+        );
+        arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+        exit (EXIT_FAILURE);
+    }
+
+    if (speed->count > 0
+     && (*speed->ival < 1 || *speed->ival > TRACE_MAX_SPEED))
+    {
+        fprintf (stderr, "The speed must be between 1 and %d.\n",
+                 TRACE_MAX_SPEED);
+        arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+        exit (EXIT_FAILURE);
+    }
+
+    if (source->count > 0 && 0 != strcmp ("auto", *source->sval)
+     && NULL == (s->source = source_find (*source->sval))
+     && NULL == (s->source = trace_find (*source->sval,
+                                         speed->count ? *speed->ival : 1)))
+    {
+        if (EINVAL == errno)
+        {
+            fprintf (stderr, "Unknown counter source: %s\n", *source->sval);
+        }
+        else
+        {
+            fprintf (
+                stderr, "Error reading trace '%s': %s\n",
+                strchr (*source->sval, ':') + 1,
+                EPROTO == errno ? "not a trace" : strerror (errno)
+            );
+        }
+
+        arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+        exit (EXIT_FAILURE);
+    }
+
+    if (netns->count > 0)
     {
-        s->ifa_name = strdup (*iface->sval);
+        if (processes->count > 0)
+        {
+            fprintf (stderr,
+                     "The --processes flag can't be used with --netns.\n");
+            arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+            exit (EXIT_FAILURE);
+        }
+
+        if (NULL != s->source)
+        {
+            fprintf (stderr, "The --source flag can't be used with --netns.\n");
+            arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+            exit (EXIT_FAILURE);
+        }
+
+        s->source = &netns_source;
+
+        if (-1 == netns_discover (s, iface->sval, iface->count))
+        {
+            arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+            exit (EXIT_FAILURE);
+        }
     }
-    else if (-1 == get_default_interface (&s->ifa_name))
+    else
     {
-        fprintf (stderr, "No active network interface found.\n");
+        for (i = 0; i < iface->count; ++i)
+        {
+            if (-1 == add_iface_pattern (s, iface->sval[i]))
+                break;
+        }
+
+        if (i < iface->count)
+        {
+            arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    /* The interfaces of a synthetic source, or those in the trace */
+    if (0 == s->n_ifaces && trace_is_source (s->source)
+     && -1 == trace_add_ifaces (s))
+    {
+        perror ("trace");
         arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
         exit (EXIT_FAILURE);
     }
 
+    if (0 == s->n_ifaces)
+    {
+        char *ifa_name;
+
+        if (-1 == get_default_interface (&ifa_name))
+        {
+            fprintf (stderr, "No active network interface found.\n");
+            arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+            exit (EXIT_FAILURE);
+        }
+
+        mbs_add_iface (s, ifa_name);
+        free (ifa_name);
+    }
+
     if (-1 == parse_bytes (*available->sval, &s->balance)) 
     {
         arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
         exit (EXIT_FAILURE);
     }
 
+    if (history->count > 0)
+        s->history = strdup (*history->sval);
+
+    if (rollups->count > 0)
+        s->rollups = strdup (*rollups->sval);
+
+    if (record->count > 0)
+        s->record = strdup (*record->sval);
+
+    if (socket->count > 0)
+        s->socket = strdup (*socket->sval);
+
+    if (shm->count > 0)
+        s->shm = strdup (*shm->sval);
+
+    if (collector->count > 0)
+        s->collector = strdup (*collector->sval);
+
+    if (host_name->count > 0)
+        s->host_name = strdup (*host_name->sval);
+
+    if (collector_key->count > 0)
+        s->collector_key = strdup (*collector_key->sval);
+
+    if (metrics_port->count > 0)
+    {
+        if (*metrics_port->ival < 1 || *metrics_port->ival > 65535)
+        {
+            fprintf (stderr, "Invalid metrics port.\n");
+            arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+            exit (EXIT_FAILURE);
+        }
+
+        s->metrics_port = *metrics_port->ival;
+    }
+
     if (statsfile->count > 0)
     {
         s->statsfile = strdup (*statsfile->sval);
@@ -282,17 +775,43 @@ mbs_getopt (int argc, char *argv[], struct mbs *s)
         s->statsfile = strdup (file);
     }
 
+    if (sync_interval->count > 0)
+    {
+        if (*sync_interval->ival < 0)
+        {
+            fprintf (stderr, "Invalid sync interval.\n");
+            arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+            exit (EXIT_FAILURE);
+        }
+
+        s->sync_interval = *sync_interval->ival;
+    }
+
     set_flag (&s->flags, !!verb->count, FLAG_VERBOSE);
     set_flag (&s->flags, !!available->count, FLAG_COUNTDOWN);
     set_flag (&s->flags, !!ascii->count, FLAG_ASCII);
     set_flag (&s->flags, !!keep_running->count, FLAG_NO_EXIT);
     set_flag (&s->flags, !!persistent->count, FLAG_PERSISTENT);
+    set_flag (&s->flags, !!netns->count, FLAG_NETNS);
+
+    set_flag (&s->flags, !!status_line->count, FLAG_STATUS_LINE);
+    set_flag (&s->flags, !!self_stats->count, FLAG_SELF_STATS);
+    set_flag (&s->flags, !!processes->count, FLAG_PROCESSES);
+
+    mbs_set_units (si->count ? MBS_UNITS_SI : MBS_UNITS_IEC);
+
+#ifdef HAVE_CURSES
+    set_flag (&s->flags, daemon->count || status_line->count, FLAG_DAEMON);
+#else
+    (void) daemon;
+    set_flag (&s->flags, true, FLAG_DAEMON);
+#endif
 
     if (s->flags & FLAG_VERBOSE) 
     {
         if (s->flags & FLAG_COUNTDOWN)
         {
-            char buf[10];
+            char buf[MBS_HUMAN_READABLE_MAX];
 
             printf (
                 "Running in countdown mode. Available data: %s\n", 
@@ -308,33 +827,332 @@ mbs_getopt (int argc, char *argv[], struct mbs *s)
     arg_freetable (argtable, sizeof(argtable) / sizeof(argtable[0]));
 }
 
+/*
+ * Switch from a kernel source which failed to getifaddrs(), and read again.
+ */
+static int
+fall_back (struct mbs *s)
+{
+    size_t i;
+
+    s->source->close (s);
+    s->source = &getifaddrs_source;
+    s->source->init (s);
+
+    /*
+     * The 32-bit counters reported by getifaddrs() are the low bits of the
+     * 64-bit ones, so truncating the snapshots keeps the next delta correct.
+     */
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        s->ifaces[i].snapshot.rx_bytes &= UINT32_MAX;
+        s->ifaces[i].snapshot.tx_bytes &= UINT32_MAX;
+    }
+
+    if (-1 == s->source->read (s))
+    {
+        const int err = errno;
+
+        if (s->flags & FLAG_VERBOSE)
+            perror (s->source->name);
+
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
 int 
-mbs_poll_interfaces (struct mbs *s, struct stats *stats)
+mbs_poll_interfaces (struct mbs *s, struct stats *delta)
 {
-    struct ifaddrs *ifa0, *ifa;
+    struct stats sum = { 0, 0, 0 };
+    size_t i, n_read = 0;
 
-    if (getifaddrs (&ifa0) == -1)
+    if (-1 == s->source->read (s))
     {
-        perror ("getifaddrs");
-        exit (EXIT_FAILURE);
+        /*
+         * Only getifaddrs() can stand in for the other kernel sources, since
+         * it reads the same interfaces; a trace, or the namespaces, have
+         * nothing to fall back on.
+         */
+        const bool kernel = &netlink_source == s->source
+                         || &sysfs_source == s->source;
+        const int err = errno;
+
+        if (s->flags & FLAG_VERBOSE)
+            perror (s->source->name);
+
+        errno = err;
+
+        /*
+         * Nothing was read, so nothing is accounted for. The snapshots are
+         * kept, and the next read which succeeds accounts for this tick too.
+         */
+        if (!kernel || -1 == fall_back (s))
+        {
+            const int reason = 0 != errno ? errno : EIO;
+
+            if (NULL == delta)
+            {
+                errno = reason;
+                return -1;
+            }
+
+            delta->rx_bytes = 0;
+            delta->tx_bytes = 0;
+            delta->timestamp = s->snapshot.timestamp;
+
+            for (i = 0; i < s->n_ifaces; ++i)
+            {
+                if (0 == s->ifaces[i].error)
+                    return 0;
+            }
+
+            errno = reason;
+            return -1;
+        }
     }
 
-    for (ifa = ifa0; ifa != NULL; ifa = ifa->ifa_next)
+    trace_record (s);
+
+    if (NULL != delta)
+    {
+        delta->rx_bytes = 0;
+        delta->tx_bytes = 0;
+        delta->timestamp = 0;
+    }
+
+    for (i = 0; i < s->n_ifaces; ++i)
     {
-        const unsigned short int sa_family = ifa->ifa_addr->sa_family;
+        struct iface *ifa = &s->ifaces[i];
 
-        if (sa_family == AF_PACKET && 0 == strcmp (ifa->ifa_name, s->ifa_name))  
+        if (0 != ifa->error)
         {
-            const struct rtnl_link_stats *if_stats = ifa->ifa_data;
+            /* Gone; if it comes back, its counters start over */
+            if (ENODEV == ifa->error)
+            {
+                ifa->snapshot.rx_bytes = 0;
+                ifa->snapshot.tx_bytes = 0;
+            }
 
-            stats->rx_bytes = if_stats->rx_bytes;
-            stats->tx_bytes = if_stats->tx_bytes;
+            continue;
+        }
 
-            freeifaddrs (ifa0);
-            return 0;
+        if (NULL != delta)
+        {
+            struct stats diff;
+
+            mbs_stats_delta (
+                &ifa->snapshot, &ifa->sample, s->source->bits, &diff
+            );
+
+            ifa->used.rx_bytes += diff.rx_bytes;
+            ifa->used.tx_bytes += diff.tx_bytes;
+
+            delta->rx_bytes += diff.rx_bytes;
+            delta->tx_bytes += diff.tx_bytes;
         }
+
+        ifa->snapshot = ifa->sample;
+
+        sum.rx_bytes += ifa->snapshot.rx_bytes;
+        sum.tx_bytes += ifa->snapshot.tx_bytes;
+
+        if (ifa->snapshot.timestamp > sum.timestamp)
+            sum.timestamp = ifa->snapshot.timestamp;
+
+        ++n_read;
     }
 
-    freeifaddrs (ifa0);
-    return -1;
+    s->snapshot = sum;
+
+    if (NULL != delta)
+        delta->timestamp = sum.timestamp;
+
+    return n_read > 0 ? 0 : -1;
+}
+
+uint64_t
+mbs_counter_delta (uint64_t prev, uint64_t cur, unsigned int bits)
+{
+    const uint64_t max = bits >= 64 ? UINT64_MAX : (1ULL << bits) - 1;
+
+    if (cur >= prev)
+        return cur - prev;
+
+    /* Counter was reset */
+    if (bits >= 64 || prev > max || prev <= max / 2)
+        return cur;
+
+    /* Counter wrapped around */
+    return (max - prev) + cur + 1;
+}
+
+void
+mbs_stats_delta (const struct stats *prev, const struct stats *cur,
+                 unsigned int bits, struct stats *diff)
+{
+    diff->rx_bytes = mbs_counter_delta (prev->rx_bytes, cur->rx_bytes, bits);
+    diff->tx_bytes = mbs_counter_delta (prev->tx_bytes, cur->tx_bytes, bits);
+}
+
+int
+mbs_link_event (struct mbs *s, const struct netlink_link *link)
+{
+    struct iface *ifa = NULL;
+    size_t i;
+    char *name;
+    bool down;
+
+    for (i = 0; i < s->n_ifaces && NULL == ifa; ++i)
+    {
+        if (s->ifaces[i].ifindex == (unsigned int) link->ifindex)
+            ifa = &s->ifaces[i];
+    }
+
+    for (i = 0; i < s->n_ifaces && NULL == ifa; ++i)
+    {
+        if (0 == strcmp (s->ifaces[i].name, link->name))
+            ifa = &s->ifaces[i];
+    }
+
+    if (NULL == ifa)
+        return 0;
+
+    if (link->removed)
+    {
+        ifa->ifindex = 0;
+        ifa->error = ENODEV;
+        return 1;
+    }
+
+    down = !(link->flags & IFF_RUNNING);
+
+    /* Nothing we care about has changed */
+    if (ifa->ifindex == (unsigned int) link->ifindex && ifa->down == down &&
+        0 == strcmp (ifa->name, link->name))
+        return 0;
+
+    /* Recreated, with counters which start over */
+    if (0 != ifa->ifindex && ifa->ifindex != (unsigned int) link->ifindex)
+    {
+        ifa->snapshot.rx_bytes = 0;
+        ifa->snapshot.tx_bytes = 0;
+    }
+
+    if (0 != strcmp (ifa->name, link->name) && '\0' != *link->name)
+    {
+        if (NULL == (name = strdup (link->name)))
+            return -1;
+
+        free (ifa->name);
+        ifa->name = name;
+    }
+
+    ifa->ifindex = link->ifindex;
+    ifa->down = down;
+
+    return 1;
+}
+
+unsigned int
+mbs_next_interval (const struct mbs *s, unsigned int current, uint64_t diff,
+                   uint64_t elapsed)
+{
+    uint64_t next;
+
+    if (0 == diff)
+    {
+        /* Idle; back off */
+        next = 2 * (uint64_t) current;
+    }
+    else
+    {
+        next = s->interval;
+
+        if ((s->flags & FLAG_COUNTDOWN) && elapsed > 0)
+        {
+            /* Milliseconds until the balance runs out at the current rate */
+            const double left = (double) s->balance * elapsed / diff / 1e6;
+
+            if (left / 4 < next)
+                next = left / 4;
+        }
+    }
+
+    if (next < s->min_interval)
+        next = s->min_interval;
+
+    if (next > s->max_interval)
+        next = s->max_interval;
+
+    return next;
+}
+
+int
+mbs_format_state (const struct mbs *s, char *buf, size_t size)
+{
+    return snprintf (
+        buf, size,
+        "%"PRIu64":%"PRIu64":%"PRIu64":%"PRIu64":%"PRIu64
+        ":%.0f:%.0f:%.0f:%.0f:%.0f",
+        s->snapshot.tx_bytes,
+        s->snapshot.rx_bytes,
+        s->used.tx_bytes,
+        s->used.rx_bytes,
+        s->balance,
+        s->rates.tx.value,
+        s->rates.rx.value,
+        s->rates.tx_avg.value,
+        s->rates.rx_avg.value,
+        s->flags & FLAG_COUNTDOWN ? rate_eta (&s->rates, s->balance) : -1
+    );
+}
+
+void
+mbs_cleanup (struct mbs *s)
+{
+    size_t i;
+
+    free (s->statsfile);
+    free (s->history);
+    free (s->rollups);
+    free (s->record);
+    free (s->socket);
+    free (s->shm);
+    free (s->collector);
+    free (s->host_name);
+    free (s->collector_key);
+
+    statsfile_close ();
+
+    if (-1 == history_close ())
+        fprintf (stderr, "Error writing to history log.\n");
+
+    rollup_close ();
+    trace_close ();
+    collect_close ();
+    procnet_close ();
+
+    if (NULL != s->source)
+        s->source->close (s);
+
+    for (i = 0; i < s->n_ifaces; ++i)
+        free (s->ifaces[i].name);
+
+    free (s->ifaces);
+
+    s->ifaces = NULL;
+    s->n_ifaces = 0;
+    s->statsfile = NULL;
+    s->history = NULL;
+    s->rollups = NULL;
+    s->record = NULL;
+    s->socket = NULL;
+    s->shm = NULL;
+    s->collector = NULL;
+    s->host_name = NULL;
+    s->collector_key = NULL;
+    s->source = NULL;
 }
@@ -41,8 +41,14 @@
 #ifndef MBS_H
 #define MBS_H
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include "rate.h"
+
+#ifdef HAVE_CURSES
 #include <ncurses.h>
+#endif
 
 /**
  * @brief An RX TX pair which represents the amount of data received and 
@@ -59,6 +65,12 @@ struct stats
      * @brief Bytes transmitted 
      */
     uint64_t tx_bytes;           
+
+    /**
+     * @brief `CLOCK_MONOTONIC` time, in nanoseconds, at which the counters
+     *        were read (see \ref mbs_now), or 0 if not applicable.
+     */
+    uint64_t timestamp;
 };
 
 /**
@@ -95,7 +107,162 @@ enum cmd_flags
      * were reset since last time the command was run (e.g., after a system 
      * reboot).
      */
-    FLAG_PERSISTENT = 1 << 4
+    FLAG_PERSISTENT = 1 << 4,
+
+    /**
+     * If this flag is set, the command monitors network namespaces rather
+     * than individual interfaces. Each entry in \ref mbs::ifaces then stands
+     * for all (matching) interfaces in one namespace.
+     *
+     * @see \ref netns.h
+     */
+    FLAG_NETNS = 1 << 5,
+
+    /**
+     * If this flag is set, the command runs without a terminal interface,
+     * e.g., as a system service. It is always set when the command is built
+     * without ncurses.
+     */
+    FLAG_DAEMON = 1 << 6,
+
+    /**
+     * If this flag is set, a single line of status is printed to stdout on
+     * every update, for status bars. It implies \ref FLAG_DAEMON.
+     *
+     * @see \ref status.h
+     */
+    FLAG_STATUS_LINE = 1 << 7,
+
+    /**
+     * If this flag is set, the time taken by each phase of a tick, and what
+     * the process has used, are printed on exit.
+     *
+     * @see \ref selfstats.h
+     */
+    FLAG_SELF_STATS = 1 << 8,
+
+    /**
+     * This flag is set by `mbs collect`, whose state is a fleet of hosts:
+     * each \ref iface is a host reporting to it.
+     *
+     * @see \ref collect.h
+     */
+    FLAG_FLEET = 1 << 9,
+
+    /**
+     * If this flag is set, the traffic is attributed to the processes which
+     * own sockets, and the busiest are shown.
+     *
+     * @see \ref procnet.h
+     */
+    FLAG_PROCESSES = 1 << 10
+};
+
+/**
+ * @brief A monitored network interface, and the amount of data sent and
+ *        received over it. When running with \ref FLAG_NETNS, this is instead
+ *        a network namespace, and with \ref FLAG_FLEET, a host.
+ */
+struct iface
+{
+    /**
+     * @brief Network interface name.
+     */
+    char *name;
+
+    /**
+     * @brief Cached kernel index of the interface, or 0 if not (yet) known.
+     */
+    unsigned int ifindex;
+
+    /**
+     * @brief `statistics/rx_bytes` file held open by the sysfs source, or -1.
+     */
+    int rx_fd;
+
+    /**
+     * @brief `statistics/tx_bytes` file held open by the sysfs source, or -1.
+     */
+    int tx_fd;
+
+    /**
+     * @brief Counters written by the most recent call to the source's
+     *        \ref counter_source::read "read" operation.
+     */
+    struct stats sample;
+
+    /**
+     * @brief Counter values the next delta is computed against.
+     */
+    struct stats snapshot;
+
+    /**
+     * @brief Amount of data used over this interface since the command was
+     *        launched.
+     */
+    struct stats used;
+
+    /**
+     * @brief 0 if \ref sample is valid, or an `errno` value (e.g., `ENODEV`)
+     *        describing why the interface could not be read.
+     */
+    int error;
+
+    /**
+     * @brief Whether the interface is known to be down (not `IFF_RUNNING`),
+     *        as last reported by a link event.
+     */
+    bool down;
+};
+
+struct mbs;
+struct netlink_link;
+
+/**
+ * @brief A backend which reads the RX and TX byte counters of the monitored
+ *        network interfaces.
+ *
+ * Backends keep whatever they need to poll cheaply (sockets, file
+ * descriptors, interface indices) in the \ref mbs and \ref iface structs
+ * between calls. The available backends are declared in \ref source.h.
+ */
+struct counter_source
+{
+    /**
+     * @brief Name used to select the backend with `--source=<name>`.
+     */
+    const char *name;
+
+    /**
+     * @brief Width (in bits) of the counters reported by \ref read.
+     *
+     * @see   \ref mbs_counter_delta
+     */
+    unsigned int bits;
+
+    /**
+     * @brief Acquire the resources used by the backend.
+     *
+     * @return 0 on success, or -1 if the backend is unavailable.
+     */
+    int (*init) (struct mbs *s);
+
+    /**
+     * @brief Read the current counter values of all interfaces, in a single
+     *        pass, into their \ref iface::sample "sample" fields.
+     *
+     * Interfaces which cannot be read have their \ref iface::error "error"
+     * field set, but that does not by itself make the read fail.
+     *
+     * @return 0 on success, or -1 if the source itself failed, in which case
+     *         `errno` is set.
+     */
+    int (*read) (struct mbs *s);
+
+    /**
+     * @brief Release the resources acquired by \ref init.
+     */
+    void (*close) (struct mbs *s);
 };
 
 /**
@@ -113,12 +280,13 @@ enum cmd_flags
 struct mbs
 {
     /**
-     * @brief Most recent TX RX value pair read.
+     * @brief Most recent TX RX value pair read, summed over all interfaces.
      */
     struct stats snapshot;       
 
     /**
-     * @brief Amount of data used since the command was launched.
+     * @brief Amount of data used since the command was launched, summed over
+     *        all interfaces.
      */
     struct stats used;           
 
@@ -132,12 +300,37 @@ struct mbs
      *
      * @see cmd_flags
      */
-    uint8_t flags;          
+    uint16_t flags;
 
     /**
-     * @brief Network interface name. 
+     * @brief Sampling interval while data is being transferred, in
+     *        milliseconds.
+     *
+     * @see   \ref mbs_next_interval
      */
-    char *ifa_name;       
+    unsigned int interval;
+
+    /**
+     * @brief Shortest sampling interval, used as the balance runs out, in
+     *        milliseconds.
+     */
+    unsigned int min_interval;
+
+    /**
+     * @brief Longest sampling interval, used while the link is idle, in
+     *        milliseconds.
+     */
+    unsigned int max_interval;
+
+    /**
+     * @brief Monitored network interfaces.
+     */
+    struct iface *ifaces;
+
+    /**
+     * @brief Number of elements in \ref ifaces.
+     */
+    size_t n_ifaces;
 
     /**
      * @brief Path to the file to which TX RX stats are written.
@@ -145,34 +338,200 @@ struct mbs
     char *statsfile;
 
     /**
-     * @brief ncurses window
+     * @brief Minimum number of seconds between flushes of the stats file to
+     *        disk.
+     *
+     * @see   \ref statsfile.h
+     */
+    unsigned int sync_interval;
+
+    /**
+     * @brief Path of the usage history log, or `NULL`.
+     *
+     * @see   \ref history.h
+     */
+    char *history;
+
+    /**
+     * @brief Path of the per-minute, hour, day and month totals, or `NULL`.
+     *
+     * @see   \ref rollup.h
+     */
+    char *rollups;
+
+    /**
+     * @brief Path of the trace to record the counters to, or `NULL`.
+     *
+     * @see   \ref trace.h
+     */
+    char *record;
+
+    /**
+     * @brief Path of the Unix domain socket to serve queries on, or `NULL`.
+     *
+     * @see   \ref server.h
+     */
+    char *socket;
+
+    /**
+     * @brief Name of the shared-memory segment to publish counters in, or
+     *        `NULL`.
+     *
+     * @see   \ref shm.h
+     */
+    char *shm;
+
+    /**
+     * @brief Local TCP port to serve OpenMetrics on, or 0.
+     *
+     * @see   \ref metrics.h
+     */
+    unsigned short metrics_port;
+
+    /**
+     * @brief Address of the collector to report usage to, or `NULL`.
+     *
+     * @see   \ref collect.h
+     */
+    char *collector;
+
+    /**
+     * @brief Name to report to the collector as, or `NULL` for the host
+     *        name.
+     */
+    char *host_name;
+
+    /**
+     * @brief File holding the key to sign reports to the collector with, or
+     *        `NULL`.
+     */
+    char *collector_key;
+
+#ifdef HAVE_CURSES
+    /**
+     * @brief ncurses window, or `NULL` in daemon mode.
      */
     WINDOW *win;            
+#endif
+
+    /**
+     * @brief Backend used to read the interface counters.
+     *
+     * @see   \ref counter_source
+     */
+    const struct counter_source *source;
+
+    /**
+     * @brief `NETLINK_ROUTE` socket held open by the netlink source, or -1.
+     *
+     * @see   \ref netlink.h
+     */
+    int nl_fd;
+
+    /**
+     * @brief Smoothed TX and RX rates, updated once per tick.
+     *
+     * @see   \ref rate.h
+     */
+    struct rates rates;
+};
+
+/**
+ * @brief Default sampling interval, in milliseconds.
+ */
+#define MBS_DEFAULT_INTERVAL 200
+
+/**
+ * @brief Shortest sampling interval accepted by `--interval`, in
+ *        milliseconds.
+ */
+#define MBS_MIN_INTERVAL 10
+
+/**
+ * @brief Default for the longest sampling interval, which the command backs
+ *        off to while the link is idle, in milliseconds.
+ */
+#define MBS_DEFAULT_MAX_INTERVAL 2000
+
+/**
+ * @brief Size of a buffer which can hold any line produced by
+ *        \ref mbs_format_state.
+ */
+#define MBS_STATE_LINE_MAX 256
+
+/**
+ * @brief Size of a buffer which can hold any string produced by
+ *        \ref format_bytes or \ref to_human_readable, such as `1023.99999P`.
+ */
+#define MBS_HUMAN_READABLE_MAX 16
+
+/**
+ * @brief Which powers amounts are printed in.
+ */
+enum mbs_units
+{
+    /**
+     * @brief Powers of 1024, as `K`, `M`, `G`, `T`, `P` and `E` (the
+     *        default).
+     */
+    MBS_UNITS_IEC,
 
     /**
-     * @brief File pointer representing the stats file.
+     * @brief Powers of 1000, as `k`, `m`, `g`, `t`, `p` and `e`, which is
+     *        how \ref parse_bytes reads them back.
      */
-    FILE *file;
+    MBS_UNITS_SI
 };
 
+/**
+ * @brief Read the monotonic clock.
+ *
+ * @return The current `CLOCK_MONOTONIC` time, in nanoseconds.
+ */
+uint64_t mbs_now (void);
+
+/**
+ * @brief Write \a bytes in human-readable form, to \a buf.
+ *
+ * The amount is expressed as a multiple of the largest power of the unit base
+ * (1024 or 1000) which is not greater than it, up to an exabyte, and rounded to
+ * as many decimals as the power. For instance 1442 is written as `1.4K`, and
+ * 4 GiB as `4.000G`. The arithmetic is done in integers, so that the result is
+ * exact for any 64-bit amount, and \a buf is never written past
+ * \ref MBS_HUMAN_READABLE_MAX bytes.
+ *
+ * @param  bytes The number of bytes to translate.
+ * @param  units Whether to use powers of 1024 or 1000.
+ * @param  buf   A buffer of at least \ref MBS_HUMAN_READABLE_MAX bytes.
+ * @return       A pointer identical to \a buf.
+ */
+char *format_bytes (uint64_t bytes, enum mbs_units units, char *buf);
+
+/**
+ * @brief Set the units which \ref to_human_readable uses, e.g., for `--si`.
+ *
+ * @param  units Whether to use powers of 1024 (the default) or 1000.
+ * @return Nothing
+ */
+void mbs_set_units (enum mbs_units units);
+
 /**
  * @brief Translate \a bytes to human-readable form.
  *
- * The input is written (as a string) to \a buf, expressed as a (rounded) 
- * multiplicative factor of the nearest lower power of 1024. For instance 1442 
- * is translated to the string `1.4K`. Note that \a buf must be large enough to 
- * contain the result, including the terminating null character.
+ * This is \ref format_bytes, in the units set with \ref mbs_set_units, for
+ * amounts (such as rates) which are not whole. They are rounded to the nearest
+ * byte first, and negative amounts count as zero.
  *
  * The function returns a pointer to the character buffer, so that it can be 
  * used in function composition, as in the following example:
  *
  * @code
- * char buf[10];
+ * char buf[MBS_HUMAN_READABLE_MAX];
  * printf ("Available data: %s\n", to_human_readable (bytes, buf)); 
  * @endcode
  *
  * @param  bytes The number of bytes to translate.
- * @param  buf   A character buffer to write the result to.
+ * @param  buf   A buffer of at least \ref MBS_HUMAN_READABLE_MAX bytes.
  * @return       A pointer identical to \a buf.
  */
 char *to_human_readable (double bytes, char *buf);
@@ -183,7 +542,9 @@ char *to_human_readable (double bytes, char *buf);
  *
  * This is a utility function, used to parse user provided byte amounts (e.g.,
  * `10K`) to numeric form. If no suffix is given, the behavior of this function
- * should be similar, if not identical, to that of `strtoull()`. 
+ * should be similar, if not identical, to that of `strtoull()`. A fractional
+ * part is allowed, as in `1.5G`, and the result is rounded down to whole bytes.
+ * The amount is parsed exactly, without going through floating point.
  *
  * The following suffixes are recognized:
  *
@@ -196,6 +557,12 @@ char *to_human_readable (double bytes, char *buf);
  * | **MB**, **M**, or **MiB**  | Mebibyte<sup>†</sup>   | 2<sup>20</sup>   |
  * | **gB**, or **g**           | Gigabyte               | 1000<sup>3</sup> |
  * | **GB**, **G**, or **GiB**  | Gibibyte<sup>†</sup>   | 2<sup>30</sup>   |
+ * | **tB**, or **t**           | Terabyte               | 1000<sup>4</sup> |
+ * | **TB**, **T**, or **TiB**  | Tebibyte<sup>†</sup>   | 2<sup>40</sup>   |
+ * | **pB**, or **p**           | Petabyte               | 1000<sup>5</sup> |
+ * | **PB**, **P**, or **PiB**  | Pebibyte<sup>†</sup>   | 2<sup>50</sup>   |
+ * | **eB**, or **e**           | Exabyte                | 1000<sup>6</sup> |
+ * | **EB**, **E**, or **EiB**  | Exbibyte<sup>†</sup>   | 2<sup>60</sup>   |
  *
  * †) Defined by the International Electrotechnical Commission (IEC).
  *
@@ -203,7 +570,8 @@ char *to_human_readable (double bytes, char *buf);
  *                character.
  * @param  result A pointer to a 64-bit integer, which will contain the result
  *                if the function is successful (i.e., the return code is 0).
- * @return        0 on success, or -1 if an error occured.
+ * @return        0 on success, or -1 if the amount is malformed or does not
+ *                fit in 64 bits.
  */
 int parse_bytes (const char *str, uint64_t *result);
 
@@ -222,16 +590,152 @@ int parse_bytes (const char *str, uint64_t *result);
 void mbs_getopt (int argc, char *argv[], struct mbs *s);
 
 /**
- * @brief Sample the amount of data transmitted and received since the last
- *        iteration and write the results to the provided \ref stats struct. 
+ * @brief Add an interface to the list of monitored interfaces, unless it is
+ *        already in it.
+ *
+ * @param  s    An \ref mbs struct holding application state and configuration
+ *              settings.
+ * @param  name Interface name. The string is copied.
+ * @return      0 on success, or -1 if an error occured.
+ */
+int mbs_add_iface (struct mbs *s, const char *name);
+
+/**
+ * @brief Remove an interface from the list of monitored interfaces, keeping
+ *        the order of the others. What was used over it stays in the totals.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @param  i Index of the interface in \ref mbs::ifaces.
+ * @return Nothing
+ */
+void mbs_remove_iface (struct mbs *s, size_t i);
+
+/**
+ * @brief Sample the amount of data transmitted and received over each of the
+ *        monitored interfaces since the last iteration, and write the
+ *        combined amount to the provided \ref stats struct.
+ *
+ * All interfaces are read in a single pass, using the backend selected by
+ * `s->source`. Should the `netlink` or `sysfs` backend fail for any other
+ * reason than an interface being absent, it is closed and the function falls
+ * back to the `getifaddrs` source on this and every following call. Since
+ * that only provides 32-bit counters, the snapshots are truncated
+ * accordingly. Other backends have nothing to fall back on. If no backend
+ * could read, nothing is accounted for on this call: \a delta is zero, and
+ * the snapshots are kept, so that the next successful read accounts for the
+ * traffic in between.
+ *
+ * The per-interface snapshots and usage are updated, and `s->snapshot` is
+ * set to the sum of the current counters. The `timestamp` of `s->snapshot`
+ * and of \a delta is the time of the most recent read. An interface which is
+ * gone (its \ref iface::error "error" is `ENODEV`) has its snapshot reset, so
+ * that if it comes back, its counters are accounted for from zero. An
+ * interface which cannot be read for any other reason keeps its snapshot. If
+ * a trace is being recorded, the counters read are written to it (see
+ * \ref trace_record).
  *
  * @param  s     An \ref mbs struct holding application state and configuration
  *               settings. (Like `this` in class-based OOP).
- * @param  stats A struct to which the the amount of data received and 
+ * @param  delta A struct to which the the amount of data received and
  *               transmitted since the last iteration will be written, if the 
- *               function is successful.
- * @return       0 on success, or -1 if an error occured.
+ *               function is successful. If this is `NULL`, the snapshots are
+ *               only initialized from the current counters, and nothing is
+ *               accounted for. This is done once, on startup.
+ * @return       0 on success, or -1 if none of the interfaces could be read,
+ *               or if the backend failed on the initial read, in which case
+ *               `errno` is set.
+ */
+int mbs_poll_interfaces (struct mbs *s, struct stats *delta);
+
+/**
+ * @brief Compute the amount by which a kernel counter has advanced between
+ *        two successive reads, taking wrap-around and resets into account.
+ *
+ * If \a cur is less than \a prev, the counter has either wrapped around or
+ * been reset (e.g., because the interface was recreated). A 64-bit counter
+ * cannot realistically wrap, so this is always treated as a reset, and the
+ * delta is \a cur. Narrower counters are assumed to have wrapped if \a prev
+ * was in the upper half of their range, and to have been reset otherwise.
+ *
+ * @param  prev The previous counter value.
+ * @param  cur  The current counter value.
+ * @param  bits Width of the counter in bits (e.g., 32 or 64).
+ * @return      The number of bytes counted between the two reads.
+ */
+uint64_t mbs_counter_delta (uint64_t prev, uint64_t cur, unsigned int bits);
+
+/**
+ * @brief Apply \ref mbs_counter_delta to both the RX and TX counters.
+ *
+ * @param  prev The previous counter values.
+ * @param  cur  The current counter values.
+ * @param  bits Width of the counters in bits.
+ * @param  diff A struct to which the deltas are written.
+ * @return      Nothing
+ */
+void mbs_stats_delta (const struct stats *prev, const struct stats *cur,
+                      unsigned int bits, struct stats *diff);
+
+/**
+ * @brief Apply a link event to the monitored interfaces.
+ *
+ * Interfaces are matched by index, and failing that, by name. A matching
+ * interface which was removed is marked as gone (`ENODEV`). One which was
+ * renamed takes on the new name, and one which (re)appeared picks up its new
+ * index. One which was recreated under a new index has its snapshot reset,
+ * since its counters start over. The \ref iface::down "down" field follows the `IFF_RUNNING` flag.
+ *
+ * @param  s    An \ref mbs struct holding application state and
+ *              configuration settings.
+ * @param  link The interface, as reported by \ref netlink_read_link_events.
+ * @return      1 if one of the monitored interfaces was affected, 0 if not,
+ *              or -1 if out of memory.
+ */
+int mbs_link_event (struct mbs *s, const struct netlink_link *link);
+
+/**
+ * @brief Decide how long to wait before taking the next sample.
+ *
+ * While the link is idle (\a diff is 0), the interval doubles every tick, up
+ * to `s->max_interval`. As soon as data is transferred again, it drops back
+ * to `s->interval`. In countdown mode, the interval is further shortened as
+ * the balance approaches zero: to a quarter of the time it would take to run
+ * out at the observed rate, but never below `s->min_interval`.
+ *
+ * @param  s       An \ref mbs struct holding application state and
+ *                 configuration settings.
+ * @param  current The interval used for the current tick, in milliseconds.
+ * @param  diff    Amount of data transferred during the current tick.
+ * @param  elapsed Duration of the current tick, in nanoseconds.
+ * @return         The next interval, in milliseconds.
+ */
+unsigned int mbs_next_interval (const struct mbs *s, unsigned int current,
+                                uint64_t diff, uint64_t elapsed);
+
+/**
+ * @brief Format the current state as a single line of colon-separated
+ *        fields, as served over the socket: the TX and RX snapshots, the
+ *        TX and RX usage, the balance, the current and average TX and RX
+ *        rates, and the time left in seconds (or -1).
+ *
+ * @param  s    An \ref mbs struct holding application state and
+ *              configuration settings.
+ * @param  buf  The output buffer. No newline is added.
+ * @param  size Size of \a buf; \ref MBS_STATE_LINE_MAX is always enough.
+ * @return      The length of the line.
+ */
+int mbs_format_state (const struct mbs *s, char *buf, size_t size);
+
+/**
+ * @brief Release all resources held by an \ref mbs struct: the interfaces,
+ *        the stats file name, the stats file, the history log, the rollups,
+ *        the recorded trace, and the counter source.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @return Nothing
  */
-int mbs_poll_interfaces (struct mbs *s, struct stats *stats);
+void mbs_cleanup (struct mbs *s);
 
 #endif 
@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "metrics.h"
+
+struct client
+{
+    int fd;
+    size_t len;
+    char buf[1024];
+};
+
+static int epfd = -1;
+static int listen_fd = -1;
+
+static struct client clients[METRICS_MAX_CLIENTS];
+static size_t n_clients = 0;
+
+/* Kept between scrapes */
+static char *response = NULL;
+static size_t response_size = 0;
+
+/*
+ * Text is appended with vsnprintf. Once it no longer fits, the rest is only
+ * measured, so that the caller knows how large the buffer needs to be.
+ */
+struct output
+{
+    char *buf;
+    size_t size;
+    size_t len;
+};
+
+static void
+append (struct output *out, const char *format, ...)
+{
+    va_list args;
+    int n;
+
+    va_start (args, format);
+    n = vsnprintf (out->len < out->size ? out->buf + out->len : NULL,
+                   out->len < out->size ? out->size - out->len : 0,
+                   format, args);
+    va_end (args);
+
+    if (n > 0)
+        out->len += n;
+}
+
+/*
+ * Escape a label value, as required by the exposition format.
+ */
+static const char *
+escape (const char *value, char *buf, size_t size)
+{
+    size_t i = 0;
+
+    for (; '\0' != *value && i + 2 < size; ++value)
+    {
+        if ('\\' == *value || '"' == *value || '\n' == *value)
+        {
+            buf[i++] = '\\';
+            buf[i++] = '\n' == *value ? 'n' : *value;
+        }
+        else
+        {
+            buf[i++] = *value;
+        }
+    }
+
+    buf[i] = '\0';
+    return buf;
+}
+
+static void
+render (const struct mbs *s, struct output *out)
+{
+    char name[512];
+    size_t i;
+
+    append (out,
+        "# TYPE mbs_tx_bytes counter\n"
+        "# UNIT mbs_tx_bytes bytes\n"
+        "# HELP mbs_tx_bytes Data sent, over all interfaces.\n"
+        "mbs_tx_bytes_total %"PRIu64"\n"
+        "# TYPE mbs_rx_bytes counter\n"
+        "# UNIT mbs_rx_bytes bytes\n"
+        "# HELP mbs_rx_bytes Data received, over all interfaces.\n"
+        "mbs_rx_bytes_total %"PRIu64"\n",
+        s->used.tx_bytes, s->used.rx_bytes);
+
+    append (out,
+        "# TYPE mbs_interface_tx_bytes counter\n"
+        "# UNIT mbs_interface_tx_bytes bytes\n"
+        "# HELP mbs_interface_tx_bytes Data sent, per interface.\n");
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        append (out, "mbs_interface_tx_bytes_total{interface=\"%s\"} "
+            "%"PRIu64"\n", escape (s->ifaces[i].name, name, sizeof (name)),
+            s->ifaces[i].used.tx_bytes);
+    }
+
+    append (out,
+        "# TYPE mbs_interface_rx_bytes counter\n"
+        "# UNIT mbs_interface_rx_bytes bytes\n"
+        "# HELP mbs_interface_rx_bytes Data received, per interface.\n");
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        append (out, "mbs_interface_rx_bytes_total{interface=\"%s\"} "
+            "%"PRIu64"\n", escape (s->ifaces[i].name, name, sizeof (name)),
+            s->ifaces[i].used.rx_bytes);
+    }
+
+    append (out,
+        "# TYPE mbs_tx_rate_bytes_per_second gauge\n"
+        "# HELP mbs_tx_rate_bytes_per_second Smoothed rate of data sent.\n"
+        "mbs_tx_rate_bytes_per_second{window=\"current\"} %.0f\n"
+        "mbs_tx_rate_bytes_per_second{window=\"average\"} %.0f\n"
+        "# TYPE mbs_rx_rate_bytes_per_second gauge\n"
+        "# HELP mbs_rx_rate_bytes_per_second Smoothed rate of data received.\n"
+        "mbs_rx_rate_bytes_per_second{window=\"current\"} %.0f\n"
+        "mbs_rx_rate_bytes_per_second{window=\"average\"} %.0f\n",
+        s->rates.tx.value, s->rates.tx_avg.value,
+        s->rates.rx.value, s->rates.rx_avg.value);
+
+    if (s->flags & FLAG_COUNTDOWN)
+    {
+        const double left = rate_eta (&s->rates, s->balance);
+
+        append (out,
+            "# TYPE mbs_balance_bytes gauge\n"
+            "# UNIT mbs_balance_bytes bytes\n"
+            "# HELP mbs_balance_bytes Data left to use.\n"
+            "mbs_balance_bytes %"PRIu64"\n", s->balance);
+
+        append (out,
+            "# TYPE mbs_time_left_seconds gauge\n"
+            "# UNIT mbs_time_left_seconds seconds\n"
+            "# HELP mbs_time_left_seconds Time until the balance runs out, at "
+            "the average rate.\n");
+
+        if (left >= 0)
+            append (out, "mbs_time_left_seconds %.0f\n", left);
+    }
+
+    append (out, "# EOF\n");
+}
+
+int
+metrics_render (const struct mbs *s, char **buf, size_t *size)
+{
+    struct output out = { *buf, *size, 0 };
+
+    render (s, &out);
+
+    if (out.len >= *size)
+    {
+        char *grown = realloc (*buf, out.len + 1);
+
+        if (NULL == grown)
+            return -1;
+
+        *buf = grown;
+        *size = out.len + 1;
+
+        out.buf = grown;
+        out.size = *size;
+        out.len = 0;
+
+        render (s, &out);
+    }
+
+    return out.len;
+}
+
+int
+metrics_open (unsigned short port)
+{
+    const int on = 1;
+    struct sockaddr_in addr;
+    struct epoll_event ev;
+
+    listen_fd = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        0);
+
+    if (-1 == listen_fd)
+        return -1;
+
+    memset (&addr, 0, sizeof (addr));
+
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons (port);
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+    memset (&ev, 0, sizeof (ev));
+
+    ev.events  = EPOLLIN;
+    ev.data.fd = listen_fd;
+
+    if (-1 == setsockopt (listen_fd, SOL_SOCKET, SO_REUSEADDR, &on,
+                          sizeof (on))
+     || -1 == bind (listen_fd, (struct sockaddr *) &addr, sizeof (addr))
+     || -1 == listen (listen_fd, 16)
+     || -1 == (epfd = epoll_create1 (EPOLL_CLOEXEC))
+     || -1 == epoll_ctl (epfd, EPOLL_CTL_ADD, listen_fd, &ev))
+    {
+        const int err = errno;
+
+        metrics_close ();
+        errno = err;
+        return -1;
+    }
+
+    return epfd;
+}
+
+static void
+drop_client (struct client *c)
+{
+    epoll_ctl (epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close (c->fd);
+
+    *c = clients[--n_clients];
+}
+
+static void
+accept_clients (void)
+{
+    struct epoll_event ev;
+    int fd;
+
+    while (-1 != (fd = accept4 (listen_fd, NULL, NULL,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC)))
+    {
+        memset (&ev, 0, sizeof (ev));
+
+        ev.events  = EPOLLIN;
+        ev.data.fd = fd;
+
+        if (METRICS_MAX_CLIENTS == n_clients ||
+            -1 == epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev))
+        {
+            close (fd);
+            continue;
+        }
+
+        clients[n_clients].fd = fd;
+        clients[n_clients++].len = 0;
+    }
+}
+
+/*
+ * Answer a complete request. The connection is closed afterwards, so a
+ * response which cannot be sent in one go is cut short.
+ */
+static void
+respond (const struct mbs *s, struct client *c)
+{
+    static const char not_found[] =
+        "HTTP/1.1 404 Not Found\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+
+    char header[256];
+    int len, n;
+
+    if (0 != strncmp (c->buf, "GET /metrics ", 13))
+    {
+        send (c->fd, not_found, sizeof (not_found) - 1, MSG_NOSIGNAL);
+        return;
+    }
+
+    if (-1 == (len = metrics_render (s, &response, &response_size)))
+        return;
+
+    n = snprintf (header, sizeof (header),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/openmetrics-text; version=1.0.0; "
+        "charset=utf-8\r\n"
+        "Content-Length: %d\r\n"
+        "Connection: close\r\n\r\n", len);
+
+    if (n == send (c->fd, header, n, MSG_NOSIGNAL | MSG_MORE))
+        send (c->fd, response, len, MSG_NOSIGNAL);
+}
+
+void
+metrics_dispatch (const struct mbs *s)
+{
+    struct epoll_event events[16];
+    struct client *c = NULL;
+    ssize_t n;
+    int i, k, count;
+
+    if (-1 == (count = epoll_wait (epfd, events, 16, 0)))
+        return;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (events[i].data.fd == listen_fd)
+        {
+            accept_clients ();
+            continue;
+        }
+
+        for (k = 0, c = NULL; k < (int) n_clients && NULL == c; ++k)
+        {
+            if (clients[k].fd == events[i].data.fd)
+                c = &clients[k];
+        }
+
+        /* Already dropped */
+        if (NULL == c)
+            continue;
+
+        n = read (c->fd, c->buf + c->len, sizeof (c->buf) - c->len - 1);
+
+        if (n < 0 && (EAGAIN == errno || EINTR == errno))
+            continue;
+
+        if (n > 0)
+        {
+            c->len += n;
+            c->buf[c->len] = '\0';
+
+            /* Wait for the rest of the headers, if there is room */
+            if (NULL == strstr (c->buf, "\r\n\r\n") &&
+                c->len < sizeof (c->buf) - 1)
+                continue;
+
+            respond (s, c);
+        }
+
+        drop_client (c);
+    }
+}
+
+void
+metrics_close (void)
+{
+    while (n_clients > 0)
+        drop_client (&clients[n_clients - 1]);
+
+    if (-1 != listen_fd)
+        close (listen_fd);
+
+    if (-1 != epfd)
+        close (epfd);
+
+    free (response);
+
+    listen_fd = -1;
+    epfd = -1;
+    response = NULL;
+    response_size = 0;
+}
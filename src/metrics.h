@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file metrics.h
+ * @brief An embedded HTTP endpoint which serves the current state in the
+ *        OpenMetrics text format (`--metrics-port=<port>`), for Prometheus
+ *        and compatible scrapers.
+ *
+ * The listener is bound to the loopback address only. `GET /metrics` returns
+ * the following metrics; anything else gets a 404.
+ *
+ * | Metric                                  | Type    | Labels      |
+ * |-----------------------------------------|---------|-------------|
+ * | `mbs_tx_bytes_total`                    | counter |             |
+ * | `mbs_rx_bytes_total`                    | counter |             |
+ * | `mbs_interface_tx_bytes_total`          | counter | `interface` |
+ * | `mbs_interface_rx_bytes_total`          | counter | `interface` |
+ * | `mbs_balance_bytes`                     | gauge   |             |
+ * | `mbs_tx_rate_bytes_per_second`          | gauge   | `window`    |
+ * | `mbs_rx_rate_bytes_per_second`          | gauge   | `window`    |
+ * | `mbs_time_left_seconds`                 | gauge   |             |
+ *
+ * The `window` label is `current` or `average` (see \ref rate.h). The
+ * balance and time left are only present in countdown mode, and the time
+ * left only while data is being transferred.
+ *
+ * Responses are rendered into a buffer which is kept between scrapes, so a
+ * scrape does not allocate once the buffer has grown to size.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "mbs.h"
+
+/**
+ * @brief Maximum number of scrapes served at the same time.
+ */
+#define METRICS_MAX_CLIENTS 16
+
+/**
+ * @brief Start listening on `127.0.0.1:<port>`.
+ *
+ * @param  port The TCP port.
+ * @return      A file descriptor which becomes readable when the listener
+ *              has work to do (see \ref metrics_dispatch), or -1 if an error
+ *              occured, in which case `errno` is set.
+ */
+int metrics_open (unsigned short port);
+
+/**
+ * @brief Accept new connections and answer complete requests, without
+ *        blocking.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @return Nothing
+ */
+void metrics_dispatch (const struct mbs *s);
+
+/**
+ * @brief Close all connections and the listener, and free the buffer.
+ *
+ * @return Nothing
+ */
+void metrics_close (void);
+
+/**
+ * @brief Render the metrics into a buffer, growing it as needed.
+ *
+ * @param  s    An \ref mbs struct holding application state and
+ *              configuration settings.
+ * @param  buf  The buffer, which may be reallocated.
+ * @param  size Size of \a buf, updated if it grows.
+ * @return      The length of the text, or -1 if out of memory.
+ */
+int metrics_render (const struct mbs *s, char **buf, size_t *size);
+
+#endif
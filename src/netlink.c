@@ -0,0 +1,486 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <linux/if_link.h>
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "netlink.h"
+
+int
+netlink_open (void)
+{
+    return socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+}
+
+static uint32_t seq;
+
+/*
+ * Some kernels (before 4.7) do not know about RTM_GETSTATS. On those, we ask
+ * for the whole link instead and pick IFLA_STATS64 out of the reply.
+ */
+static bool getstats_unsupported = false;
+
+static int
+request (int fd, struct nlmsghdr *req, uint16_t flags)
+{
+    req->nlmsg_flags = NLM_F_REQUEST | flags;
+    req->nlmsg_seq   = ++seq;
+
+    return -1 == send (fd, req, req->nlmsg_len, 0) ? -1 : 0;
+}
+
+static void
+copy_stats64 (const struct rtattr *rta, struct stats *stats)
+{
+    struct rtnl_link_stats64 link;
+
+    memset (&link, 0, sizeof (link));
+    memcpy (&link, RTA_DATA (rta), RTA_PAYLOAD (rta) < sizeof (link) ?
+        RTA_PAYLOAD (rta) : sizeof (link));
+
+    stats->rx_bytes = link.rx_bytes;
+    stats->tx_bytes = link.tx_bytes;
+}
+
+/*
+ * Read the reply to the most recent request and extract the 64-bit counters
+ * from the attribute of the given type. The attributes start `hdrlen` bytes
+ * into the payload of a message of type `type`.
+ */
+static int
+reply (int fd, uint16_t type, size_t hdrlen, unsigned short attr,
+       struct stats *stats)
+{
+    /* Large enough for RTM_NEWSTATS, and for RTM_NEWLINK on most links */
+    char buf[8192] __attribute__ ((aligned (NLMSG_ALIGNTO)));
+
+    struct nlmsghdr *nlh;
+    ssize_t len;
+
+    /*
+     * The kernel answers synchronously, so the reply is already queued by
+     * the time send returns. Skip anything left over from an earlier request
+     * by matching on the sequence number.
+     */
+    while ((len = recv (fd, buf, sizeof (buf), MSG_DONTWAIT)) > 0)
+    {
+        for (nlh = (struct nlmsghdr *) buf; NLMSG_OK (nlh, len);
+             nlh = NLMSG_NEXT (nlh, len))
+        {
+            struct rtattr *rta;
+            int rta_len;
+
+            if (nlh->nlmsg_seq != seq)
+                continue;
+
+            if (NLMSG_ERROR == nlh->nlmsg_type)
+            {
+                const struct nlmsgerr *err = NLMSG_DATA (nlh);
+
+                errno = -err->error;
+                return -1;
+            }
+
+            if (type != nlh->nlmsg_type)
+                continue;
+
+            rta = (struct rtattr *) ((char *) NLMSG_DATA (nlh) +
+                NLMSG_ALIGN (hdrlen));
+            rta_len = NLMSG_PAYLOAD (nlh, hdrlen);
+
+            for (; RTA_OK (rta, rta_len); rta = RTA_NEXT (rta, rta_len))
+            {
+                if (attr == rta->rta_type)
+                {
+                    copy_stats64 (rta, stats);
+                    return 0;
+                }
+            }
+
+            errno = EOPNOTSUPP;
+            return -1;
+        }
+    }
+
+    if (0 == len || (-1 == len && (EAGAIN == errno || EWOULDBLOCK == errno)))
+        errno = EIO;
+
+    return -1;
+}
+
+static int
+read_link_stats64 (int fd, unsigned int ifindex, struct stats *stats)
+{
+    struct
+    {
+        struct nlmsghdr  nlh;
+        struct ifinfomsg ifi;
+    } req;
+
+    memset (&req, 0, sizeof (req));
+
+    req.nlh.nlmsg_len  = NLMSG_LENGTH (sizeof (req.ifi));
+    req.nlh.nlmsg_type = RTM_GETLINK;
+
+    req.ifi.ifi_family = AF_UNSPEC;
+    req.ifi.ifi_index  = ifindex;
+
+    if (-1 == request (fd, &req.nlh, 0))
+        return -1;
+
+    return reply (fd, RTM_NEWLINK, sizeof (req.ifi), IFLA_STATS64, stats);
+}
+
+int
+netlink_read_stats (int fd, unsigned int ifindex, struct stats *stats)
+{
+#ifdef RTM_GETSTATS
+    struct
+    {
+        struct nlmsghdr      nlh;
+        struct if_stats_msg  ifsm;
+    } req;
+
+    if (true == getstats_unsupported)
+        return read_link_stats64 (fd, ifindex, stats);
+
+    memset (&req, 0, sizeof (req));
+
+    req.nlh.nlmsg_len  = NLMSG_LENGTH (sizeof (req.ifsm));
+    req.nlh.nlmsg_type = RTM_GETSTATS;
+
+    req.ifsm.family      = AF_UNSPEC;
+    req.ifsm.ifindex     = ifindex;
+    req.ifsm.filter_mask = IFLA_STATS_FILTER_BIT (IFLA_STATS_LINK_64);
+
+    if (-1 == request (fd, &req.nlh, 0))
+        return -1;
+
+    if (0 == reply (fd, RTM_NEWSTATS, sizeof (req.ifsm), IFLA_STATS_LINK_64,
+        stats))
+        return 0;
+
+    if (EOPNOTSUPP != errno && EINVAL != errno)
+        return -1;
+
+    getstats_unsupported = true;
+#endif
+    return read_link_stats64 (fd, ifindex, stats);
+}
+
+/*
+ * Fill in a netlink_link from an RTM_NEWLINK or RTM_DELLINK message.
+ */
+static void
+parse_link (const struct nlmsghdr *nlh, struct netlink_link *link)
+{
+    const struct ifinfomsg *ifi = NLMSG_DATA (nlh);
+    struct rtattr *rta;
+    int rta_len;
+
+    memset (link, 0, sizeof (*link));
+
+    link->ifindex = ifi->ifi_index;
+    link->flags   = ifi->ifi_flags;
+    link->name    = "";
+    link->removed = RTM_DELLINK == nlh->nlmsg_type;
+
+    rta = IFLA_RTA (ifi);
+    rta_len = IFLA_PAYLOAD (nlh);
+
+    for (; RTA_OK (rta, rta_len); rta = RTA_NEXT (rta, rta_len))
+    {
+        if (IFLA_IFNAME == rta->rta_type)
+            link->name = RTA_DATA (rta);
+        else if (IFLA_STATS64 == rta->rta_type)
+            copy_stats64 (rta, &link->stats);
+    }
+}
+
+int
+netlink_dump_links (int fd,
+                    void (*cb) (const struct netlink_link *link, void *arg),
+                    void *arg)
+{
+    struct
+    {
+        struct nlmsghdr  nlh;
+        struct ifinfomsg ifi;
+    } req;
+
+    char buf[32768] __attribute__ ((aligned (NLMSG_ALIGNTO)));
+
+    memset (&req, 0, sizeof (req));
+
+    req.nlh.nlmsg_len  = NLMSG_LENGTH (sizeof (req.ifi));
+    req.nlh.nlmsg_type = RTM_GETLINK;
+
+    req.ifi.ifi_family = AF_UNSPEC;
+
+    if (-1 == request (fd, &req.nlh, NLM_F_DUMP))
+        return -1;
+
+    for (;;)
+    {
+        struct nlmsghdr *nlh;
+        ssize_t len;
+
+        if ((len = recv (fd, buf, sizeof (buf), 0)) <= 0)
+        {
+            if (0 == len)
+                errno = EIO;
+
+            return -1;
+        }
+
+        for (nlh = (struct nlmsghdr *) buf; NLMSG_OK (nlh, len);
+             nlh = NLMSG_NEXT (nlh, len))
+        {
+            struct netlink_link link;
+
+            if (nlh->nlmsg_seq != seq)
+                continue;
+
+            if (NLMSG_DONE == nlh->nlmsg_type)
+                return 0;
+
+            if (NLMSG_ERROR == nlh->nlmsg_type)
+            {
+                const struct nlmsgerr *err = NLMSG_DATA (nlh);
+
+                errno = -err->error;
+                return -1;
+            }
+
+            if (RTM_NEWLINK != nlh->nlmsg_type)
+                continue;
+
+            parse_link (nlh, &link);
+
+            cb (&link, arg);
+        }
+    }
+}
+
+int
+netlink_subscribe_links (void)
+{
+    const int group = RTNLGRP_LINK;
+    struct sockaddr_nl addr;
+    int fd;
+
+    fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                 NETLINK_ROUTE);
+
+    if (-1 == fd)
+        return -1;
+
+    memset (&addr, 0, sizeof (addr));
+    addr.nl_family = AF_NETLINK;
+
+    if (-1 == bind (fd, (struct sockaddr *) &addr, sizeof (addr)) ||
+        -1 == setsockopt (fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group,
+                          sizeof (group)))
+    {
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int
+netlink_read_link_events (int fd,
+                          void (*cb) (const struct netlink_link *link,
+                                      void *arg),
+                          void *arg)
+{
+    char buf[32768] __attribute__ ((aligned (NLMSG_ALIGNTO)));
+
+    for (;;)
+    {
+        struct nlmsghdr *nlh;
+        ssize_t len;
+
+        if ((len = recv (fd, buf, sizeof (buf), MSG_DONTWAIT)) <= 0)
+        {
+            if (0 == len)
+            {
+                errno = EIO;
+                return -1;
+            }
+
+            return EAGAIN == errno || EWOULDBLOCK == errno ? 0 : -1;
+        }
+
+        for (nlh = (struct nlmsghdr *) buf; NLMSG_OK (nlh, len);
+             nlh = NLMSG_NEXT (nlh, len))
+        {
+            struct netlink_link link;
+
+            if (RTM_NEWLINK != nlh->nlmsg_type &&
+                RTM_DELLINK != nlh->nlmsg_type)
+                continue;
+
+            parse_link (nlh, &link);
+
+            cb (&link, arg);
+        }
+    }
+}
+
+int
+netlink_open_sock_diag (void)
+{
+    return socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+}
+
+/*
+ * Fill in a netlink_tcp from a SOCK_DIAG_BY_FAMILY message. Kernels before
+ * 4.1 have a shorter tcp_info, without the byte counters, which are left at
+ * zero.
+ */
+static void
+parse_tcp (const struct nlmsghdr *nlh, struct netlink_tcp *sock)
+{
+    const struct inet_diag_msg *msg = NLMSG_DATA (nlh);
+    struct rtattr *rta;
+    int rta_len;
+
+    memset (sock, 0, sizeof (*sock));
+
+    sock->inode = msg->idiag_inode;
+
+    rta = (struct rtattr *) (msg + 1);
+    rta_len = NLMSG_PAYLOAD (nlh, sizeof (*msg));
+
+    for (; RTA_OK (rta, rta_len); rta = RTA_NEXT (rta, rta_len))
+    {
+        if (INET_DIAG_INFO == rta->rta_type)
+        {
+            struct tcp_info info;
+
+            memset (&info, 0, sizeof (info));
+            memcpy (&info, RTA_DATA (rta), RTA_PAYLOAD (rta) < sizeof (info) ?
+                RTA_PAYLOAD (rta) : sizeof (info));
+
+            sock->bytes_acked    = info.tcpi_bytes_acked;
+            sock->bytes_received = info.tcpi_bytes_received;
+        }
+    }
+}
+
+int
+netlink_dump_tcp (int fd, int family,
+                  void (*cb) (const struct netlink_tcp *sock, void *arg),
+                  void *arg)
+{
+    struct
+    {
+        struct nlmsghdr         nlh;
+        struct inet_diag_req_v2 req;
+    } req;
+
+    char buf[32768] __attribute__ ((aligned (NLMSG_ALIGNTO)));
+
+    memset (&req, 0, sizeof (req));
+
+    req.nlh.nlmsg_len  = NLMSG_LENGTH (sizeof (req.req));
+    req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+
+    req.req.sdiag_family   = family;
+    req.req.sdiag_protocol = IPPROTO_TCP;
+    req.req.idiag_states   = ~0U;
+    req.req.idiag_ext      = 1 << (INET_DIAG_INFO - 1);
+
+    if (-1 == request (fd, &req.nlh, NLM_F_DUMP))
+        return -1;
+
+    for (;;)
+    {
+        struct nlmsghdr *nlh;
+        ssize_t len;
+
+        if ((len = recv (fd, buf, sizeof (buf), 0)) <= 0)
+        {
+            if (0 == len)
+                errno = EIO;
+
+            return -1;
+        }
+
+        for (nlh = (struct nlmsghdr *) buf; NLMSG_OK (nlh, len);
+             nlh = NLMSG_NEXT (nlh, len))
+        {
+            struct netlink_tcp sock;
+
+            if (nlh->nlmsg_seq != seq)
+                continue;
+
+            if (NLMSG_DONE == nlh->nlmsg_type)
+                return 0;
+
+            if (NLMSG_ERROR == nlh->nlmsg_type)
+            {
+                const struct nlmsgerr *err = NLMSG_DATA (nlh);
+
+                errno = -err->error;
+                return -1;
+            }
+
+            if (SOCK_DIAG_BY_FAMILY != nlh->nlmsg_type)
+                continue;
+
+            parse_tcp (nlh, &sock);
+
+            /* Those in TIME_WAIT no longer belong to a descriptor */
+            if (0 != sock.inode)
+                cb (&sock, arg);
+        }
+    }
+}
+
+void
+netlink_close (int fd)
+{
+    if (fd >= 0)
+        close (fd);
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file netlink.h
+ * @brief Low-level access to interface counters over a `NETLINK_ROUTE`
+ *        socket, and to the counters of TCP sockets over a
+ *        `NETLINK_SOCK_DIAG` one.
+ *
+ * The socket is opened once and kept open for the lifetime of the process.
+ * Each sample is then a single `RTM_GETSTATS` request, filtered by interface
+ * index, so the cost of a poll does not depend on how many interfaces (or
+ * addresses) exist on the system.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef NETLINK_H
+#define NETLINK_H
+
+#include <stdbool.h>
+#include "mbs.h"
+
+/**
+ * @brief Open a `NETLINK_ROUTE` socket.
+ *
+ * @return A socket file descriptor, or -1 if an error occured.
+ */
+int netlink_open (void);
+
+/**
+ * @brief Read the 64-bit RX and TX byte counters of a single interface.
+ *
+ * The counters come from `IFLA_STATS_LINK_64` in an `RTM_GETSTATS` reply.
+ * On kernels that predate `RTM_GETSTATS`, this function falls back to an
+ * `RTM_GETLINK` request for the same interface and reads `IFLA_STATS64`
+ * instead. Either way, the counters are 64 bits wide.
+ *
+ * @param  fd      A socket obtained from \ref netlink_open.
+ * @param  ifindex Kernel index of the interface to query.
+ * @param  stats   A struct to which the counters are written, if the function
+ *                 is successful.
+ * @return         0 on success, or -1 if an error occured, in which case
+ *                 `errno` is set. `ENODEV` means that the interface does not
+ *                 exist (anymore).
+ */
+int netlink_read_stats (int fd, unsigned int ifindex, struct stats *stats);
+
+/**
+ * @brief A network interface, as reported by \ref netlink_dump_links and
+ *        \ref netlink_read_link_events.
+ */
+struct netlink_link
+{
+    /**
+     * @brief Kernel index of the interface.
+     */
+    int ifindex;
+
+    /**
+     * @brief Interface flags (`IFF_UP`, `IFF_LOOPBACK`, etc.).
+     */
+    unsigned int flags;
+
+    /**
+     * @brief Interface name.
+     */
+    const char *name;
+
+    /**
+     * @brief 64-bit RX and TX byte counters.
+     */
+    struct stats stats;
+
+    /**
+     * @brief Whether the interface was removed (`RTM_DELLINK`).
+     */
+    bool removed;
+};
+
+/**
+ * @brief List all interfaces in the network namespace of a socket, along with
+ *        their counters, using a single `RTM_GETLINK` dump request.
+ *
+ * A netlink socket stays bound to the network namespace it was created in, so
+ * this can be used to read the counters of another namespace without
+ * entering it.
+ *
+ * @param  fd  A socket obtained from \ref netlink_open.
+ * @param  cb  A function which is called once for every interface.
+ * @param  arg Passed on to \a cb.
+ * @return     0 on success, or -1 if an error occured, in which case `errno`
+ *             is set.
+ */
+int netlink_dump_links (int fd,
+                        void (*cb) (const struct netlink_link *link, void *arg),
+                        void *arg);
+
+/**
+ * @brief Open a non-blocking `NETLINK_ROUTE` socket which is subscribed to
+ *        the `RTNLGRP_LINK` multicast group, so that it becomes readable as
+ *        soon as an interface is added, removed, renamed, or brought up or
+ *        down.
+ *
+ * @return A socket file descriptor, or -1 if an error occured.
+ */
+int netlink_subscribe_links (void);
+
+/**
+ * @brief Read all pending link events from a socket obtained from
+ *        \ref netlink_subscribe_links, without blocking.
+ *
+ * @param  fd  The subscribed socket.
+ * @param  cb  A function which is called once for every event.
+ * @param  arg Passed on to \a cb.
+ * @return     0 once there are no more events, or -1 if an error occured, in
+ *             which case `errno` is set. `ENOBUFS` means that events were
+ *             lost.
+ */
+int netlink_read_link_events (int fd,
+                              void (*cb) (const struct netlink_link *link,
+                                          void *arg),
+                              void *arg);
+
+/**
+ * @brief Open a `NETLINK_SOCK_DIAG` socket.
+ *
+ * @return A socket file descriptor, or -1 if an error occured.
+ */
+int netlink_open_sock_diag (void);
+
+/**
+ * @brief A TCP socket, as reported by \ref netlink_dump_tcp.
+ */
+struct netlink_tcp
+{
+    /**
+     * @brief Inode of the socket, as in `/proc/net/tcp`.
+     */
+    uint64_t inode;
+
+    /**
+     * @brief Data sent and acknowledged by the peer (`tcpi_bytes_acked`),
+     *        and data received (`tcpi_bytes_received`), since the socket was
+     *        opened. Both are 0 on kernels before 4.1.
+     */
+    uint64_t bytes_acked, bytes_received;
+};
+
+/**
+ * @brief List the TCP sockets of an address family in the network namespace
+ *        of a socket, along with their byte counters, using a single
+ *        `SOCK_DIAG_BY_FAMILY` dump request. Sockets which are not owned by a
+ *        descriptor (in `TIME_WAIT`) are left out.
+ *
+ * @param  fd     A socket obtained from \ref netlink_open_sock_diag.
+ * @param  family `AF_INET` or `AF_INET6`.
+ * @param  cb     A function which is called once for every socket.
+ * @param  arg    Passed on to \a cb.
+ * @return        0 on success, or -1 if an error occured, in which case
+ *                `errno` is set.
+ */
+int netlink_dump_tcp (int fd, int family,
+                      void (*cb) (const struct netlink_tcp *sock, void *arg),
+                      void *arg);
+
+/**
+ * @brief Close a socket obtained from \ref netlink_open or
+ *        \ref netlink_open_sock_diag. Passing -1 is a no-op.
+ *
+ * @param  fd The socket to close.
+ * @return Nothing
+ */
+void netlink_close (int fd);
+
+#endif
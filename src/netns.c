@@ -0,0 +1,601 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "netlink.h"
+#include "netns.h"
+
+/*
+ * The last counters read for one interface in a namespace.
+ */
+struct link
+{
+    int ifindex;
+    struct stats counters;
+    bool seen;
+};
+
+/*
+ * Per-namespace state, kept in an array parallel to s->ifaces.
+ */
+struct netns
+{
+    /* Namespace file descriptor, and identity (for deduplication) */
+    int fd;
+    dev_t dev;
+    ino_t ino;
+
+    /* NETLINK_ROUTE socket created inside the namespace, or -1 */
+    int nl_fd;
+
+    /* Interfaces seen in the previous sample */
+    struct link *links;
+    size_t n_links;
+    size_t cap;
+
+    /* Sum of the per-interface deltas, reported as the entry's counters */
+    struct stats total;
+    bool primed;
+
+    /* Whether the namespace was seen by the latest discovery */
+    bool found;
+};
+
+static struct netns *netns = NULL;
+
+static char **patterns = NULL;
+static int n_patterns = 0;
+
+/* When namespaces were last looked for */
+static uint64_t discovered;
+
+/* Worker thread */
+
+enum request
+{
+    REQUEST_NONE,
+    REQUEST_OPEN,
+    REQUEST_READ,
+    REQUEST_STOP
+};
+
+static pthread_t worker;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static enum request request = REQUEST_NONE;
+
+/*
+ * Add the namespace at the path, unless it is already known, in which case
+ * it is only marked as found. Namespaces are told apart by the inode of the
+ * nsfs file, which is taken before anything is opened, so that finding those
+ * which are already known is cheap.
+ */
+static int
+add_netns (struct mbs *s, const char *path, const char *name)
+{
+    char unique[96];
+    struct netns *ns;
+    struct stat st, fd_st;
+    size_t i;
+    int fd;
+
+    if (-1 == stat (path, &st))
+        return -1;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        if (netns[i].dev == st.st_dev && netns[i].ino == st.st_ino)
+        {
+            netns[i].found = true;
+            return 0;
+        }
+    }
+
+    if (-1 == (fd = open (path, O_RDONLY | O_CLOEXEC)))
+        return -1;
+
+    /* The process exited in between, and the path is not the same namespace */
+    if (-1 == fstat (fd, &fd_st)
+     || fd_st.st_dev != st.st_dev || fd_st.st_ino != st.st_ino)
+    {
+        close (fd);
+        return -1;
+    }
+
+    if (NULL == (ns = realloc (netns, (s->n_ifaces + 1) * sizeof (*ns))))
+    {
+        close (fd);
+        return -1;
+    }
+
+    netns = ns;
+
+    /* Two entries by the same name would be merged */
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        if (0 == strcmp (s->ifaces[i].name, name))
+            break;
+    }
+
+    if (i < s->n_ifaces)
+    {
+        snprintf (unique, sizeof (unique), "%s@%lu", name,
+                  (unsigned long) st.st_ino);
+        name = unique;
+    }
+
+    i = s->n_ifaces;
+
+    if (-1 == mbs_add_iface (s, name) || i == s->n_ifaces)
+    {
+        close (fd);
+        return -1;
+    }
+
+    ns = &netns[i];
+
+    memset (ns, 0, sizeof (*ns));
+
+    ns->fd = fd;
+    ns->dev = st.st_dev;
+    ns->ino = st.st_ino;
+    ns->nl_fd = -1;
+    ns->found = true;
+
+    if ((s->flags & FLAG_VERBOSE) && (s->flags & FLAG_DAEMON) && i > 0)
+        printf ("Monitoring network namespace %s.\n", name);
+
+    return 0;
+}
+
+static void
+discover_named (struct mbs *s)
+{
+    struct dirent *entry;
+    DIR *dir;
+
+    if (NULL == (dir = opendir ("/run/netns")))
+        return;
+
+    while (NULL != (entry = readdir (dir)))
+    {
+        char path[PATH_MAX];
+
+        if ('.' == entry->d_name[0])
+            continue;
+
+        snprintf (path, sizeof (path), "/run/netns/%s", entry->d_name);
+        add_netns (s, path, entry->d_name);
+    }
+
+    closedir (dir);
+}
+
+static void
+discover_processes (struct mbs *s)
+{
+    struct dirent *entry;
+    DIR *dir;
+
+    if (NULL == (dir = opendir ("/proc")))
+        return;
+
+    while (NULL != (entry = readdir (dir)))
+    {
+        char path[PATH_MAX], comm[32] = "", name[64];
+        FILE *file;
+
+        if (!isdigit ((unsigned char) entry->d_name[0]))
+            continue;
+
+        snprintf (path, sizeof (path), "/proc/%s/comm", entry->d_name);
+
+        if (NULL != (file = fopen (path, "r")))
+        {
+            if (NULL != fgets (comm, sizeof (comm), file))
+                comm[strcspn (comm, "\n")] = '\0';
+
+            fclose (file);
+        }
+
+        snprintf (path, sizeof (path), "/proc/%s/ns/net", entry->d_name);
+        snprintf (name, sizeof (name), "%s[%.10s]", comm, entry->d_name);
+        add_netns (s, path, name);
+    }
+
+    closedir (dir);
+}
+
+/*
+ * Look for namespaces again: add those which were created since, and drop
+ * those which no process is in, and which are not bind mounted, any longer.
+ * The entries of the namespace we are in are never dropped. Returns true if
+ * any were added or dropped.
+ */
+static bool
+discover (struct mbs *s)
+{
+    const size_t count = s->n_ifaces;
+    bool changed = false;
+    size_t i;
+
+    for (i = 1; i < s->n_ifaces; ++i)
+        netns[i].found = false;
+
+    discover_named (s);
+    discover_processes (s);
+
+    changed = count != s->n_ifaces;
+
+    for (i = s->n_ifaces; i-- > 1; )
+    {
+        struct netns *ns = &netns[i];
+
+        if (ns->found)
+            continue;
+
+        if ((s->flags & FLAG_VERBOSE) && (s->flags & FLAG_DAEMON))
+            printf ("Network namespace %s is gone.\n", s->ifaces[i].name);
+
+        netlink_close (ns->nl_fd);
+        close (ns->fd);
+        free (ns->links);
+
+        memmove (ns, ns + 1, (s->n_ifaces - i - 1) * sizeof (*ns));
+        mbs_remove_iface (s, i);
+
+        changed = true;
+    }
+
+    return changed;
+}
+
+int
+netns_discover (struct mbs *s, const char **argv, int argc)
+{
+    int i;
+
+    if (argc > 0 && NULL == (patterns = calloc (argc, sizeof (char *))))
+        return -1;
+
+    for (i = 0; i < argc; ++i)
+        patterns[n_patterns++] = strdup (argv[i]);
+
+    /* The namespace we are in comes first */
+    if (-1 == add_netns (s, "/proc/self/ns/net", "host"))
+    {
+        perror ("/proc/self/ns/net");
+        return -1;
+    }
+
+    discover (s);
+    discovered = mbs_now ();
+
+    return 0;
+}
+
+/* Runs on the worker thread */
+static void
+open_sockets (struct mbs *s)
+{
+    int self;
+    size_t i;
+
+    if (-1 == (self = open ("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC)))
+    {
+        perror ("/proc/thread-self/ns/net");
+        return;
+    }
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        struct netns *ns = &netns[i];
+
+        if (ns->nl_fd >= 0)
+            continue;
+
+        /* No need to switch for the namespace we are already in */
+        if (0 == i)
+        {
+            ns->nl_fd = netlink_open ();
+            continue;
+        }
+
+        if (-1 == setns (ns->fd, CLONE_NEWNET))
+        {
+            s->ifaces[i].error = errno;
+            continue;
+        }
+
+        ns->nl_fd = netlink_open ();
+
+        if (-1 == setns (self, CLONE_NEWNET))
+        {
+            perror ("setns");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    close (self);
+}
+
+static bool
+link_matches (const struct netlink_link *link)
+{
+    int i;
+
+    if (link->flags & IFF_LOOPBACK)
+        return false;
+
+    if (0 == n_patterns)
+        return true;
+
+    for (i = 0; i < n_patterns; ++i)
+    {
+        if (0 == fnmatch (patterns[i], link->name, 0))
+            return true;
+    }
+
+    return false;
+}
+
+static void
+account_link (const struct netlink_link *link, void *arg)
+{
+    struct netns *ns = arg;
+    struct stats diff;
+    size_t i;
+
+    if (!link_matches (link))
+        return;
+
+    for (i = 0; i < ns->n_links; ++i)
+    {
+        if (ns->links[i].ifindex == link->ifindex)
+            break;
+    }
+
+    if (i == ns->n_links)
+    {
+        if (ns->n_links == ns->cap)
+        {
+            const size_t cap = ns->cap ? 2 * ns->cap : 8;
+            struct link *links = realloc (ns->links, cap * sizeof (*links));
+
+            if (NULL == links)
+                return;
+
+            ns->links = links;
+            ns->cap = cap;
+        }
+
+        /*
+         * Interfaces present on startup are the baseline. Those created later
+         * are accounted for from zero.
+         */
+        ns->links[i].ifindex = link->ifindex;
+
+        if (ns->primed)
+        {
+            ns->links[i].counters.rx_bytes = 0;
+            ns->links[i].counters.tx_bytes = 0;
+        }
+        else
+        {
+            ns->links[i].counters = link->stats;
+
+            ns->total.rx_bytes += link->stats.rx_bytes;
+            ns->total.tx_bytes += link->stats.tx_bytes;
+        }
+
+        ++ns->n_links;
+    }
+
+    mbs_stats_delta (&ns->links[i].counters, &link->stats, 64, &diff);
+
+    ns->total.rx_bytes += diff.rx_bytes;
+    ns->total.tx_bytes += diff.tx_bytes;
+
+    ns->links[i].counters = link->stats;
+    ns->links[i].seen = true;
+}
+
+/* Runs on the worker thread */
+static void
+read_counters (struct mbs *s)
+{
+    size_t i, j, k;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        struct netns *ns = &netns[i];
+
+        if (ns->nl_fd < 0)
+        {
+            if (0 == s->ifaces[i].error)
+                s->ifaces[i].error = ENODEV;
+
+            continue;
+        }
+
+        for (j = 0; j < ns->n_links; ++j)
+            ns->links[j].seen = false;
+
+        /*
+         * The total and the last sample are kept, and the next dump carries
+         * on from them. The error must not be ENODEV, which would reset the
+         * snapshot and charge the whole total again.
+         */
+        if (-1 == netlink_dump_links (ns->nl_fd, account_link, ns))
+        {
+            s->ifaces[i].error = 0 != errno && ENODEV != errno ? errno : EIO;
+            continue;
+        }
+
+        /* Forget about interfaces which are gone */
+        for (j = 0, k = 0; j < ns->n_links; ++j)
+        {
+            if (ns->links[j].seen)
+                ns->links[k++] = ns->links[j];
+        }
+
+        ns->n_links = k;
+        ns->primed = true;
+
+        s->ifaces[i].sample = ns->total;
+        s->ifaces[i].sample.timestamp = mbs_now ();
+        s->ifaces[i].error = 0;
+    }
+}
+
+static void *
+run_worker (void *arg)
+{
+    struct mbs *s = arg;
+
+    pthread_mutex_lock (&lock);
+
+    for (;;)
+    {
+        while (REQUEST_NONE == request)
+            pthread_cond_wait (&cond, &lock);
+
+        if (REQUEST_STOP == request)
+            break;
+
+        if (REQUEST_OPEN == request)
+            open_sockets (s);
+        else
+            read_counters (s);
+
+        request = REQUEST_NONE;
+        pthread_cond_broadcast (&cond);
+    }
+
+    pthread_mutex_unlock (&lock);
+    return NULL;
+}
+
+/* Hand a request to the worker, and wait until it is done */
+static void
+submit (enum request req)
+{
+    pthread_mutex_lock (&lock);
+
+    request = req;
+    pthread_cond_broadcast (&cond);
+
+    while (REQUEST_NONE != request && REQUEST_STOP != req)
+        pthread_cond_wait (&cond, &lock);
+
+    pthread_mutex_unlock (&lock);
+}
+
+/* Counter source */
+
+static int
+netns_init (struct mbs *s)
+{
+    if (0 != pthread_create (&worker, NULL, run_worker, s))
+        return -1;
+
+    submit (REQUEST_OPEN);
+    return 0;
+}
+
+static int
+netns_read (struct mbs *s)
+{
+    const uint64_t now = mbs_now ();
+
+    /* Sockets are opened for the new ones by the worker */
+    if (now - discovered >= NETNS_DISCOVER_INTERVAL * 1000000ULL)
+    {
+        discovered = now;
+
+        if (discover (s))
+            submit (REQUEST_OPEN);
+    }
+
+    submit (REQUEST_READ);
+    return 0;
+}
+
+static void
+netns_fini (struct mbs *s)
+{
+    size_t i;
+    int j;
+
+    submit (REQUEST_STOP);
+    pthread_join (worker, NULL);
+
+    request = REQUEST_NONE;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        netlink_close (netns[i].nl_fd);
+        close (netns[i].fd);
+        free (netns[i].links);
+    }
+
+    for (j = 0; j < n_patterns; ++j)
+        free (patterns[j]);
+
+    free (netns);
+    free (patterns);
+
+    netns = NULL;
+    patterns = NULL;
+    n_patterns = 0;
+}
+
+const struct counter_source netns_source =
+{
+    "netns", 64, netns_init, netns_read, netns_fini
+};
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file netns.h
+ * @brief Accounting across network namespaces, for container hosts.
+ *
+ * With `--netns`, the entries in \ref mbs::ifaces are network namespaces
+ * rather than interfaces: the one the command runs in (`host`), those bind
+ * mounted under `/run/netns`, and those of running processes, found through
+ * `/proc/<pid>/ns/net`. The counters of an entry are the sum over all
+ * non-loopback interfaces in the namespace, or only those matching the
+ * `<interface>` arguments, if any were given.
+ *
+ * Switching namespaces with `setns()` is left to a dedicated worker thread,
+ * so that the main thread never leaves its own namespace. The worker holds a
+ * file descriptor for every namespace, and a `NETLINK_ROUTE` socket created
+ * inside it. Since a netlink socket stays bound to the namespace it was
+ * created in, `setns()` is only needed once per namespace; after that, each
+ * sample is a single `RTM_GETLINK` dump per namespace, on the worker thread.
+ *
+ * Namespaces are looked for on startup, and again every
+ * \ref NETNS_DISCOVER_INTERVAL milliseconds. Those created since are added,
+ * and counted from when their interfaces were created. Those which no
+ * process is in and which are not bind mounted any longer are dropped, and
+ * their file descriptor and socket closed, so that they are not kept alive
+ * by the command; what was used in them stays in the totals. Entering other
+ * namespaces requires `CAP_SYS_ADMIN`.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef NETNS_H
+#define NETNS_H
+
+#include "mbs.h"
+
+/**
+ * @brief Milliseconds between two searches for namespaces which were
+ *        created, or have gone away.
+ */
+#define NETNS_DISCOVER_INTERVAL 5000
+
+/**
+ * @brief Read counters from all discovered network namespaces.
+ */
+extern const struct counter_source netns_source;
+
+/**
+ * @brief Find the network namespaces on the system and add one entry per
+ *        namespace to `s->ifaces`.
+ *
+ * @param  s          An \ref mbs struct holding application state and
+ *                    configuration settings.
+ * @param  patterns   Glob patterns selecting the interfaces counted in each
+ *                    namespace. If there are none, all interfaces except
+ *                    loopback are counted.
+ * @param  n_patterns Number of elements in \a patterns.
+ * @return            0 on success, or -1 if an error occured.
+ */
+int netns_discover (struct mbs *s, const char **patterns, int n_patterns);
+
+#endif
@@ -0,0 +1,1098 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "netlink.h"
+#include "procnet.h"
+
+/* Owners of sockets, other than the index of a process */
+#define UNKNOWN -1  /* Not looked for yet */
+#define ORPHAN  -2  /* Looked for, and not found */
+
+static const char *const socket_lists[] = {
+    "/proc/net/tcp", "/proc/net/tcp6", "/proc/net/udp", "/proc/net/udp6"
+};
+
+/* The lists from this one on are of UDP sockets */
+#define FIRST_UDP 2
+
+/*
+ * A socket, and its owner. The round is the first search which looks for it
+ * from the start, so that it is not given up on by a search which may have
+ * gone past its owner before it was opened. TCP sockets carry their byte
+ * counters as of the last refresh.
+ */
+struct slot
+{
+    uint64_t inode;
+    int32_t owner;
+    uint32_t round;
+    bool udp;
+    uint64_t acked, received;
+};
+
+/* Open addressing, by inode; 0 marks an empty slot */
+struct table
+{
+    struct slot *slots;
+    size_t size, count;
+};
+
+struct proc
+{
+    pid_t pid;
+    char comm[PROCNET_COMM_MAX];
+
+    unsigned int sockets, udp_sockets;
+
+    /* The last search which found a socket of it */
+    uint32_t found;
+
+    /* What its TCP sockets sent and received since the last refresh */
+    uint64_t sent, received;
+
+    /*
+     * Counters from /proc/<pid>/io, and how much they grew at the last read.
+     * Only read for the owners of UDP sockets, unless the TCP counters
+     * cannot be read.
+     */
+    bool io;
+    uint64_t rchar, wchar;
+    uint64_t read, written;
+
+    uint64_t tx_bytes, rx_bytes;
+
+    /* Whether any of its share was estimated from the I/O counters */
+    bool estimated;
+};
+
+struct pids
+{
+    pid_t *pids;
+    size_t n, cap;
+};
+
+static bool opened;
+
+/* For the counters of TCP sockets; -1 if they cannot be read */
+static int diag_fd = -1;
+static bool measured;
+
+/* The sockets as of the last refresh; the other table is reused for the next */
+static struct table sockets, spare;
+static size_t unknown;
+
+static struct proc *procs;
+static size_t n_procs, cap_procs;
+
+/* The search for the owners of new sockets, which may span many refreshes */
+static struct
+{
+    bool active;
+    uint32_t round;
+    bool listed;
+    struct pids order;
+    size_t pos;
+    DIR *dir;
+    pid_t pid;
+    int proc;
+} search;
+
+/*
+ * The processes there were when they were last listed, and those which have
+ * owned sockets, in order.
+ */
+static struct pids seen, listing, known;
+
+static uint64_t pending_tx, pending_rx, last;
+static struct stats other;
+
+static size_t
+hash (uint64_t inode, size_t size)
+{
+    return (size_t) ((inode * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1);
+}
+
+static struct slot *
+lookup (const struct table *t, uint64_t inode)
+{
+    size_t i;
+
+    if (0 == t->size)
+        return NULL;
+
+    for (i = hash (inode, t->size); 0 != t->slots[i].inode;
+         i = (i + 1) & (t->size - 1))
+    {
+        if (inode == t->slots[i].inode)
+            return &t->slots[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Add a socket which is not in the table, keeping it at most half full.
+ * Returns NULL on failure to allocate memory.
+ */
+static struct slot *
+insert (struct table *t, uint64_t inode)
+{
+    size_t i;
+
+    if (2 * (t->count + 1) > t->size)
+    {
+        const size_t size = t->size ? 2 * t->size : 1024;
+        struct slot *slots = calloc (size, sizeof (struct slot));
+
+        if (NULL == slots)
+            return NULL;
+
+        for (i = 0; i < t->size; ++i)
+        {
+            size_t j = hash (t->slots[i].inode, size);
+
+            if (0 == t->slots[i].inode)
+                continue;
+
+            while (0 != slots[j].inode)
+                j = (j + 1) & (size - 1);
+
+            slots[j] = t->slots[i];
+        }
+
+        free (t->slots);
+
+        t->slots = slots;
+        t->size = size;
+    }
+
+    for (i = hash (inode, t->size); 0 != t->slots[i].inode;
+         i = (i + 1) & (t->size - 1))
+        ;
+
+    t->count++;
+    t->slots[i].inode = inode;
+
+    return &t->slots[i];
+}
+
+static int
+push (struct pids *p, pid_t pid)
+{
+    if (p->n == p->cap)
+    {
+        const size_t cap = p->cap ? 2 * p->cap : 256;
+        pid_t *pids = realloc (p->pids, cap * sizeof (pid_t));
+
+        if (NULL == pids)
+            return -1;
+
+        p->pids = pids;
+        p->cap = cap;
+    }
+
+    p->pids[p->n++] = pid;
+
+    return 0;
+}
+
+static int
+compare_pids (const void *a, const void *b)
+{
+    const pid_t x = *(const pid_t *) a,
+                y = *(const pid_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static bool
+contains (const pid_t *pids, size_t n, pid_t pid)
+{
+    return NULL != bsearch (&pid, pids, n, sizeof (pid_t), compare_pids);
+}
+
+static void
+read_comm (pid_t pid, char *comm)
+{
+    char path[32];
+    ssize_t n = -1;
+    int fd;
+
+    snprintf (path, sizeof (path), "/proc/%d/comm", (int) pid);
+
+    if (-1 != (fd = open (path, O_RDONLY | O_CLOEXEC)))
+    {
+        n = read (fd, comm, PROCNET_COMM_MAX - 1);
+        close (fd);
+    }
+
+    if (n <= 0)
+    {
+        strcpy (comm, "?");
+        return;
+    }
+
+    comm[n] = '\0';
+    comm[strcspn (comm, "\n")] = '\0';
+}
+
+static bool
+read_io (pid_t pid, uint64_t *rchar, uint64_t *wchar)
+{
+    char path[32], buf[256];
+    ssize_t n;
+    int fd;
+
+    snprintf (path, sizeof (path), "/proc/%d/io", (int) pid);
+
+    if (-1 == (fd = open (path, O_RDONLY | O_CLOEXEC)))
+        return false;
+
+    n = read (fd, buf, sizeof (buf) - 1);
+    close (fd);
+
+    if (n <= 0)
+        return false;
+
+    buf[n] = '\0';
+
+    return 2 == sscanf (buf, "rchar: %" SCNu64 " wchar: %" SCNu64,
+                        rchar, wchar);
+}
+
+/*
+ * Find the process which a socket was found in the descriptors of, or add
+ * it. A process which owns no more sockets, and has a different name, is
+ * taken to have exited, and its ID to have been reused. Processes are kept
+ * after their sockets are closed, since they are likely to open more, until
+ * the room is needed; those to which data was attributed are kept for good.
+ * Returns its index, or -1 if there is no room.
+ */
+static int
+add_proc (pid_t pid)
+{
+    char comm[PROCNET_COMM_MAX];
+    size_t i, slot = n_procs;
+
+    read_comm (pid, comm);
+
+    for (i = 0; i < n_procs; ++i)
+    {
+        if (pid != procs[i].pid)
+            continue;
+
+        if (procs[i].sockets > 0 || 0 == strcmp (comm, procs[i].comm))
+            return i;
+
+        /* The ID was reused; nothing is lost by starting over */
+        if (0 == procs[i].tx_bytes && 0 == procs[i].rx_bytes)
+            slot = i;
+    }
+
+    for (i = 0; i < n_procs && slot == n_procs
+             && PROCNET_MAX_PROCS == n_procs; ++i)
+    {
+        if (0 == procs[i].sockets && 0 == procs[i].tx_bytes
+         && 0 == procs[i].rx_bytes)
+            slot = i;
+    }
+
+    if (slot == n_procs)
+    {
+        if (PROCNET_MAX_PROCS == n_procs)
+            return -1;
+
+        if (n_procs == cap_procs)
+        {
+            const size_t cap = cap_procs ? 2 * cap_procs : 64;
+            struct proc *p = realloc (procs, cap * sizeof (struct proc));
+
+            if (NULL == p)
+                return -1;
+
+            procs = p;
+            cap_procs = cap;
+        }
+
+        n_procs++;
+    }
+
+    memset (&procs[slot], 0, sizeof (struct proc));
+    procs[slot].pid = pid;
+    strcpy (procs[slot].comm, comm);
+
+    return slot;
+}
+
+/*
+ * The inode is the tenth field of each line, after the header.
+ */
+static uint64_t
+parse_inode (const char *line)
+{
+    int field;
+
+    for (field = 0; field < 9; ++field)
+    {
+        while (' ' == *line)
+            ++line;
+
+        while ('\0' != *line && ' ' != *line)
+            ++line;
+    }
+
+    return strtoull (line, NULL, 10);
+}
+
+/*
+ * Read the sockets there are now into the spare table, carrying over what is
+ * known of those which were there before, and swap the tables. Returns -1 if
+ * none of the lists could be read, or on failure to allocate memory.
+ */
+static int
+read_sockets (void)
+{
+    struct table t = spare;
+    char line[512];
+    bool read_any = false;
+    size_t i, k;
+
+    if (NULL != t.slots)
+        memset (t.slots, 0, t.size * sizeof (struct slot));
+
+    t.count = 0;
+    unknown = 0;
+
+    for (i = 0; i < n_procs; ++i)
+        procs[i].sockets = procs[i].udp_sockets = 0;
+
+    for (k = 0; k < sizeof (socket_lists) / sizeof (socket_lists[0]); ++k)
+    {
+        FILE *f = fopen (socket_lists[k], "re");
+
+        if (NULL == f)
+            continue;
+
+        read_any = true;
+
+        /* The header */
+        if (NULL == fgets (line, sizeof (line), f))
+        {
+            fclose (f);
+            continue;
+        }
+
+        while (NULL != fgets (line, sizeof (line), f))
+        {
+            const uint64_t inode = parse_inode (line);
+            const struct slot *old;
+            struct slot *s;
+
+            /* Sockets which are closing belong to no one */
+            if (0 == inode || NULL != lookup (&t, inode))
+                continue;
+
+            if (NULL == (s = insert (&t, inode)))
+            {
+                fclose (f);
+                spare = t;
+                return -1;
+            }
+
+            if (NULL != (old = lookup (&sockets, inode)))
+            {
+                s->owner = old->owner;
+                s->round = old->round;
+                s->acked = old->acked;
+                s->received = old->received;
+            }
+            else
+            {
+                s->owner = UNKNOWN;
+                s->round = search.round + 1;
+            }
+
+            s->udp = k >= FIRST_UDP;
+
+            if (s->owner >= 0)
+            {
+                procs[s->owner].sockets++;
+                procs[s->owner].udp_sockets += s->udp;
+            }
+            else if (UNKNOWN == s->owner)
+            {
+                unknown++;
+            }
+        }
+
+        fclose (f);
+    }
+
+    /* Keep what is known, for when the lists can be read again */
+    if (!read_any)
+    {
+        spare = t;
+        errno = ENOENT;
+        return -1;
+    }
+
+    spare = sockets;
+    sockets = t;
+
+    return 0;
+}
+
+static int
+compare_found (const void *a, const void *b)
+{
+    const uint32_t x = procs[*(const size_t *) a].found,
+                   y = procs[*(const size_t *) b].found;
+
+    return (x < y) - (x > y);
+}
+
+/*
+ * Start looking in the processes which have owned sockets, since servers
+ * keep accepting connections and clients keep connecting; those in which
+ * sockets were found most recently first.
+ */
+static int
+start_search (void)
+{
+    size_t *by_found = malloc ((n_procs ? n_procs : 1) * sizeof (size_t));
+    size_t i;
+
+    if (NULL == by_found)
+        return -1;
+
+    for (i = 0; i < n_procs; ++i)
+        by_found[i] = i;
+
+    qsort (by_found, n_procs, sizeof (size_t), compare_found);
+
+    search.order.n = 0;
+
+    for (i = 0; i < n_procs; ++i)
+    {
+        if (-1 == push (&search.order, procs[by_found[i]].pid))
+        {
+            free (by_found);
+            return -1;
+        }
+    }
+
+    free (by_found);
+
+    search.active = true;
+    search.listed = false;
+    search.round++;
+    search.pos = 0;
+    search.proc = -1;
+
+    return 0;
+}
+
+/*
+ * Once those have been looked in, list the processes there are, and go on
+ * with those which were started since the last time they were listed, then
+ * the rest.
+ */
+static int
+list_processes (void)
+{
+    DIR *dir = opendir ("/proc");
+    struct dirent *ent;
+    struct pids tmp;
+    size_t i;
+    int pass;
+
+    if (NULL == dir)
+        return -1;
+
+    listing.n = 0;
+    known.n = 0;
+    search.listed = true;
+
+    for (i = 0; i < n_procs; ++i)
+    {
+        if (-1 == push (&known, procs[i].pid))
+        {
+            closedir (dir);
+            return -1;
+        }
+    }
+
+    qsort (known.pids, known.n, sizeof (pid_t), compare_pids);
+
+    while (NULL != (ent = readdir (dir)))
+    {
+        char *end;
+        const long pid = strtol (ent->d_name, &end, 10);
+
+        if ('\0' == *end && pid > 0 && -1 == push (&listing, pid))
+        {
+            closedir (dir);
+            return -1;
+        }
+    }
+
+    closedir (dir);
+    qsort (listing.pids, listing.n, sizeof (pid_t), compare_pids);
+
+    for (pass = 0; pass < 2; ++pass)
+    {
+        for (i = 0; i < listing.n; ++i)
+        {
+            const pid_t pid = listing.pids[i];
+
+            if (contains (known.pids, known.n, pid)
+             || (0 == pass) == contains (seen.pids, seen.n, pid))
+                continue;
+
+            if (-1 == push (&search.order, pid))
+                return -1;
+        }
+    }
+
+    tmp = seen;
+    seen = listing;
+    listing = tmp;
+
+    return 0;
+}
+
+/*
+ * The sockets which were looked for from the start of this search, and were
+ * not found, have no owner which can be seen.
+ */
+static void
+end_search (void)
+{
+    size_t i;
+
+    if (NULL != search.dir)
+        closedir (search.dir);
+
+    search.dir = NULL;
+    search.active = false;
+
+    for (i = 0; i < sockets.size; ++i)
+    {
+        struct slot *s = &sockets.slots[i];
+
+        if (0 != s->inode && UNKNOWN == s->owner && s->round <= search.round)
+        {
+            s->owner = ORPHAN;
+            unknown--;
+        }
+    }
+}
+
+/*
+ * Read descriptor links until the new sockets are all found, the processes
+ * run out, or the budget does. Returns the number of links read.
+ */
+static unsigned int
+find_owners (unsigned int budget)
+{
+    unsigned int links = 0;
+    char path[32], link[64];
+
+    while (search.active && links < budget)
+    {
+        struct dirent *ent;
+        struct slot *s;
+        ssize_t n;
+
+        if (0 == unknown)
+        {
+            end_search ();
+            break;
+        }
+
+        if (NULL == search.dir)
+        {
+            if (search.pos == search.order.n
+             && (search.listed || -1 == list_processes ()
+              || search.pos == search.order.n))
+            {
+                end_search ();
+                break;
+            }
+
+            search.pid = search.order.pids[search.pos++];
+            search.proc = -1;
+
+            snprintf (path, sizeof (path), "/proc/%d/fd", (int) search.pid);
+            search.dir = opendir (path);
+            continue;
+        }
+
+        if (NULL == (ent = readdir (search.dir)))
+        {
+            closedir (search.dir);
+            search.dir = NULL;
+            continue;
+        }
+
+        if ('.' == ent->d_name[0])
+            continue;
+
+        n = readlinkat (dirfd (search.dir), ent->d_name, link,
+                        sizeof (link) - 1);
+        links++;
+
+        if (n < 9 || 0 != memcmp (link, "socket:[", 8))
+            continue;
+
+        link[n] = '\0';
+
+        s = lookup (&sockets, strtoull (link + 8, NULL, 10));
+
+        if (NULL == s || UNKNOWN != s->owner)
+            continue;
+
+        if (-1 == search.proc && -1 == (search.proc = add_proc (search.pid)))
+            continue;
+
+        s->owner = search.proc;
+        procs[search.proc].found = search.round;
+        procs[search.proc].sockets++;
+        procs[search.proc].udp_sockets += s->udp;
+        unknown--;
+    }
+
+    return links;
+}
+
+/*
+ * Add what a TCP socket sent and received since the last refresh to its
+ * owner. One which is new since then is counted from when it was opened.
+ */
+static void
+account_tcp (const struct netlink_tcp *sock, void *arg)
+{
+    struct slot *s = lookup (&sockets, sock->inode);
+
+    (void) arg;
+
+    if (NULL == s || s->udp)
+        return;
+
+    if (s->owner >= 0)
+    {
+        procs[s->owner].sent += sock->bytes_acked >= s->acked ?
+            sock->bytes_acked - s->acked : sock->bytes_acked;
+        procs[s->owner].received += sock->bytes_received >= s->received ?
+            sock->bytes_received - s->received : sock->bytes_received;
+    }
+
+    s->acked = sock->bytes_acked;
+    s->received = sock->bytes_received;
+}
+
+/*
+ * Read how much each owner has sent and received over TCP since the last
+ * refresh, and, for those which own UDP sockets, how much they have read and
+ * written. If the TCP counters cannot be read, the I/O counters are read for
+ * all of them instead.
+ */
+static void
+read_counters (void)
+{
+    size_t i;
+
+    for (i = 0; i < n_procs; ++i)
+        procs[i].sent = procs[i].received = 0;
+
+    measured = diag_fd >= 0
+            && 0 == netlink_dump_tcp (diag_fd, AF_INET, account_tcp, NULL)
+            && 0 == netlink_dump_tcp (diag_fd, AF_INET6, account_tcp, NULL);
+
+    for (i = 0; i < n_procs; ++i)
+    {
+        struct proc *p = &procs[i];
+        uint64_t rchar, wchar;
+
+        p->read = p->written = 0;
+
+        if (0 == p->sockets || (measured && 0 == p->udp_sockets)
+         || !read_io (p->pid, &rchar, &wchar))
+        {
+            p->io = false;
+            continue;
+        }
+
+        if (p->io)
+        {
+            p->read = rchar > p->rchar ? rchar - p->rchar : 0;
+            p->written = wchar > p->wchar ? wchar - p->wchar : 0;
+        }
+
+        p->io = true;
+        p->rchar = rchar;
+        p->wchar = wchar;
+    }
+}
+
+static unsigned int
+refresh_sockets (unsigned int budget)
+{
+    unsigned int links;
+
+    if (-1 == read_sockets ())
+        return 0;
+
+    if (!search.active && unknown > 0)
+        start_search ();
+
+    links = find_owners (budget);
+    read_counters ();
+
+    return links;
+}
+
+static uint64_t
+weight (const struct proc *p, bool rx, bool tcp)
+{
+    if (tcp)
+        return rx ? p->received : p->sent;
+
+    return rx ? p->read : p->written;
+}
+
+static uint64_t
+total_weight (bool rx, bool tcp)
+{
+    uint64_t total = 0;
+    size_t i;
+
+    for (i = 0; i < n_procs; ++i)
+        total += weight (&procs[i], rx, tcp);
+
+    return total;
+}
+
+/*
+ * Share an amount between the owners in proportion to one of their weights,
+ * of which the total is not zero, in whole bytes. What is left from rounding
+ * down goes to the heaviest.
+ */
+static void
+share (uint64_t amount, bool rx, bool tcp, uint64_t total)
+{
+    uint64_t given = 0;
+    size_t i, heaviest = 0;
+
+    for (i = 0; i < n_procs; ++i)
+    {
+        const uint64_t w = weight (&procs[i], rx, tcp);
+        uint64_t part = (uint64_t) ((double) amount * w / total);
+
+        if (w > weight (&procs[heaviest], rx, tcp))
+            heaviest = i;
+
+        if (part > amount - given)
+            part = amount - given;
+
+        given += part;
+
+        if (rx)
+            procs[i].rx_bytes += part;
+        else
+            procs[i].tx_bytes += part;
+
+        procs[i].estimated |= !tcp && part > 0;
+    }
+
+    if (rx)
+        procs[heaviest].rx_bytes += amount - given;
+    else
+        procs[heaviest].tx_bytes += amount - given;
+
+    procs[heaviest].estimated |= !tcp && amount > given;
+}
+
+/*
+ * Split an amount between the owners. As much of it as the TCP sockets
+ * account for goes by their counters. The rest (UDP, and the headers of
+ * both) goes to the owners of UDP sockets by what they read and wrote, or
+ * else by the TCP counters as well.
+ */
+static void
+split (uint64_t amount, bool rx)
+{
+    const uint64_t tcp = total_weight (rx, true),
+                   io = total_weight (rx, false);
+
+    if (tcp > 0)
+    {
+        const uint64_t part = io > 0 && amount > tcp ? tcp : amount;
+
+        share (part, rx, true, tcp);
+        amount -= part;
+    }
+
+    if (0 == amount)
+        return;
+
+    if (io > 0)
+        share (amount, rx, false, io);
+    else if (rx)
+        other.rx_bytes += amount;
+    else
+        other.tx_bytes += amount;
+}
+
+int
+procnet_open (void)
+{
+    opened = true;
+    last = mbs_now ();
+    diag_fd = netlink_open_sock_diag ();
+
+    if (-1 == read_sockets ())
+    {
+        procnet_close ();
+        return -1;
+    }
+
+    if (unknown > 0 && -1 == start_search ())
+    {
+        procnet_close ();
+        return -1;
+    }
+
+    find_owners (UINT_MAX);
+    read_counters ();
+
+    return 0;
+}
+
+unsigned int
+procnet_refresh (void)
+{
+    return refresh_sockets (PROCNET_SCAN_BUDGET);
+}
+
+pid_t
+procnet_owner (uint64_t inode)
+{
+    const struct slot *s = lookup (&sockets, inode);
+
+    return NULL != s && s->owner >= 0 ? procs[s->owner].pid : -1;
+}
+
+void
+procnet_add (uint64_t tx, uint64_t rx, uint64_t now)
+{
+    if (!opened)
+        return;
+
+    pending_tx += tx;
+    pending_rx += rx;
+
+    if ((0 == pending_tx && 0 == pending_rx)
+     || now - last < PROCNET_REFRESH_MS * 1000000ULL)
+        return;
+
+    last = now;
+
+    refresh_sockets (PROCNET_SCAN_BUDGET);
+    split (pending_tx, false);
+    split (pending_rx, true);
+
+    pending_tx = pending_rx = 0;
+}
+
+static uint64_t
+attributed (const struct proc *p)
+{
+    return p->tx_bytes + p->rx_bytes;
+}
+
+static int
+compare_procs (const void *a, const void *b)
+{
+    const uint64_t x = attributed (*(const struct proc *const *) a),
+                   y = attributed (*(const struct proc *const *) b);
+
+    return (x < y) - (x > y);
+}
+
+/*
+ * The processes to which any data was attributed, the busiest first, in a
+ * new array. Returns -1 on failure to allocate memory.
+ */
+static ssize_t
+sorted (const struct proc ***out)
+{
+    const struct proc **p = malloc ((n_procs ? n_procs : 1) * sizeof (*p));
+    size_t i, n = 0;
+
+    if (NULL == p)
+        return -1;
+
+    for (i = 0; i < n_procs; ++i)
+    {
+        if (attributed (&procs[i]) > 0)
+            p[n++] = &procs[i];
+    }
+
+    qsort (p, n, sizeof (*p), compare_procs);
+    *out = p;
+
+    return n;
+}
+
+size_t
+procnet_top (struct procnet_entry *top, size_t n, struct stats *other_used)
+{
+    const struct proc *best[PROCNET_TOP];
+    size_t i, j, count = 0;
+
+    if (n > PROCNET_TOP)
+        n = PROCNET_TOP;
+
+    /* Insertion into a short list, rather than sorting them all */
+    for (i = 0; i < n_procs; ++i)
+    {
+        const struct proc *p = &procs[i];
+
+        if (0 == attributed (p))
+            continue;
+
+        for (j = count; j > 0 && attributed (best[j - 1]) < attributed (p);
+             --j)
+        {
+            if (j < n)
+                best[j] = best[j - 1];
+        }
+
+        if (j < n)
+        {
+            best[j] = p;
+            count += count < n;
+        }
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        top[i].pid = best[i]->pid;
+        strcpy (top[i].comm, best[i]->comm);
+        top[i].tx_bytes = best[i]->tx_bytes;
+        top[i].rx_bytes = best[i]->rx_bytes;
+        top[i].estimated = best[i]->estimated;
+    }
+
+    other_used->tx_bytes = other.tx_bytes;
+    other_used->rx_bytes = other.rx_bytes;
+    other_used->timestamp = 0;
+
+    return count;
+}
+
+void
+procnet_print (FILE *f)
+{
+    char tx_str[MBS_HUMAN_READABLE_MAX], rx_str[MBS_HUMAN_READABLE_MAX];
+    const struct proc **p;
+    bool estimated = false;
+    ssize_t n, i;
+
+    if (-1 == (n = sorted (&p)))
+        return;
+
+    fprintf (f, "%-15s %7s %12s %12s\n", "process", "pid", "tx", "rx");
+
+    for (i = 0; i < n; ++i)
+    {
+        fprintf (f, "%-15s%c%7d %12s %12s\n", p[i]->comm,
+                 p[i]->estimated ? '*' : ' ', (int) p[i]->pid,
+                 to_human_readable (p[i]->tx_bytes, tx_str),
+                 to_human_readable (p[i]->rx_bytes, rx_str));
+
+        estimated = estimated || p[i]->estimated;
+    }
+
+    fprintf (f, "%-15s %7s %12s %12s\n", "(other)", "-",
+             to_human_readable (other.tx_bytes, tx_str),
+             to_human_readable (other.rx_bytes, rx_str));
+
+    if (estimated)
+        fprintf (f, "* In part by what it read and wrote, files included "
+                 "(UDP).\n");
+
+    free (p);
+}
+
+void
+procnet_close (void)
+{
+    if (NULL != search.dir)
+        closedir (search.dir);
+
+    free (sockets.slots);
+    free (spare.slots);
+    free (procs);
+    free (search.order.pids);
+    free (seen.pids);
+    free (listing.pids);
+    free (known.pids);
+    netlink_close (diag_fd);
+
+    memset (&sockets, 0, sizeof (sockets));
+    memset (&spare, 0, sizeof (spare));
+    memset (&search, 0, sizeof (search));
+    memset (&seen, 0, sizeof (seen));
+    memset (&listing, 0, sizeof (listing));
+    memset (&known, 0, sizeof (known));
+    memset (&other, 0, sizeof (other));
+
+    procs = NULL;
+    n_procs = cap_procs = 0;
+    unknown = 0;
+    pending_tx = pending_rx = 0;
+    diag_fd = -1;
+    measured = false;
+    opened = false;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file procnet.h
+ * @brief Which processes the traffic is for (`--processes`): the data used
+ *        on the monitored interfaces, split between the processes which own
+ *        sockets.
+ *
+ * The kernel does not count traffic per process, so this is an estimate. The
+ * sockets are listed in `/proc/net/tcp`, `tcp6`, `udp` and `udp6`, by inode,
+ * and a process owns those which its descriptors in `/proc/<pid>/fd` link
+ * to. The data used over each interval of \ref PROCNET_REFRESH_MS is split
+ * between the owners in proportion to what their TCP sockets sent and
+ * received meanwhile, as counted by the kernel (`tcpi_bytes_acked` and
+ * `tcpi_bytes_received`, over `NETLINK_SOCK_DIAG`).
+ *
+ * UDP sockets have no such counters. What the TCP sockets do not account for
+ * goes to the owners of UDP sockets, in proportion to what they read and
+ * wrote, as counted in `/proc/<pid>/io` (`rchar` for RX, `wchar` for TX).
+ * Those also count files and pipes, so the shares which come from them are
+ * marked as estimated (\ref procnet_entry::estimated). If the TCP counters
+ * cannot be read, all of it is split that way. The I/O counters can only be
+ * read for the processes of the same user, unless running as root; what
+ * cannot be attributed is counted as other traffic.
+ *
+ * Reading the links in `/proc/<pid>/fd` is what costs, so the owners are
+ * kept in a table by inode, which carries over from one refresh to the next.
+ * Only sockets which were not there before are looked for: first among the
+ * processes which have owned sockets, those which opened one most recently
+ * first, then among those which were started since, and then the rest. No
+ * more than \ref PROCNET_SCAN_BUDGET links are read per refresh; a search
+ * which is not done carries on at the next one. Sockets which no process was
+ * found to own (e.g., those of processes of another user, without root) are
+ * not looked for again. While the link is idle, nothing is read.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef PROCNET_H
+#define PROCNET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "mbs.h"
+
+/**
+ * @brief Number of processes in the terminal interface.
+ */
+#define PROCNET_TOP 5
+
+/**
+ * @brief Shortest time between two refreshes, in milliseconds. Traffic is
+ *        attributed once per refresh.
+ */
+#define PROCNET_REFRESH_MS 1000
+
+/**
+ * @brief Largest number of descriptor links read per refresh, after the
+ *        first.
+ */
+#define PROCNET_SCAN_BUDGET 4096
+
+/**
+ * @brief Largest number of processes kept track of.
+ */
+#define PROCNET_MAX_PROCS 4096
+
+/**
+ * @brief Size of a buffer which can hold a command name, including the
+ *        terminating null character.
+ */
+#define PROCNET_COMM_MAX 16
+
+/**
+ * @brief A process, and the traffic attributed to it.
+ */
+struct procnet_entry
+{
+    pid_t pid;
+    char comm[PROCNET_COMM_MAX];
+
+    /**
+     * @brief Data sent and received since \ref procnet_open.
+     */
+    uint64_t tx_bytes, rx_bytes;
+
+    /**
+     * @brief Whether any of it was attributed by what the process read and
+     *        wrote, rather than by the counters of its TCP sockets.
+     */
+    bool estimated;
+};
+
+/**
+ * @brief Start attributing traffic to processes, and find the owners of all
+ *        the sockets there are now, without a budget.
+ *
+ * @return 0 on success, or -1 if `/proc/net` cannot be read, or on failure
+ *         to allocate memory, in which case `errno` is set.
+ */
+int procnet_open (void);
+
+/**
+ * @brief Read the sockets there are now, and look for the owners of those
+ *        which were not there before, within the budget.
+ *
+ * @return The number of descriptor links which were read.
+ */
+unsigned int procnet_refresh (void);
+
+/**
+ * @brief Find the process which owns a socket, as of the last refresh.
+ *
+ * @param  inode The inode of the socket.
+ * @return       Its process ID, or -1 if no owner is known.
+ */
+pid_t procnet_owner (uint64_t inode);
+
+/**
+ * @brief Account for the data used during a tick. Once per
+ *        \ref PROCNET_REFRESH_MS, the sockets are refreshed and what was
+ *        used since the last time is attributed. Does nothing unless
+ *        \ref procnet_open was called.
+ *
+ * @param  tx  Data sent during the tick.
+ * @param  rx  Data received during the tick.
+ * @param  now The current time, in nanoseconds on the monotonic clock.
+ * @return Nothing
+ */
+void procnet_add (uint64_t tx, uint64_t rx, uint64_t now);
+
+/**
+ * @brief Get the processes to which the most data has been attributed.
+ *
+ * @param  top   Receives up to \a n processes, the busiest first.
+ * @param  n     The size of \a top.
+ * @param  other Receives the data which could not be attributed.
+ * @return       The number of processes in \a top.
+ */
+size_t procnet_top (struct procnet_entry *top, size_t n, struct stats *other);
+
+/**
+ * @brief Print the processes to which data has been attributed, the busiest
+ *        first.
+ *
+ * @param  f The stream to print to.
+ * @return Nothing
+ */
+void procnet_print (FILE *f);
+
+/**
+ * @brief Stop attributing traffic, and forget the processes.
+ *
+ * @return Nothing
+ */
+void procnet_close (void);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "rate.h"
+
+static void
+ewma_init (struct ewma *e, double tau)
+{
+    e->tau = tau;
+    e->value = 0;
+    e->weight = 0;
+}
+
+static void
+ewma_update (struct ewma *e, double rate, double dt)
+{
+    const double a = dt / (e->tau + dt);
+
+    e->weight += a * (1 - e->weight);
+    e->value += a / e->weight * (rate - e->value);
+}
+
+void
+rate_init (struct rates *r, double tau, double avg_tau)
+{
+    ewma_init (&r->tx, tau);
+    ewma_init (&r->rx, tau);
+    ewma_init (&r->tx_avg, avg_tau);
+    ewma_init (&r->rx_avg, avg_tau);
+
+    memset (&r->recent, 0, sizeof (r->recent));
+}
+
+void
+rate_update (struct rates *r, uint64_t tx, uint64_t rx, uint64_t elapsed)
+{
+    const double dt = elapsed / 1e9;
+
+    if (0 == elapsed)
+        return;
+
+    ewma_update (&r->tx, tx / dt, dt);
+    ewma_update (&r->rx, rx / dt, dt);
+    ewma_update (&r->tx_avg, tx / dt, dt);
+    ewma_update (&r->rx_avg, rx / dt, dt);
+
+    rate_record (r, tx / dt, rx / dt);
+}
+
+void
+rate_record (struct rates *r, double tx, double rx)
+{
+    r->recent.tx[r->recent.next] = tx;
+    r->recent.rx[r->recent.next] = rx;
+    r->recent.next = (r->recent.next + 1) % RATE_HISTORY;
+
+    if (r->recent.count < RATE_HISTORY)
+        ++r->recent.count;
+}
+
+double
+rate_eta (const struct rates *r, uint64_t balance)
+{
+    const double rate = r->tx_avg.value + r->rx_avg.value;
+
+    /* Less than a byte per second is as good as idle */
+    if (rate < 1)
+        return -1;
+
+    return balance / rate;
+}
+
+unsigned int
+rate_recent (const struct rates *r, double *tx, double *rx, unsigned int n)
+{
+    const struct rate_history *h = &r->recent;
+    unsigned int i, k;
+
+    if (n > h->count)
+        n = h->count;
+
+    k = (h->next + RATE_HISTORY - n) % RATE_HISTORY;
+
+    for (i = 0; i < n; ++i)
+    {
+        tx[i] = h->tx[k];
+        rx[i] = h->rx[k];
+        k = (k + 1) % RATE_HISTORY;
+    }
+
+    return n;
+}
+
+char *
+rate_format_eta (double seconds, char *buf)
+{
+    unsigned long t;
+
+    if (seconds < 0)
+    {
+        sprintf (buf, "-");
+        return buf;
+    }
+
+    if (seconds >= 86400.0 * 999)
+    {
+        sprintf (buf, ">999d");
+        return buf;
+    }
+
+    t = seconds + 0.5;
+
+    if (t < 60)
+        sprintf (buf, "%lus", t);
+    else if (t < 3600)
+        sprintf (buf, "%lum %02lus", t / 60, t % 60);
+    else if (t < 86400)
+        sprintf (buf, "%luh %02lum", t / 3600, t / 60 % 60);
+    else
+        sprintf (buf, "%lud %02luh", t / 86400, t / 3600 % 24);
+
+    return buf;
+}
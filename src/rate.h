@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file rate.h
+ * @brief Smoothed throughput rates, and an estimate of when the balance runs
+ *        out.
+ *
+ * Each direction is tracked by two exponentially weighted moving averages of
+ * the per-tick rate: a short one, for the current speed, and a long one, for
+ * the average speed. Since the sampling interval varies, the weight given to
+ * each new sample depends on how long the tick lasted, relative to the time
+ * constant of the average.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef RATE_H
+#define RATE_H
+
+#include <stdint.h>
+
+/**
+ * @brief Default time constant of the current rates, in seconds.
+ */
+#define RATE_DEFAULT_TAU 2.0
+
+/**
+ * @brief Default time constant of the average rates, in seconds.
+ */
+#define RATE_DEFAULT_AVG_TAU 60.0
+
+/**
+ * @brief An exponentially weighted moving average of a rate.
+ */
+struct ewma
+{
+    /**
+     * @brief Time constant, in seconds.
+     */
+    double tau;
+
+    /**
+     * @brief Current estimate, in bytes per second.
+     */
+    double value;
+
+    /**
+     * @brief Total weight of the samples taken so far, which approaches 1.
+     *        Dividing by it keeps the estimate from being biased towards
+     *        zero while there are only a few samples.
+     */
+    double weight;
+};
+
+/**
+ * @brief Number of per-tick rates kept for the graph.
+ */
+#define RATE_HISTORY 64
+
+/**
+ * @brief Size of a buffer which can hold any string produced by
+ *        \ref rate_format_eta, such as `999d 23h`.
+ */
+#define RATE_ETA_MAX 10
+
+/**
+ * @brief The most recent per-tick rates, in a ring of fixed size, so that
+ *        keeping them never allocates.
+ */
+struct rate_history
+{
+    double tx[RATE_HISTORY];
+    double rx[RATE_HISTORY];
+
+    /**
+     * @brief Where the next sample goes.
+     */
+    unsigned int next;
+
+    /**
+     * @brief Number of samples in the ring, at most #RATE_HISTORY.
+     */
+    unsigned int count;
+};
+
+/**
+ * @brief Current and average TX and RX rates.
+ */
+struct rates
+{
+    struct ewma tx;
+    struct ewma rx;
+    struct ewma tx_avg;
+    struct ewma rx_avg;
+    struct rate_history recent;
+};
+
+/**
+ * @brief Reset the rates, and set their time constants.
+ *
+ * @param  r       The rates to initialize.
+ * @param  tau     Time constant of the current rates, in seconds.
+ * @param  avg_tau Time constant of the average rates, in seconds.
+ * @return Nothing
+ */
+void rate_init (struct rates *r, double tau, double avg_tau);
+
+/**
+ * @brief Feed the data transferred during one tick to the rates, and keep
+ *        the rate of the tick in the ring of recent ones.
+ *
+ * A tick of length \f$\Delta t\f$ is given the weight
+ * \f$\Delta t / (\tau + \Delta t)\f$, so a long, idle tick pulls the
+ * estimates further towards zero than a short one.
+ *
+ * @param  r       The rates to update.
+ * @param  tx      Bytes transmitted during the tick.
+ * @param  rx      Bytes received during the tick.
+ * @param  elapsed Length of the tick, in nanoseconds. Ticks of length 0 are
+ *                 ignored.
+ * @return Nothing
+ */
+void rate_update (struct rates *r, uint64_t tx, uint64_t rx,
+                  uint64_t elapsed);
+
+/**
+ * @brief Keep a rate in the ring of recent ones, without feeding it to the
+ *        averages. This is for rates which are worked out elsewhere, such as
+ *        the sum of those of many hosts.
+ *
+ * @param  r  The rates.
+ * @param  tx The TX rate, in bytes per second.
+ * @param  rx The RX rate, in bytes per second.
+ * @return Nothing
+ */
+void rate_record (struct rates *r, double tx, double rx);
+
+/**
+ * @brief Estimate how long it takes for the balance to run out, at the
+ *        average rate.
+ *
+ * @param  r       The rates.
+ * @param  balance The amount of data left.
+ * @return         The estimate, in seconds, or -1 if no data is being
+ *                 transferred.
+ */
+double rate_eta (const struct rates *r, uint64_t balance);
+
+/**
+ * @brief Copy the most recent per-tick rates, oldest first.
+ *
+ * @param  r  The rates.
+ * @param  tx Array of at least \a n elements for the TX rates.
+ * @param  rx Array of at least \a n elements for the RX rates.
+ * @param  n  The number of rates wanted.
+ * @return    The number of rates copied, which is less than \a n if there
+ *            have not been that many ticks yet.
+ */
+unsigned int rate_recent (const struct rates *r, double *tx, double *rx,
+                          unsigned int n);
+
+/**
+ * @brief Format a duration as a short string, such as `42s`, `5m 07s`,
+ *        `3h 20m` or `2d 04h`, or `-` if it is negative.
+ *
+ * @param  seconds The duration.
+ * @param  buf     A buffer of at least \ref RATE_ETA_MAX bytes.
+ * @return         The \a buf argument.
+ */
+char *rate_format_eta (double seconds, char *buf);
+
+#endif
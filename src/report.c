@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "argtable3/argtable3.h"
+#include "mbs.h"
+#include "report.h"
+#include "rollup.h"
+
+struct row
+{
+    struct rollup_bucket bucket;
+    uint64_t total;
+};
+
+static const char *const level_names[ROLLUP_LEVELS] = {
+    "minute", "hour", "day", "month"
+};
+
+static const char *const level_formats[ROLLUP_LEVELS] = {
+    "%Y-%m-%d %H:%M", "%Y-%m-%d %H:%M", "%Y-%m-%d", "%Y-%m"
+};
+
+/*
+ * Start of the billing month which contains now, if the plan renews on the
+ * given day of the month.
+ */
+static uint64_t
+billing_month (uint64_t now, int day)
+{
+    const time_t when = now;
+    struct tm tm;
+
+    localtime_r (&when, &tm);
+
+    if (tm.tm_mday < day)
+        tm.tm_mon--;
+
+    tm.tm_mday = day;
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+
+    return mktime (&tm);
+}
+
+/*
+ * Parse a point in time: `now`, `today`, `month` (start of the billing
+ * month), `-<n>m`, `-<n>h` or `-<n>d` (relative to now), `YYYY-MM-DD`, or
+ * `YYYY-MM-DD HH:MM` (local time).
+ */
+static int
+parse_when (const char *str, uint64_t now, int billing_day, uint64_t *out)
+{
+    struct rollup_bucket today;
+    struct tm tm;
+    unsigned long n;
+    char unit, end;
+
+    if (0 == strcmp ("now", str))
+    {
+        *out = now;
+        return 0;
+    }
+
+    if (0 == strcmp ("today", str))
+    {
+        rollup_period (ROLLUP_DAY, now, &today);
+        *out = today.start;
+        return 0;
+    }
+
+    if (0 == strcmp ("month", str))
+    {
+        *out = billing_month (now, billing_day);
+        return 0;
+    }
+
+    if (2 == sscanf (str, "-%lu%c%c", &n, &unit, &end))
+    {
+        const uint64_t scale = 'm' == unit ? 60
+                             : 'h' == unit ? 3600
+                             : 'd' == unit ? 86400 : 0;
+
+        if (0 == scale || n * scale > now)
+            return -1;
+
+        *out = now - n * scale;
+        return 0;
+    }
+
+    memset (&tm, 0, sizeof (tm));
+
+    if (3 != sscanf (str, "%d-%d-%d%c", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                     &end)
+     && 5 != sscanf (str, "%d-%d-%d%*1[ T]%d:%d%c", &tm.tm_year, &tm.tm_mon,
+                     &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &end))
+        return -1;
+
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+
+    if (tm.tm_mon < 0 || tm.tm_mon > 11 || tm.tm_mday < 1 || tm.tm_mday > 31)
+        return -1;
+
+    *out = mktime (&tm);
+
+    return 0;
+}
+
+static void
+print_amount (uint64_t bytes, bool exact)
+{
+    char buf[MBS_HUMAN_READABLE_MAX];
+
+    if (exact)
+        printf ("  %20"PRIu64, bytes);
+    else
+        printf ("  %10s", to_human_readable (bytes, buf));
+}
+
+static void
+print_row (const char *label, const struct rollup_bucket *b, bool exact)
+{
+    printf ("%-33s", label);
+    print_amount (b->tx_bytes, exact);
+    print_amount (b->rx_bytes, exact);
+    print_amount (b->tx_bytes + b->rx_bytes, exact);
+    printf ("\n");
+}
+
+static void
+print_header (const char *label, bool exact)
+{
+    const int width = exact ? 22 : 12;
+
+    printf ("%-33s%*s%*s%*s\n", label, width, "TX", width, "RX", width,
+            "Total");
+}
+
+static int
+by_total (const void *a, const void *b)
+{
+    const uint64_t x = ((const struct row *) a)->total,
+                   y = ((const struct row *) b)->total;
+
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/*
+ * One row per period at the given level, or only the n largest ones.
+ */
+static int
+report_by (const struct rollup_file *f, enum rollup_level level,
+           uint64_t from, uint64_t to, uint64_t now, size_t top, bool exact)
+{
+    struct rollup_bucket b;
+    struct row *rows = NULL, *tmp;
+    size_t i, n = 0, size = 0;
+    char label[64];
+    uint64_t t;
+
+    for (t = from; t < to; t = b.end)
+    {
+        if (!rollup_get (f, level, t, now, &b)
+         || (0 == b.tx_bytes && 0 == b.rx_bytes))
+            continue;
+
+        if (n == size)
+        {
+            size = size ? size * 2 : 64;
+
+            if (NULL == (tmp = realloc (rows, size * sizeof (*rows))))
+            {
+                free (rows);
+                return -1;
+            }
+
+            rows = tmp;
+        }
+
+        rows[n].bucket = b;
+        rows[n].total = b.tx_bytes + b.rx_bytes;
+        n++;
+    }
+
+    if (top > 0)
+    {
+        qsort (rows, n, sizeof (*rows), by_total);
+
+        if (n > top)
+            n = top;
+    }
+
+    print_header (level_names[level], exact);
+
+    for (i = 0; i < n; ++i)
+    {
+        const time_t start = rows[i].bucket.start;
+        struct tm tm;
+
+        strftime (label, sizeof (label), level_formats[level],
+                  localtime_r (&start, &tm));
+        print_row (label, &rows[i].bucket, exact);
+    }
+
+    free (rows);
+
+    return 0;
+}
+
+/*
+ * A single row with the totals for the whole range.
+ */
+static void
+report_sum (const struct rollup_file *f, uint64_t from, uint64_t to,
+            uint64_t now, bool exact)
+{
+    struct rollup_bucket sum;
+    char label[64], end[20];
+    time_t start, stop;
+    struct tm tm;
+
+    rollup_sum (f, from, to, now, &sum);
+
+    start = sum.start;
+    stop = sum.end < now ? sum.end : now;
+
+    strftime (label, sizeof (label), "%Y-%m-%d %H:%M",
+              localtime_r (&start, &tm));
+    strftime (end, sizeof (end), "%Y-%m-%d %H:%M", localtime_r (&stop, &tm));
+    strcat (label, " - ");
+    strcat (label, end);
+
+    print_header ("period", exact);
+    print_row (label, &sum, exact);
+}
+
+int
+report_main (int argc, char *argv[])
+{
+    struct arg_lit *help,
+                   *exact,
+                   *si;
+    struct arg_str *rollups,
+                   *since,
+                   *until,
+                   *by;
+    struct arg_int *top,
+                   *billing_day;
+    struct arg_end *end;
+
+    const struct rollup_file *f;
+    const uint64_t now = time (NULL);
+    uint64_t from, to;
+    int nerrors, status = EXIT_FAILURE, level = ROLLUP_LEVELS, day = 1;
+    const char command[] = "mbs report";
+
+    void *argtable[] =
+    {
+        help = arg_litn (
+            NULL, "help",
+            0, 1, "display this help and exit"
+        ),
+        rollups = arg_strn (
+            NULL, "rollups", "<path>",
+            1, 1, "rollups file, as given to mbs --rollups"
+        ),
+        since = arg_strn (
+            NULL, "since", "<when>",
+            0, 1, "start of the range (default: month)"
+        ),
+        until = arg_strn (
+            NULL, "until", "<when>",
+            0, 1, "end of the range (default: now)"
+        ),
+        billing_day = arg_intn (
+            NULL, "billing-day", "<day>",
+            0, 1, "day of the month on which the plan renews (default: 1)"
+        ),
+        by = arg_strn (
+            NULL, "by", "<level>",
+            0, 1, "one row per minute, hour, day or month"
+        ),
+        top = arg_intn (
+            NULL, "top", "<n>",
+            0, 1, "only the n rows with the most data (with --by)"
+        ),
+        exact = arg_litn (
+            NULL, "bytes",
+            0, 1, "show exact byte counts"
+        ),
+        si = arg_litn (
+            NULL, "si",
+            0, 1, "show amounts in powers of 1000 rather than 1024"
+        ),
+        end = arg_end (20),
+    };
+
+    nerrors = arg_parse (argc, argv, argtable);
+
+    if (help->count > 0)
+    {
+        printf ("Usage: %s", command);
+        arg_print_syntax (stdout, argtable, "\n");
+        printf ("Report data used in a range of time, from the rollups kept "
+            "by mbs --rollups.\n\n");
+        arg_print_glossary (stdout, argtable, "  %-25s %s\n");
+        printf ("\n<when> is now, today, month (start of the billing month), "
+            "-<n>m, -<n>h, -<n>d,\nYYYY-MM-DD, or 'YYYY-MM-DD HH:MM'.\n");
+        arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+        return EXIT_SUCCESS;
+    }
+
+    if (nerrors > 0)
+    {
+        arg_print_errors (stdout, end, command);
+        printf ("Try '%s --help' for more information.\n", command);
+        goto done;
+    }
+
+    mbs_set_units (si->count ? MBS_UNITS_SI : MBS_UNITS_IEC);
+
+    if (billing_day->count > 0)
+    {
+        day = *billing_day->ival;
+
+        if (day < 1 || day > 28)
+        {
+            fprintf (stderr, "The billing day must be between 1 and 28.\n");
+            goto done;
+        }
+    }
+
+    if (by->count > 0)
+    {
+        for (level = 0; level < ROLLUP_LEVELS; ++level)
+        {
+            if (0 == strcmp (level_names[level], *by->sval))
+                break;
+        }
+
+        if (ROLLUP_LEVELS == level)
+        {
+            fprintf (stderr, "Unknown level: %s\n", *by->sval);
+            goto done;
+        }
+    }
+
+    if (top->count > 0 && (ROLLUP_LEVELS == level || *top->ival < 1))
+    {
+        fprintf (stderr, "--top needs --by, and a positive number.\n");
+        goto done;
+    }
+
+    if (-1 == parse_when (since->count ? *since->sval : "month", now, day,
+                          &from)
+     || -1 == parse_when (until->count ? *until->sval : "now", now, day, &to))
+    {
+        fprintf (stderr, "Invalid time.\n");
+        goto done;
+    }
+
+    if (NULL == (f = rollup_map (*rollups->sval)))
+    {
+        fprintf (
+            stderr, "Error opening rollups '%s': %s\n", *rollups->sval,
+            EPROTO == errno ? "not a rollups file" : strerror (errno)
+        );
+        goto done;
+    }
+
+    if (ROLLUP_LEVELS == level)
+    {
+        report_sum (f, from, to, now, exact->count > 0);
+        status = EXIT_SUCCESS;
+    }
+    else if (0 == report_by (f, level, from, to, now,
+                             top->count ? *top->ival : 0, exact->count > 0))
+    {
+        status = EXIT_SUCCESS;
+    }
+
+    rollup_unmap (f);
+
+done:
+    arg_freetable (argtable, sizeof (argtable) / sizeof (argtable[0]));
+
+    return status;
+}
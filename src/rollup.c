@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "mbs.h"
+#include "rollup.h"
+
+static const uint32_t capacity[ROLLUP_LEVELS] = {
+    ROLLUP_MINUTES, ROLLUP_HOURS, ROLLUP_DAYS, ROLLUP_MONTHS
+};
+
+static const size_t offset[ROLLUP_LEVELS] = {
+    0,
+    ROLLUP_MINUTES,
+    ROLLUP_MINUTES + ROLLUP_HOURS,
+    ROLLUP_MINUTES + ROLLUP_HOURS + ROLLUP_DAYS
+};
+
+/* Shortest length of a period at each level, in seconds */
+static const uint64_t min_length[ROLLUP_LEVELS] = {
+    60, 3600, 23 * 3600, 28 * 86400
+};
+
+static struct rollup_file *map = NULL;
+
+/* The bucket being added to at each level */
+static struct rollup_bucket *current[ROLLUP_LEVELS];
+
+static bool dirty = false;
+static uint64_t synced = 0;
+static uint64_t sync_ns = 0;
+
+/*
+ * Work out the period containing t, and its position in the ring.
+ */
+static uint64_t
+period (enum rollup_level level, uint64_t t, struct rollup_bucket *out)
+{
+    const time_t when = t;
+    uint64_t index;
+    struct tm tm;
+
+    memset (out, 0, sizeof (*out));
+
+    if (ROLLUP_MINUTE == level)
+    {
+        out->start = t - t % 60;
+        out->end = out->start + 60;
+
+        return t / 60;
+    }
+
+    localtime_r (&when, &tm);
+
+    switch (level)
+    {
+        case ROLLUP_HOUR:
+            out->start = t - tm.tm_min * 60 - tm.tm_sec;
+            out->end = out->start + 3600;
+
+            return out->start / 3600;
+
+        case ROLLUP_DAY:
+            /* Local days since the epoch */
+            index = (t + tm.tm_gmtoff) / 86400;
+            break;
+
+        default:
+            index = tm.tm_year * 12 + tm.tm_mon;
+            tm.tm_mday = 1;
+    }
+
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    out->start = mktime (&tm);
+
+    if (ROLLUP_DAY == level)
+        tm.tm_mday++;
+    else
+        tm.tm_mon++;
+
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    out->end = mktime (&tm);
+
+    return index;
+}
+
+static const struct rollup_bucket *
+slot (const struct rollup_file *f, enum rollup_level level, uint64_t t,
+      struct rollup_bucket *p)
+{
+    const uint64_t index = period (level, t, p);
+
+    return &f->buckets[offset[level] + index % capacity[level]];
+}
+
+static bool
+valid (const struct rollup_file *f)
+{
+    return ROLLUP_MAGIC == f->magic
+        && ROLLUP_VERSION == f->version
+        && 0 == memcmp (f->capacity, capacity, sizeof (capacity));
+}
+
+int
+rollup_open (const char *path, unsigned int sync_interval)
+{
+    struct stat st;
+    int fd, i;
+
+    if (-1 == (fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)))
+        return -1;
+
+    if (-1 == fstat (fd, &st)
+     || (0 == st.st_size && -1 == ftruncate (fd, sizeof (*map))))
+    {
+        const int err = errno;
+
+        close (fd);
+        errno = err;
+        return -1;
+    }
+
+    if (0 != st.st_size && (off_t) sizeof (*map) != st.st_size)
+    {
+        close (fd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    map = mmap (NULL, sizeof (*map), PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+    close (fd);
+
+    if (MAP_FAILED == map)
+    {
+        map = NULL;
+        return -1;
+    }
+
+    if (0 == st.st_size)
+    {
+        map->magic = ROLLUP_MAGIC;
+        map->version = ROLLUP_VERSION;
+        memcpy (map->capacity, capacity, sizeof (capacity));
+    }
+    else if (!valid (map))
+    {
+        munmap (map, sizeof (*map));
+        map = NULL;
+        errno = EPROTO;
+        return -1;
+    }
+
+    for (i = 0; i < ROLLUP_LEVELS; ++i)
+        current[i] = NULL;
+
+    dirty = false;
+    synced = mbs_now ();
+    sync_ns = sync_interval * 1000000000ULL;
+
+    return 0;
+}
+
+void
+rollup_add (uint64_t time, uint64_t tx_bytes, uint64_t rx_bytes)
+{
+    struct rollup_bucket p;
+    int i;
+
+    if (NULL == map || (0 == tx_bytes && 0 == rx_bytes))
+        return;
+
+    for (i = 0; i < ROLLUP_LEVELS; ++i)
+    {
+        struct rollup_bucket *b = current[i];
+
+        if (NULL == b || time < b->start || time >= b->end)
+        {
+            b = current[i] = (struct rollup_bucket *) slot (map, i, time, &p);
+
+            /* The slot still holds a period which has been wrapped around */
+            if (b->start != p.start || b->end != p.end)
+                *b = p;
+        }
+
+        b->tx_bytes += tx_bytes;
+        b->rx_bytes += rx_bytes;
+    }
+
+    dirty = true;
+}
+
+int
+rollup_sync (void)
+{
+    if (NULL == map || !dirty || mbs_now () - synced < sync_ns)
+        return 0;
+
+    if (-1 == msync (map, sizeof (*map), MS_SYNC))
+        return -1;
+
+    dirty = false;
+    synced = mbs_now ();
+
+    return 0;
+}
+
+void
+rollup_close (void)
+{
+    if (NULL == map)
+        return;
+
+    if (dirty)
+        msync (map, sizeof (*map), MS_SYNC);
+
+    munmap (map, sizeof (*map));
+
+    map = NULL;
+    dirty = false;
+}
+
+const struct rollup_file *
+rollup_map (const char *path)
+{
+    struct rollup_file *f;
+    struct stat st;
+    int fd;
+
+    if (-1 == (fd = open (path, O_RDONLY | O_CLOEXEC)))
+        return NULL;
+
+    if (-1 == fstat (fd, &st) || (off_t) sizeof (*f) != st.st_size)
+    {
+        close (fd);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    f = mmap (NULL, sizeof (*f), PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+
+    if (MAP_FAILED == f)
+        return NULL;
+
+    if (!valid (f))
+    {
+        munmap (f, sizeof (*f));
+        errno = EPROTO;
+        return NULL;
+    }
+
+    return f;
+}
+
+void
+rollup_unmap (const struct rollup_file *f)
+{
+    munmap ((void *) f, sizeof (*f));
+}
+
+void
+rollup_period (enum rollup_level level, uint64_t time,
+               struct rollup_bucket *out)
+{
+    period (level, time, out);
+}
+
+int
+rollup_get (const struct rollup_file *f, enum rollup_level level,
+            uint64_t time, uint64_t now, struct rollup_bucket *out)
+{
+    const struct rollup_bucket *b = slot (f, level, time, out);
+
+    /*
+     * Periods further back than the ring reaches have been overwritten, or
+     * will be, even if the slot happens to be untouched.
+     */
+    if (out->start + (capacity[level] - 1) * min_length[level] <= now)
+        return 0;
+
+    if (b->start == out->start && b->end == out->end)
+    {
+        out->tx_bytes = b->tx_bytes;
+        out->rx_bytes = b->rx_bytes;
+    }
+
+    return 1;
+}
+
+long
+rollup_sum (const struct rollup_file *f, uint64_t from, uint64_t to,
+            uint64_t now, struct rollup_bucket *out)
+{
+    struct rollup_bucket b;
+    uint64_t t = from;
+    long n = 0;
+    int level;
+
+    memset (out, 0, sizeof (*out));
+
+    out->start = from;
+    out->end = from;
+
+    while (t < to)
+    {
+        /* The coarsest bucket which starts here and ends within the range */
+        for (level = ROLLUP_MONTH; level >= ROLLUP_MINUTE; --level)
+        {
+            if (rollup_get (f, level, t, now, &b)
+             && b.start == t && b.end <= to)
+                break;
+        }
+
+        /* Otherwise, the finest bucket still held which contains t */
+        if (level < ROLLUP_MINUTE)
+        {
+            for (level = ROLLUP_MINUTE; level < ROLLUP_LEVELS; ++level)
+            {
+                if (rollup_get (f, level, t, now, &b))
+                    break;
+            }
+
+            /* Older than anything kept */
+            if (ROLLUP_LEVELS == level)
+            {
+                t += min_length[ROLLUP_MONTH];
+                out->start = t;
+                out->end = t;
+                continue;
+            }
+        }
+
+        if (0 == n++ && b.start < out->start)
+            out->start = b.start;
+
+        out->end = b.end;
+        out->tx_bytes += b.tx_bytes;
+        out->rx_bytes += b.rx_bytes;
+        t = b.end;
+    }
+
+    return n;
+}
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file rollup.h
+ * @brief Per-minute, per-hour, per-day and per-month totals of the data
+ *        transferred (`--rollups=<path>`), and range queries over them.
+ *
+ * The totals are kept in a file which is mapped into memory. Each level is a
+ * ring of buckets, indexed by period, which holds the most recent periods:
+ *
+ * | Level  | Buckets                | Covers        |
+ * |--------|------------------------|---------------|
+ * | Minute | \ref ROLLUP_MINUTES    | 31 days       |
+ * | Hour   | \ref ROLLUP_HOURS      | 2 years       |
+ * | Day    | \ref ROLLUP_DAYS       | 10 years      |
+ * | Month  | \ref ROLLUP_MONTHS     | 100 years     |
+ *
+ * Hours, days and months follow local time. Every bucket records the period
+ * it belongs to, so a bucket which was last written long ago is recognized
+ * and reset when its slot comes around again.
+ *
+ * Adding a sample updates one bucket per level; the periods are only worked
+ * out again when a boundary is crossed. A query over a range is answered by
+ * stepping through it with the coarsest bucket that fits: a year takes a few
+ * dozen buckets, not half a million minutes.
+ *
+ * All fields are in host byte order.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stdint.h>
+
+/**
+ * @brief Value of \ref rollup_file::magic ("MBSR").
+ */
+#define ROLLUP_MAGIC 0x5253424d
+
+/**
+ * @brief Layout version; bumped whenever \ref rollup_file changes.
+ */
+#define ROLLUP_VERSION 1
+
+/**
+ * @brief Number of buckets at each level.
+ */
+#define ROLLUP_MINUTES (60 * 24 * 31)
+#define ROLLUP_HOURS   (24 * 366 * 2)
+#define ROLLUP_DAYS    (366 * 10)
+#define ROLLUP_MONTHS  (12 * 100)
+
+/**
+ * @brief Total number of buckets in the file.
+ */
+#define ROLLUP_BUCKETS \
+    (ROLLUP_MINUTES + ROLLUP_HOURS + ROLLUP_DAYS + ROLLUP_MONTHS)
+
+/**
+ * @brief Resolutions, from finest to coarsest.
+ */
+enum rollup_level
+{
+    ROLLUP_MINUTE,
+    ROLLUP_HOUR,
+    ROLLUP_DAY,
+    ROLLUP_MONTH,
+    ROLLUP_LEVELS
+};
+
+/**
+ * @brief Data transferred during one period.
+ */
+struct rollup_bucket
+{
+    /**
+     * @brief Start and end of the period, in seconds since the epoch. Both
+     *        are 0 in a bucket which was never written.
+     */
+    uint64_t start, end;
+
+    /**
+     * @brief Number of bytes sent and received.
+     */
+    uint64_t tx_bytes, rx_bytes;
+};
+
+/**
+ * @brief Layout of the file.
+ */
+struct rollup_file
+{
+    /**
+     * @brief Always \ref ROLLUP_MAGIC.
+     */
+    uint32_t magic;
+
+    /**
+     * @brief Always \ref ROLLUP_VERSION.
+     */
+    uint32_t version;
+
+    /**
+     * @brief Number of buckets at each level, as a guard against files
+     *        written with different settings.
+     */
+    uint32_t capacity[ROLLUP_LEVELS];
+
+    uint64_t reserved;
+
+    /**
+     * @brief The buckets of each level, minutes first.
+     */
+    struct rollup_bucket buckets[ROLLUP_BUCKETS];
+};
+
+/**
+ * @brief Open and map the file for updating, creating it if it does not
+ *        exist.
+ *
+ * @param  path          Location of the file.
+ * @param  sync_interval Minimum number of seconds between flushes to disk.
+ * @return               0 on success, or -1 if the file could not be opened
+ *                       or has an unexpected layout, in which case `errno`
+ *                       is set.
+ */
+int rollup_open (const char *path, unsigned int sync_interval);
+
+/**
+ * @brief Add data transferred at the given time to the bucket at each level.
+ *
+ * @param  time     Wall-clock time, in seconds since the epoch.
+ * @param  tx_bytes Number of bytes sent.
+ * @param  rx_bytes Number of bytes received.
+ * @return Nothing
+ */
+void rollup_add (uint64_t time, uint64_t tx_bytes, uint64_t rx_bytes);
+
+/**
+ * @brief Flush updated buckets to disk, if the sync interval has passed
+ *        since the last flush. This is cheap to call on every tick.
+ *
+ * @return 0 on success, or -1 if the flush failed.
+ */
+int rollup_sync (void);
+
+/**
+ * @brief Flush any pending updates and unmap the file.
+ *
+ * @return Nothing
+ */
+void rollup_close (void);
+
+/**
+ * @brief Map the file read-only, for queries.
+ *
+ * @param  path Location of the file.
+ * @return      The mapped file, or `NULL` if it could not be opened or has
+ *              an unexpected layout. Release it with \ref rollup_unmap.
+ */
+const struct rollup_file *rollup_map (const char *path);
+
+/**
+ * @brief Unmap a file mapped by \ref rollup_map.
+ *
+ * @param  f The mapped file.
+ * @return Nothing
+ */
+void rollup_unmap (const struct rollup_file *f);
+
+/**
+ * @brief Work out the period which contains a point in time.
+ *
+ * @param  level The resolution.
+ * @param  time  Seconds since the epoch.
+ * @param  out   Receives the start and end of the period; the amounts are
+ *               set to 0.
+ * @return Nothing
+ */
+void rollup_period (enum rollup_level level, uint64_t time,
+                    struct rollup_bucket *out);
+
+/**
+ * @brief Look up the bucket of the period which contains a point in time.
+ *
+ * @param  f     The mapped file.
+ * @param  level The resolution.
+ * @param  time  Seconds since the epoch.
+ * @param  now   The current time, which tells how far back each level
+ *               reaches.
+ * @param  out   Receives the period and its amounts, which are 0 if nothing
+ *               was recorded.
+ * @return       1 if the period is still held at this level, 0 if it has
+ *               been overwritten.
+ */
+int rollup_get (const struct rollup_file *f, enum rollup_level level,
+                uint64_t time, uint64_t now, struct rollup_bucket *out);
+
+/**
+ * @brief Add up the data transferred in a range, using the coarsest buckets
+ *        which fit. Where the range does not start or end on a boundary kept
+ *        for that period, it is widened to the enclosing bucket.
+ *
+ * @param  f    The mapped file.
+ * @param  from Start of the range (inclusive), in seconds since the epoch.
+ * @param  to   End of the range (exclusive).
+ * @param  now  The current time.
+ * @param  out  Receives the range actually covered, and the totals.
+ * @return      The number of buckets read.
+ */
+long rollup_sum (const struct rollup_file *f, uint64_t from, uint64_t to,
+                 uint64_t now, struct rollup_bucket *out);
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "mbs.h"
+#include "selfstats.h"
+
+static const char *const phase_names[SELFSTATS_PHASES] = {
+    "poll", "update", "save", "draw", "tick"
+};
+
+static struct selfstats_timing timings[SELFSTATS_PHASES];
+
+static struct
+{
+    uint64_t start, last;
+    uint64_t phase[SELFSTATS_PHASES];
+    unsigned int ran;
+    int64_t allocations;
+} tick;
+
+static uint64_t started;
+static double cpu_started;
+static int64_t syscalls_started;
+static uint64_t tick_allocations;
+
+/* Counted by allocs.c, in the builds which include it */
+#ifndef COUNT_ALLOCATIONS
+int64_t
+selfstats_allocations (void)
+{
+    return -1;
+}
+#endif
+
+static double
+cpu_time (void)
+{
+    struct rusage ru;
+
+    if (-1 == getrusage (RUSAGE_SELF, &ru))
+        return 0;
+
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+         + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/*
+ * Read and write system calls made by the process, or -1 if unknown. This is
+ * called while the panel is drawn, during a tick, so it does not allocate.
+ */
+static int64_t
+syscalls (void)
+{
+    const char *p;
+    char buf[512];
+    ssize_t len;
+    int fd;
+
+    if (-1 == (fd = open ("/proc/self/io", O_RDONLY | O_CLOEXEC)))
+        return -1;
+
+    len = read (fd, buf, sizeof (buf) - 1);
+    close (fd);
+
+    if (len <= 0)
+        return -1;
+
+    buf[len] = '\0';
+
+    if (NULL == (p = strstr (buf, "syscr: ")) || NULL == strstr (p, "syscw: "))
+        return -1;
+
+    return strtoull (p + 7, NULL, 10)
+         + strtoull (strstr (p, "syscw: ") + 7, NULL, 10);
+}
+
+void
+selfstats_init (void)
+{
+    int p;
+
+    memset (timings, 0, sizeof (timings));
+
+    for (p = 0; p < SELFSTATS_PHASES; ++p)
+        timings[p].min = UINT64_MAX;
+
+    tick_allocations = 0;
+    started = mbs_now ();
+    cpu_started = cpu_time ();
+    syscalls_started = syscalls ();
+}
+
+void
+selfstats_begin (void)
+{
+    memset (&tick, 0, sizeof (tick));
+
+    tick.start = tick.last = mbs_now ();
+    tick.allocations = selfstats_allocations ();
+}
+
+void
+selfstats_mark (enum selfstats_phase phase)
+{
+    const uint64_t now = mbs_now ();
+
+    tick.phase[phase] += now - tick.last;
+    tick.ran |= 1u << phase;
+    tick.last = now;
+}
+
+int
+selfstats_bucket (uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    int k = 0;
+
+    while (us > 0 && k < SELFSTATS_BUCKETS - 1)
+    {
+        us >>= 1;
+        ++k;
+    }
+
+    return k;
+}
+
+static void
+add (struct selfstats_timing *t, uint64_t ns)
+{
+    if (ns < t->min)
+        t->min = ns;
+
+    if (ns > t->max)
+        t->max = ns;
+
+    t->total += ns;
+    t->histogram[selfstats_bucket (ns)]++;
+    t->count++;
+}
+
+void
+selfstats_end (void)
+{
+    int p;
+
+    tick.phase[SELFSTATS_TICK] = mbs_now () - tick.start;
+    tick.ran |= 1u << SELFSTATS_TICK;
+
+    for (p = 0; p < SELFSTATS_PHASES; ++p)
+    {
+        if (tick.ran & (1u << p))
+            add (&timings[p], tick.phase[p]);
+    }
+
+    if (tick.allocations >= 0)
+        tick_allocations += selfstats_allocations () - tick.allocations;
+}
+
+const struct selfstats_timing *
+selfstats_timing (enum selfstats_phase phase)
+{
+    return &timings[phase];
+}
+
+const char *
+selfstats_phase_name (enum selfstats_phase phase)
+{
+    return phase_names[phase];
+}
+
+void
+selfstats_usage (struct selfstats_usage *usage)
+{
+    const int64_t calls = syscalls ();
+
+    usage->wall = (mbs_now () - started) / 1e9;
+    usage->cpu = cpu_time () - cpu_started;
+    usage->ticks = timings[SELFSTATS_TICK].count;
+    usage->allocations = selfstats_allocations () < 0
+                       ? -1 : (int64_t) tick_allocations;
+    usage->syscalls = calls < 0 || syscalls_started < 0
+                    ? -1 : calls - syscalls_started;
+}
+
+char *
+selfstats_format_ns (uint64_t ns, bool ascii, char *buf)
+{
+    if (ns < 1000)
+        snprintf (buf, SELFSTATS_NS_MAX, "%" PRIu64 "ns", ns);
+    else if (ns < 1000000)
+        snprintf (buf, SELFSTATS_NS_MAX, "%.1f%s", ns / 1e3,
+                  ascii ? "us" : "µs");
+    else if (ns < 1000000000)
+        snprintf (buf, SELFSTATS_NS_MAX, "%.1fms", ns / 1e6);
+    else
+        snprintf (buf, SELFSTATS_NS_MAX, "%.1fs", ns / 1e9);
+
+    return buf;
+}
+
+void
+selfstats_print (FILE *f)
+{
+    struct selfstats_usage u;
+    char min[SELFSTATS_NS_MAX], avg[SELFSTATS_NS_MAX], max[SELFSTATS_NS_MAX];
+    int p, k;
+
+    selfstats_usage (&u);
+
+    fprintf (f, "%-7s %9s %9s %9s %9s  histogram (<1us <2us <4us ... "
+             ">=16ms)\n", "phase", "count", "min", "avg", "max");
+
+    for (p = 0; p < SELFSTATS_PHASES; ++p)
+    {
+        const struct selfstats_timing *t = &timings[p];
+
+        if (0 == t->count)
+        {
+            fprintf (f, "%-7s %9d %9s %9s %9s\n", phase_names[p], 0,
+                     "-", "-", "-");
+            continue;
+        }
+
+        fprintf (f, "%-7s %9" PRIu64 " %9s %9s %9s ", phase_names[p],
+                 t->count, selfstats_format_ns (t->min, true, min),
+                 selfstats_format_ns (t->total / t->count, true, avg),
+                 selfstats_format_ns (t->max, true, max));
+
+        for (k = 0; k < SELFSTATS_BUCKETS; ++k)
+            fprintf (f, " %" PRIu64, t->histogram[k]);
+
+        fprintf (f, "\n");
+    }
+
+    fprintf (f, "CPU time: %.3fs of %.1fs (%.3f%%)\n", u.cpu, u.wall,
+             u.wall > 0 ? 100 * u.cpu / u.wall : 0);
+
+    if (u.syscalls >= 0)
+    {
+        fprintf (f, "Read/write system calls: %" PRId64 " (%.2f per tick)\n",
+                 u.syscalls, u.ticks ? (double) u.syscalls / u.ticks : 0);
+    }
+
+    if (u.allocations >= 0)
+    {
+        fprintf (f, "Allocations during ticks: %" PRId64 " (%.2f per tick)\n",
+                 u.allocations,
+                 u.ticks ? (double) u.allocations / u.ticks : 0);
+    }
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file selfstats.h
+ * @brief What the command itself costs: the time taken by each phase of a
+ *        tick, the allocations made during ticks, and the CPU time and
+ *        system calls of the process (`--self-stats`).
+ *
+ * Each tick of the main loop is split into phases, which are timed with the
+ * monotonic clock. For each, the shortest, average and longest time are kept,
+ * along with a histogram with one bucket per power of two microseconds. A
+ * phase which does not run during a tick (e.g., nothing is drawn while the
+ * link is idle) is not counted for it. Timing a tick takes a handful of reads
+ * of the clock, which costs no system calls.
+ *
+ * Allocations are counted by standing in for `malloc()` and the rest of the
+ * allocator, where the C library allows it (glibc). This is only built into
+ * `mbs_bench`, the tests, and `mbs` when configured with
+ * `-DWITH_ALLOCATION_COUNTING=ON`; otherwise the allocator is left alone, and
+ * allocations are not counted. System calls are those which read or write, as
+ * counted by the kernel in `/proc/self/io`, which is only read when the
+ * statistics are shown.
+ *
+ * With `--self-stats`, the statistics are printed on exit. In the terminal
+ * interface, they are shown in a panel, which the `s` key toggles.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef SELFSTATS_H
+#define SELFSTATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Number of buckets in a histogram. Bucket \f$k\f$ counts times
+ *        below \f$2^k\f$ microseconds, and the last one everything else.
+ */
+#define SELFSTATS_BUCKETS 16
+
+/**
+ * @brief Size of a buffer which can hold any time formatted by
+ *        \ref selfstats_format_ns.
+ */
+#define SELFSTATS_NS_MAX 16
+
+/**
+ * @brief The phases of a tick.
+ */
+enum selfstats_phase
+{
+    /**
+     * @brief Reading the counters (\ref mbs_poll_interfaces).
+     */
+    SELFSTATS_POLL,
+
+    /**
+     * @brief Updating the usage, balance and rates, and publishing them.
+     */
+    SELFSTATS_UPDATE,
+
+    /**
+     * @brief Writing the stats file, history and rollups.
+     */
+    SELFSTATS_SAVE,
+
+    /**
+     * @brief Drawing the window, or printing the status line.
+     */
+    SELFSTATS_DRAW,
+
+    /**
+     * @brief The whole tick.
+     */
+    SELFSTATS_TICK,
+
+    SELFSTATS_PHASES
+};
+
+/**
+ * @brief Timings of one phase.
+ */
+struct selfstats_timing
+{
+    /**
+     * @brief Number of ticks in which the phase ran.
+     */
+    uint64_t count;
+
+    /**
+     * @brief Shortest, longest and total time, in nanoseconds.
+     */
+    uint64_t min, max, total;
+
+    /**
+     * @brief Number of times in each bucket.
+     */
+    uint64_t histogram[SELFSTATS_BUCKETS];
+};
+
+/**
+ * @brief What the process has used since \ref selfstats_init.
+ */
+struct selfstats_usage
+{
+    /**
+     * @brief Wall-clock time, and user and system CPU time, in seconds.
+     */
+    double wall, cpu;
+
+    /**
+     * @brief Number of ticks.
+     */
+    uint64_t ticks;
+
+    /**
+     * @brief Allocations made during ticks, or -1 if they are not counted.
+     */
+    int64_t allocations;
+
+    /**
+     * @brief Read and write system calls, or -1 if they are not known.
+     */
+    int64_t syscalls;
+};
+
+/**
+ * @brief Start counting from now.
+ *
+ * @return Nothing
+ */
+void selfstats_init (void);
+
+/**
+ * @brief Mark the start of a tick.
+ *
+ * @return Nothing
+ */
+void selfstats_begin (void);
+
+/**
+ * @brief Charge the time since the last mark (or the start of the tick) to
+ *        a phase.
+ *
+ * @param  phase The phase which just ended.
+ * @return Nothing
+ */
+void selfstats_mark (enum selfstats_phase phase);
+
+/**
+ * @brief Mark the end of a tick, and add the time of each phase which ran to
+ *        its timings.
+ *
+ * @return Nothing
+ */
+void selfstats_end (void);
+
+/**
+ * @brief Get the timings of a phase.
+ *
+ * @param  phase The phase.
+ * @return       The timings, which are updated by \ref selfstats_end.
+ */
+const struct selfstats_timing *selfstats_timing (enum selfstats_phase phase);
+
+/**
+ * @brief Name of a phase, such as `poll`.
+ *
+ * @param  phase The phase.
+ * @return       The name.
+ */
+const char *selfstats_phase_name (enum selfstats_phase phase);
+
+/**
+ * @brief The histogram bucket of a time.
+ *
+ * @param  ns A time, in nanoseconds.
+ * @return    The bucket, from 0 to \ref SELFSTATS_BUCKETS - 1.
+ */
+int selfstats_bucket (uint64_t ns);
+
+/**
+ * @brief Get the CPU time, system calls and allocations used so far.
+ *
+ * @param  usage A struct to which the usage is written.
+ * @return Nothing
+ */
+void selfstats_usage (struct selfstats_usage *usage);
+
+/**
+ * @brief Number of allocations made by the process so far.
+ *
+ * @return The number, or -1 if allocations are not counted (in this build,
+ *         or with this C library).
+ */
+int64_t selfstats_allocations (void);
+
+/**
+ * @brief Format a time as a short string, such as `850ns`, `12.5us` or
+ *        `3.2ms`, using `µs` unless \a ascii is set.
+ *
+ * @param  ns    The time, in nanoseconds.
+ * @param  ascii Whether to stick to ASCII.
+ * @param  buf   A buffer of at least \ref SELFSTATS_NS_MAX bytes.
+ * @return       The \a buf argument.
+ */
+char *selfstats_format_ns (uint64_t ns, bool ascii, char *buf);
+
+/**
+ * @brief Print the timings and usage, as a table.
+ *
+ * @param  f The stream to print to.
+ * @return Nothing
+ */
+void selfstats_print (FILE *f);
+
+#endif
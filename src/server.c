@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.h"
+
+struct client
+{
+    int fd;
+    bool subscribed;
+    size_t len;
+    char buf[64];
+};
+
+static int epfd = -1;
+static int listen_fd = -1;
+static char *socket_path = NULL;
+
+static struct client clients[SERVER_MAX_CLIENTS];
+static size_t n_clients = 0;
+
+static int
+make_address (const char *path, struct sockaddr_un *addr)
+{
+    memset (addr, 0, sizeof (*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen (path) >= sizeof (addr->sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy (addr->sun_path, path);
+    return 0;
+}
+
+/*
+ * Remove a socket left behind by an instance which is no longer running.
+ * Anything else at the path, including a live socket, is left alone.
+ */
+static void
+remove_stale (const struct sockaddr_un *addr)
+{
+    struct stat st;
+    int fd;
+
+    if (-1 == lstat (addr->sun_path, &st) || !S_ISSOCK (st.st_mode))
+        return;
+
+    if (-1 == (fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)))
+        return;
+
+    if (-1 == connect (fd, (const struct sockaddr *) addr, sizeof (*addr)) &&
+        ECONNREFUSED == errno)
+        unlink (addr->sun_path);
+
+    close (fd);
+}
+
+int
+server_open (const char *path)
+{
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+
+    if (-1 == make_address (path, &addr))
+        return -1;
+
+    remove_stale (&addr);
+
+    listen_fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        0);
+
+    if (-1 == listen_fd)
+        return -1;
+
+    if (-1 == bind (listen_fd, (struct sockaddr *) &addr, sizeof (addr)))
+    {
+        close (listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    socket_path = strdup (path);
+
+    memset (&ev, 0, sizeof (ev));
+
+    ev.events  = EPOLLIN;
+    ev.data.fd = listen_fd;
+
+    if (-1 == listen (listen_fd, 16)
+     || -1 == (epfd = epoll_create1 (EPOLL_CLOEXEC))
+     || -1 == epoll_ctl (epfd, EPOLL_CTL_ADD, listen_fd, &ev))
+    {
+        const int err = errno;
+
+        server_close ();
+        errno = err;
+        return -1;
+    }
+
+    return epfd;
+}
+
+static struct client *
+find_client (int fd)
+{
+    size_t i;
+
+    for (i = 0; i < n_clients; ++i)
+    {
+        if (clients[i].fd == fd)
+            return &clients[i];
+    }
+
+    return NULL;
+}
+
+static void
+drop_client (struct client *c)
+{
+    epoll_ctl (epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close (c->fd);
+
+    *c = clients[--n_clients];
+}
+
+static void
+accept_clients (void)
+{
+    struct epoll_event ev;
+    int fd;
+
+    while (-1 != (fd = accept4 (listen_fd, NULL, NULL,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC)))
+    {
+        memset (&ev, 0, sizeof (ev));
+
+        ev.events  = EPOLLIN;
+        ev.data.fd = fd;
+
+        if (SERVER_MAX_CLIENTS == n_clients ||
+            -1 == epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev))
+        {
+            close (fd);
+            continue;
+        }
+
+        memset (&clients[n_clients], 0, sizeof (clients[n_clients]));
+        clients[n_clients++].fd = fd;
+    }
+}
+
+/*
+ * Replies are small, and sent in one go. A client which cannot take a whole
+ * reply right away is not reading, and gets dropped.
+ */
+static int
+reply (struct client *c, const char *buf, size_t len)
+{
+    return (ssize_t) len == send (c->fd, buf, len,
+                                  MSG_NOSIGNAL | MSG_DONTWAIT) ? 0 : -1;
+}
+
+static int
+handle_request (const struct mbs *s, struct client *c, const char *request)
+{
+    char line[MBS_STATE_LINE_MAX];
+    size_t i;
+    int len;
+
+    if (0 == strcmp ("GET", request))
+    {
+        len = mbs_format_state (s, line, sizeof (line) - 1);
+        line[len++] = '\n';
+
+        return reply (c, line, len);
+    }
+
+    if (0 == strcmp ("IFACES", request))
+    {
+        for (i = 0; i < s->n_ifaces; ++i)
+        {
+            const struct iface *ifa = &s->ifaces[i];
+
+            len = snprintf (
+                line, sizeof (line), "%s:%"PRIu64":%"PRIu64":%d\n",
+                ifa->name, ifa->used.tx_bytes, ifa->used.rx_bytes, ifa->error
+            );
+
+            if ((size_t) len >= sizeof (line) || -1 == reply (c, line, len))
+                return -1;
+        }
+
+        return reply (c, "\n", 1);
+    }
+
+    if (0 == strcmp ("SUBSCRIBE", request) ||
+        0 == strcmp ("UNSUBSCRIBE", request))
+    {
+        c->subscribed = 'S' == *request;
+        return reply (c, "OK\n", 3);
+    }
+
+    return reply (c, "ERR\n", 4);
+}
+
+/*
+ * Read what the client has sent, and answer every complete line. Returns -1
+ * if the client should be dropped.
+ */
+static int
+serve_client (const struct mbs *s, struct client *c)
+{
+    char *start, *end;
+    ssize_t n;
+
+    n = read (c->fd, c->buf + c->len, sizeof (c->buf) - c->len - 1);
+
+    if (n <= 0)
+        return 0 == n || (EAGAIN != errno && EINTR != errno) ? -1 : 0;
+
+    c->len += n;
+    c->buf[c->len] = '\0';
+
+    start = c->buf;
+
+    while (NULL != (end = strchr (start, '\n')))
+    {
+        *end = '\0';
+
+        if (end > start && '\r' == end[-1])
+            end[-1] = '\0';
+
+        if (-1 == handle_request (s, c, start))
+            return -1;
+
+        start = end + 1;
+    }
+
+    c->len -= start - c->buf;
+    memmove (c->buf, start, c->len);
+
+    /* A line which does not fit is not a valid request */
+    return c->len == sizeof (c->buf) - 1 ? -1 : 0;
+}
+
+void
+server_dispatch (const struct mbs *s)
+{
+    struct epoll_event events[16];
+    struct client *c;
+    int i, n;
+
+    if (-1 == (n = epoll_wait (epfd, events, 16, 0)))
+        return;
+
+    for (i = 0; i < n; ++i)
+    {
+        if (events[i].data.fd == listen_fd)
+        {
+            accept_clients ();
+            continue;
+        }
+
+        /* Already dropped */
+        if (NULL == (c = find_client (events[i].data.fd)))
+            continue;
+
+        if (-1 == serve_client (s, c))
+            drop_client (c);
+    }
+}
+
+void
+server_publish (const struct mbs *s, const struct stats *delta)
+{
+    char line[MBS_STATE_LINE_MAX];
+    size_t i = n_clients;
+    int len;
+
+    len = snprintf (
+        line, sizeof (line), "%"PRIu64":%"PRIu64":%"PRIu64":%"PRIu64"\n",
+        delta->timestamp, delta->tx_bytes, delta->rx_bytes, s->balance
+    );
+
+    /* Backwards, since dropping a client moves the last one into its slot */
+    while (i-- > 0)
+    {
+        if (clients[i].subscribed && -1 == reply (&clients[i], line, len))
+            drop_client (&clients[i]);
+    }
+}
+
+void
+server_close (void)
+{
+    while (n_clients > 0)
+        drop_client (&clients[n_clients - 1]);
+
+    if (-1 != listen_fd)
+        close (listen_fd);
+
+    if (-1 != epfd)
+        close (epfd);
+
+    if (NULL != socket_path)
+        unlink (socket_path);
+
+    free (socket_path);
+
+    listen_fd = -1;
+    epfd = -1;
+    socket_path = NULL;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file server.h
+ * @brief A Unix domain socket through which other programs can query a
+ *        running instance (`--socket=<path>`).
+ *
+ * The protocol is line based. Each request is a single line, and is answered
+ * from the in-memory state:
+ *
+ * | Request       | Response                                               |
+ * |---------------|--------------------------------------------------------|
+ * | `GET`         | One line, as formatted by \ref mbs_format_state.       |
+ * | `IFACES`      | One `<name>:<TX used>:<RX used>:<error>` line per interface, followed by an empty line. |
+ * | `SUBSCRIBE`   | `OK`, followed by one `<timestamp>:<TX delta>:<RX delta>:<balance>` line per sample. |
+ * | `UNSUBSCRIBE` | `OK`, after which no more samples are pushed.           |
+ *
+ * Anything else is answered with `ERR`. Timestamps are in nanoseconds on the
+ * monotonic clock. Clients which do not keep up with their subscription (the
+ * socket buffer fills up) are disconnected.
+ *
+ * The server has its own epoll set, which the main loop watches as a single
+ * file descriptor, and never blocks.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "mbs.h"
+
+/**
+ * @brief Maximum number of clients connected at the same time.
+ */
+#define SERVER_MAX_CLIENTS 64
+
+/**
+ * @brief Start listening on a Unix domain socket. A stale socket left behind
+ *        at \a path is replaced.
+ *
+ * @param  path Where to create the socket.
+ * @return      A file descriptor which becomes readable when the server has
+ *              work to do (see \ref server_dispatch), or -1 if an error
+ *              occured, in which case `errno` is set.
+ */
+int server_open (const char *path);
+
+/**
+ * @brief Accept new connections and answer pending requests, without
+ *        blocking.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @return Nothing
+ */
+void server_dispatch (const struct mbs *s);
+
+/**
+ * @brief Push the result of a sample to all subscribed clients.
+ *
+ * @param  s     An \ref mbs struct holding application state and
+ *               configuration settings.
+ * @param  delta The amount of data transferred since the previous sample.
+ * @return Nothing
+ */
+void server_publish (const struct mbs *s, const struct stats *delta);
+
+/**
+ * @brief Disconnect all clients, and remove the socket.
+ *
+ * @return Nothing
+ */
+void server_close (void);
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "mbs.h"
+#include "shm.h"
+
+static struct mbs_shm *seg = NULL;
+static char *seg_name = NULL;
+
+/*
+ * Bracket an update of the data with odd and even sequence numbers. There
+ * is only one writer, so the sequence number need not be read atomically.
+ */
+static void
+write_begin (void)
+{
+    __atomic_store_n (&seg->seq, seg->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+static void
+write_end (void)
+{
+    __atomic_store_n (&seg->seq, seg->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Whether the segment is still published by another process, which has not
+ * exited.
+ */
+static bool
+owned (const struct mbs_shm *seg)
+{
+    const pid_t pid = (pid_t) seg->data.pid;
+
+    if (MBS_SHM_MAGIC != seg->magic || pid <= 0 || getpid () == pid)
+        return false;
+
+    return 0 == kill (pid, 0) || EPERM == errno;
+}
+
+int
+shm_publish_open (const struct mbs *s, const char *name)
+{
+    size_t i, len = 0;
+    struct stat st;
+    bool created;
+    int fd;
+
+    if (NULL == (seg_name = malloc (strlen (name) + 2)))
+        return -1;
+
+    sprintf (seg_name, "%s%s", '/' == *name ? "" : "/", name);
+
+    /* Take over a segment that already exists, unless its writer is alive */
+    fd = shm_open (seg_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    created = -1 != fd;
+
+    if (-1 == fd && EEXIST == errno)
+        fd = shm_open (seg_name, O_RDWR, 0);
+
+    if (-1 == fd)
+    {
+        free (seg_name);
+        seg_name = NULL;
+        return -1;
+    }
+
+    /* A segment left behind by an earlier instance is at least as large */
+    if (0 == fstat (fd, &st) && (st.st_size >= (off_t) sizeof (*seg)
+                                 || 0 == ftruncate (fd, sizeof (*seg))))
+    {
+        seg = mmap (NULL, sizeof (*seg), PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+    }
+
+    close (fd);
+
+    /*
+     * Only a segment created here is removed; one that already existed may
+     * belong to a live instance, which has not been checked for yet.
+     */
+    if (NULL == seg || MAP_FAILED == seg)
+    {
+        const int err = errno;
+
+        if (created)
+            shm_unlink (seg_name);
+
+        free (seg_name);
+
+        seg = NULL;
+        seg_name = NULL;
+        errno = err;
+        return -1;
+    }
+
+    if (owned (seg))
+    {
+        /* Leave it for the instance which is using it */
+        munmap (seg, sizeof (*seg));
+        free (seg_name);
+
+        seg = NULL;
+        seg_name = NULL;
+        errno = EBUSY;
+        return -1;
+    }
+
+    /*
+     * An instance that died half-way through an update left an odd number
+     * behind. Move on to an even one that readers have not seen before, so
+     * that the update below is bracketed correctly.
+     */
+    __atomic_store_n (&seg->seq, (seg->seq | 1) + 1, __ATOMIC_RELAXED);
+
+    /* Readers which see an odd number leave the data alone until we're done */
+    write_begin ();
+
+    seg->magic   = MBS_SHM_MAGIC;
+    seg->version = MBS_SHM_VERSION;
+
+    memset (&seg->data, 0, sizeof (seg->data));
+
+    seg->data.started = mbs_now ();
+    seg->data.pid = getpid ();
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        len += snprintf (
+            seg->data.iface + len, sizeof (seg->data.iface) - len, "%s%s",
+            i > 0 ? "," : "", s->ifaces[i].name
+        );
+
+        if (len >= sizeof (seg->data.iface))
+            break;
+    }
+
+    write_end ();
+
+    return 0;
+}
+
+void
+shm_publish (const struct mbs *s)
+{
+    if (NULL == seg)
+        return;
+
+    write_begin ();
+
+    seg->data.snapshot_tx = s->snapshot.tx_bytes;
+    seg->data.snapshot_rx = s->snapshot.rx_bytes;
+    seg->data.used_tx     = s->used.tx_bytes;
+    seg->data.used_rx     = s->used.rx_bytes;
+    seg->data.balance     = s->balance;
+    seg->data.timestamp   = s->snapshot.timestamp;
+
+    write_end ();
+}
+
+void
+shm_publish_close (void)
+{
+    if (NULL != seg)
+        munmap (seg, sizeof (*seg));
+
+    if (NULL != seg_name)
+        shm_unlink (seg_name);
+
+    free (seg_name);
+
+    seg = NULL;
+    seg_name = NULL;
+}
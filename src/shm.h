@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file shm.h
+ * @brief A POSIX shared-memory segment in which a running instance publishes
+ *        its counters (`--shm=<name>`), and the functions other programs can
+ *        use to read it.
+ *
+ * The segment is protected by a sequence lock: the writer makes \ref
+ * mbs_shm::seq odd before it updates the data, and even again afterwards.
+ * A reader copies the data and retries if the sequence number was odd, or
+ * changed in the meantime. Reads therefore never block the writer, take no
+ * system calls, and always return a consistent set of values.
+ *
+ * This header does not depend on the rest of the code, and can be copied
+ * into other programs:
+ *
+ * @code
+ * const struct mbs_shm *seg = mbs_shm_attach ("/mbs");
+ * struct mbs_shm_data data;
+ *
+ * if (NULL != seg)
+ * {
+ *     mbs_shm_read (seg, &data);
+ *     printf ("%" PRIu64 " bytes left\n", data.balance);
+ * }
+ * @endcode
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef SHM_H
+#define SHM_H
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Value of \ref mbs_shm::magic ("MBS1").
+ */
+#define MBS_SHM_MAGIC 0x3153424d
+
+/**
+ * @brief Layout version; bumped whenever \ref mbs_shm_data changes.
+ */
+#define MBS_SHM_VERSION 1
+
+/**
+ * @brief The published values.
+ */
+struct mbs_shm_data
+{
+    /**
+     * @brief Most recent TX and RX counter values, summed over all
+     *        interfaces.
+     */
+    uint64_t snapshot_tx, snapshot_rx;
+
+    /**
+     * @brief Amount of data sent and received since the command was launched
+     *        (or, with `--persistent`, since the first session).
+     */
+    uint64_t used_tx, used_rx;
+
+    /**
+     * @brief Amount of data left, or 0 when not in countdown mode.
+     */
+    uint64_t balance;
+
+    /**
+     * @brief When the counters were read, in nanoseconds on the monotonic
+     *        clock.
+     */
+    uint64_t timestamp;
+
+    /**
+     * @brief When the segment was created, on the same clock.
+     */
+    uint64_t started;
+
+    /**
+     * @brief Process ID of the writer.
+     */
+    int64_t pid;
+
+    /**
+     * @brief Comma-separated names of the monitored interfaces (truncated).
+     */
+    char iface[64];
+};
+
+/**
+ * @brief The shared-memory segment.
+ */
+struct mbs_shm
+{
+    /**
+     * @brief Always \ref MBS_SHM_MAGIC.
+     */
+    uint32_t magic;
+
+    /**
+     * @brief Always \ref MBS_SHM_VERSION.
+     */
+    uint32_t version;
+
+    /**
+     * @brief Sequence number; odd while the writer is updating \ref data.
+     */
+    uint32_t seq;
+
+    uint32_t reserved;
+
+    /**
+     * @brief The values, which are only consistent when read through
+     *        \ref mbs_shm_read.
+     */
+    struct mbs_shm_data data;
+};
+
+/**
+ * @brief Map the segment published under \a name, read-only.
+ *
+ * @param  name The name given with `--shm` (e.g., `/mbs`).
+ * @return      The segment, or `NULL` if it does not exist or has an
+ *              unexpected layout. Unmap with `munmap (seg, sizeof (*seg))`.
+ */
+static inline const struct mbs_shm *
+mbs_shm_attach (const char *name)
+{
+    struct mbs_shm *seg;
+    struct stat st;
+    int fd;
+
+    if (-1 == (fd = shm_open (name, O_RDONLY, 0)))
+        return NULL;
+
+    /* Still being set up; touching it now would raise SIGBUS */
+    if (-1 == fstat (fd, &st) || st.st_size < (off_t) sizeof (*seg))
+    {
+        close (fd);
+        return NULL;
+    }
+
+    seg = mmap (NULL, sizeof (*seg), PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+
+    if (MAP_FAILED == seg)
+        return NULL;
+
+    if (MBS_SHM_MAGIC != seg->magic || MBS_SHM_VERSION != seg->version)
+    {
+        munmap (seg, sizeof (*seg));
+        return NULL;
+    }
+
+    return seg;
+}
+
+/**
+ * @brief Take a consistent copy of the published values.
+ *
+ * @param  seg A segment returned by \ref mbs_shm_attach.
+ * @param  out Where to copy the values.
+ * @return Nothing
+ */
+static inline void
+mbs_shm_read (const struct mbs_shm *seg, struct mbs_shm_data *out)
+{
+    uint32_t before, after;
+
+    do
+    {
+        before = __atomic_load_n (&seg->seq, __ATOMIC_ACQUIRE);
+
+        memcpy (out, (const void *) &seg->data, sizeof (*out));
+
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        after = __atomic_load_n (&seg->seq, __ATOMIC_RELAXED);
+    }
+    while ((before & 1) || before != after);
+}
+
+struct mbs;
+
+/**
+ * @brief Create the segment, and map it for writing. A segment left behind
+ *        by an instance which has exited is taken over; one whose writer is
+ *        still running is not.
+ *
+ * @param  s    An \ref mbs struct holding application state and
+ *              configuration settings.
+ * @param  name Name of the segment. A leading `/` is added if missing.
+ * @return      0 on success, or -1 if an error occured, in which case
+ *              `errno` is set (to `EBUSY` if another instance publishes
+ *              under the same name).
+ */
+int shm_publish_open (const struct mbs *s, const char *name);
+
+/**
+ * @brief Publish the current state.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @return Nothing
+ */
+void shm_publish (const struct mbs *s);
+
+/**
+ * @brief Unmap and remove the segment. Readers which still have it mapped
+ *        keep their last copy.
+ *
+ * @return Nothing
+ */
+void shm_publish_close (void);
+
+#endif
@@ -0,0 +1,443 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _DEFAULT_SOURCE
+#define __STDC_FORMAT_MACROS
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "netlink.h"
+#include "source.h"
+
+/* Number of reads each source is timed over by auto-selection */
+#define AUTO_SAMPLES 16
+
+/* netlink */
+
+static int
+netlink_init (struct mbs *s)
+{
+    size_t i;
+
+    if (-1 == (s->nl_fd = netlink_open ()))
+        return -1;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+        s->ifaces[i].ifindex = if_nametoindex (s->ifaces[i].name);
+
+    return 0;
+}
+
+static int
+netlink_read (struct mbs *s)
+{
+    size_t i;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        struct iface *ifa = &s->ifaces[i];
+
+        ifa->error = 0;
+
+        if (0 == ifa->ifindex &&
+            0 == (ifa->ifindex = if_nametoindex (ifa->name)))
+        {
+            ifa->error = ENODEV;
+            continue;
+        }
+
+        if (0 == netlink_read_stats (s->nl_fd, ifa->ifindex, &ifa->sample))
+        {
+            ifa->sample.timestamp = mbs_now ();
+            continue;
+        }
+
+        if (ENODEV != errno)
+            return -1;
+
+        /* The interface may come back later, under a different index */
+        ifa->ifindex = 0;
+        ifa->error = ENODEV;
+    }
+
+    return 0;
+}
+
+static void
+netlink_fini (struct mbs *s)
+{
+    size_t i;
+
+    netlink_close (s->nl_fd);
+    s->nl_fd = -1;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+        s->ifaces[i].ifindex = 0;
+}
+
+const struct counter_source netlink_source =
+{
+    "netlink", 64, netlink_init, netlink_read, netlink_fini
+};
+
+/* sysfs */
+
+static int
+sysfs_open (const char *name, const char *counter)
+{
+    char path[PATH_MAX];
+
+    if (NULL != strchr (name, '/'))
+    {
+        errno = ENODEV;
+        return -1;
+    }
+
+    snprintf (
+        path, sizeof (path), "/sys/class/net/%s/statistics/%s",
+        name, counter
+    );
+
+    return open (path, O_RDONLY | O_CLOEXEC);
+}
+
+static void
+sysfs_close_iface (struct iface *ifa)
+{
+    if (ifa->rx_fd >= 0)
+        close (ifa->rx_fd);
+
+    if (ifa->tx_fd >= 0)
+        close (ifa->tx_fd);
+
+    ifa->rx_fd = -1;
+    ifa->tx_fd = -1;
+}
+
+static int
+sysfs_open_iface (struct iface *ifa)
+{
+    ifa->rx_fd = sysfs_open (ifa->name, "rx_bytes");
+    ifa->tx_fd = sysfs_open (ifa->name, "tx_bytes");
+
+    if (-1 == ifa->rx_fd || -1 == ifa->tx_fd)
+    {
+        const int err = ENOENT == errno ? ENODEV : errno;
+
+        sysfs_close_iface (ifa);
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+sysfs_read_counter (int fd, uint64_t *value)
+{
+    char buf[32];
+    char *end;
+    ssize_t len;
+
+    if ((len = pread (fd, buf, sizeof (buf) - 1, 0)) <= 0)
+    {
+        if (0 == len)
+            errno = EIO;
+
+        return -1;
+    }
+
+    buf[len] = '\0';
+    *value = strtoull (buf, &end, 10);
+
+    if (end == buf)
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+sysfs_read_iface (struct iface *ifa)
+{
+    if (0 == sysfs_read_counter (ifa->rx_fd, &ifa->sample.rx_bytes) &&
+        0 == sysfs_read_counter (ifa->tx_fd, &ifa->sample.tx_bytes))
+    {
+        ifa->sample.timestamp = mbs_now ();
+        return 0;
+    }
+
+    return -1;
+}
+
+static int
+sysfs_init (struct mbs *s)
+{
+    size_t i;
+
+    /* Bail out if sysfs is not mounted at all */
+    if (-1 == access ("/sys/class/net", X_OK))
+        return -1;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+        sysfs_open_iface (&s->ifaces[i]);
+
+    return 0;
+}
+
+static int
+sysfs_read (struct mbs *s)
+{
+    size_t i;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        struct iface *ifa = &s->ifaces[i];
+
+        ifa->error = 0;
+
+        /*
+         * The files are opened once; after that, each poll is just two
+         * reads. If the interface went away (and perhaps came back), the old
+         * descriptors are stale and we have to reopen.
+         */
+        if (ifa->rx_fd >= 0 && 0 == sysfs_read_iface (ifa))
+            continue;
+
+        if (ifa->rx_fd >= 0 && ENODEV != errno)
+            return -1;
+
+        sysfs_close_iface (ifa);
+
+        if (0 == sysfs_open_iface (ifa) && 0 == sysfs_read_iface (ifa))
+            continue;
+
+        if (ENODEV != errno)
+            return -1;
+
+        ifa->error = ENODEV;
+    }
+
+    return 0;
+}
+
+static void
+sysfs_fini (struct mbs *s)
+{
+    size_t i;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+        sysfs_close_iface (&s->ifaces[i]);
+}
+
+const struct counter_source sysfs_source =
+{
+    "sysfs", 64, sysfs_init, sysfs_read, sysfs_fini
+};
+
+/* getifaddrs */
+
+static int
+getifaddrs_init (struct mbs *s)
+{
+    (void) s;
+    return 0;
+}
+
+static int
+getifaddrs_read (struct mbs *s)
+{
+    struct ifaddrs *ifa0, *ifa;
+    uint64_t now;
+    size_t i;
+
+    if (-1 == getifaddrs (&ifa0))
+        return -1;
+
+    now = mbs_now ();
+
+    for (i = 0; i < s->n_ifaces; ++i)
+        s->ifaces[i].error = ENODEV;
+
+    for (ifa = ifa0; ifa != NULL; ifa = ifa->ifa_next)
+    {
+        const struct rtnl_link_stats *if_stats = ifa->ifa_data;
+
+        if (NULL == ifa->ifa_addr || NULL == ifa->ifa_data)
+            continue;
+
+        if (ifa->ifa_addr->sa_family != AF_PACKET)
+            continue;
+
+        for (i = 0; i < s->n_ifaces; ++i)
+        {
+            if (0 == strcmp (ifa->ifa_name, s->ifaces[i].name))
+            {
+                s->ifaces[i].sample.rx_bytes = if_stats->rx_bytes;
+                s->ifaces[i].sample.tx_bytes = if_stats->tx_bytes;
+                s->ifaces[i].sample.timestamp = now;
+                s->ifaces[i].error = 0;
+            }
+        }
+    }
+
+    freeifaddrs (ifa0);
+    return 0;
+}
+
+static void
+getifaddrs_fini (struct mbs *s)
+{
+    (void) s;
+}
+
+const struct counter_source getifaddrs_source =
+{
+    "getifaddrs", 32, getifaddrs_init, getifaddrs_read, getifaddrs_fini
+};
+
+/* Selection */
+
+static const struct counter_source *sources[] =
+{
+    &netlink_source,
+    &sysfs_source,
+    &getifaddrs_source
+};
+
+#define N_SOURCES (sizeof (sources) / sizeof (sources[0]))
+
+const struct counter_source *
+source_find (const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < N_SOURCES; ++i)
+    {
+        if (0 == strcmp (sources[i]->name, name))
+            return sources[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Return the fastest time, in nanoseconds, of a number of reads, or 0 if the
+ * source is unable to read the interface counters.
+ */
+static uint64_t
+time_source (struct mbs *s, const struct counter_source *source)
+{
+    uint64_t best = UINT64_MAX;
+    size_t j;
+    int i;
+
+    if (-1 == source->init (s))
+        return 0;
+
+    for (i = 0; i < AUTO_SAMPLES; ++i)
+    {
+        const uint64_t t0 = mbs_now ();
+        uint64_t ns;
+
+        if (-1 == source->read (s))
+        {
+            source->close (s);
+            return 0;
+        }
+
+        if ((ns = mbs_now () - t0) < best)
+            best = ns;
+    }
+
+    source->close (s);
+
+    /* A source which can't see any of the interfaces is no good either */
+    for (j = 0; j < s->n_ifaces; ++j)
+    {
+        if (0 == s->ifaces[j].error)
+            return best > 0 ? best : 1;
+    }
+
+    return 0;
+}
+
+int
+source_init (struct mbs *s)
+{
+    if (NULL == s->source)
+    {
+        uint64_t best = UINT64_MAX;
+        size_t i;
+
+        s->source = &getifaddrs_source;
+
+        for (i = 0; i < N_SOURCES; ++i)
+        {
+            const uint64_t ns = time_source (s, sources[i]);
+
+            if (s->flags & FLAG_VERBOSE)
+            {
+                if (ns > 0)
+                {
+                    printf (
+                        "Source %s: %"PRIu64" ns/read\n",
+                        sources[i]->name, ns
+                    );
+                }
+                else
+                {
+                    printf ("Source %s: unavailable\n", sources[i]->name);
+                }
+            }
+
+            if (ns > 0 && ns < best)
+            {
+                best = ns;
+                s->source = sources[i];
+            }
+        }
+    }
+
+    return s->source->init (s);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file source.h
+ * @brief The counter sources (backends) that \ref mbs_poll_interfaces can
+ *        read interface counters from.
+ *
+ * | Name         | Counters | Cost per poll                                 |
+ * |--------------|----------|-----------------------------------------------|
+ * | `netlink`    | 64-bit   | One `RTM_GETSTATS` request on an open socket. |
+ * | `sysfs`      | 64-bit   | Two `pread()`s on files opened at startup.    |
+ * | `getifaddrs` | 32-bit   | A list of every address on every interface.   |
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include "mbs.h"
+
+/**
+ * @brief Read counters with `RTM_GETSTATS` requests over a netlink socket.
+ */
+extern const struct counter_source netlink_source;
+
+/**
+ * @brief Read counters from `/sys/class/net/<interface>/statistics`.
+ */
+extern const struct counter_source sysfs_source;
+
+/**
+ * @brief Read counters from the list returned by `getifaddrs()`.
+ */
+extern const struct counter_source getifaddrs_source;
+
+/**
+ * @brief Look up a counter source by name.
+ *
+ * @param  name One of `netlink`, `sysfs` or `getifaddrs`.
+ * @return      The source, or `NULL` if no source by that name exists.
+ */
+const struct counter_source *source_find (const char *name);
+
+/**
+ * @brief Initialize the counter source of an \ref mbs struct.
+ *
+ * If `s->source` is `NULL` (i.e., `--source=auto`), every available source is
+ * initialized and timed over a number of reads, and the cheapest one is kept.
+ * If no source is able to read any of the interfaces, `getifaddrs` is used.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @return   0 on success, or -1 if the selected source could not be
+ *           initialized.
+ */
+int source_init (struct mbs *s);
+
+#endif
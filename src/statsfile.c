@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "codec.h"
+#include "statsfile.h"
+
+static struct statsfile *map = NULL;
+
+/* Slot holding the most recent record */
+static unsigned int current = 0;
+
+static bool dirty = false;
+static uint64_t synced = 0;
+static uint64_t sync_ns = 0;
+
+static uint32_t
+checksum (const struct statsfile_record *rec)
+{
+    return codec_crc32 (0, rec, offsetof (struct statsfile_record, checksum));
+}
+
+static const char *
+parse_u64 (const char *p, const char *end, uint64_t *out)
+{
+    const char *start = p;
+    uint64_t n = 0;
+
+    for (; p < end && *p >= '0' && *p <= '9'; ++p)
+    {
+        const unsigned int digit = *p - '0';
+
+        if (n > (UINT64_MAX - digit) / 10)
+            return NULL;
+
+        n = n * 10 + digit;
+    }
+
+    if (p == start)
+        return NULL;
+
+    *out = n;
+
+    return p;
+}
+
+static int
+flush (void)
+{
+    if (-1 == msync (map, sizeof (*map), MS_SYNC))
+        return -1;
+
+    dirty = false;
+    synced = mbs_now ();
+
+    return 0;
+}
+
+int
+statsfile_open (const char *path, unsigned int sync_interval,
+                struct statsfile_record *last)
+{
+    const uint32_t magic = STATSFILE_MAGIC;
+    char buf[MBS_STATE_LINE_MAX];
+    uint64_t fields[5];
+    struct stat st;
+    ssize_t len = 0;
+    bool text = false;
+    int fd, err;
+
+    if (-1 == (fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)))
+        return -1;
+
+    if (-1 == fstat (fd, &st))
+        goto fail;
+
+    if (st.st_size > 0 && -1 == (len = pread (fd, buf, sizeof (buf), 0)))
+        goto fail;
+
+    if (len >= (ssize_t) sizeof (magic) && 0 == memcmp (buf, &magic, sizeof (magic)))
+    {
+        if (st.st_size < (off_t) sizeof (*map))
+        {
+            errno = EPROTO;
+            goto fail;
+        }
+    }
+    else if (len > 0)
+    {
+        /* Anything else must be a file in the old format */
+        if (-1 == statsfile_parse_text (buf, len, fields))
+        {
+            errno = EPROTO;
+            goto fail;
+        }
+
+        text = true;
+    }
+
+    if (0 == len || text)
+    {
+        if (-1 == ftruncate (fd, 0) || -1 == ftruncate (fd, sizeof (*map)))
+            goto fail;
+    }
+
+    map = mmap (NULL, sizeof (*map), PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+
+    if (MAP_FAILED == map)
+    {
+        map = NULL;
+        goto fail;
+    }
+
+    close (fd);
+
+    current = 0;
+    dirty = false;
+    synced = mbs_now ();
+    sync_ns = sync_interval * 1000000000ULL;
+
+    if (0 == len || text)
+    {
+        map->magic = STATSFILE_MAGIC;
+        map->version = STATSFILE_VERSION;
+        map->record_size = sizeof (struct statsfile_record);
+
+        if (!text)
+            return 0;
+
+        struct statsfile_record *rec = &map->slot[0];
+
+        rec->seq = 1;
+        rec->snapshot_tx = fields[0];
+        rec->snapshot_rx = fields[1];
+        rec->used_tx = fields[2];
+        rec->used_rx = fields[3];
+        rec->balance = fields[4];
+        rec->saved = time (NULL);
+        rec->checksum = checksum (rec);
+
+        /* Don't leave the file half converted */
+        flush ();
+
+        *last = *rec;
+
+        return 1;
+    }
+
+    if (STATSFILE_VERSION != map->version
+     || sizeof (struct statsfile_record) != map->record_size)
+    {
+        munmap (map, sizeof (*map));
+        map = NULL;
+        errno = EPROTO;
+        return -1;
+    }
+
+    const bool valid[2] = {
+        statsfile_valid (&map->slot[0]),
+        statsfile_valid (&map->slot[1])
+    };
+
+    if (!valid[0] && !valid[1])
+        return 0;
+
+    current = !valid[0] || (valid[1] && map->slot[1].seq > map->slot[0].seq);
+
+    *last = map->slot[current];
+
+    return 1;
+
+fail:
+    err = errno;
+    close (fd);
+    errno = err;
+
+    return -1;
+}
+
+void
+statsfile_save (const struct mbs *s)
+{
+    struct statsfile_record *rec;
+    uint64_t seq;
+
+    if (NULL == map)
+        return;
+
+    /*
+     * The slot which is overwritten is the older one, so if this save is
+     * torn, the checksum gives it away and the other slot is used instead.
+     */
+    seq = statsfile_valid (&map->slot[current]) ? map->slot[current].seq : 0;
+    current ^= 1;
+    rec = &map->slot[current];
+
+    rec->seq = seq + 1;
+    rec->snapshot_tx = s->snapshot.tx_bytes;
+    rec->snapshot_rx = s->snapshot.rx_bytes;
+    rec->used_tx = s->used.tx_bytes;
+    rec->used_rx = s->used.rx_bytes;
+    rec->balance = s->balance;
+    rec->saved = time (NULL);
+    rec->checksum = checksum (rec);
+
+    dirty = true;
+}
+
+int
+statsfile_sync (void)
+{
+    if (NULL == map || !dirty || mbs_now () - synced < sync_ns)
+        return 0;
+
+    return flush ();
+}
+
+void
+statsfile_close (void)
+{
+    if (NULL == map)
+        return;
+
+    if (dirty)
+        flush ();
+
+    munmap (map, sizeof (*map));
+    map = NULL;
+}
+
+bool
+statsfile_valid (const struct statsfile_record *rec)
+{
+    return rec->seq > 0 && checksum (rec) == rec->checksum;
+}
+
+int
+statsfile_parse_text (const char *buf, size_t len, uint64_t fields[5])
+{
+    const char *p = buf, *end = buf + len;
+    int i;
+
+    for (i = 0; i < 5; ++i)
+    {
+        if (i > 0)
+        {
+            if (p == end || ':' != *p)
+                return -1;
+
+            ++p;
+        }
+
+        if (NULL == (p = parse_u64 (p, end, &fields[i])))
+            return -1;
+    }
+
+    /* The rates and time left which follow are not needed */
+    if (p != end && ':' != *p && '\n' != *p)
+        return -1;
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file statsfile.h
+ * @brief The binary stats file in which the totals are persisted between
+ *        sessions (`--statsfile=<path>`, see `--persistent`).
+ *
+ * The file is mapped into memory and updated in place, so saving the state on
+ * a tick takes no system calls. It holds a small header, followed by two
+ * record slots. Each save goes to the older slot, and carries a sequence
+ * number one higher than the other slot's, and a CRC-32 of its contents. A
+ * save which is torn by a crash or power loss therefore never damages the
+ * last complete record: on startup, the valid slot with the highest sequence
+ * number wins.
+ *
+ * Writing to the mapping hands the data to the page cache, where it survives
+ * the process being killed. Flushing it to disk (`msync`) is coalesced, and
+ * happens at most once per `--sync-interval` seconds, and on exit.
+ *
+ * All fields are in host byte order. A file in the old text format (five
+ * colon-separated integers) is converted when it is opened.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef STATSFILE_H
+#define STATSFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mbs.h"
+
+/**
+ * @brief Value of \ref statsfile::magic ("MBST").
+ */
+#define STATSFILE_MAGIC 0x5453424d
+
+/**
+ * @brief Layout version; bumped whenever \ref statsfile_record changes.
+ */
+#define STATSFILE_VERSION 1
+
+/**
+ * @brief Default number of seconds between flushes to disk.
+ */
+#define STATSFILE_DEFAULT_SYNC_INTERVAL 30
+
+/**
+ * @brief One saved state.
+ */
+struct statsfile_record
+{
+    /**
+     * @brief Incremented on every save; 0 in a slot which was never written.
+     */
+    uint64_t seq;
+
+    /**
+     * @brief TX and RX counter values at the time of the save.
+     */
+    uint64_t snapshot_tx, snapshot_rx;
+
+    /**
+     * @brief Amount of data sent and received, over all sessions.
+     */
+    uint64_t used_tx, used_rx;
+
+    /**
+     * @brief Amount of data left, or 0 when not in countdown mode.
+     */
+    uint64_t balance;
+
+    /**
+     * @brief Wall-clock time of the save, in seconds since the epoch.
+     */
+    uint64_t saved;
+
+    /**
+     * @brief CRC-32 of all the fields above.
+     */
+    uint32_t checksum;
+
+    uint32_t reserved;
+};
+
+/**
+ * @brief Layout of the file.
+ */
+struct statsfile
+{
+    /**
+     * @brief Always \ref STATSFILE_MAGIC.
+     */
+    uint32_t magic;
+
+    /**
+     * @brief Always \ref STATSFILE_VERSION.
+     */
+    uint32_t version;
+
+    /**
+     * @brief `sizeof (struct statsfile_record)`, as a guard against files
+     *        written on a platform with a different layout.
+     */
+    uint32_t record_size;
+
+    uint32_t reserved;
+
+    /**
+     * @brief The two record slots, written alternately.
+     */
+    struct statsfile_record slot[2];
+};
+
+/**
+ * @brief Open and map the stats file, creating it if it does not exist, and
+ *        converting it if it is in the old text format.
+ *
+ * @param  path          Location of the file.
+ * @param  sync_interval Minimum number of seconds between flushes to disk.
+ * @param  last          Receives the most recent valid record, if any.
+ * @return               1 if a record was loaded into \a last, 0 if the file
+ *                       holds no valid record, or -1 if the file could not be
+ *                       opened, or has an unsupported layout, in which case
+ *                       `errno` is set.
+ */
+int statsfile_open (const char *path, unsigned int sync_interval,
+                    struct statsfile_record *last);
+
+/**
+ * @brief Save the current totals to the older slot.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @return Nothing
+ */
+void statsfile_save (const struct mbs *s);
+
+/**
+ * @brief Flush saved records to disk, if any are pending and the sync
+ *        interval has passed since the last flush. This is cheap to call on
+ *        every tick.
+ *
+ * @return 0 on success, or -1 if the flush failed.
+ */
+int statsfile_sync (void);
+
+/**
+ * @brief Flush any pending record and unmap the file.
+ *
+ * @return Nothing
+ */
+void statsfile_close (void);
+
+/**
+ * @brief Check that a record is intact.
+ *
+ * @param  rec A record slot.
+ * @return     `true` if the slot has been written, and its checksum matches.
+ */
+bool statsfile_valid (const struct statsfile_record *rec);
+
+/**
+ * @brief Parse the old text format, `<TX snapshot>:<RX snapshot>:<TX used>:
+ *        <RX used>:<balance>`. Any further fields are ignored.
+ *
+ * @param  buf    The file contents.
+ * @param  len    Length of \a buf.
+ * @param  fields Receives the five values.
+ * @return        0 on success, or -1 if the text is malformed or a value is
+ *                out of range.
+ */
+int statsfile_parse_text (const char *buf, size_t len, uint64_t fields[5]);
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include "status.h"
+
+/* Whether stdout is a terminal, or -1 if not known yet */
+static int tty = -1;
+
+static bool pending = false;
+
+int
+status_format (const struct mbs *s, bool bold, char *buf, size_t size)
+{
+    const char *on = bold ? "\033[1m" : "",
+               *off = bold ? "\033[0m" : "";
+    char used[MBS_HUMAN_READABLE_MAX], left[MBS_HUMAN_READABLE_MAX],
+         tx[MBS_HUMAN_READABLE_MAX], rx[MBS_HUMAN_READABLE_MAX], eta[RATE_ETA_MAX];
+    int len;
+
+    to_human_readable (s->used.tx_bytes + s->used.rx_bytes, used);
+    to_human_readable (s->rates.tx.value, tx);
+    to_human_readable (s->rates.rx.value, rx);
+
+    if (s->flags & FLAG_COUNTDOWN)
+    {
+        to_human_readable (s->balance, left);
+        rate_format_eta (rate_eta (&s->rates, s->balance), eta);
+
+        len = snprintf (
+            buf, size,
+            "Used %s%s%s  Left %s%s%s (%s)  TX %s%s/s%s  RX %s%s/s%s",
+            on, used, off, on, left, off, eta, on, tx, off, on, rx, off
+        );
+    }
+    else
+    {
+        len = snprintf (
+            buf, size, "Used %s%s%s  TX %s%s/s%s  RX %s%s/s%s",
+            on, used, off, on, tx, off, on, rx, off
+        );
+    }
+
+    if (1 == s->n_ifaces && s->ifaces[0].down && len >= 0
+     && (size_t) len < size)
+        len += snprintf (buf + len, size - len, "  (down)");
+
+    return len;
+}
+
+void
+status_line (const struct mbs *s)
+{
+    char line[160];
+    int len;
+
+    if (-1 == tty)
+        tty = isatty (STDOUT_FILENO);
+
+    len = status_format (s, tty, line, sizeof (line));
+
+    if (len < 0)
+        return;
+
+    if ((size_t) len >= sizeof (line))
+        len = sizeof (line) - 1;
+
+    /* Carriage return and erase the line, or a new line */
+    if (tty)
+        fputs ("\r\033[K", stdout);
+
+    fwrite (line, len, 1, stdout);
+
+    if (!tty)
+        fputc ('\n', stdout);
+
+    fflush (stdout);
+
+    pending = tty;
+}
+
+void
+status_line_end (void)
+{
+    if (pending)
+        fputc ('\n', stdout);
+
+    pending = false;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file status.h
+ * @brief A single line of status, printed on every update for status bars
+ *        such as tmux, i3bar or lemonbar (`--status-line`).
+ *
+ * The command keeps running and prints one line per update, so the status
+ * bar reads a stream rather than starting the command over and over. When
+ * stdout is a terminal, the line is rewritten in place with ANSI escape
+ * codes, and the values are shown in bold. Otherwise, each update is printed
+ * on a line of its own, without escape codes:
+ *
+ * @code
+ * Used 1.2G  Left 3.8G (2h 05m)  TX 12K/s  RX 340K/s
+ * @endcode
+ *
+ * ncurses is not used.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "mbs.h"
+
+/**
+ * @brief Format the status line, without a line break or escape codes.
+ *
+ * @param  s    An \ref mbs struct holding application state and
+ *              configuration settings.
+ * @param  bold Whether to wrap the values in ANSI bold escape codes.
+ * @param  buf  The output buffer.
+ * @param  size Size of \a buf.
+ * @return      The length of the line.
+ */
+int status_format (const struct mbs *s, bool bold, char *buf, size_t size);
+
+/**
+ * @brief Print the status line to stdout, and flush it.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @return Nothing
+ */
+void status_line (const struct mbs *s);
+
+/**
+ * @brief End the line which is being rewritten in place, if any, so that
+ *        whatever is printed next starts on a line of its own.
+ *
+ * @return Nothing
+ */
+void status_line_end (void);
+
+#endif
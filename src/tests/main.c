@@ -1,42 +1,1840 @@
+#define __STDC_FORMAT_MACROS
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "../codec.h"
+#include "../collect.h"
+#include "../history.h"
 #include "../mbs.h"
+#include "../metrics.h"
+#include "../netlink.h"
+#include "../procnet.h"
+#include "../rollup.h"
+#include "../selfstats.h"
+#include "../server.h"
+#include "../shm.h"
+#include "../statsfile.h"
+#include "../status.h"
+#include "../trace.h"
+#include "../window.h"
+
+static void
+test_parse_bytes (char *input, uint64_t match)
+{
+    uint64_t result;
+
+    if (-1 == parse_bytes (input, &result))
+    {
+        fprintf (stderr, "error: %s\n", input);
+        exit (EXIT_FAILURE);
+    }
+
+    if (result != match)
+    {
+        fprintf (stderr, "%lu is not \"%s\"\n", match, input);
+        exit (EXIT_FAILURE);
+    }
+}
+
+static void
+test_to_human_readable (double bytes, char *s)
+{
+    char buf[MBS_HUMAN_READABLE_MAX];
+
+    to_human_readable (bytes, buf);
+
+    if (0 != strcmp (s, buf))
+    {
+        fprintf (stderr, "Expected result: %s\n", s);
+        fprintf (stderr, "Actual result: %s\n", buf);
+        exit (EXIT_FAILURE);
+    }
+
+    printf ("Ok!\n");
+}
+
+static void
+test_counter_delta (const uint64_t *seq, size_t n, unsigned int bits,
+                    uint64_t match)
+{
+    uint64_t total = 0;
+    size_t i;
+
+    for (i = 1; i < n; ++i)
+        total += mbs_counter_delta (seq[i - 1], seq[i], bits);
+
+    if (total != match)
+    {
+        fprintf (stderr, "Expected total: %"PRIu64"\n", match);
+        fprintf (stderr, "Actual total: %"PRIu64"\n", total);
+        exit (EXIT_FAILURE);
+    }
+
+    printf ("Ok!\n");
+}
+
+static void
+test_stats_delta (void)
+{
+    /* 10 Gb/s sampled every 200 ms, starting just below the 32-bit limit */
+    const uint64_t step = 250000000;
+    struct stats prev = { UINT32_MAX - 100, UINT32_MAX - 100, 0 }, cur, diff;
+    int i;
+
+    for (i = 0; i < 100; ++i)
+    {
+        cur.rx_bytes = (prev.rx_bytes + step) & UINT32_MAX;
+        cur.tx_bytes = (prev.tx_bytes + 2 * step) & UINT32_MAX;
+
+        mbs_stats_delta (&prev, &cur, 32, &diff);
+
+        if (diff.rx_bytes != step || diff.tx_bytes != 2 * step)
+        {
+            fprintf (stderr, "Wrong delta after %d samples\n", i);
+            exit (EXIT_FAILURE);
+        }
+
+        prev = cur;
+    }
+
+    printf ("Ok!\n");
+}
+
+static bool fail_reads = true;
+
+static int
+failing_read (struct mbs *s)
+{
+    if (fail_reads)
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    s->ifaces[0].sample.rx_bytes += 1000;
+    s->ifaces[0].sample.tx_bytes += 10;
+    s->ifaces[0].sample.timestamp += 1;
+
+    return 0;
+}
+
+static void
+test_poll_failure (void)
+{
+    /* Like a trace, or the namespaces: nothing to fall back on */
+    const struct counter_source failing =
+    {
+        "failing", 64, NULL, failing_read, NULL
+    };
+    struct iface iface;
+    struct stats delta;
+    struct mbs s;
+
+    memset (&s, 0, sizeof (s));
+    memset (&iface, 0, sizeof (iface));
+
+    /* Left over from the read before */
+    iface.name = "lo";
+    iface.sample = (struct stats) { 100, 200, 1 };
+    s.ifaces = &iface;
+    s.n_ifaces = 1;
+    s.source = &failing;
+    s.nl_fd = -1;
+
+    if (-1 != mbs_poll_interfaces (&s, NULL) || &failing != s.source
+     || EIO != errno || 0 != s.snapshot.rx_bytes)
+    {
+        fprintf (stderr, "mbs_poll_interfaces: a failed read was used\n");
+        exit (EXIT_FAILURE);
+    }
+
+    /* A long-lived interface, with a lot behind it */
+    fail_reads = false;
+    iface.sample = (struct stats) { 500000000000ULL, 100, 1 };
+
+    if (-1 == mbs_poll_interfaces (&s, NULL))
+    {
+        fprintf (stderr, "mbs_poll_interfaces: the first read failed\n");
+        exit (EXIT_FAILURE);
+    }
+
+    /* One bad tick accounts for nothing, and loses nothing */
+    fail_reads = true;
+
+    if (0 != mbs_poll_interfaces (&s, &delta) || 0 != delta.rx_bytes
+     || 0 != iface.error || 500000001000ULL != iface.snapshot.rx_bytes)
+    {
+        fprintf (stderr, "mbs_poll_interfaces: a failed read reset the "
+                 "snapshot\n");
+        exit (EXIT_FAILURE);
+    }
+
+    fail_reads = false;
+
+    if (0 != mbs_poll_interfaces (&s, &delta)
+     || 1000 != delta.rx_bytes || 10 != delta.tx_bytes)
+    {
+        fprintf (stderr, "mbs_poll_interfaces: expected a delta of 1000/10, "
+                 "got %"PRIu64"/%"PRIu64"\n", delta.rx_bytes, delta.tx_bytes);
+        exit (EXIT_FAILURE);
+    }
+
+    printf ("Ok!\n");
+}
+
+static void
+test_next_interval (void)
+{
+    struct mbs s;
+    unsigned int interval = 200;
+    int i;
+
+    memset (&s, 0, sizeof (s));
+
+    s.interval = 200;
+    s.min_interval = 10;
+    s.max_interval = 2000;
+
+    /* Idle; back off to the longest interval */
+    for (i = 0; i < 10; ++i)
+        interval = mbs_next_interval (&s, interval, 0, interval * 1000000ULL);
+
+    if (2000 != interval)
+    {
+        fprintf (stderr, "Expected an idle interval of 2000, got %u\n",
+                 interval);
+        exit (EXIT_FAILURE);
+    }
+
+    /* Data flows again */
+    if (200 != mbs_next_interval (&s, interval, 1, 2000000000ULL))
+    {
+        fprintf (stderr, "Expected an active interval of 200\n");
+        exit (EXIT_FAILURE);
+    }
+
+    /* 1000 bytes left at 1000 bytes per 200 ms */
+    s.flags = FLAG_COUNTDOWN;
+    s.balance = 1000;
+
+    if (50 != mbs_next_interval (&s, 200, 1000, 200000000ULL))
+    {
+        fprintf (stderr, "Expected a countdown interval of 50\n");
+        exit (EXIT_FAILURE);
+    }
+
+    s.balance = 10;
+
+    if (10 != mbs_next_interval (&s, 200, 1000, 200000000ULL))
+    {
+        fprintf (stderr, "Expected a countdown interval of 10\n");
+        exit (EXIT_FAILURE);
+    }
+
+    printf ("Ok!\n");
+}
+
+static void
+test_rates (void)
+{
+    struct rates r;
+    double tx[100], rx[100];
+    char buf[RATE_ETA_MAX];
+    int i;
+
+    rate_init (&r, 2, 60);
+
+    /* 1 MB/s in ticks of 200 ms, then one idle tick of 2 s */
+    for (i = 0; i < 50; ++i)
+        rate_update (&r, 200000, 0, 200000000ULL);
+
+    if (r.tx.value != 1000000 || r.tx_avg.value != 1000000 || r.rx.value)
+    {
+        fprintf (stderr, "Expected a steady rate of 1000000 B/s\n");
+        exit (EXIT_FAILURE);
+    }
+
+    rate_update (&r, 0, 0, 2000000000ULL);
+
+    if (r.tx.value < 490000 || r.tx.value > 510000)
+    {
+        fprintf (stderr, "Expected the rate to about halve, got %f\n",
+                 r.tx.value);
+        exit (EXIT_FAILURE);
+    }
+
+    /* The ring keeps the last RATE_HISTORY rates, oldest first */
+    if (51 != rate_recent (&r, tx, rx, 64) || 1000000 != tx[49] || 0 != tx[50])
+    {
+        fprintf (stderr, "Wrong recent rates\n");
+        exit (EXIT_FAILURE);
+    }
+
+    for (i = 0; i < 20; ++i)
+        rate_update (&r, i, 0, 1000000000ULL);
+
+    if (RATE_HISTORY != rate_recent (&r, tx, rx, 100)
+     || 1000000 != tx[RATE_HISTORY - 22] || 19 != tx[RATE_HISTORY - 1]
+     || 3 != rate_recent (&r, tx, rx, 3) || 17 != tx[0])
+    {
+        fprintf (stderr, "Wrong recent rates after wrapping around\n");
+        exit (EXIT_FAILURE);
+    }
+
+    if (0 != strcmp ("1h 01m", rate_format_eta (3690, buf))
+     || 0 != strcmp ("5m 07s", rate_format_eta (307, buf))
+     || 0 != strcmp ("-", rate_format_eta (-1, buf)))
+    {
+        fprintf (stderr, "Wrong time format: %s\n", buf);
+        exit (EXIT_FAILURE);
+    }
+
+    printf ("Ok!\n");
+}
+
+static void
+test_metrics (void)
+{
+    struct iface ifaces[2];
+    struct mbs s;
+    char *buf = NULL;
+    size_t size = 0;
+    int len;
+
+    memset (&s, 0, sizeof (s));
+    memset (ifaces, 0, sizeof (ifaces));
+
+    ifaces[0].name = "eth0";
+    ifaces[0].used.tx_bytes = 100;
+    ifaces[1].name = "we\"ird";
+    ifaces[1].used.rx_bytes = 200;
+
+    s.ifaces = ifaces;
+    s.n_ifaces = 2;
+    s.used.tx_bytes = 100;
+    s.used.rx_bytes = 200;
+    s.flags = FLAG_COUNTDOWN;
+    s.balance = 5000;
+
+    rate_init (&s.rates, 2, 60);
+    rate_update (&s.rates, 1000, 0, 1000000000ULL);
+
+    len = metrics_render (&s, &buf, &size);
+
+    if (len <= 0 || (size_t) len != strlen (buf)
+     || NULL == strstr (buf, "\nmbs_tx_bytes_total 100\n")
+     || NULL == strstr (buf, "\nmbs_rx_bytes_total 200\n")
+     || NULL == strstr (buf, "{interface=\"we\\\"ird\"} 200\n")
+     || NULL == strstr (buf, "\nmbs_balance_bytes 5000\n")
+     || NULL == strstr (buf, "\nmbs_time_left_seconds 5\n")
+     || 0 != strcmp (buf + len - 6, "# EOF\n"))
+    {
+        fprintf (stderr, "Unexpected metrics:\n%s", buf);
+        exit (EXIT_FAILURE);
+    }
+
+    /* Rendering again reuses the buffer */
+    if (len != metrics_render (&s, &buf, &size) || size != (size_t) len + 1)
+    {
+        fprintf (stderr, "Expected the metrics buffer to be reused\n");
+        exit (EXIT_FAILURE);
+    }
+
+    free (buf);
+
+    printf ("Ok!\n");
+}
+
+/*
+ * Send a request (if any), let the server answer it, and compare what the
+ * client received.
+ */
+static void
+server_expect (const struct mbs *s, int fd, const char *request,
+               const char *expected)
+{
+    char buf[256];
+    ssize_t len;
+
+    if (NULL != request && (ssize_t) strlen (request)
+                           != send (fd, request, strlen (request), 0))
+    {
+        perror ("send");
+        exit (EXIT_FAILURE);
+    }
+
+    server_dispatch (s);
+
+    if (-1 == (len = recv (fd, buf, sizeof (buf) - 1, MSG_DONTWAIT)))
+        len = 0;
+
+    buf[len] = '\0';
+
+    if (0 != strcmp (expected, buf))
+    {
+        fprintf (stderr, "Unexpected reply to %s: '%s'\n",
+                 NULL != request ? request : "nothing", buf);
+        exit (EXIT_FAILURE);
+    }
+}
+
+static void
+test_server (void)
+{
+    char dir[] = "/tmp/mbs_tests_XXXXXX";
+    struct sockaddr_un addr;
+    struct iface ifaces[2];
+    struct stats delta = { .tx_bytes = 1, .rx_bytes = 2, .timestamp = 7 };
+    struct stat st;
+    struct mbs s;
+    char expected[64];
+    int fd;
+
+    memset (&s, 0, sizeof (s));
+    memset (ifaces, 0, sizeof (ifaces));
+    memset (&addr, 0, sizeof (addr));
+
+    ifaces[0].name = "eth0";
+    ifaces[0].used.tx_bytes = 100;
+    ifaces[1].name = "wlan0";
+    ifaces[1].used.rx_bytes = 200;
+    ifaces[1].error = EIO;
+
+    s.ifaces = ifaces;
+    s.n_ifaces = 2;
+    s.snapshot.tx_bytes = 10;
+    s.snapshot.rx_bytes = 20;
+    s.used.tx_bytes = 100;
+    s.used.rx_bytes = 200;
+    s.balance = 5000;
+
+    if (NULL == mkdtemp (dir))
+    {
+        perror ("mkdtemp");
+        exit (EXIT_FAILURE);
+    }
+
+    addr.sun_family = AF_UNIX;
+    snprintf (addr.sun_path, sizeof (addr.sun_path), "%s/mbs.sock", dir);
+
+    if (-1 == server_open (addr.sun_path)
+     || -1 == (fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0))
+     || -1 == connect (fd, (struct sockaddr *) &addr, sizeof (addr)))
+    {
+        perror ("server");
+        exit (EXIT_FAILURE);
+    }
+
+    /* Accept the connection */
+    server_expect (&s, fd, NULL, "");
+
+    server_expect (&s, fd, "GET\n", "10:20:100:200:5000:0:0:0:0:-1\n");
+
+    snprintf (expected, sizeof (expected), "eth0:100:0:0\nwlan0:0:200:%d\n\n",
+              EIO);
+    server_expect (&s, fd, "IFACES\n", expected);
+
+    /* Samples are only pushed to subscribers */
+    server_publish (&s, &delta);
+    server_expect (&s, fd, NULL, "");
+
+    server_expect (&s, fd, "SUBSCRIBE\n", "OK\n");
+    server_publish (&s, &delta);
+    server_expect (&s, fd, NULL, "7:1:2:5000\n");
+
+    server_expect (&s, fd, "UNSUBSCRIBE\n", "OK\n");
+    server_publish (&s, &delta);
+    server_expect (&s, fd, NULL, "");
+
+    /* Requests can arrive in pieces, and end in CRLF */
+    server_expect (&s, fd, "GE", "");
+    server_expect (&s, fd, "T\r\nBOGUS\n", "10:20:100:200:5000:0:0:0:0:-1\n"
+                   "ERR\n");
+
+    close (fd);
+    server_dispatch (&s);
+    server_close ();
+
+    if (0 == stat (addr.sun_path, &st))
+    {
+        fprintf (stderr, "Expected the socket to be removed\n");
+        exit (EXIT_FAILURE);
+    }
+
+    rmdir (dir);
+
+    printf ("Ok!\n");
+}
+
+static void
+test_statsfile (void)
+{
+    char path[] = "/tmp/mbs_tests_XXXXXX";
+    const char legacy[] = "100:200:30:40:5000:1.5:0:2.5:0:-1\n";
+    struct statsfile_record rec;
+    uint64_t fields[5];
+    struct mbs s;
+    FILE *file;
+    int fd;
+
+    if (0 != statsfile_parse_text ("1:2:3:4:5", 9, fields)
+     || 5 != fields[4]
+     || 0 != statsfile_parse_text ("18446744073709551615:0:0:0:0", 28, fields)
+     || UINT64_MAX != fields[0]
+     || -1 != statsfile_parse_text ("18446744073709551616:0:0:0:0", 28, fields)
+     || -1 != statsfile_parse_text ("1:2:3:4", 7, fields)
+     || -1 != statsfile_parse_text ("1:2:-3:4:5", 10, fields)
+     || -1 != statsfile_parse_text ("1:2:3:4:5x", 10, fields))
+    {
+        fprintf (stderr, "Unexpected result parsing the text format\n");
+        exit (EXIT_FAILURE);
+    }
+
+    if (-1 == (fd = mkstemp (path)) || -1 == write (fd, legacy, strlen (legacy)))
+    {
+        perror ("mkstemp");
+        exit (EXIT_FAILURE);
+    }
+
+    close (fd);
+
+    /* A file in the old format is converted */
+    if (1 != statsfile_open (path, 0, &rec)
+     || 100 != rec.snapshot_tx || 40 != rec.used_rx || 5000 != rec.balance)
+    {
+        fprintf (stderr, "Failed to import the text format\n");
+        exit (EXIT_FAILURE);
+    }
+
+    memset (&s, 0, sizeof (s));
+    s.used.tx_bytes = 1;
+    statsfile_save (&s);
+    s.used.tx_bytes = 2;
+    statsfile_save (&s);
+    statsfile_close ();
+
+    if (1 != statsfile_open (path, 0, &rec) || 2 != rec.used_tx
+     || 3 != rec.seq)
+    {
+        fprintf (stderr, "Expected the most recent record\n");
+        exit (EXIT_FAILURE);
+    }
+
+    statsfile_close ();
+
+    /* Tear the most recent record (in slot 0); the one before it is used */
+    file = fopen (path, "r+");
+    fseek (file, offsetof (struct statsfile, slot)
+               + offsetof (struct statsfile_record, used_tx), SEEK_SET);
+    fputc (0x7f, file);
+    fclose (file);
+
+    if (1 != statsfile_open (path, 0, &rec) || 1 != rec.used_tx)
+    {
+        fprintf (stderr, "Expected a torn record to be skipped\n");
+        exit (EXIT_FAILURE);
+    }
+
+    statsfile_close ();
+    unlink (path);
+
+    printf ("Ok!\n");
+}
+
+static void
+test_codec (void)
+{
+    const uint64_t values[] = { 0, 1, 127, 128, 300, UINT32_MAX, UINT64_MAX };
+    const int64_t signs[] = { 0, -1, 1, -64, 64, INT64_MIN, INT64_MAX };
+    /* FIPS 180-4 examples, and RFC 4231 test cases 2 and 6 */
+    const char *digests[] =
+    {
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+        "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843",
+        "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"
+    };
+    uint8_t buf[CODEC_VARINT_MAX], key[131], digest[4][CODEC_SHA256_LEN];
+    char hex[2 * CODEC_SHA256_LEN + 1];
+    uint64_t n;
+    size_t i, k, len;
+
+    for (i = 0; i < sizeof (values) / sizeof (values[0]); ++i)
+    {
+        len = codec_put_varint (buf, values[i]);
+
+        if (len != codec_get_varint (buf, buf + len, &n) || n != values[i]
+         || 0 != codec_get_varint (buf, buf + len - 1, &n))
+        {
+            fprintf (stderr, "Varint round trip failed: %"PRIu64"\n",
+                     values[i]);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < sizeof (signs) / sizeof (signs[0]); ++i)
+    {
+        if (codec_unzigzag (codec_zigzag (signs[i])) != signs[i])
+        {
+            fprintf (stderr, "Zigzag round trip failed: %"PRId64"\n",
+                     signs[i]);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    if (1 != codec_put_varint (buf, codec_zigzag (-1))
+     || 0xcbf43926 != codec_crc32 (0, "123456789", 9)
+     || 0xcbf43926 != codec_crc32 (codec_crc32 (0, "1234", 4), "56789", 5))
+    {
+        fprintf (stderr, "Unexpected zigzag or CRC-32 result\n");
+        exit (EXIT_FAILURE);
+    }
+
+    memset (key, 0xaa, sizeof (key));
+
+    codec_sha256 ("abc", 3, digest[0]);
+    codec_sha256 ("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+                  56, digest[1]);
+    codec_hmac_sha256 ("Jefe", 4, "what do ya want for nothing?", 28,
+                       digest[2]);
+    codec_hmac_sha256 (key, sizeof (key), "Test Using Larger Than Block-Size "
+                       "Key - Hash Key First", 54, digest[3]);
+
+    for (i = 0; i < 4; ++i)
+    {
+        for (k = 0; k < CODEC_SHA256_LEN; ++k)
+            sprintf (hex + 2 * k, "%02x", digest[i][k]);
+
+        if (0 != strcmp (hex, digests[i]))
+        {
+            fprintf (stderr, "Unexpected SHA-256 result: %s\n", hex);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    printf ("Ok!\n");
+}
+
+struct history_check
+{
+    uint64_t n, tx, rx, first, last;
+    uint64_t stop;
+};
+
+static int
+check_sample (const struct history_sample *x, void *arg)
+{
+    struct history_check *check = arg;
+
+    if (0 == check->n++)
+        check->first = x->time;
+
+    check->last = x->time;
+    check->tx += x->tx_bytes;
+    check->rx += x->rx_bytes;
+
+    return check->n == check->stop;
+}
+
+static void
+test_history (void)
+{
+    char path[] = "/tmp/mbs_tests_XXXXXX";
+    struct history_check check = { 0 };
+    struct stat st;
+    uint64_t t, tx = 0, rx = 0;
+    int fd;
+
+    if (-1 == (fd = mkstemp (path)))
+    {
+        perror ("mkstemp");
+        exit (EXIT_FAILURE);
+    }
+
+    close (fd);
+
+    /* Ten thousand busy seconds, in two sessions, with ticks of 250 ms */
+    for (t = 0; t < 40000; ++t)
+    {
+        if (0 == t || 20000 == t)
+            history_open (path, 0);
+
+        history_append (1500000000 + t / 4, 1000 + t % 7, t % 1000);
+        tx += 1000 + t % 7;
+        rx += t % 1000;
+
+        if (19999 == t || 39999 == t)
+            history_close ();
+    }
+
+    /* Idle seconds take no room */
+    history_open (path, 0);
+    history_append (1500000000 + 20000, 0, 0);
+    history_append (1500000000 + 30000, 1, 1);
+    history_close ();
+
+    stat (path, &st);
+
+    if (10001 != history_scan (path, 0, UINT64_MAX, check_sample, &check)
+     || tx + 1 != check.tx || rx + 1 != check.rx
+     || 1500000000 != check.first || 1500030000 != check.last
+     || st.st_size > 10 * HISTORY_BLOCK_SIZE)
+    {
+        fprintf (stderr, "Unexpected history: %"PRIu64" samples, %ld bytes\n",
+                 check.n, (long) st.st_size);
+        exit (EXIT_FAILURE);
+    }
+
+    /* A range, and a scan which is stopped early */
+    memset (&check, 0, sizeof (check));
+
+    if (100 != history_scan (path, 1500005000, 1500005100, check_sample,
+                             &check)
+     || 1500005000 != check.first || 1500005099 != check.last)
+    {
+        fprintf (stderr, "Unexpected history range\n");
+        exit (EXIT_FAILURE);
+    }
+
+    memset (&check, 0, sizeof (check));
+    check.stop = 3;
+
+    if (3 != history_scan (path, 0, UINT64_MAX, check_sample, &check))
+    {
+        fprintf (stderr, "Expected the scan to stop\n");
+        exit (EXIT_FAILURE);
+    }
+
+    /* Samples which were written survive a torn write of their block */
+    history_open (path, 0);
+    history_append (1500040000, 1, 1);
+    history_append (1500040001, 1, 1);
+
+    if (-1 == history_close ())
+    {
+        perror ("history_close");
+        exit (EXIT_FAILURE);
+    }
+
+    stat (path, &st);
+
+    if (-1 == (fd = open (path, O_WRONLY))
+     || 4 != pwrite (fd, "torn", 4, st.st_size - 2 * HISTORY_BLOCK_SIZE + 64))
+    {
+        perror ("open");
+        exit (EXIT_FAILURE);
+    }
+
+    close (fd);
+
+    history_open (path, 0);
+    history_append (1500040002, 1, 1);
+    history_close ();
+
+    memset (&check, 0, sizeof (check));
+
+    if (10004 != history_scan (path, 0, UINT64_MAX, check_sample, &check)
+     || 1500040002 != check.last)
+    {
+        fprintf (stderr, "Torn block not recovered: %"PRIu64" samples\n",
+                 check.n);
+        exit (EXIT_FAILURE);
+    }
+
+    unlink (path);
+
+    printf ("Ok!\n");
+}
+
+#define ROLLUP_SAMPLES (400 * 24 * 6)
+
+static uint64_t rollup_times[ROLLUP_SAMPLES];
+
+static uint64_t
+rollup_expected (uint64_t from, uint64_t to)
+{
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < ROLLUP_SAMPLES; ++i)
+    {
+        if (rollup_times[i] >= from && rollup_times[i] < to)
+            sum += 1000 + i % 100;
+    }
+
+    return sum;
+}
+
+static void
+check_rollup_sum (const struct rollup_file *f, uint64_t from, uint64_t to,
+                  uint64_t now, long max_buckets)
+{
+    struct rollup_bucket sum;
+    long n;
+
+    n = rollup_sum (f, from, to, now, &sum);
+
+    if (n > max_buckets || sum.rx_bytes != 0
+     || sum.tx_bytes != rollup_expected (sum.start, sum.end))
+    {
+        fprintf (stderr, "Unexpected rollup sum over %"PRIu64"-%"PRIu64": "
+                 "%"PRIu64" in %ld buckets\n", from, to, sum.tx_bytes, n);
+        exit (EXIT_FAILURE);
+    }
+}
+
+static void
+test_rollups (void)
+{
+    char path[] = "/tmp/mbs_tests_XXXXXX";
+    struct tm tm = { 0 };
+    struct rollup_bucket day;
+    const struct rollup_file *f;
+    uint64_t start, now;
+    size_t i;
+    int fd;
+
+    /* Eastern European time, with a 23-hour day on 30 March 2025 */
+    setenv ("TZ", "EET-2EEST,M3.5.0/3,M10.5.0/4", 1);
+    tzset ();
+
+    tm.tm_year = 125;
+    tm.tm_mday = 1;
+    tm.tm_isdst = -1;
+    start = mktime (&tm);
+
+    if (-1 == (fd = mkstemp (path)) || -1 == rollup_open (path, 0))
+    {
+        perror ("rollup_open");
+        exit (EXIT_FAILURE);
+    }
+
+    close (fd);
+
+    /* A sample every ten minutes, for 400 days */
+    for (i = 0; i < ROLLUP_SAMPLES; ++i)
+    {
+        rollup_times[i] = start + i * 600 + i % 7;
+        rollup_add (rollup_times[i], 1000 + i % 100, 0);
+    }
+
+    now = rollup_times[ROLLUP_SAMPLES - 1];
+
+    rollup_close ();
+
+    if (NULL == (f = rollup_map (path)))
+    {
+        perror ("rollup_map");
+        exit (EXIT_FAILURE);
+    }
+
+    /* A year, from month buckets */
+    tm.tm_year = 126;
+    tm.tm_isdst = -1;
+    check_rollup_sum (f, start, mktime (&tm), now, 12);
+
+    /* Unaligned, in the last 31 days, from minutes to months */
+    check_rollup_sum (f, now - 20 * 86400 + 61, now - 3600 + 120, now, 200);
+
+    /* Unaligned, older than the minutes that are kept */
+    check_rollup_sum (f, start + 45 * 86400 + 1234, start + 200 * 86400 + 99,
+                      now, 200);
+
+    rollup_period (ROLLUP_DAY, start + 88 * 86400 + 43200, &day);
+
+    if (23 * 3600 != day.end - day.start)
+    {
+        fprintf (stderr, "Expected a 23-hour day\n");
+        exit (EXIT_FAILURE);
+    }
+
+    rollup_unmap (f);
+    unlink (path);
+    unsetenv ("TZ");
+    tzset ();
+
+    printf ("Ok!\n");
+}
+
+static void
+test_status_line (void)
+{
+    struct iface iface;
+    struct mbs s;
+    char buf[160];
+
+    memset (&s, 0, sizeof (s));
+    memset (&iface, 0, sizeof (iface));
+
+    iface.name = "eth0";
+    s.ifaces = &iface;
+    s.n_ifaces = 1;
+    s.used.tx_bytes = 1024;
+    s.used.rx_bytes = 1024;
+    rate_init (&s.rates, 2, 60);
+
+    status_format (&s, false, buf, sizeof (buf));
+
+    if (0 != strcmp ("Used 2.0K  TX 0B/s  RX 0B/s", buf))
+    {
+        fprintf (stderr, "Unexpected status line: '%s'\n", buf);
+        exit (EXIT_FAILURE);
+    }
+
+    s.flags = FLAG_COUNTDOWN;
+    s.balance = 1536;
+    iface.down = true;
+
+    status_format (&s, true, buf, sizeof (buf));
+
+    if (0 != strcmp ("Used \033[1m2.0K\033[0m  Left \033[1m1.5K\033[0m (-)  "
+                     "TX \033[1m0B/s\033[0m  RX \033[1m0B/s\033[0m  (down)",
+                     buf))
+    {
+        fprintf (stderr, "Unexpected status line: '%s'\n", buf);
+        exit (EXIT_FAILURE);
+    }
+
+    printf ("Ok!\n");
+}
+
+/*
+ * Step through a trace until its interfaces are gone, optionally recording
+ * what was read, and return the data used.
+ */
+static struct stats
+replay_trace (const char *path, const char *record)
+{
+    char spec[64];
+    struct mbs s;
+    struct stats delta, used;
+
+    memset (&s, 0, sizeof (s));
+    s.nl_fd = -1;
+
+    snprintf (spec, sizeof (spec), "step:%s", path);
+
+    if (NULL == (s.source = trace_find (spec, 1))
+     || -1 == trace_add_ifaces (&s) || 0 == s.n_ifaces
+     || -1 == s.source->init (&s)
+     || (NULL != record && -1 == trace_record_open (record, &s))
+     || -1 == mbs_poll_interfaces (&s, NULL))
+    {
+        perror ("trace");
+        exit (EXIT_FAILURE);
+    }
+
+    while (0 == mbs_poll_interfaces (&s, &delta))
+    {
+        s.used.rx_bytes += delta.rx_bytes;
+        s.used.tx_bytes += delta.tx_bytes;
+    }
+
+    used = s.used;
+    mbs_cleanup (&s);
+
+    return used;
+}
+
+static void
+test_trace (void)
+{
+    /* A 32-bit counter which wraps, and an interface which shows up late */
+    const char *trace =
+        "mbs-trace 1 32\n"
+        "# <ms> <interface> <rx bytes> <tx bytes>\n"
+        "0 eth0 4294967000 100\n"
+        "0 wlan0 - -\n"
+        "1000 eth0 200 300\n"
+        "2000 wlan0 10 20\n"
+        "3000 eth0 1000 400\n"
+        "4000 wlan0 15 25\n";
+    char path[] = "/tmp/mbs_tests_XXXXXX", record[] = "/tmp/mbs_tests_XXXXXX";
+    struct counter_source wide = { "wide", 64, NULL, NULL, NULL }, narrow;
+    struct stats c, prev, used;
+    struct iface iface;
+    struct mbs s;
+    uint64_t ms, rx, tx;
+    char header[32];
+    FILE *f;
+    int fd, p;
+
+    /* The synthetic patterns, sampled every 100 ms for ten minutes */
+    for (p = 0; p < TRACE_PATTERNS; ++p)
+    {
+        const unsigned int bits = TRACE_WRAP == p ? 32 : 64;
+
+        trace_synthetic (p, 0, &prev);
+        rx = tx = 0;
+
+        for (ms = 100; ms <= 600000; ms += 100)
+        {
+            trace_synthetic (p, ms, &c);
+            rx += mbs_counter_delta (prev.rx_bytes, c.rx_bytes, bits);
+            tx += mbs_counter_delta (prev.tx_bytes, c.tx_bytes, bits);
+            prev = c;
+        }
+
+        /*
+         * A reset loses what was transferred since the read before it:
+         * 100 ms worth, 20 times.
+         */
+        if ((TRACE_CONSTANT == p && (rx != 600000000 || tx != 60000000))
+         || (TRACE_BURSTY == p && (rx != 600000000 || tx != 60000000))
+         || (TRACE_WRAP == p && (rx != 600000 * 65536ULL
+                              || tx != 600000 * 6554ULL))
+         || (TRACE_RESET == p && (rx != 600000000 - 20 * 100000
+                               || tx != 60000000 - 20 * 10000)))
+        {
+            fprintf (stderr, "Pattern %d: %" PRIu64 " RX, %" PRIu64 " TX\n",
+                     p, rx, tx);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    if (-1 == (fd = mkstemp (path))
+     || -1 == write (fd, trace, strlen (trace))
+     || -1 == close (fd) || -1 == (fd = mkstemp (record)) || -1 == close (fd))
+    {
+        perror ("mkstemp");
+        exit (EXIT_FAILURE);
+    }
+
+    /* A read for every time in the trace, recorded as it was read */
+    used = replay_trace (path, record);
+
+    if (296 + 1000 + 15 != used.rx_bytes || 300 + 25 != used.tx_bytes)
+    {
+        fprintf (stderr, "Replayed %" PRIu64 " RX, %" PRIu64 " TX\n",
+                 used.rx_bytes, used.tx_bytes);
+        exit (EXIT_FAILURE);
+    }
+
+    used = replay_trace (record, NULL);
+
+    if (296 + 1000 + 15 != used.rx_bytes || 300 + 25 != used.tx_bytes)
+    {
+        fprintf (stderr, "Replayed the recording: %" PRIu64 " RX, %" PRIu64
+                 " TX\n", used.rx_bytes, used.tx_bytes);
+        exit (EXIT_FAILURE);
+    }
+
+    /* Recorded from 64-bit counters, and then from the low 32 bits of them */
+    narrow = wide;
+    narrow.bits = 32;
+
+    memset (&s, 0, sizeof (s));
+    memset (&iface, 0, sizeof (iface));
+
+    iface.name = "eth0";
+    iface.sample = (struct stats) { 5ULL << 32 | 4294967000ULL, 100, 1 };
+    s.ifaces = &iface;
+    s.n_ifaces = 1;
+    s.source = &wide;
+
+    if (-1 == trace_record_open (record, &s))
+    {
+        perror ("trace_record_open");
+        exit (EXIT_FAILURE);
+    }
+
+    trace_record (&s);
+
+    s.source = &narrow;
+    iface.sample = (struct stats) { 200, 300, 1000000001 };
+    trace_record (&s);
+
+    trace_close ();
+
+    if (NULL == (f = fopen (record, "r"))
+     || NULL == fgets (header, sizeof (header), f)
+     || 0 != strcmp ("mbs-trace 1 32\n", header))
+    {
+        fprintf (stderr, "Recorded the wrong width: %s", header);
+        exit (EXIT_FAILURE);
+    }
+
+    fclose (f);
+
+    used = replay_trace (record, NULL);
+
+    if (296 + 200 != used.rx_bytes || 200 != used.tx_bytes)
+    {
+        fprintf (stderr, "Replayed the fallback: %" PRIu64 " RX, %" PRIu64
+                 " TX\n", used.rx_bytes, used.tx_bytes);
+        exit (EXIT_FAILURE);
+    }
+
+    /* Not a trace */
+    if (NULL != trace_find ("replay:/dev/null", 1) || EPROTO != errno
+     || NULL != trace_find ("synthetic:sine", 1) || EINVAL != errno)
+    {
+        fprintf (stderr, "Expected errors from trace_find\n");
+        exit (EXIT_FAILURE);
+    }
+
+    unlink (path);
+    unlink (record);
+
+    printf ("Ok!\n");
+}
+
+static void
+find_tcp (const struct netlink_tcp *sock, void *arg)
+{
+    struct netlink_tcp *want = arg;
+
+    if (sock->inode == want->inode)
+        *want = *sock;
+}
+
+/*
+ * What has been attributed to this process, if it is among the busiest.
+ */
+static struct stats
+procnet_self (void)
+{
+    struct procnet_entry top[PROCNET_TOP];
+    struct stats self = { 0, 0, 0 }, other;
+    size_t i, n = procnet_top (top, PROCNET_TOP, &other);
+
+    for (i = 0; i < n; ++i)
+    {
+        if (getpid () == top[i].pid)
+        {
+            self.tx_bytes = top[i].tx_bytes;
+            self.rx_bytes = top[i].rx_bytes;
+        }
+    }
+
+    return self;
+}
+
+static void
+test_procnet (void)
+{
+    struct procnet_entry top[PROCNET_TOP];
+    struct stats other;
+    struct stat st;
+    struct sockaddr_in addr = { 0 };
+    struct netlink_tcp tcp = { 0, 0, 0 };
+    struct stats before, after;
+    socklen_t addrlen;
+    char buf[4096] = { 0 };
+    uint64_t now;
+    FILE *f;
+    size_t i, n;
+    int fd, tries, listener, peer, diag;
+    bool found = false;
+
+    if (-1 == procnet_open ())
+    {
+        perror ("procnet_open");
+        exit (EXIT_FAILURE);
+    }
+
+    /*
+     * A socket which was not there when the owners were last looked for. It
+     * is only listed once it is bound.
+     */
+    fd = socket (AF_INET, SOCK_DGRAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+    if (-1 == fd || -1 == bind (fd, (struct sockaddr *) &addr, sizeof (addr))
+     || -1 == fstat (fd, &st))
+    {
+        perror ("socket");
+        exit (EXIT_FAILURE);
+    }
+
+    for (tries = 0; tries < 100 && getpid () != procnet_owner (st.st_ino);
+         ++tries)
+        procnet_refresh ();
+
+    if (getpid () != procnet_owner (st.st_ino))
+    {
+        printf ("procnet: socket %lu not found\n", (unsigned long) st.st_ino);
+        exit (EXIT_FAILURE);
+    }
+
+    /* The owner is known; nothing is read to find it again */
+    procnet_refresh ();
+
+    if (getpid () != procnet_owner (st.st_ino))
+    {
+        printf ("procnet: socket %lu lost\n", (unsigned long) st.st_ino);
+        exit (EXIT_FAILURE);
+    }
+
+    /* Write a lot, so that this is the busiest process */
+    if (NULL == (f = fopen ("/dev/null", "w")))
+    {
+        perror ("/dev/null");
+        exit (EXIT_FAILURE);
+    }
+
+    for (i = 0; i < 256; ++i)
+    {
+        fwrite (buf, 1, sizeof (buf), f);
+        fflush (f);
+    }
+
+    fclose (f);
+
+    now = mbs_now ();
+
+    /* Too soon after the last refresh; kept for later */
+    procnet_add (1000, 0, now);
+
+    if (0 != procnet_top (top, PROCNET_TOP, &other) || 0 != other.tx_bytes)
+    {
+        printf ("procnet_add: attributed too soon\n");
+        exit (EXIT_FAILURE);
+    }
+
+    procnet_add (0, 0, now + 2000000000ULL);
+    n = procnet_top (top, PROCNET_TOP, &other);
+
+    for (i = 0; i < n; ++i)
+    {
+        found = found || getpid () == top[i].pid;
+        other.tx_bytes += top[i].tx_bytes;
+        other.rx_bytes += top[i].rx_bytes;
+    }
+
+    if (!found || other.tx_bytes > 1000 || 0 != other.rx_bytes
+     || (n < PROCNET_TOP && 1000 != other.tx_bytes))
+    {
+        printf ("procnet_add: attributed %" PRIu64 " and %" PRIu64 "\n",
+                other.tx_bytes, other.rx_bytes);
+        exit (EXIT_FAILURE);
+    }
+
+    close (fd);
+    procnet_refresh ();
+
+    if (-1 != procnet_owner (st.st_ino))
+    {
+        printf ("procnet: closed socket still owned\n");
+        exit (EXIT_FAILURE);
+    }
+
+    /* Over TCP, the counters of the sockets say who it was for */
+    addrlen = sizeof (addr);
+    addr.sin_port = 0;
+
+    if (-1 == (listener = socket (AF_INET, SOCK_STREAM, 0))
+     || -1 == bind (listener, (struct sockaddr *) &addr, sizeof (addr))
+     || -1 == listen (listener, 1)
+     || -1 == getsockname (listener, (struct sockaddr *) &addr, &addrlen)
+     || -1 == (fd = socket (AF_INET, SOCK_STREAM, 0))
+     || -1 == connect (fd, (struct sockaddr *) &addr, sizeof (addr))
+     || -1 == (peer = accept (listener, NULL, NULL))
+     || -1 == fstat (fd, &st))
+    {
+        perror ("tcp");
+        exit (EXIT_FAILURE);
+    }
+
+    for (tries = 0; tries < 100 && getpid () != procnet_owner (st.st_ino);
+         ++tries)
+        procnet_refresh ();
+
+    before = procnet_self ();
+
+    for (i = 0; i < 16; ++i)
+    {
+        if (sizeof (buf) != send (fd, buf, sizeof (buf), 0)
+         || sizeof (buf) != recv (peer, buf, sizeof (buf), MSG_WAITALL))
+        {
+            perror ("send");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    tcp.inode = st.st_ino;
+    diag = netlink_open_sock_diag ();
+
+    /* The SYN is acknowledged too */
+    if (-1 == netlink_dump_tcp (diag, AF_INET, find_tcp, &tcp)
+     || 16 * sizeof (buf) + 1 != tcp.bytes_acked)
+    {
+        printf ("netlink_dump_tcp: %" PRIu64 " bytes acked\n",
+                tcp.bytes_acked);
+        exit (EXIT_FAILURE);
+    }
+
+    netlink_close (diag);
+
+    procnet_add (16 * sizeof (buf), 16 * sizeof (buf), now + 4000000000ULL);
+    after = procnet_self ();
+
+    if (after.tx_bytes - before.tx_bytes < 8 * sizeof (buf)
+     || after.rx_bytes - before.rx_bytes < 8 * sizeof (buf))
+    {
+        printf ("procnet_add: attributed %" PRIu64 " and %" PRIu64 " of TCP "
+                "traffic\n", after.tx_bytes - before.tx_bytes,
+                after.rx_bytes - before.rx_bytes);
+        exit (EXIT_FAILURE);
+    }
+
+    close (peer);
+    close (fd);
+    close (listener);
+
+    procnet_close ();
+}
 
 static void
-test_parse_bytes (char *input, uint64_t match)
+test_collect (void)
 {
-    uint64_t result;
+    struct collect_batch b, d, runs[2];
+    struct mbs fleet, s;
+    struct stats delta;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof (addr);
+    uint8_t buf[COLLECT_FRAME_MAX];
+    char address[32], path[] = "/tmp/mbs_tests_XXXXXX";
+    size_t len;
+    int fd, i, k;
 
-    if (-1 == parse_bytes (input, &result))
+    memset (&b, 0, sizeof (b));
+    strcpy (b.name, "web1");
+    b.session = 42;
+    b.n = 2;
+    b.samples[0] = (struct collect_sample) { 200, 100, 1000 };
+    b.samples[1] = (struct collect_sample) { 200, 100, 1000 };
+
+    len = collect_encode (&b, buf);
+
+    if ((int) len != collect_decode (buf, len, &d)
+     || 0 != strcmp ("web1", d.name) || 42 != d.session || 2 != d.n
+     || 1000 != d.samples[1].rx || 0 != collect_decode (buf, len - 1, &d))
     {
-        fprintf (stderr, "error: %s\n", input);
+        fprintf (stderr, "collect_decode: the frame did not survive\n");
         exit (EXIT_FAILURE);
     }
 
-    if (result != match)
+    buf[len - 5] ^= 1;
+
+    if (-1 != collect_decode (buf, len, &d) || EPROTO != errno)
     {
-        fprintf (stderr, "%lu is not \"%s\"\n", match, input);
+        fprintf (stderr, "collect_decode: a corrupt frame was accepted\n");
+        exit (EXIT_FAILURE);
+    }
+
+    memset (&fleet, 0, sizeof (fleet));
+    fleet.flags = FLAG_FLEET | FLAG_COUNTDOWN;
+    fleet.nl_fd = -1;
+    rate_init (&fleet.rates, RATE_DEFAULT_TAU, RATE_DEFAULT_AVG_TAU);
+
+    /* The same batch twice, another host, and then a restart */
+    collect_merge (&fleet, &b, 1000000000ULL);
+    collect_merge (&fleet, &b, 1000000000ULL);
+
+    strcpy (b.name, "db1");
+    collect_merge (&fleet, &b, 1000000000ULL);
+
+    strcpy (b.name, "web1");
+    b.session = 43;
+    b.base_tx = 50;
+    b.base_rx = 50;
+    b.n = 0;
+    collect_merge (&fleet, &b, 3000000000ULL);
+
+    /* Sent before the restart, and received after; not counted again */
+    b.session = 42;
+    b.seq = 2;
+    b.base_tx = 200;
+    b.base_rx = 2000;
+    collect_merge (&fleet, &b, 3000000000ULL);
+
+    /* Restarted again; neither of the sessions before it counts again */
+    b.session = 44;
+    b.seq = 0;
+    b.base_tx = 10;
+    b.base_rx = 10;
+    collect_merge (&fleet, &b, 3000000000ULL);
+
+    b.session = 43;
+    b.base_tx = 100;
+    b.base_rx = 100;
+    collect_merge (&fleet, &b, 3000000000ULL);
+
+    b.session = 42;
+    collect_merge (&fleet, &b, 3000000000ULL);
+
+    collect_update (&fleet, 10000, 3000000000ULL, 1500000000ULL, &delta);
+
+    if (2 != fleet.n_ifaces || 260 != fleet.ifaces[0].used.tx_bytes
+     || 2060 != fleet.ifaces[0].used.rx_bytes
+     || 460 != fleet.used.tx_bytes || 4060 != fleet.used.rx_bytes
+     || 460 != delta.tx_bytes || 10000 - 4520 != fleet.balance
+     || 0 != fleet.ifaces[0].error || ETIMEDOUT != fleet.ifaces[1].error
+     || fleet.rates.rx.value < 4999 || fleet.rates.rx.value > 5001)
+    {
+        fprintf (stderr, "collect_merge: fleet used %"PRIu64"/%"PRIu64", "
+                 "%.1f B/s\n", fleet.used.tx_bytes, fleet.used.rx_bytes,
+                 fleet.rates.rx.value);
+        exit (EXIT_FAILURE);
+    }
+
+    mbs_cleanup (&fleet);
+
+    /* Signed with a key, and only accepted with the same one */
+    if (-1 == (fd = mkstemp (path)) || 7 != write (fd, "secret\n", 7)
+     || -1 == collect_set_key (path))
+    {
+        perror ("collect_set_key");
+        exit (EXIT_FAILURE);
+    }
+
+    len = collect_encode (&b, buf);
+
+    if ((int) len != collect_decode (buf, len, &d) || 42 != d.session)
+    {
+        fprintf (stderr, "collect_decode: a signed frame was refused\n");
+        exit (EXIT_FAILURE);
+    }
+
+    buf[len - 1] ^= 1;
+
+    if (-1 != collect_decode (buf, len, &d))
+    {
+        fprintf (stderr, "collect_decode: a bad signature was accepted\n");
+        exit (EXIT_FAILURE);
+    }
+
+    buf[len - 1] ^= 1;
+
+    if (-1 == ftruncate (fd, 0) || 6 != pwrite (fd, "public", 6, 0)
+     || -1 == collect_set_key (path) || -1 != collect_decode (buf, len, &d))
+    {
+        fprintf (stderr, "collect_decode: the wrong key was accepted\n");
+        exit (EXIT_FAILURE);
+    }
+
+    /* Nor without a key at all */
+    collect_close ();
+
+    if (-1 != collect_decode (buf, len, &d))
+    {
+        fprintf (stderr, "collect_decode: a signed frame was accepted\n");
+        exit (EXIT_FAILURE);
+    }
+
+    close (fd);
+    unlink (path);
+
+    /* A full batch goes out right away */
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+    fd = socket (AF_INET, SOCK_DGRAM, 0);
+
+    if (-1 == bind (fd, (struct sockaddr *) &addr, sizeof (addr))
+     || -1 == getsockname (fd, (struct sockaddr *) &addr, &addrlen))
+    {
+        perror ("bind");
+        exit (EXIT_FAILURE);
+    }
+
+    snprintf (address, sizeof (address), "udp://127.0.0.1:%d",
+              ntohs (addr.sin_port));
+
+    /* Resumed with --persistent; what was used before is not sent again */
+    memset (&s, 0, sizeof (s));
+    s.used.tx_bytes = 1000;
+
+    for (k = 0; k < 2; ++k)
+    {
+        /* Sessions are a millisecond apart at least */
+        usleep (2000);
+
+        if (-1 == collect_open (address, "web2", &s))
+        {
+            perror ("collect_open");
+            exit (EXIT_FAILURE);
+        }
+
+        for (i = 0; i < COLLECT_BATCH; ++i)
+        {
+            s.used.rx_bytes += 10;
+            collect_sample (&s);
+        }
+
+        len = recv (fd, buf, sizeof (buf), MSG_DONTWAIT);
+
+        if ((int) len != collect_decode (buf, len, &runs[k])
+         || COLLECT_BATCH != runs[k].n || 0 != strcmp ("web2", runs[k].name)
+         || 0 != runs[k].base_tx || 0 != runs[k].base_rx
+         || 10 != runs[k].samples[COLLECT_BATCH - 1].rx)
+        {
+            fprintf (stderr, "collect_sample: no batch was sent\n");
+            exit (EXIT_FAILURE);
+        }
+
+        collect_close ();
+    }
+
+    close (fd);
+
+    memset (&fleet, 0, sizeof (fleet));
+    fleet.flags = FLAG_FLEET;
+    fleet.nl_fd = -1;
+
+    collect_merge (&fleet, &runs[0], 1000000000ULL);
+    collect_merge (&fleet, &runs[1], 2000000000ULL);
+
+    if (runs[1].session <= runs[0].session
+     || 0 != fleet.ifaces[0].used.tx_bytes
+     || 2 * 10 * COLLECT_BATCH != fleet.ifaces[0].used.rx_bytes)
+    {
+        fprintf (stderr, "collect_merge: the restart of a persistent host "
+                 "used %"PRIu64"/%"PRIu64"\n", fleet.ifaces[0].used.tx_bytes,
+                 fleet.ifaces[0].used.rx_bytes);
         exit (EXIT_FAILURE);
     }
+
+    mbs_cleanup (&fleet);
+
+    printf ("Ok! (%zu bytes for a batch of %d)\n", len, COLLECT_BATCH);
 }
 
 static void
-test_to_human_readable (double bytes, char *s)
+test_selfstats (void)
 {
-    char buf[10];
+    const struct selfstats_timing *t;
+    struct selfstats_usage u;
+    char buf[SELFSTATS_NS_MAX];
+    void *p;
 
-    to_human_readable (bytes, buf);
+    if (0 != selfstats_bucket (500) || 1 != selfstats_bucket (1500)
+        || 2 != selfstats_bucket (2000) || 14 != selfstats_bucket (9000000)
+        || SELFSTATS_BUCKETS - 1 != selfstats_bucket (UINT64_MAX))
+    {
+        printf ("selfstats_bucket: wrong bucket\n");
+        exit (EXIT_FAILURE);
+    }
 
-    if (0 != strcmp (s, buf))
+    if (strcmp (selfstats_format_ns (850, true, buf), "850ns")
+        || strcmp (selfstats_format_ns (12500, true, buf), "12.5us")
+        || strcmp (selfstats_format_ns (12500, false, buf), "12.5µs")
+        || strcmp (selfstats_format_ns (3200000, true, buf), "3.2ms"))
     {
-        fprintf (stderr, "Expected result: %s\n", s);
-        fprintf (stderr, "Actual result: %s\n", buf);
+        printf ("selfstats_format_ns: got \"%s\"\n", buf);
         exit (EXIT_FAILURE);
     }
 
-    printf ("Ok!\n");
+    selfstats_init ();
+    selfstats_begin ();
+    selfstats_mark (SELFSTATS_POLL);
+    p = malloc (64);
+    free (p);
+    p = aligned_alloc (64, 64);
+    free (p);
+    selfstats_end ();
+
+    /* Outside a tick, so this should not be counted */
+    p = malloc (64);
+    free (p);
+
+    t = selfstats_timing (SELFSTATS_POLL);
+
+    if (1 != t->count || t->min != t->max || t->total != t->min
+        || 1 != t->histogram[selfstats_bucket (t->min)])
+    {
+        printf ("selfstats: poll counted %" PRIu64 " times\n", t->count);
+        exit (EXIT_FAILURE);
+    }
+
+    if (1 != selfstats_timing (SELFSTATS_TICK)->count
+        || 0 != selfstats_timing (SELFSTATS_DRAW)->count)
+    {
+        printf ("selfstats: wrong phases counted\n");
+        exit (EXIT_FAILURE);
+    }
+
+    selfstats_usage (&u);
+
+    if (1 != u.ticks || (u.allocations >= 0 && 2 != u.allocations))
+    {
+        printf ("selfstats: %" PRIu64 " ticks, %" PRId64 " allocations\n",
+                u.ticks, u.allocations);
+        exit (EXIT_FAILURE);
+    }
+}
+
+static void
+test_shm (void)
+{
+    const struct mbs_shm *seg = NULL;
+    struct mbs_shm_data data;
+    struct mbs_shm *raw;
+    struct iface iface;
+    struct mbs s;
+    char name[32];
+    uint64_t last = 0, changes = 0;
+    pid_t child;
+    long i;
+    int fd;
+
+    memset (&s, 0, sizeof (s));
+    memset (&iface, 0, sizeof (iface));
+    memset (&data, 0, sizeof (data));
+
+    iface.name = "eth0";
+    s.ifaces = &iface;
+    s.n_ifaces = 1;
+
+    snprintf (name, sizeof (name), "/mbs_tests.%d", (int) getpid ());
+
+    if (0 == (child = fork ()))
+    {
+        uint64_t k;
+
+        if (-1 == shm_publish_open (&s, name))
+            _exit (EXIT_FAILURE);
+
+        /* All fields are equal, so a mix of two updates would show */
+        for (k = 1;; ++k)
+        {
+            s.snapshot.tx_bytes = s.snapshot.rx_bytes = k;
+            s.used.tx_bytes = s.used.rx_bytes = k;
+            s.balance = k;
+            s.snapshot.timestamp = k;
+
+            shm_publish (&s);
+        }
+    }
+
+    for (i = 0; i < 5000 && (NULL == seg || data.pid != child); ++i)
+    {
+        if (NULL == seg)
+            seg = mbs_shm_attach (name);
+        else
+            mbs_shm_read (seg, &data);
+
+        usleep (1000);
+    }
+
+    if (NULL == seg || data.pid != child)
+    {
+        printf ("shm: segment not published\n");
+        kill (child, SIGKILL);
+        exit (EXIT_FAILURE);
+    }
+
+    for (i = 0; i < 10000000 && changes < 1000; ++i)
+    {
+        mbs_shm_read (seg, &data);
+
+        if (data.snapshot_rx != data.snapshot_tx
+         || data.used_tx != data.snapshot_tx
+         || data.used_rx != data.snapshot_tx
+         || data.balance != data.snapshot_tx
+         || data.timestamp != data.snapshot_tx)
+        {
+            printf ("shm: torn read (%" PRIu64 ", %" PRIu64 ", %" PRIu64
+                    ")\n", data.snapshot_tx, data.used_rx, data.timestamp);
+            kill (child, SIGKILL);
+            exit (EXIT_FAILURE);
+        }
+
+        if (data.timestamp != last)
+            ++changes;
+
+        last = data.timestamp;
+
+        /* Let the child run, on a single processor */
+        if (0 == i % 10000)
+            usleep (100);
+    }
+
+    if (changes < 100)
+    {
+        printf ("shm: only %" PRIu64 " updates seen\n", changes);
+        kill (child, SIGKILL);
+        exit (EXIT_FAILURE);
+    }
+
+    /* The child is still publishing */
+    if (-1 != shm_publish_open (&s, name) || EBUSY != errno)
+    {
+        printf ("shm: took over a segment in use\n");
+        kill (child, SIGKILL);
+        exit (EXIT_FAILURE);
+    }
+
+    kill (child, SIGKILL);
+    waitpid (child, NULL, 0);
+
+    /* As if the child had died half-way through an update */
+    fd = shm_open (name, O_RDWR, 0);
+    raw = mmap (NULL, sizeof (*raw), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                0);
+    close (fd);
+
+    if (MAP_FAILED == raw)
+    {
+        perror ("mmap");
+        exit (EXIT_FAILURE);
+    }
+
+    raw->seq |= 1;
+    munmap (raw, sizeof (*raw));
+
+    if (-1 == shm_publish_open (&s, name))
+    {
+        perror ("shm_publish_open");
+        exit (EXIT_FAILURE);
+    }
+
+    s.balance = 12345;
+    shm_publish (&s);
+
+    /* Would spin forever if the sequence number had been left odd */
+    mbs_shm_read (seg, &data);
+
+    if (data.pid != getpid () || 12345 != data.balance
+     || strcmp (data.iface, "eth0"))
+    {
+        printf ("shm: not taken over\n");
+        exit (EXIT_FAILURE);
+    }
+
+    shm_publish_close ();
+    munmap ((void *) seg, sizeof (*seg));
+
+    if (NULL != (seg = mbs_shm_attach (name)))
+    {
+        printf ("shm: segment not removed\n");
+        exit (EXIT_FAILURE);
+    }
+
+    printf ("Ok! (%" PRIu64 " updates read)\n", changes);
+}
+
+#ifdef HAVE_CURSES
+static long
+terminal_bytes (FILE *out)
+{
+    struct stat st;
+
+    fflush (out);
+    fstat (fileno (out), &st);
+
+    return st.st_size;
+}
+
+static void
+test_window (void)
+{
+    FILE *out = tmpfile (), *in = fopen ("/dev/null", "r");
+    struct iface iface, many[64];
+    SCREEN *screen;
+    size_t i;
+    struct mbs s;
+    long full, idle, changed;
+
+    if (NULL == out || NULL == in
+     || NULL == (screen = newterm ("xterm", out, in)))
+    {
+        printf ("Skipped (no terminal description)\n");
+        return;
+    }
+
+    set_term (screen);
+
+    memset (&s, 0, sizeof (s));
+    memset (&iface, 0, sizeof (iface));
+
+    iface.name = "eth0";
+    s.ifaces = &iface;
+    s.n_ifaces = 1;
+    s.flags = FLAG_COUNTDOWN;
+    s.balance = 3000000;
+    s.used.tx_bytes = 1000000;
+    rate_init (&s.rates, 2, 60);
+
+    if (-1 == window_open (&s))
+    {
+        fprintf (stderr, "Failed to open the window\n");
+        exit (EXIT_FAILURE);
+    }
+
+    draw_window (&s, false, false);
+    full = terminal_bytes (out);
+
+    /* Nothing has changed: nothing is sent */
+    draw_window (&s, false, false);
+    idle = terminal_bytes (out) - full;
+
+    /* Only the TX total, used, left and a few bar cells change */
+    s.used.tx_bytes += 300000;
+    s.balance -= 300000;
+    draw_window (&s, true, false);
+    changed = terminal_bytes (out) - full - idle;
+
+    window_close (&s);
+
+    /* More interfaces than there are lines: the list is cut short */
+    s.ifaces = many;
+    s.n_ifaces = sizeof (many) / sizeof (many[0]);
+    s.flags |= FLAG_PROCESSES;
+
+    for (i = 0; i < s.n_ifaces; ++i)
+    {
+        memset (&many[i], 0, sizeof (many[i]));
+        many[i].name = "veth";
+    }
+
+    if (-1 == window_open (&s))
+    {
+        fprintf (stderr, "Failed to open a window with %zu interfaces on %d "
+                 "lines\n", s.n_ifaces, LINES);
+        exit (EXIT_FAILURE);
+    }
+
+    draw_window (&s, false, false);
+
+    if (getmaxy (s.win) > LINES)
+    {
+        fprintf (stderr, "Window of %d rows on %d lines\n", getmaxy (s.win),
+                 LINES);
+        exit (EXIT_FAILURE);
+    }
+
+    window_close (&s);
+    delscreen (screen);
+    fclose (out);
+    fclose (in);
+
+    if (0 != idle || changed <= 0 || changed > full / 4)
+    {
+        fprintf (stderr, "Terminal bytes: %ld in full, %ld idle, %ld for a "
+                 "change\n", full, idle, changed);
+        exit (EXIT_FAILURE);
+    }
+
+    printf ("Ok! (%ld bytes in full, %ld per idle tick, %ld for a change)\n",
+            full, idle, changed);
 }
+#endif
 
 int 
 main (int argc, char *argv[])
@@ -69,6 +1867,16 @@ main (int argc, char *argv[])
     test_parse_bytes ("1.1K", 1126);
     test_parse_bytes ("15.2M", 15938355);
     test_parse_bytes ("15.2m", 15200000);
+    test_parse_bytes (".5K", 512);
+    printf ("Testing exact and large input\n");
+    test_parse_bytes ("9007199254740993", 9007199254740993ULL);
+    test_parse_bytes ("18446744073709551615", UINT64_MAX);
+    test_parse_bytes ("2T", 2ULL << 40);
+    test_parse_bytes ("3TiB", 3ULL << 40);
+    test_parse_bytes ("1.5P", 3ULL << 49);
+    test_parse_bytes ("15E", 15ULL << 60);
+    test_parse_bytes ("18e", 18000000000000000000ULL);
+    test_parse_bytes ("1.000000000000000001e", 1000000000000000001ULL);
 
     if (-1 != parse_bytes ("xxx", &result))
     {
@@ -80,9 +1888,88 @@ main (int argc, char *argv[])
         fprintf (stderr, "100pesos should return -1\n");
         exit (EXIT_FAILURE);
     }
+    {
+        const char *invalid[] = { "18446744073709551616", "16E", "19e", ".",
+                                  "K", "1kiB", "1Kb", "1.2.3", "-1" };
+        size_t i;
+
+        for (i = 0; i < sizeof (invalid) / sizeof (invalid[0]); ++i)
+        {
+            if (-1 != parse_bytes (invalid[i], &result))
+            {
+                fprintf (stderr, "%s should return -1\n", invalid[i]);
+                exit (EXIT_FAILURE);
+            }
+        }
+    }
     
     test_to_human_readable (4*1024*1024*1024L, "4.000G");
     test_to_human_readable (1442, "1.4K");
+    test_to_human_readable (0, "0B");
+    test_to_human_readable (1023, "1023B");
+    test_to_human_readable (1048535, "1024.0K");
+    test_to_human_readable (1ULL << 50, "1.00000P");
+    test_to_human_readable (-5, "0B");
+    {
+        char buf[MBS_HUMAN_READABLE_MAX];
+
+        if (strcmp (format_bytes (UINT64_MAX, MBS_UNITS_IEC, buf), "16.000000E")
+            || strcmp (format_bytes (UINT64_MAX, MBS_UNITS_SI, buf),
+                       "18.446744e")
+            || strcmp (format_bytes (1000, MBS_UNITS_SI, buf), "1.0k")
+            || strcmp (format_bytes (999, MBS_UNITS_SI, buf), "999B")
+            || -1 == parse_bytes (format_bytes (4000000000ULL, MBS_UNITS_SI,
+                                                buf), &result)
+            || 4000000000ULL != result)
+        {
+            fprintf (stderr, "format_bytes: got %s\n", buf);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    printf ("Testing counter wrap-around and reset\n");
+    {
+        const uint64_t steady[]    = { 0, 100, 200, 300 };
+        const uint64_t wrap32[]    = { 4294967000ULL, 4294967295ULL, 704,
+                                       1704 };
+        const uint64_t twice32[]   = { 3000000000ULL, 1000000000,
+                                       3500000000ULL, 200000000 };
+        const uint64_t reset32[]   = { 5000, 6000, 100, 600 };
+        const uint64_t reset64[]   = { 10000000000ULL, 10000000500ULL, 300,
+                                       400 };
+        const uint64_t max64[]     = { UINT64_MAX - 10, UINT64_MAX, 50 };
+        const uint64_t overflow[]  = { 10000000000ULL, 700 };
+
+        test_counter_delta (steady, 4, 32, 300);
+        test_counter_delta (steady, 4, 64, 300);
+        test_counter_delta (wrap32, 4, 32, 2000);
+        test_counter_delta (twice32, 4, 32, 5789934592ULL);
+        test_counter_delta (reset32, 4, 32, 1000 + 100 + 500);
+        test_counter_delta (reset64, 4, 64, 500 + 300 + 100);
+        test_counter_delta (max64, 3, 64, 10 + 50);
+        /* 64-bit snapshot followed by a 32-bit read */
+        test_counter_delta (overflow, 2, 32, 700);
+    }
+
+    test_stats_delta ();
+    test_poll_failure ();
+    test_next_interval ();
+    test_rates ();
+    test_metrics ();
+    test_server ();
+    test_statsfile ();
+    test_codec ();
+    test_history ();
+    test_rollups ();
+    test_status_line ();
+    test_trace ();
+    test_selfstats ();
+    test_shm ();
+    test_collect ();
+    test_procnet ();
+#ifdef HAVE_CURSES
+    test_window ();
+#endif
 
     printf ("-------------\n");
     printf ("All tests OK!\n");
@@ -0,0 +1,623 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define __STDC_FORMAT_MACROS
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "trace.h"
+
+/* Where the counters of the wrap pattern start: 1 MiB short of wrapping */
+#define WRAP_START (UINT32_MAX - 0xfffff)
+
+/* A line of a trace */
+struct entry
+{
+    uint64_t time;
+    size_t iface;
+    bool valid;
+    struct stats counters;
+};
+
+/* The state of an interface in the trace, as of the last entry applied */
+struct replay_iface
+{
+    char *name;
+    bool valid;
+    struct stats counters;
+};
+
+static uint64_t started;
+static unsigned int speed = 1;
+
+/* Whether a replay moves on to the next time in the trace on every read */
+static bool stepping = false;
+
+static struct
+{
+    struct entry *entries;
+    size_t n_entries, next;
+    struct replay_iface *ifaces;
+    size_t n_ifaces;
+} replay;
+
+static struct
+{
+    FILE *file;
+    uint64_t opened, now;
+    unsigned int bits;
+    size_t n_ifaces;
+    struct iface *last;
+} rec;
+
+/*
+ * Time since the source started, in nanoseconds, on a clock which runs
+ * faster than real time by the given factor.
+ */
+static uint64_t
+trace_clock (void)
+{
+    return (mbs_now () - started) * speed;
+}
+
+void
+trace_synthetic (enum trace_pattern pattern, uint64_t ms,
+                 struct stats *counters)
+{
+    uint64_t busy;
+
+    switch (pattern)
+    {
+        case TRACE_BURSTY:
+            busy = ms / 10000 * 1000
+                 + (ms % 10000 < 1000 ? ms % 10000 : 1000);
+            counters->rx_bytes = busy * 10000;
+            counters->tx_bytes = busy * 1000;
+            break;
+
+        case TRACE_WRAP:
+            counters->rx_bytes = (WRAP_START + ms * 65536) & UINT32_MAX;
+            counters->tx_bytes = (WRAP_START + ms * 6554) & UINT32_MAX;
+            break;
+
+        case TRACE_RESET:
+            ms %= 30000;
+            /* fall through */
+
+        default:
+            counters->rx_bytes = ms * 1000;
+            counters->tx_bytes = ms * 100;
+    }
+}
+
+/* synthetic */
+
+static int
+synthetic_init (struct mbs *s)
+{
+    (void) s;
+
+    started = mbs_now ();
+    return 0;
+}
+
+static int synthetic_read (struct mbs *s);
+
+static void
+synthetic_close (struct mbs *s)
+{
+    (void) s;
+}
+
+static const struct counter_source synthetic_sources[TRACE_PATTERNS] =
+{
+    { "synthetic:constant", 64, synthetic_init, synthetic_read,
+      synthetic_close },
+    { "synthetic:bursty", 64, synthetic_init, synthetic_read,
+      synthetic_close },
+    { "synthetic:wrap", 32, synthetic_init, synthetic_read,
+      synthetic_close },
+    { "synthetic:reset", 64, synthetic_init, synthetic_read,
+      synthetic_close }
+};
+
+static int
+synthetic_read (struct mbs *s)
+{
+    const uint64_t t = trace_clock ();
+    size_t i;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        struct iface *ifa = &s->ifaces[i];
+
+        trace_synthetic (s->source - synthetic_sources, t / 1000000,
+                         &ifa->sample);
+
+        ifa->sample.timestamp = started + t;
+        ifa->error = 0;
+    }
+
+    return 0;
+}
+
+/* replay */
+
+static int
+replay_init (struct mbs *s)
+{
+    size_t i;
+
+    (void) s;
+
+    for (i = 0; i < replay.n_ifaces; ++i)
+        replay.ifaces[i].valid = false;
+
+    replay.next = 0;
+    started = mbs_now ();
+
+    return 0;
+}
+
+static int
+replay_read (struct mbs *s)
+{
+    /* Once every entry has been seen, the interfaces are gone */
+    const bool finished = replay.next == replay.n_entries;
+    uint64_t t;
+    size_t i, j;
+
+    /* Stepping, the clock is the time of the next entry, whatever the time */
+    if (!stepping)
+        t = trace_clock ();
+    else if (!finished)
+        t = replay.entries[replay.next].time * 1000000;
+    else
+        t = 0;
+
+    while (replay.next < replay.n_entries
+        && replay.entries[replay.next].time * 1000000 <= t)
+    {
+        const struct entry *e = &replay.entries[replay.next++];
+
+        replay.ifaces[e->iface].valid = e->valid;
+        replay.ifaces[e->iface].counters = e->counters;
+    }
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        struct iface *ifa = &s->ifaces[i];
+
+        ifa->error = ENODEV;
+
+        if (finished)
+            continue;
+
+        for (j = 0; j < replay.n_ifaces; ++j)
+        {
+            if (0 == strcmp (replay.ifaces[j].name, ifa->name))
+                break;
+        }
+
+        if (j < replay.n_ifaces && replay.ifaces[j].valid)
+        {
+            ifa->sample = replay.ifaces[j].counters;
+            ifa->sample.timestamp = started + t;
+            ifa->error = 0;
+        }
+    }
+
+    return 0;
+}
+
+static void
+replay_close (struct mbs *s)
+{
+    (void) s;
+}
+
+/* The width of the counters comes from the trace */
+static const struct counter_source replay_source =
+{
+    "replay", 64, replay_init, replay_read, replay_close
+};
+
+static const struct counter_source replay32_source =
+{
+    "replay", 32, replay_init, replay_read, replay_close
+};
+
+static void
+replay_free (void)
+{
+    size_t i;
+
+    for (i = 0; i < replay.n_ifaces; ++i)
+        free (replay.ifaces[i].name);
+
+    free (replay.ifaces);
+    free (replay.entries);
+
+    memset (&replay, 0, sizeof (replay));
+}
+
+/*
+ * Index of the interface by the given name, which is added if it is not
+ * already known. Returns -1 if out of memory.
+ */
+static ssize_t
+replay_iface (const char *name)
+{
+    struct replay_iface *ifaces;
+    size_t i;
+
+    for (i = 0; i < replay.n_ifaces; ++i)
+    {
+        if (0 == strcmp (replay.ifaces[i].name, name))
+            return i;
+    }
+
+    ifaces = realloc (replay.ifaces, (i + 1) * sizeof (*ifaces));
+
+    if (NULL == ifaces)
+        return -1;
+
+    replay.ifaces = ifaces;
+
+    memset (&ifaces[i], 0, sizeof (*ifaces));
+
+    if (NULL == (ifaces[i].name = strdup (name)))
+        return -1;
+
+    replay.n_ifaces++;
+    return i;
+}
+
+static bool
+parse_counter (const char *str, unsigned int bits, uint64_t *value)
+{
+    char *end;
+
+    if (*str < '0' || *str > '9')
+        return false;
+
+    errno = 0;
+    *value = strtoull (str, &end, 10);
+
+    /*
+     * A recording which fell back to 32-bit counters half-way has 64-bit
+     * values before that, of which the low bits are what matters.
+     */
+    if (bits < 64)
+        *value &= (1ULL << bits) - 1;
+
+    return 0 == errno && '\0' == *end;
+}
+
+/*
+ * Read a trace into memory. Returns the width of its counters, or -1 if an
+ * error occured.
+ */
+static int
+replay_load (const char *path)
+{
+    char *line = NULL, name[64], rx[32], tx[32];
+    size_t size = 0, capacity = 0;
+    unsigned int version, bits;
+    struct entry e;
+    ssize_t k;
+    FILE *f;
+    int err = EPROTO;
+
+    if (NULL == (f = fopen (path, "r")))
+        return -1;
+
+    if (-1 == getline (&line, &size, f)
+     || 2 != sscanf (line, "mbs-trace %u %u", &version, &bits)
+     || TRACE_VERSION != version || (32 != bits && 64 != bits))
+    {
+        goto fail;
+    }
+
+    while (-1 != getline (&line, &size, f))
+    {
+        if ('#' == line[0] || '\n' == line[0])
+            continue;
+
+        if (4 != sscanf (line, "%" SCNu64 " %63s %31s %31s", &e.time, name,
+                         rx, tx)
+         || (replay.n_entries > 0
+          && e.time < replay.entries[replay.n_entries - 1].time))
+        {
+            goto fail;
+        }
+
+        e.valid = 0 != strcmp ("-", rx) || 0 != strcmp ("-", tx);
+        e.counters.rx_bytes = 0;
+        e.counters.tx_bytes = 0;
+        e.counters.timestamp = 0;
+
+        if (e.valid && (!parse_counter (rx, bits, &e.counters.rx_bytes)
+                     || !parse_counter (tx, bits, &e.counters.tx_bytes)))
+        {
+            goto fail;
+        }
+
+        if (-1 == (k = replay_iface (name)))
+        {
+            err = ENOMEM;
+            goto fail;
+        }
+
+        e.iface = k;
+
+        if (replay.n_entries == capacity)
+        {
+            struct entry *entries;
+
+            capacity = capacity ? 2 * capacity : 256;
+            entries = realloc (replay.entries, capacity * sizeof (e));
+
+            if (NULL == entries)
+            {
+                err = ENOMEM;
+                goto fail;
+            }
+
+            replay.entries = entries;
+        }
+
+        replay.entries[replay.n_entries++] = e;
+    }
+
+    if (ferror (f))
+    {
+        err = errno;
+        goto fail;
+    }
+
+    free (line);
+    fclose (f);
+
+    return bits;
+
+fail:
+    free (line);
+    fclose (f);
+    replay_free ();
+
+    errno = err;
+    return -1;
+}
+
+const struct counter_source *
+trace_find (const char *spec, unsigned int speed_factor)
+{
+    size_t i;
+    int bits;
+
+    speed = speed_factor;
+    stepping = 0 == strncmp ("step:", spec, 5);
+
+    if (0 == strcmp ("synthetic", spec))
+        return &synthetic_sources[TRACE_CONSTANT];
+
+    for (i = 0; i < TRACE_PATTERNS; ++i)
+    {
+        if (0 == strcmp (synthetic_sources[i].name, spec))
+            return &synthetic_sources[i];
+    }
+
+    if (0 == strncmp ("replay:", spec, 7) || stepping)
+    {
+        replay_free ();
+
+        if (-1 == (bits = replay_load (strchr (spec, ':') + 1)))
+            return NULL;
+
+        return 32 == bits ? &replay32_source : &replay_source;
+    }
+
+    errno = EINVAL;
+    return NULL;
+}
+
+bool
+trace_is_source (const struct counter_source *source)
+{
+    return (source >= synthetic_sources
+         && source < synthetic_sources + TRACE_PATTERNS)
+        || &replay_source == source || &replay32_source == source;
+}
+
+int
+trace_add_ifaces (struct mbs *s)
+{
+    size_t i;
+
+    if (&replay_source != s->source && &replay32_source != s->source)
+        return mbs_add_iface (s, "synthetic0");
+
+    for (i = 0; i < replay.n_ifaces; ++i)
+    {
+        if (-1 == mbs_add_iface (s, replay.ifaces[i].name))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Recording */
+
+int
+trace_record_open (const char *path, const struct mbs *s)
+{
+    size_t i;
+
+    if (NULL == (rec.last = calloc (s->n_ifaces, sizeof (struct iface))))
+        return -1;
+
+    if (NULL == (rec.file = fopen (path, "w")))
+    {
+        free (rec.last);
+        rec.last = NULL;
+        return -1;
+    }
+
+    fprintf (rec.file, "mbs-trace %d %u\n", TRACE_VERSION, s->source->bits);
+    fprintf (rec.file, "# <ms> <interface> <rx bytes> <tx bytes>\n");
+
+    /* From the first read */
+    rec.opened = 0;
+    rec.now = 0;
+    rec.bits = s->source->bits;
+    rec.n_ifaces = s->n_ifaces;
+
+    /* Not a state an interface can be in, so that all are written first */
+    for (i = 0; i < rec.n_ifaces; ++i)
+        rec.last[i].error = -1;
+
+    return 0;
+}
+
+/*
+ * Time of the read, in milliseconds since the first one. It is that of the
+ * samples, rather than of the clock, so that a replay which runs faster than
+ * real time, or steps, is recorded the way it played. Reads are a millisecond
+ * apart at the least, so that replaying the recording sees each of them.
+ */
+static uint64_t
+record_time (const struct mbs *s)
+{
+    uint64_t t = 0;
+    size_t i;
+
+    for (i = 0; i < s->n_ifaces; ++i)
+    {
+        if (0 == s->ifaces[i].error && s->ifaces[i].sample.timestamp > t)
+            t = s->ifaces[i].sample.timestamp;
+    }
+
+    if (0 == t)
+        t = mbs_now ();
+
+    if (0 == rec.opened)
+        rec.opened = t;
+    else if (t < rec.now + 1000000)
+        t = rec.now + 1000000;
+
+    rec.now = t;
+
+    return (rec.now - rec.opened) / 1000000;
+}
+
+void
+trace_record (const struct mbs *s)
+{
+    uint64_t ms, mask;
+    size_t i;
+
+    if (NULL == rec.file)
+        return;
+
+    /*
+     * The source fell back to narrower counters. The header is rewritten in
+     * place (it is as long either way), and the values written before are
+     * taken modulo the new width when the trace is replayed.
+     */
+    if (s->source->bits < rec.bits)
+    {
+        rec.bits = s->source->bits;
+
+        fflush (rec.file);
+        fseek (rec.file, 0, SEEK_SET);
+        fprintf (rec.file, "mbs-trace %d %u\n", TRACE_VERSION, rec.bits);
+        fseek (rec.file, 0, SEEK_END);
+    }
+
+    ms = record_time (s);
+    mask = rec.bits < 64 ? (1ULL << rec.bits) - 1 : UINT64_MAX;
+
+    for (i = 0; i < s->n_ifaces && i < rec.n_ifaces; ++i)
+    {
+        const struct iface *ifa = &s->ifaces[i];
+        struct iface *last = &rec.last[i];
+
+        if (ifa->error == last->error
+         && (0 != ifa->error
+          || (ifa->sample.rx_bytes == last->sample.rx_bytes
+           && ifa->sample.tx_bytes == last->sample.tx_bytes)))
+        {
+            continue;
+        }
+
+        if (0 != ifa->error)
+        {
+            fprintf (rec.file, "%" PRIu64 " %s - -\n", ms, ifa->name);
+        }
+        else
+        {
+            fprintf (rec.file, "%" PRIu64 " %s %" PRIu64 " %" PRIu64 "\n",
+                     ms, ifa->name, ifa->sample.rx_bytes & mask,
+                     ifa->sample.tx_bytes & mask);
+        }
+
+        last->error = ifa->error;
+        last->sample = ifa->sample;
+    }
+}
+
+int
+trace_record_sync (void)
+{
+    if (NULL == rec.file)
+        return 0;
+
+    return 0 == fflush (rec.file) && !ferror (rec.file) ? 0 : -1;
+}
+
+void
+trace_close (void)
+{
+    if (NULL != rec.file)
+        fclose (rec.file);
+
+    free (rec.last);
+    memset (&rec, 0, sizeof (rec));
+
+    replay_free ();
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2017 Johannes Hildén <hildenjohannes@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of copyright holder nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file trace.h
+ * @brief Counter sources which do not read real interfaces: synthetic
+ *        traffic, and the replay of recorded traces (`--record=<path>`).
+ *
+ * With `--source=synthetic:<pattern>`, every interface follows one of these
+ * patterns, as a function of the time since the command started:
+ *
+ * | Pattern    | Counters | Traffic (received, sent)                       |
+ * |------------|----------|------------------------------------------------|
+ * | `constant` | 64-bit   | 1 MB/s and 100 kB/s.                           |
+ * | `bursty`   | 64-bit   | 10 MB/s and 1 MB/s, one second out of ten.     |
+ * | `wrap`     | 32-bit   | 65 MB/s and 6.5 MB/s, wrapping every minute.   |
+ * | `reset`    | 64-bit   | As `constant`, but reset every 30 seconds.     |
+ *
+ * A trace is a text file. The first line is `mbs-trace <version> <bits>`,
+ * where `<bits>` is the width of the counters. Each of the other lines is
+ * either a comment, starting with `#`, or
+ *
+ *     <ms> <interface> <rx bytes> <tx bytes>
+ *
+ * giving the counters of an interface from `<ms>` milliseconds into the
+ * trace, or `- -` if the interface could not be read. Lines are in order of
+ * time, and `--record` only writes one when the counters have changed. If the
+ * source falls back to 32-bit counters while recording, the header is
+ * rewritten to say so, and values from before are taken modulo 2^32. With
+ * `--source=replay:<path>`, the counters follow the trace, and when it ends,
+ * its interfaces are gone, which ends the run unless `--keep-running` was
+ * given.
+ *
+ * Both sources run on a clock which `--speed` makes run faster than real
+ * time, by up to \ref TRACE_MAX_SPEED times. The timestamps of the samples
+ * follow the same clock, so that the rates are those of the trace. With
+ * `--source=step:<path>`, a trace is replayed on a clock of its own instead:
+ * every read moves on to the next time in the trace, however long it has
+ * been, so the run does not depend on how fast the machine is.
+ *
+ * @author Johannes Hildén <hildenjohannes@gmail.com>
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include "mbs.h"
+
+/**
+ * @brief Version written on the first line of a trace.
+ */
+#define TRACE_VERSION 1
+
+/**
+ * @brief Largest factor accepted by `--speed`.
+ */
+#define TRACE_MAX_SPEED 1000
+
+/**
+ * @brief The traffic patterns of the synthetic source.
+ */
+enum trace_pattern
+{
+    TRACE_CONSTANT,
+    TRACE_BURSTY,
+    TRACE_WRAP,
+    TRACE_RESET,
+    TRACE_PATTERNS
+};
+
+/**
+ * @brief Look up a synthetic or replay source.
+ *
+ * A trace to replay is read into memory, in full, right away.
+ *
+ * @param  spec  `synthetic`, `synthetic:<pattern>`, `replay:<path>` or
+ *               `step:<path>`.
+ * @param  speed How many times faster than real time the source runs, from 1
+ *               to \ref TRACE_MAX_SPEED.
+ * @return       The source, or `NULL` if an error occured, in which case
+ *               `errno` is set. It is `EINVAL` if \a spec does not name a
+ *               source, and `EPROTO` if the file is not a trace.
+ */
+const struct counter_source *trace_find (const char *spec, unsigned int speed);
+
+/**
+ * @brief Check whether a counter source is one of those in this module.
+ *
+ * @param  source A counter source, or `NULL`.
+ * @return        True if it was returned by \ref trace_find.
+ */
+bool trace_is_source (const struct counter_source *source);
+
+/**
+ * @brief Add the interfaces a trace or synthetic source provides, for when
+ *        none were given: every interface in the trace, or `synthetic0`.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @return   0 on success, or -1 if an error occured.
+ */
+int trace_add_ifaces (struct mbs *s);
+
+/**
+ * @brief The counters of a synthetic interface.
+ *
+ * @param  pattern  The traffic pattern.
+ * @param  ms       Time since the source started, in milliseconds.
+ * @param  counters A struct to which the counters are written. Its
+ *                  timestamp is left as it is.
+ * @return Nothing
+ */
+void trace_synthetic (enum trace_pattern pattern, uint64_t ms,
+                      struct stats *counters);
+
+/**
+ * @brief Start recording the counters read by \ref mbs_poll_interfaces to a
+ *        trace, which is truncated. Times are those of the samples, from the
+ *        first read on.
+ *
+ * @param  path Path of the trace.
+ * @param  s    An \ref mbs struct, with its interfaces and counter source set
+ *              up.
+ * @return      0 on success, or -1 if an error occured.
+ */
+int trace_record_open (const char *path, const struct mbs *s);
+
+/**
+ * @brief Write the counters of the interfaces which have changed since the
+ *        last call, if a recording is open.
+ *
+ * @param  s An \ref mbs struct, right after a read of the counter source.
+ * @return Nothing
+ */
+void trace_record (const struct mbs *s);
+
+/**
+ * @brief Flush what has been recorded to the trace.
+ *
+ * @return 0 on success (or if nothing is being recorded), or -1 if an error
+ *         occured.
+ */
+int trace_record_sync (void);
+
+/**
+ * @brief Close the recording, and release a trace read by \ref trace_find.
+ *
+ * @return Nothing
+ */
+void trace_close (void);
+
+#endif
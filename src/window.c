@@ -30,176 +30,840 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <locale.h>
 #include <ncurses.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include "procnet.h"
+#include "selfstats.h"
 #include "window.h"
 
-void 
-draw_window (struct mbs *s, bool tx_active, bool rx_active)
+/* Width of the progress bar, in cells */
+#define BAR_CELLS       62
+#define BAR_CELLS_ASCII 60
+
+/* Rows of the panel of self statistics */
+#define PANEL_ROWS 7
+
+/* Rows of the busiest processes: a heading, and one for other traffic */
+#define PROCS_ROWS (PROCNET_TOP + 2)
+
+/* Cells of the graphs, from empty to full */
+static const char *const blocks[] = {
+    " ", "\u2581", "\u2582", "\u2583", "\u2584",
+    "\u2585", "\u2586", "\u2587", "\u2588"
+};
+
+static const char levels[] = " .,:-=+*#";
+
+/*
+ * A number on the screen: the value it was formatted from, and how many
+ * columns the text took up.
+ */
+struct field
 {
-    int i;
-    double tot = s->balance + s->used.tx_bytes + s->used.rx_bytes, 
-           r   = tot > 0 ? s->balance / tot : 0;
+    double value;
+    bool set;
+    int len;
+    char str[16];
+};
 
-    char available_str[10], used_str[10], used_tx_str[10], used_rx_str[10];
+/*
+ * One row of the graph: the label with the peak rate, which the top of the
+ * scale stands for, and the cells as they were last drawn.
+ */
+struct graph_row
+{
+    struct field peak;
+    int label_len;
+    char cells[BAR_CELLS * 3 + 1];
+};
 
-    to_human_readable (s->balance, available_str);
-    to_human_readable (s->used.tx_bytes + s->used.rx_bytes, used_str);
+struct iface_row
+{
+    int error;
+    bool down;
+    struct field tx, rx;
+};
 
-    to_human_readable (s->used.tx_bytes, used_tx_str);
-    to_human_readable (s->used.rx_bytes, used_rx_str);
+struct proc_row
+{
+    bool shown;
+    int name_len;
+    char name[32];
+    struct field tx, rx;
+};
 
-    werase (s->win);
+/*
+ * What is on the screen, so that only what has changed since the last tick
+ * is drawn again. Everything is drawn after a reset.
+ */
+static struct
+{
+    bool valid;
+    bool tx_active, rx_active;
+    int bar;
+    bool empty;
+    int rates_len, averages_len;
+    char title[64];
+    struct field used, used_tx, used_rx, left, eta;
+    struct field rate_tx, rate_rx, avg_tx, avg_rx;
+    struct graph_row graph_tx, graph_rx;
+    struct iface_row *ifaces;
+    struct proc_row procs[PROCNET_TOP], other;
+} frame;
+
+/* Rows of the window without the panel, and whether the panel is wanted */
+static int window_rows, window_cols;
+static bool panel, panel_shown;
 
-    /* Frame */
+/*
+ * Rows of the list of interfaces, the last of which says how many more there
+ * are if they do not all fit, and whether there is room for the processes.
+ */
+static size_t list_rows, list_entries;
+static bool procs_shown;
 
-    box (s->win, 0, 0);
+/* The terminal was resized, and the window should be fitted to it again */
+static bool resized;
 
-    wmove (s->win, 0, 2);
+static void
+reset_frame (void)
+{
+    struct iface_row *ifaces = frame.ifaces;
 
-    wattron (s->win, A_BOLD);
-    wprintw (s->win, " mbs ");
-    wattroff (s->win, A_BOLD);
+    memset (&frame, 0, sizeof (frame));
 
-    /* Interface name */
+    frame.ifaces = ifaces;
+    frame.bar = -1;
+}
 
-    if (s->flags & FLAG_COUNTDOWN)
+/*
+ * Update the field if the value has changed. Returns true if so.
+ */
+static bool
+update (struct field *f, double value)
+{
+    if (f->set && f->value == value)
+        return false;
+
+    f->value = value;
+    f->set = true;
+
+    return true;
+}
+
+/*
+ * Write a string at the given position, and blank out whatever was left of a
+ * longer one which was written there before.
+ */
+static void
+put (WINDOW *win, int y, int x, attr_t attr, const char *str, int *len)
+{
+    const int n = strlen (str);
+
+    wattron (win, attr);
+    mvwaddstr (win, y, x, str);
+    wattroff (win, attr);
+
+    if (n < *len)
+        wprintw (win, "%*s", *len - n, "");
+
+    *len = n;
+}
+
+static void
+put_field (WINDOW *win, int y, int x, attr_t attr, struct field *f,
+           double value)
+{
+    if (update (f, value))
+        put (win, y, x, attr, to_human_readable (value, f->str), &f->len);
+}
+
+static void
+put_indicator (WINDOW *win, int y, int x, bool active, bool *shown,
+               bool ascii)
+{
+    if (active == *shown)
+        return;
+
+    wmove (win, y, x);
+
+    if (active)
     {
-        wmove (s->win, 1, 18);
+        wattron (win, A_BOLD);
+        waddstr (win, ascii ? "*" : "\u2022");
+        wattroff (win, A_BOLD);
     }
     else
     {
-        wmove (s->win, 1, 17);
+        waddch (win, ' ');
     }
 
-    wprintw (s->win, "%s", s->ifa_name);
+    *shown = active;
+}
+
+/*
+ * Number of filled cells, as the loops that used to draw the bar counted
+ * them.
+ */
+static int
+bar_fill (double r, int scale, int cells)
+{
+    int i = 0;
+
+    while (i < cells && i < scale * r - 1)
+        ++i;
+
+    return i;
+}
 
-    /* TX */
+/*
+ * Draw only the cells between the old and the new fill level, with a single
+ * call.
+ */
+static void
+put_bar (WINDOW *win, int y, int x, double r, bool ascii)
+{
+    const int cells = ascii ? BAR_CELLS_ASCII : BAR_CELLS,
+              fill = ascii ? bar_fill (r, 61, cells) : bar_fill (r, 63, cells),
+              from = frame.bar < 0 ? 0 : frame.bar < fill ? frame.bar : fill,
+              to   = frame.bar < 0 ? cells : frame.bar > fill ? frame.bar : fill;
+    char buf[BAR_CELLS * 3 + 1], *p = buf;
+    int i;
 
-    wmove (s->win, 1, 31);
+    if (fill == frame.bar)
+        return;
 
-    if (true == tx_active)
+    for (i = from; i < to; ++i)
     {
-        wattron (s->win, A_BOLD);
-        wprintw (
-            s->win, "%s", 
-            s->flags & FLAG_ASCII ? 
-            "*" : "\u2022"
-        );
-        wattroff (s->win, A_BOLD);
+        const char *cell = i < fill ? (ascii ? "=" : "\u2588")
+                                    : (ascii ? "-" : "\u2591");
+        const size_t n = strlen (cell);
+
+        memcpy (p, cell, n);
+        p += n;
     }
-    else
+
+    *p = '\0';
+
+    mvwaddstr (win, y, x + (ascii ? 1 : 0) + from, buf);
+    frame.bar = fill;
+}
+
+/*
+ * Draw the recent per-tick rates as a sparkline, newest to the right, scaled
+ * so that the peak fills a whole cell. Every nonzero rate shows, however
+ * small. The cells are kept on the stack, and only sent when they differ
+ * from what is on the screen.
+ */
+static void
+put_graph (WINDOW *win, int y, const char *name, const double *v,
+           unsigned int n, bool ascii, struct graph_row *row)
+{
+    const unsigned int cells = ascii ? BAR_CELLS_ASCII : BAR_CELLS;
+    char buf[BAR_CELLS * 3 + 1], label[32], *p = buf;
+    double peak = 0;
+    unsigned int i;
+
+    for (i = 0; i < n; ++i)
     {
-        wprintw (s->win, " ");
+        if (v[i] > peak)
+            peak = v[i];
     }
 
-    wprintw (s->win, " ");
+    if (update (&row->peak, peak))
+    {
+        snprintf (label, sizeof (label), "%s %s/s", name,
+                  to_human_readable (peak, row->peak.str));
+        put (win, y, 2, A_NORMAL, label, &row->label_len);
+    }
 
-    if (!(s->flags & FLAG_ASCII))
-        wprintw (s->win, "\u2196 ");
+    for (i = n; i < cells; ++i)
+        *p++ = ' ';
 
-    wprintw (s->win, "TX: ");
+    for (i = 0; i < n; ++i)
+    {
+        const int level = v[i] > 0 ? 1 + (int) (v[i] * 7 / peak) : 0;
 
-    wattron (s->win, A_BOLD);
-    wprintw (s->win, "%s", used_tx_str);
-    wattroff (s->win, A_BOLD);
+        if (ascii)
+        {
+            *p++ = levels[level];
+        }
+        else
+        {
+            const size_t len = strlen (blocks[level]);
 
-    /* RX */
+            memcpy (p, blocks[level], len);
+            p += len;
+        }
+    }
 
-    wmove (s->win, 1, 47);
+    *p = '\0';
 
-    if (true == rx_active)
+    if (0 != strcmp (buf, row->cells))
     {
-        wattron (s->win, A_BOLD);
-        wprintw (
-            s->win, "%s", 
-            s->flags & FLAG_ASCII ? 
-            "*" : "\u2022"
-        );
-        wattroff (s->win, A_BOLD);
+        mvwaddstr (win, y, ascii ? 19 : 18, buf);
+        strcpy (row->cells, buf);
     }
-    else
+}
+
+/*
+ * A time, right-aligned in nine columns. The padding is worked out from the
+ * ASCII form, since µs takes up two bytes, but only one column.
+ */
+static void
+put_time (WINDOW *win, uint64_t ns, bool ascii)
+{
+    char buf[SELFSTATS_NS_MAX];
+    const int len = strlen (selfstats_format_ns (ns, true, buf));
+
+    wprintw (win, "%*s%s ", 9 - len, "", selfstats_format_ns (ns, ascii, buf));
+}
+
+/*
+ * The timings of each phase of a tick, with a histogram, and what the
+ * process has used. It all changes on every tick, and is left to curses to
+ * work out what to send.
+ */
+static void
+draw_panel (WINDOW *win, int y, bool ascii)
+{
+    struct selfstats_usage u;
+    char buf[96];
+    int p, k;
+
+    mvwprintw (win, y, 2, "%-8s %9s %9s %9s   %-30s", "Phase", "Min", "Avg",
+               "Max", ascii ? "Histogram (<1us .. >=16ms)"
+                            : "Histogram (<1\u00b5s .. \u226516ms)");
+
+    for (p = 0; p < SELFSTATS_PHASES; ++p)
     {
-        wprintw (s->win, " ");
-    }
+        const struct selfstats_timing *t = selfstats_timing (p);
+        uint64_t top = 0;
 
-    wprintw (s->win, " ");
+        wmove (win, y + 1 + p, 2);
 
-    if (!(s->flags & FLAG_ASCII))
-        wprintw (s->win, "\u2199 ");
+        if (0 == t->count)
+        {
+            wprintw (win, "%-8s %9s %9s %9s   %16s", selfstats_phase_name (p),
+                     "-", "-", "-", "");
+            continue;
+        }
 
-    wprintw (s->win, "RX: ");
+        wprintw (win, "%-8s ", selfstats_phase_name (p));
+        put_time (win, t->min, ascii);
+        put_time (win, t->total / t->count, ascii);
+        put_time (win, t->max, ascii);
+        waddstr (win, "  ");
 
-    wattron (s->win, A_BOLD);
-    wprintw (s->win, "%s", used_rx_str);
-    wattroff (s->win, A_BOLD);
+        for (k = 0; k < SELFSTATS_BUCKETS; ++k)
+        {
+            if (t->histogram[k] > top)
+                top = t->histogram[k];
+        }
+
+        for (k = 0; k < SELFSTATS_BUCKETS; ++k)
+        {
+            const int level = t->histogram[k]
+                ? 1 + (int) (t->histogram[k] * 7 / top) : 0;
 
-    /* Exit */
+            if (ascii)
+                waddch (win, levels[level]);
+            else
+                waddstr (win, blocks[level]);
+        }
+    }
 
-    wmove (s->win, 1, 63);
-    wprintw (s->win, "Press 'q' to exit");
+    selfstats_usage (&u);
 
-    /* Used */
+    snprintf (buf, sizeof (buf), "CPU %.3f%% (%.2fs of %.0fs)", u.wall > 0
+              ? 100 * u.cpu / u.wall : 0, u.cpu, u.wall);
+    mvwprintw (win, y + 1 + SELFSTATS_PHASES, 2, "%-36s", buf);
 
-    if (s->flags & FLAG_COUNTDOWN)
+    if (u.syscalls >= 0)
     {
-        wmove (s->win, 2, 2);
+        snprintf (buf, sizeof (buf), "R/W calls %.1f/tick",
+                  u.ticks ? (double) u.syscalls / u.ticks : 0);
+        wprintw (win, "%-21s", buf);
     }
-    else
+
+    if (u.allocations >= 0)
     {
-        wmove (s->win, 1, 2);
+        snprintf (buf, sizeof (buf), "Allocs %.2f/tick",
+                  u.ticks ? (double) u.allocations / u.ticks : 0);
+        wprintw (win, "%-19s", buf);
     }
+}
+
+/*
+ * Everything which does not change from one tick to the next.
+ */
+static void
+draw_frame (struct mbs *s)
+{
+    const bool countdown = s->flags & FLAG_COUNTDOWN,
+               ascii = s->flags & FLAG_ASCII;
+    size_t j;
 
-    wprintw (s->win, "Used: ");
+    werase (s->win);
+    reset_frame ();
+
+    box (s->win, 0, 0);
 
+    wmove (s->win, 0, 2);
     wattron (s->win, A_BOLD);
-    wprintw (s->win, "%s", used_str);
+    waddstr (s->win, " mbs ");
     wattroff (s->win, A_BOLD);
 
-    /* Left */
+    mvwaddstr (s->win, 1, 33, ascii ? "TX: " : "\u2196 TX: ");
+    mvwaddstr (s->win, 1, 49, ascii ? "RX: " : "\u2199 RX: ");
+    mvwaddstr (s->win, 1, 63, "Press 'q' to exit");
+    mvwaddstr (s->win, countdown ? 2 : 1, 2, "Used: ");
 
-    if (s->flags & FLAG_COUNTDOWN)
+    if (countdown)
     {
-        wmove (s->win, 3, 2);
+        mvwaddstr (s->win, 2, 18, "Time left: ");
+        mvwaddstr (s->win, 3, 2, "Left: ");
 
-        wprintw (s->win, "Left: ");
+        if (ascii)
+        {
+            mvwaddstr (s->win, 3, 18, "[");
+            mvwaddstr (s->win, 3, 19 + BAR_CELLS_ASCII, "]");
+        }
+    }
 
-        if (r > 0 || !(s->flags & FLAG_NO_EXIT))
+    if (list_rows > 0)
+    {
+        const int row = countdown ? 7 : 5;
+
+        for (j = 0; j < list_entries && j < s->n_ifaces; ++j)
         {
-            wattron (s->win, A_BOLD);
-            wprintw (s->win, "%s", available_str);
-            wattroff (s->win, A_BOLD);
+            mvwprintw (s->win, row + j, 2, "%.27s", s->ifaces[j].name);
+
+            /* Not a state an interface can be in, so the row gets drawn */
+            frame.ifaces[j].error = -1;
         }
-        else
+
+        if (list_entries < s->n_ifaces)
         {
-            wprintw (s->win, "-");
+            mvwprintw (s->win, row + j, 2, "(%zu more)",
+                       s->n_ifaces - list_entries);
         }
     }
 
-    /* Bar */
+    if (procs_shown)
+    {
+        const int row = window_rows - 1 - PROCS_ROWS;
+
+        mvwaddstr (s->win, row, 2, "Processes (estimated)");
+        mvwaddstr (s->win, row + PROCS_ROWS - 1, 2, "Other");
+        mvwaddstr (s->win, row + PROCS_ROWS - 1, 33,
+                   ascii ? "TX: " : "\u2196 TX: ");
+        mvwaddstr (s->win, row + PROCS_ROWS - 1, 49,
+                   ascii ? "RX: " : "\u2199 RX: ");
+    }
+
+    frame.valid = true;
+}
+
+static void
+draw_iface (struct mbs *s, int y, size_t j)
+{
+    const struct iface *ifa = &s->ifaces[j];
+    struct iface_row *row = &frame.ifaces[j];
+    const bool ascii = s->flags & FLAG_ASCII;
 
-    if (s->flags & FLAG_COUNTDOWN)
+    if (ifa->error != row->error)
     {
-        wmove (s->win, 3, 18);
+        /* Between "gone" and the counters, the whole row changes */
+        mvwprintw (s->win, y, 33, "%36s", "");
 
-        if (s->flags & FLAG_ASCII)
+        if (0 != ifa->error)
         {
-            wprintw (s->win, "[");
-            for (i = 0; i < 61 * r - 1; ++i)
-                wprintw (s->win, "=");
-            for (; i < 60; ++i)
-                wprintw (s->win, "-");
-            wprintw (s->win, "]");
+            mvwaddstr (s->win, y, 33, "gone");
         }
         else
         {
-            for (i = 0; i < 63 * r - 1; ++i)
-                wprintw (s->win, "\u2588");
-            for (; i < 63 - 1; ++i)
-                wprintw (s->win, "\u2591");
+            mvwaddstr (s->win, y, 33, ascii ? "TX: " : "\u2196 TX: ");
+            mvwaddstr (s->win, y, 49, ascii ? "RX: " : "\u2199 RX: ");
         }
+
+        memset (&row->tx, 0, sizeof (row->tx));
+        memset (&row->rx, 0, sizeof (row->rx));
+
+        row->error = ifa->error;
+        row->down = false;
     }
 
+    if (0 != ifa->error)
+        return;
+
+    put_field (s->win, y, ascii ? 37 : 39, A_NORMAL, &row->tx,
+               ifa->used.tx_bytes);
+    put_field (s->win, y, ascii ? 53 : 55, A_NORMAL, &row->rx,
+               ifa->used.rx_bytes);
+
+    if (ifa->down != row->down)
+    {
+        mvwaddstr (s->win, y, 65, ifa->down ? "down" : "    ");
+        row->down = ifa->down;
+    }
+}
+
+/*
+ * The processes to which the most traffic was attributed, the busiest first,
+ * and what could not be attributed.
+ */
+static void
+draw_procs (struct mbs *s, int y)
+{
+    const bool ascii = s->flags & FLAG_ASCII;
+    struct procnet_entry top[PROCNET_TOP];
+    struct stats other;
+    const size_t n = procnet_top (top, PROCNET_TOP, &other);
+    char name[32];
+    size_t j;
+
+    for (j = 0; j < PROCNET_TOP; ++j)
+    {
+        struct proc_row *row = &frame.procs[j];
+
+        if (j >= n)
+        {
+            if (row->shown)
+            {
+                mvwprintw (s->win, y + j, 2, "%78s", "");
+                memset (row, 0, sizeof (*row));
+            }
+
+            continue;
+        }
+
+        if (!row->shown)
+        {
+            mvwaddstr (s->win, y + j, 33, ascii ? "TX: " : "\u2196 TX: ");
+            mvwaddstr (s->win, y + j, 49, ascii ? "RX: " : "\u2199 RX: ");
+            row->shown = true;
+        }
+
+        snprintf (name, sizeof (name), "%.15s (%d)%s", top[j].comm,
+                  (int) top[j].pid, top[j].estimated ? "*" : "");
+
+        if (0 != strcmp (name, row->name))
+        {
+            put (s->win, y + j, 2, A_NORMAL, name, &row->name_len);
+            strcpy (row->name, name);
+        }
+
+        put_field (s->win, y + j, ascii ? 37 : 39, A_NORMAL, &row->tx,
+                   top[j].tx_bytes);
+        put_field (s->win, y + j, ascii ? 53 : 55, A_NORMAL, &row->rx,
+                   top[j].rx_bytes);
+    }
+
+    put_field (s->win, y + PROCNET_TOP, ascii ? 37 : 39, A_NORMAL,
+               &frame.other.tx, other.tx_bytes);
+    put_field (s->win, y + PROCNET_TOP, ascii ? 53 : 55, A_NORMAL,
+               &frame.other.rx, other.rx_bytes);
+}
+
+/*
+ * Fit the window to the terminal. The list of interfaces (or namespaces, or
+ * hosts) gets the rows which are left, and the processes are left out before
+ * it goes below two rows. Whatever does not fit in the end is cut off.
+ */
+static void
+layout (const struct mbs *s)
+{
+    /* Two of them for the graph */
+    const int base = s->flags & FLAG_COUNTDOWN ? 8 : 6;
+
+    /* One line per interface, if there is more than one */
+    const int wanted = s->n_ifaces > 1 ? (int) s->n_ifaces : 0;
+    int room = LINES - base;
+
+    procs_shown = (s->flags & FLAG_PROCESSES)
+               && room - PROCS_ROWS >= (wanted < 2 ? wanted : 2);
+
+    if (procs_shown)
+        room -= PROCS_ROWS;
+
+    list_rows = wanted < room ? wanted : room > 0 ? room : 0;
+    list_entries = (int) list_rows < wanted ? list_rows - 1 : list_rows;
+
+    window_rows = base + list_rows + (procs_shown ? PROCS_ROWS : 0);
+    window_cols = COLS < 82 ? COLS : 82;
+
+    if (window_rows > LINES)
+        window_rows = LINES > 0 ? LINES : 1;
+
+    if (window_cols < 1)
+        window_cols = 1;
+}
+
+int
+window_open (struct mbs *s)
+{
+    panel_shown = panel = resized = false;
+
+    setlocale (LC_ALL, "");
+
+    /* The screen may already have been set up with newterm () */
+    if (NULL == stdscr)
+        initscr ();
+
+    layout (s);
+
+    frame.ifaces = calloc (s->n_ifaces, sizeof (struct iface_row));
+
+    if (NULL == frame.ifaces
+     || NULL == (s->win = newwin (window_rows, window_cols, 0, 0)))
+    {
+        free (frame.ifaces);
+        frame.ifaces = NULL;
+        endwin ();
+        return -1;
+    }
+
+    reset_frame ();
+
+    curs_set (0);
+    timeout (0);  /* This is so that getch doesn't block. */
+
+    return 0;
+}
+
+void
+window_close (struct mbs *s)
+{
+    curs_set (1);
+    delwin (s->win);
+    endwin ();
+
+    free (frame.ifaces);
+
+    frame.ifaces = NULL;
+    s->win = NULL;
+}
+
+int
+window_read_keys (void)
+{
+    int ch, keys = 0;
+
+    while (ERR != (ch = getch ()))
+    {
+        if ('q' == ch)
+        {
+            keys |= WINDOW_QUIT;
+        }
+        else if ('s' == ch)
+        {
+            panel = !panel;
+            keys |= WINDOW_REDRAW;
+        }
+    }
+
+    return keys;
+}
+
+void
+window_resize (void)
+{
+    struct winsize ws;
+
+    if (0 == ioctl (STDOUT_FILENO, TIOCGWINSZ, &ws))
+        resizeterm (ws.ws_row, ws.ws_col);
+
+    clearok (curscr, TRUE);
+    resized = true;
+}
+
+void 
+draw_window (struct mbs *s, bool tx_active, bool rx_active)
+{
+    const bool countdown = s->flags & FLAG_COUNTDOWN,
+               ascii = s->flags & FLAG_ASCII;
+    const int graph_row = countdown ? 4 : 2,
+              rates_row = countdown ? 6 : 4;
+    double tot = s->balance + s->used.tx_bytes + s->used.rx_bytes, 
+           r   = tot > 0 ? s->balance / tot : 0;
+    char title[64], buf[64], tx_str[MBS_HUMAN_READABLE_MAX],
+         rx_str[MBS_HUMAN_READABLE_MAX];
+    double recent_tx[BAR_CELLS], recent_rx[BAR_CELLS];
+    unsigned int n;
+    size_t j;
+
+    if (resized)
+    {
+        layout (s);
+
+        resized = false;
+        frame.valid = false;
+    }
+
+    /* There is no room for the panel */
+    if (panel && window_rows + PANEL_ROWS > LINES)
+        panel = false;
+
+    /*
+     * The panel was shown or hidden, or the window was resized; blank out
+     * what the box leaves behind
+     */
+    if ((panel != panel_shown || !frame.valid)
+     && OK == wresize (s->win, window_rows + (panel ? PANEL_ROWS : 0),
+                       window_cols))
+    {
+        werase (stdscr);
+        wnoutrefresh (stdscr);
+
+        panel_shown = panel;
+        frame.valid = false;
+    }
+
+    if (!frame.valid)
+        draw_frame (s);
+
+    /* Interface name */
+
+    if (s->flags & FLAG_NETNS)
+        snprintf (title, sizeof (title), "%zu namespaces", s->n_ifaces);
+    else if ((s->flags & FLAG_FLEET) && 1 != s->n_ifaces)
+        snprintf (title, sizeof (title), "%zu hosts", s->n_ifaces);
+    else if (1 == s->n_ifaces)
+        snprintf (title, sizeof (title), "%s%s", s->ifaces[0].name,
+            s->ifaces[0].down ? " (down)" : "");
+    else
+        snprintf (title, sizeof (title), "%zu interfaces", s->n_ifaces);
+
+    if (0 != strcmp (title, frame.title))
+    {
+        int len = strlen (frame.title);
+
+        put (s->win, 1, countdown ? 18 : 17, A_NORMAL, title, &len);
+        strcpy (frame.title, title);
+    }
+
+    /* TX and RX */
+
+    put_indicator (s->win, 1, 31, tx_active, &frame.tx_active, ascii);
+    put_field (s->win, 1, ascii ? 37 : 39, A_BOLD, &frame.used_tx,
+               s->used.tx_bytes);
+
+    put_indicator (s->win, 1, 47, rx_active, &frame.rx_active, ascii);
+    put_field (s->win, 1, ascii ? 53 : 55, A_BOLD, &frame.used_rx,
+               s->used.rx_bytes);
+
+    /* Used */
+
+    put_field (s->win, countdown ? 2 : 1, 8, A_BOLD, &frame.used,
+               s->used.tx_bytes + s->used.rx_bytes);
+
+    if (countdown)
+    {
+        /* Time left */
+
+        const double eta = rate_eta (&s->rates, s->balance);
+
+        if (update (&frame.eta, eta))
+        {
+            put (s->win, 2, 29, A_BOLD, rate_format_eta (eta, frame.eta.str),
+                 &frame.eta.len);
+        }
+
+        /* Left */
+
+        if (r > 0 || !(s->flags & FLAG_NO_EXIT))
+        {
+            if (frame.empty)
+                memset (&frame.left, 0, sizeof (frame.left));
+
+            put_field (s->win, 3, 8, A_BOLD, &frame.left, s->balance);
+            frame.empty = false;
+        }
+        else if (!frame.empty)
+        {
+            put (s->win, 3, 8, A_NORMAL, "-", &frame.left.len);
+            frame.empty = true;
+        }
+
+        /* Bar */
+
+        put_bar (s->win, 3, 18, r, ascii);
+    }
+
+    /* Graph */
+
+    n = rate_recent (&s->rates, recent_tx, recent_rx,
+                     ascii ? BAR_CELLS_ASCII : BAR_CELLS);
+
+    put_graph (s->win, graph_row, "TX", recent_tx, n, ascii, &frame.graph_tx);
+    put_graph (s->win, graph_row + 1, "RX", recent_rx, n, ascii,
+               &frame.graph_rx);
+
+    /* Rates; both values of a pair are updated, hence no || */
+
+    if (update (&frame.rate_tx, s->rates.tx.value)
+      | update (&frame.rate_rx, s->rates.rx.value))
+    {
+        snprintf (buf, sizeof (buf), "Rate: TX %s/s RX %s/s",
+            to_human_readable (s->rates.tx.value, tx_str),
+            to_human_readable (s->rates.rx.value, rx_str));
+        put (s->win, rates_row, 2, A_NORMAL, buf, &frame.rates_len);
+    }
+
+    if (update (&frame.avg_tx, s->rates.tx_avg.value)
+      | update (&frame.avg_rx, s->rates.rx_avg.value))
+    {
+        snprintf (buf, sizeof (buf), "Average: TX %s/s RX %s/s",
+            to_human_readable (s->rates.tx_avg.value, tx_str),
+            to_human_readable (s->rates.rx_avg.value, rx_str));
+        put (s->win, rates_row, 41, A_NORMAL, buf, &frame.averages_len);
+    }
+
+    /* Interfaces */
+
+    for (j = 0; j < list_entries && j < s->n_ifaces; ++j)
+        draw_iface (s, rates_row + 1 + j, j);
+
+    /* Processes */
+
+    if (procs_shown)
+        draw_procs (s, window_rows - PROCS_ROWS);
+
+    /* Self statistics */
+
+    if (panel_shown)
+        draw_panel (s->win, window_rows - 1, ascii);
+
     /* Refresh */
 
     wrefresh (s->win);
 }
+
+void
+draw_gone (struct mbs *s)
+{
+    werase (s->win);
+
+    box (s->win, 0, 0);
+    wmove (s->win, 0, 2);
+    wattron (s->win, A_BOLD);
+    wprintw (s->win, " mbs ");
+    wattroff (s->win, A_BOLD);
+
+    wmove (s->win, 2, 2);
+
+    if (1 == s->n_ifaces)
+        wprintw (s->win, "Interface %s is gone.", s->ifaces[0].name);
+    else
+        wprintw (s->win, "All interfaces are gone.");
+
+    wrefresh (s->win);
+
+    /* The next draw_window () starts from scratch */
+    frame.valid = false;
+}
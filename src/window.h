@@ -37,6 +37,10 @@
  *        rendering the terminal interface of the application. The 
  *        implementation is based on the ncurses library.
  *
+ * The interface is optional. When the command is built without ncurses
+ * (`-DWITH_CURSES=OFF`), \ref FLAG_DAEMON is always set and these functions
+ * are never called.
+ *
  * @see https://www.gnu.org/software/ncurses/
  *
  * @author Johannes Hildén <hildenjohannes@gmail.com>
@@ -47,9 +51,63 @@
 #include <stdbool.h>
 #include "mbs.h"
 
+/**
+ * @brief Returned by \ref window_read_keys if the user asked to quit.
+ */
+#define WINDOW_QUIT 1
+
+/**
+ * @brief Returned by \ref window_read_keys if the window should be drawn
+ *        again, e.g., because a panel was shown or hidden.
+ */
+#define WINDOW_REDRAW 2
+
+#ifdef HAVE_CURSES
+
+/**
+ * @brief Set up the terminal and create the window.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @return   0 on success, or -1 if the terminal could not be initialized.
+ */
+int window_open (struct mbs *s);
+
+/**
+ * @brief Destroy the window and restore the terminal.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @return Nothing
+ */
+void window_close (struct mbs *s);
+
+/**
+ * @brief Read all pending key presses, without blocking.
+ *
+ * The `s` key shows or hides the panel of self statistics (see
+ * \ref selfstats.h).
+ *
+ * @return \ref WINDOW_QUIT if the user asked to quit (by pressing 'Q'), and
+ *         \ref WINDOW_REDRAW if the window should be drawn again, or 0.
+ */
+int window_read_keys (void);
+
+/**
+ * @brief Adapt to a new terminal size, after a `SIGWINCH`. The window is
+ *        fitted to it and repainted in full on the next refresh.
+ *
+ * @return Nothing
+ */
+void window_resize (void);
+
 /**
  * @brief Render ncurses interface.
  *
+ * Only what has changed since the previous call is drawn again, and numbers
+ * are only formatted when their value has changed; a tick on which nothing
+ * changed sends nothing to the terminal.
+ *
  * @param  s         An \ref mbs struct holding application state and 
  *                   configuration settings.
  * @param  tx_active A boolean to indicate whether any data was transmitted 
@@ -60,4 +118,29 @@
  */
 void draw_window (struct mbs *s, bool tx_active, bool rx_active);
 
+/**
+ * @brief Replace the contents of the window with a message saying that the
+ *        monitored interface(s) are gone.
+ *
+ * @param  s An \ref mbs struct holding application state and configuration
+ *           settings.
+ * @return Nothing
+ */
+void draw_gone (struct mbs *s);
+
+#else
+
+static inline int window_open (struct mbs *s) { (void) s; return -1; }
+static inline void window_close (struct mbs *s) { (void) s; }
+static inline int window_read_keys (void) { return 0; }
+static inline void window_resize (void) { }
+static inline void draw_window (struct mbs *s, bool tx_active,
+                                bool rx_active)
+{
+    (void) s; (void) tx_active; (void) rx_active;
+}
+static inline void draw_gone (struct mbs *s) { (void) s; }
+
+#endif
+
 #endif